@@ -20,89 +20,100 @@
  */
 #include "hal_RGB.h"
 #include "hal_gpio.h"
-#include "hal_exti.h"
+#include "hal_pwm.h"
 
-static GPIO_TypeDef * rgb_port = NULL;
-static uint16_t rgb_pin;
-static SOFT_EXTI_LINE_E soft_exti_line;
-static uint8_t is_busy = false;
-void HAL_ShowRGB(uint8_t exti);
-// pin: eg. PA1
-void HAL_RGBInit(uint8_t pin, SOFT_EXTI_LINE_E exti) {
-  GpioInit(pin, GPIO_Mode_Out_PP);
-  SoftExtiInit(exti, HAL_ShowRGB);
-  soft_exti_line = exti;
-}
+static uint8_t *rgb_bits = NULL;
+static uint16_t rgb_bits_size = 0;
+static volatile bool is_busy = false;
 
-static void rgb_delay(__IO uint32_t time) {
-  while(time--);
-}
+bool HAL_RGBInit(uint8_t pin, uint8_t light_count) {
+  DMA_InitTypeDef DMA_InitStruct;
+  NVIC_InitTypeDef NVicInit;
+
+  if (pin == RGB_PIN_TIM1_CH1) {
+    HAL_PwmInit(PWM_TIM1, PWM_CH1, pin, 72000000, RGB_BIT_PERIOD);
+  } else if (pin == RGB_PIN_TIM1_CH1N) {
+    HAL_PwmInit(PWM_TIM1_PARTIAL, PWM_CH1, pin, 72000000, RGB_BIT_PERIOD);
+  } else {
+    return false;
+  }
+  TIM_Cmd(TIM1, DISABLE);
+  TIM1->CCR1 = 0;
 
-static void RGBHigh() {
-  // T1H 580ns ~ 1µs
-  // T1L 580ns ~ 1µs
-  rgb_port->BSRR = rgb_pin;
-  rgb_delay(4);
-  rgb_port->BRR = rgb_pin;
-  rgb_delay(1);
+  rgb_bits_size = light_count * 24 + RGB_TAIL_SLOTS;
+  rgb_bits = new uint8_t[rgb_bits_size];
+
+  // byte in memory, half word to CCR1, one per update event
+  RCC_AHBPeriphClockCmd(RCC_AHBPeriph_DMA1, ENABLE);
+  DMA_DeInit(DMA1_Channel5);
+  DMA_InitStruct.DMA_DIR = DMA_DIR_PeripheralDST;
+  DMA_InitStruct.DMA_M2M = DMA_M2M_Disable;
+  DMA_InitStruct.DMA_BufferSize = rgb_bits_size;
+  DMA_InitStruct.DMA_MemoryBaseAddr = (uint32_t)rgb_bits;
+  DMA_InitStruct.DMA_MemoryDataSize = DMA_MemoryDataSize_Byte;
+  DMA_InitStruct.DMA_MemoryInc = DMA_MemoryInc_Enable;
+  DMA_InitStruct.DMA_Mode = DMA_Mode_Normal;
+  DMA_InitStruct.DMA_PeripheralBaseAddr = (uint32_t)&TIM1->CCR1;
+  DMA_InitStruct.DMA_PeripheralDataSize = DMA_PeripheralDataSize_HalfWord;
+  DMA_InitStruct.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+  DMA_InitStruct.DMA_Priority = DMA_Priority_High;
+  DMA_Init(DMA1_Channel5, &DMA_InitStruct);
+  TIM_DMACmd(TIM1, TIM_DMA_Update, ENABLE);
+
+  NVicInit.NVIC_IRQChannel = DMA1_Channel5_IRQn;
+  NVicInit.NVIC_IRQChannelSubPriority = 0;
+  NVicInit.NVIC_IRQChannelPreemptionPriority = 3;
+  NVicInit.NVIC_IRQChannelCmd = ENABLE;
+  DMA_ITConfig(DMA1_Channel5, DMA_IT_TC, ENABLE);
+  NVIC_Init(&NVicInit);
+  return true;
 }
 
-static void RGBLow() {
-  // T0H 220ns ~ 380ns
-  // T0L 580ns ~ 1µs
-  rgb_port->BSRR = rgb_pin;
-  rgb_delay(0);
-  rgb_port->BRR = rgb_pin;
-  rgb_delay(0);
+bool HAL_RGBBusy() {
+  return is_busy;
 }
 
-static RGB_T *cur_rgb;
-static uint8_t cur_light_count = 0;
+bool HAL_SetAllRGB(RGB_T *rgb, uint8_t light_count) {
+  uint8_t *bits = rgb_bits;
+  uint8_t color[3];
 
-void HAL_SetAllRGB(uint8_t pin, RGB_T *rgb, uint8_t light_count) {
-  rgb_port = GpioGetPort(pin);
-  rgb_pin = (1 << (pin % 16));
-  cur_rgb = rgb;
-  cur_light_count = light_count;
-  while (is_busy);
-  SoftExtiTrigger(soft_exti_line);
-  while (is_busy);
-  rgb_delay(1000);
-}
+  if (rgb_bits == NULL || is_busy)
+    return false;
 
-void HAL_ShowRGB(uint8_t exti)
-{
-  uint32_t i = 0, k = 0;
-  uint8_t r, g, b;
-  is_busy = true;
-  for (k = 0; k < cur_light_count; k ++) {
-    r = cur_rgb[k].r;
-    g = cur_rgb[k].g;
-    b = cur_rgb[k].b;
+  if (light_count * 24 + RGB_TAIL_SLOTS > rgb_bits_size)
+    light_count = (rgb_bits_size - RGB_TAIL_SLOTS) / 24;
 
-    for (i = 0; i < 8; i++) {
-      if (g & (1 << (7 - i))) {
-        RGBHigh();
-      } else {
-        RGBLow();
+  for (uint8_t k = 0; k < light_count; k++) {
+    color[0] = rgb[k].g;
+    color[1] = rgb[k].r;
+    color[2] = rgb[k].b;
+    for (uint8_t c = 0; c < 3; c++) {
+      for (uint8_t mask = 0x80; mask; mask >>= 1) {
+        *bits++ = (color[c] & mask) ? RGB_BIT_T1H : RGB_BIT_T0H;
       }
     }
+  }
+  for (uint8_t i = 0; i < RGB_TAIL_SLOTS; i++) {
+    *bits++ = 0;
+  }
 
-    for (i = 0; i < 8; i++) {
-      if (r & (1 << (7 - i))) {
-        RGBHigh();
-      } else {
-        RGBLow();
-      }
-    }
+  // the first period runs with CCR1 0, the update dma then feeds one bit per period
+  is_busy = true;
+  DMA_Cmd(DMA1_Channel5, DISABLE);
+  DMA1_Channel5->CNDTR = bits - rgb_bits;
+  DMA_Cmd(DMA1_Channel5, ENABLE);
+  TIM1->CCR1 = 0;
+  TIM1->CNT = 0;
+  TIM_Cmd(TIM1, ENABLE);
+  return true;
+}
 
-    for (i = 0; i < 8; i++) {
-      if (b & (1 << (7 - i))) {
-        RGBHigh();
-      } else {
-        RGBLow();
-      }
-    }
+extern "C" void __irq_dma1_channel5() {
+  if (DMA_GetITStatus(DMA1_IT_TC5) != RESET) {
+    // the last tail slot is preloaded, the running period is already low
+    TIM_Cmd(TIM1, DISABLE);
+    DMA_Cmd(DMA1_Channel5, DISABLE);
+    DMA_ClearITPendingBit(DMA1_IT_TC5);
+    is_busy = false;
   }
-  is_busy = false;
 }
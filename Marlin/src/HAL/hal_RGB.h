@@ -22,14 +22,25 @@
 #define MODULES_WHIMSYCWD_MARLIN_SRC_HAL_RGB_H_
 
 #include <stdio.h>
-#include "hal_exti.h"
+#include <stdint.h>
+
+// WS2812 bits are streamed as TIM1 CH1 duties by the TIM1 update DMA (DMA1 channel 5)
+#define RGB_PIN_TIM1_CH1      8    // PA8
+#define RGB_PIN_TIM1_CH1N     7    // PA7, TIM1 partial remap
+#define RGB_BIT_PERIOD        90   // 1.25us at 72MHz
+#define RGB_BIT_T0H           22   // 0.31us
+#define RGB_BIT_T1H           50   // 0.69us
+#define RGB_TAIL_SLOTS        2    // low slots so the line is idle when the dma completes
+
 typedef struct{
     uint8_t r;
     uint8_t g;
     uint8_t b;
 } RGB_T;
 
-void HAL_RGBInit(uint8_t pin, SOFT_EXTI_LINE_E exti);  // pin: eg. PA1
-void HAL_SetAllRGB(uint8_t pin, RGB_T *rgb, uint8_t light_count);
+bool HAL_RGBInit(uint8_t pin, uint8_t light_count);  // pin: PA8 or PA7
+// encodes the frame and starts the dma, returns false if the previous frame is still being sent
+bool HAL_SetAllRGB(RGB_T *rgb, uint8_t light_count);
+bool HAL_RGBBusy();
 
 #endif
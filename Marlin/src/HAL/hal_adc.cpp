@@ -46,6 +46,7 @@
     ADC_Channel_15    PC5
 ****************************************************************************************************/
 ADC_CB_F adc_cb_f = NULL;
+ADC_CB_F adc_injected_cb_f = NULL;
 TIM_TypeDef * AdcTim = NULL;
 uint16_t adc_cache[ADC_CACHE_SIZE];
 uint32_t adc_cusum[ADC_MAX_DEV_COUNT];
@@ -70,6 +71,8 @@ static void AdcCaptureDeal() {
     adc_cusum[i] = temp[i];
   }
   adc_status = 1;
+  if (adc_cb_f)
+    adc_cb_f();
 }
 
 void hal_AddRegularChanne(uint16_t ADC_channel) {
@@ -246,6 +249,10 @@ uint8_t HAL_adc_init_chn(ADC_CHN_E chn, ADC_TIM_E tim, uint16_t period_us) {
     return ret_index;
 }
 
+void HAL_adc_capture_cb_init(ADC_CB_F cb) {
+  adc_cb_f = cb;
+}
+
 void hal_start_adc() {
   if (adc_started == false) {
     adc_started = true;
@@ -259,6 +266,50 @@ void hal_start_adc() {
   }
 }
 
+uint8_t HAL_adc_injected_init(uint8_t pin, uint32_t trigger, ADC_CB_F cb) {
+  NVIC_InitTypeDef NVicInit;
+  uint8_t chn;
+  for (chn = 0; chn < sizeof(adc_pin_map); chn++) {
+    if (adc_pin_map[chn] == pin)
+      break;
+  }
+  if (chn >= sizeof(adc_pin_map))
+    return ADC_ERROR;
+
+  // ADC1 is already calibrated by the regular channels, injected group only
+  GpioInit(pin, GPIO_Mode_AIN);
+  adc_injected_cb_f = cb;
+  ADC_InjectedSequencerLengthConfig(ADC1, 1);
+  ADC_InjectedChannelConfig(ADC1, chn, 1, ADC_SampleTime_28Cycles5);
+  ADC_ExternalTrigInjectedConvConfig(ADC1, trigger);
+  ADC_ExternalTrigInjectedConvCmd(ADC1, ENABLE);
+  ADC_ITConfig(ADC1, ADC_IT_JEOC, DISABLE);
+
+  NVicInit.NVIC_IRQChannel = ADC1_2_IRQn;
+  NVicInit.NVIC_IRQChannelSubPriority = 1;
+  NVicInit.NVIC_IRQChannelPreemptionPriority = 2;
+  NVicInit.NVIC_IRQChannelCmd = ENABLE;
+  NVIC_Init(&NVicInit);
+  return chn;
+}
+
+void HAL_adc_injected_enable(bool enable) {
+  ADC_ClearITPendingBit(ADC1, ADC_IT_JEOC);
+  ADC_ITConfig(ADC1, ADC_IT_JEOC, enable ? ENABLE : DISABLE);
+}
+
+uint16_t HAL_adc_injected_get() {
+  return ADC1->JDR1;
+}
+
+extern "C" void __irq_adc() {
+  if (ADC_GetITStatus(ADC1, ADC_IT_JEOC) != RESET) {
+    ADC_ClearITPendingBit(ADC1, ADC_IT_JEOC);
+    if (adc_injected_cb_f)
+      adc_injected_cb_f();
+  }
+}
+
 uint8_t HAL_adc_init(uint8_t pin, ADC_TIM_E tim, uint16_t period_us) {
   for (uint8_t i = 0; i < sizeof(adc_pin_map); i++) {
     if (adc_pin_map[i] == pin) {
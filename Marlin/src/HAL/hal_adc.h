@@ -69,5 +69,11 @@ void ADC_CaptureEnable();
 void ADC_CaptureDisable();
 uint8_t hal_adc_status();
 void hal_start_adc();
+// cb runs in the DMA interrupt after every ADC_DEEP scans, ADC_Get() then holds the new block
+void HAL_adc_capture_cb_init(ADC_CB_F cb);
+// one injected channel on an external trigger, cb runs in the ADC interrupt on JEOC
+uint8_t HAL_adc_injected_init(uint8_t pin, uint32_t trigger, ADC_CB_F cb);
+void HAL_adc_injected_enable(bool enable);
+uint16_t HAL_adc_injected_get();
 #endif
 
@@ -21,6 +21,7 @@
 
 #include <string.h>
 #include <src/core/can_bus.h>
+#include <src/core/trace.h>
 #include <include/libmaple/libmaple_types.h>
 #include "std_library/inc/stm32f10x.h"
 #include "hal_can.h"
@@ -270,6 +271,7 @@ void HAL_CAN_try_send_standard() {
     }
     txMessage_g.DLC = txItem.len;
     CAN_SendData(&txMessage_g);
+    TRACE(TRACE_EVT_CAN_TX, txItem.len, txMessage_g.StdId);
     canbus_g.standard_send_buffer_.remove();
   }
 }
@@ -321,6 +323,7 @@ extern "C" {
     if (rxMessage.RTR == CAN_RTR_REMOTE) {
       canbus_g.PushRecvRemoteData(rxMessage.StdId, rxMessage.IDE);
     } else if (rxMessage.IDE == CAN_ID_STD) {
+      TRACE(TRACE_EVT_CAN_RX, rxMessage.DLC, rxMessage.StdId);
       canbus_g.PushRecvStandardData(rxMessage.StdId, rxMessage.Data, rxMessage.DLC);
     }
     CAN_ClearITPendingBit(CAN1, CAN_IT_FMP1);
@@ -0,0 +1,297 @@
+/*
+ * Snapmaker2-Modules Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Modules
+ * (see https://github.com/Snapmaker/Snapmaker2-Modules)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "hal_i2c.h"
+#include "hal_gpio.h"
+#include <libmaple/systick.h>
+#include <libmaple/delay.h>
+
+#define I2C_IT_ALL   (I2C_CR2_ITEVTEN | I2C_CR2_ITBUFEN | I2C_CR2_ITERREN)
+#define I2C_SR1_ERR  (I2C_SR1_BERR | I2C_SR1_ARLO | I2C_SR1_AF | I2C_SR1_OVR)
+
+typedef enum {
+  I2C_PHASE_TX,
+  I2C_PHASE_RESTART,
+  I2C_PHASE_RX,
+} I2C_PHASE;
+
+static I2C_XFER_T *queue[I2C_QUEUE_LEN];
+static uint8_t queue_head = 0;
+static uint8_t queue_tail = 0;
+static I2C_XFER_T *cur = NULL;
+static uint8_t cur_retried = 0;
+static uint32_t cur_time = 0;
+static volatile I2C_XFER_STATE cur_result = I2C_XFER_IDLE;
+static volatile uint8_t phase = I2C_PHASE_TX;
+static volatile uint8_t xfer_index = 0;
+static uint32_t i2c_speed = 100000;
+static I2C_STATS_T stats;
+
+static void I2CSetup() {
+  RCC_APB1PeriphClockCmd(RCC_APB1Periph_I2C1, ENABLE);
+  I2C1->CR1 = I2C_CR1_SWRST;
+  I2C1->CR1 = 0;
+  I2C1->CR2 = I2C_APB1_MHZ;
+  I2C1->CCR = I2C_APB1_MHZ * 1000000 / (2 * i2c_speed);  // standard mode, 50% duty
+  I2C1->TRISE = I2C_APB1_MHZ + 1;                        // 1000ns
+  I2C1->CR1 = I2C_CR1_PE;
+}
+
+// clock out a slave holding SDA low, then give the pins back to the peripheral
+static void I2CBusRecover() {
+  I2C1->CR1 = 0;
+  GpioWrite(I2C_PIN_SCL, 1);
+  GpioWrite(I2C_PIN_SDA, 1);
+  GpioInit(I2C_PIN_SCL, GPIO_Mode_Out_OD);
+  GpioInit(I2C_PIN_SDA, GPIO_Mode_Out_OD);
+  for (uint8_t i = 0; i < 9 && !GpioRead(I2C_PIN_SDA); i++) {
+    GpioWrite(I2C_PIN_SCL, 0);
+    delay_us(5);
+    GpioWrite(I2C_PIN_SCL, 1);
+    delay_us(5);
+  }
+  GpioWrite(I2C_PIN_SDA, 0);
+  delay_us(5);
+  GpioWrite(I2C_PIN_SDA, 1);
+  delay_us(5);
+  GpioInit(I2C_PIN_SCL, GPIO_Mode_AF_OD);
+  GpioInit(I2C_PIN_SDA, GPIO_Mode_AF_OD);
+  I2CSetup();
+  stats.recover++;
+}
+
+static bool I2CBusIdle() {
+  return !(I2C1->CR1 & (I2C_CR1_START | I2C_CR1_STOP)) && !(I2C1->SR2 & I2C_SR2_BUSY);
+}
+
+static void I2CStart() {
+  xfer_index = 0;
+  phase = cur->tx_len ? I2C_PHASE_TX : I2C_PHASE_RX;
+  cur->state = I2C_XFER_BUSY;
+  cur_result = I2C_XFER_BUSY;
+  cur_time = systick_uptime();
+  I2C1->CR1 &= ~I2C_CR1_POS;
+  I2C1->CR2 |= I2C_IT_ALL;
+  I2C1->CR1 |= I2C_CR1_START | I2C_CR1_ACK;
+}
+
+static void I2CEnd(I2C_XFER_STATE result) {
+  I2C1->CR2 &= ~I2C_IT_ALL;
+  cur_result = result;
+}
+
+void HAL_I2CInit(uint32_t speed_hz) {
+  NVIC_InitTypeDef NVicInit;
+
+  i2c_speed = speed_hz;
+  I2CBusRecover();
+  stats.recover = 0;
+
+  NVicInit.NVIC_IRQChannelSubPriority = 0;
+  NVicInit.NVIC_IRQChannelPreemptionPriority = 3;
+  NVicInit.NVIC_IRQChannelCmd = ENABLE;
+  NVicInit.NVIC_IRQChannel = I2C1_EV_IRQn;
+  NVIC_Init(&NVicInit);
+  NVicInit.NVIC_IRQChannel = I2C1_ER_IRQn;
+  NVIC_Init(&NVicInit);
+}
+
+bool HAL_I2CSubmit(I2C_XFER_T *xfer) {
+  uint8_t next = (queue_head + 1) % I2C_QUEUE_LEN;
+  if (xfer->state == I2C_XFER_PENDING || xfer->state == I2C_XFER_BUSY || next == queue_tail)
+    return false;
+  xfer->state = I2C_XFER_PENDING;
+  queue[queue_head] = xfer;
+  queue_head = next;
+  HAL_I2CLoop();
+  return true;
+}
+
+void HAL_I2CLoop() {
+  if (cur == NULL) {
+    if (queue_tail == queue_head)
+      return;
+    cur = queue[queue_tail];
+    queue_tail = (queue_tail + 1) % I2C_QUEUE_LEN;
+    cur_retried = 0;
+    cur_result = I2C_XFER_PENDING;
+    cur_time = systick_uptime();
+  }
+
+  switch (cur_result) {
+    case I2C_XFER_PENDING:
+      if (I2CBusIdle()) {
+        I2CStart();
+      } else if (systick_uptime() - cur_time > I2C_XFER_TIMEOUT_MS) {
+        // busy flag stuck without a transfer, see the F1 errata
+        I2CBusRecover();
+        cur_time = systick_uptime();
+      }
+      return;
+    case I2C_XFER_BUSY:
+      if (systick_uptime() - cur_time <= I2C_XFER_TIMEOUT_MS)
+        return;
+      I2CEnd(I2C_XFER_ERROR);
+      stats.timeout++;
+      I2CBusRecover();
+      break;
+    case I2C_XFER_DONE:
+      stats.done++;
+      break;
+    case I2C_XFER_NACK:
+      stats.nack++;
+      break;
+    default:
+      stats.error++;
+      I2CBusRecover();
+      break;
+  }
+
+  if (cur_result != I2C_XFER_DONE && cur_retried < cur->retry) {
+    cur_retried++;
+    stats.retry++;
+    cur_result = I2C_XFER_PENDING;
+    cur_time = systick_uptime();
+    return;
+  }
+  cur->state = cur_result;
+  cur = NULL;
+}
+
+bool HAL_I2CWait(I2C_XFER_T *xfer, uint32_t timeout_ms) {
+  uint32_t start = systick_uptime();
+  do {
+    HAL_I2CLoop();
+    if (xfer->state != I2C_XFER_PENDING && xfer->state != I2C_XFER_BUSY)
+      return xfer->state == I2C_XFER_DONE;
+  } while (systick_uptime() - start < timeout_ms);
+  return false;
+}
+
+I2C_STATS_T *HAL_I2CStats() {
+  return &stats;
+}
+
+// rx uses the BTF sequences of RM0008, the clock is stretched while both data
+// and shift registers are full so the interrupt latency is not critical
+extern "C" void __irq_i2c1_ev() {
+  I2C_XFER_T *xfer = cur;
+  uint16_t sr1 = I2C1->SR1;
+  uint8_t remain;
+
+  if (xfer == NULL || cur_result != I2C_XFER_BUSY) {
+    I2C1->CR2 &= ~I2C_IT_ALL;
+    return;
+  }
+
+  if (sr1 & I2C_SR1_SB) {
+    if (phase == I2C_PHASE_RESTART)
+      phase = I2C_PHASE_RX;
+    I2C1->DR = (xfer->addr << 1) | (phase == I2C_PHASE_RX);
+    return;
+  }
+
+  if (sr1 & I2C_SR1_ADDR) {
+    if (phase == I2C_PHASE_RX) {
+      if (xfer->rx_len == 1) {
+        I2C1->CR1 &= ~I2C_CR1_ACK;
+        (void)I2C1->SR2;
+        I2C1->CR1 |= I2C_CR1_STOP;
+      } else if (xfer->rx_len == 2) {
+        I2C1->CR1 = (I2C1->CR1 & ~I2C_CR1_ACK) | I2C_CR1_POS;
+        (void)I2C1->SR2;
+        I2C1->CR2 &= ~I2C_CR2_ITBUFEN;
+      } else {
+        if (xfer->rx_len == 3)
+          I2C1->CR2 &= ~I2C_CR2_ITBUFEN;
+        (void)I2C1->SR2;
+      }
+    } else {
+      (void)I2C1->SR2;
+    }
+    return;
+  }
+
+  if (phase == I2C_PHASE_TX) {
+    if (xfer_index < xfer->tx_len) {
+      if (sr1 & I2C_SR1_TXE) {
+        I2C1->DR = xfer->tx[xfer_index++];
+        // wait for the last byte to leave the shift register
+        if (xfer_index == xfer->tx_len)
+          I2C1->CR2 &= ~I2C_CR2_ITBUFEN;
+      }
+    } else if (sr1 & I2C_SR1_BTF) {
+      if (xfer->rx_len) {
+        phase = I2C_PHASE_RESTART;
+        xfer_index = 0;
+        I2C1->CR2 |= I2C_CR2_ITBUFEN;
+        I2C1->CR1 |= I2C_CR1_START;
+      } else {
+        I2C1->CR1 |= I2C_CR1_STOP;
+        I2CEnd(I2C_XFER_DONE);
+      }
+    }
+    return;
+  }
+
+  // BTF stays set until the repeated start is out
+  if (phase == I2C_PHASE_RESTART)
+    return;
+
+  remain = xfer->rx_len - xfer_index;
+  if (remain > 3) {
+    if (sr1 & I2C_SR1_RXNE) {
+      xfer->rx[xfer_index++] = I2C1->DR;
+      if (remain == 4)
+        I2C1->CR2 &= ~I2C_CR2_ITBUFEN;
+    }
+  } else if (remain == 3) {
+    // N-2 in DR, N-1 in shift, nack the last one
+    if (sr1 & I2C_SR1_BTF) {
+      I2C1->CR1 &= ~I2C_CR1_ACK;
+      xfer->rx[xfer_index++] = I2C1->DR;
+    }
+  } else if (remain == 2) {
+    if (sr1 & I2C_SR1_BTF) {
+      I2C1->CR1 |= I2C_CR1_STOP;
+      xfer->rx[xfer_index++] = I2C1->DR;
+      xfer->rx[xfer_index++] = I2C1->DR;
+      I2CEnd(I2C_XFER_DONE);
+    }
+  } else if (sr1 & I2C_SR1_RXNE) {
+    xfer->rx[xfer_index++] = I2C1->DR;
+    I2CEnd(I2C_XFER_DONE);
+  }
+}
+
+extern "C" void __irq_i2c1_er() {
+  uint16_t sr1 = I2C1->SR1;
+
+  // error flags are cleared by writing 0
+  I2C1->SR1 = ~(sr1 & I2C_SR1_ERR);
+  if (cur == NULL || cur_result != I2C_XFER_BUSY)
+    return;
+  if (sr1 & I2C_SR1_AF) {
+    I2C1->CR1 |= I2C_CR1_STOP;
+    I2CEnd(I2C_XFER_NACK);
+  } else {
+    I2CEnd(I2C_XFER_ERROR);
+  }
+}
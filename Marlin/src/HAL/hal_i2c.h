@@ -0,0 +1,73 @@
+/*
+ * Snapmaker2-Modules Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Modules
+ * (see https://github.com/Snapmaker/Snapmaker2-Modules)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef MODULES_WHIMSYCWD_MARLIN_SRC_HAL_I2C_H_
+#define MODULES_WHIMSYCWD_MARLIN_SRC_HAL_I2C_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+// interrupt driven I2C1 master on PB6 (SCL) / PB7 (SDA), transactions are queued and
+// stepped by the event interrupt, HAL_I2CLoop() finishes them from the main loop
+#define I2C_PIN_SCL           22   // PB6
+#define I2C_PIN_SDA           23   // PB7
+#define I2C_APB1_MHZ          36
+#define I2C_XFER_TX_MAX       4
+#define I2C_QUEUE_LEN         4
+#define I2C_XFER_TIMEOUT_MS   10
+
+typedef enum {
+  I2C_XFER_IDLE,
+  I2C_XFER_PENDING,
+  I2C_XFER_BUSY,
+  I2C_XFER_DONE,
+  I2C_XFER_NACK,
+  I2C_XFER_ERROR,
+} I2C_XFER_STATE;
+
+// write tx then read rx with a repeated start, either length may be 0
+typedef struct {
+  uint8_t addr;                    // 7 bit
+  uint8_t tx[I2C_XFER_TX_MAX];
+  uint8_t tx_len;
+  uint8_t *rx;
+  uint8_t rx_len;
+  uint8_t retry;                   // extra attempts after a nack, bus error or timeout
+  volatile I2C_XFER_STATE state;
+} I2C_XFER_T;
+
+typedef struct {
+  uint32_t done;
+  uint32_t nack;
+  uint32_t error;
+  uint32_t timeout;
+  uint32_t retry;
+  uint32_t recover;
+} I2C_STATS_T;
+
+void HAL_I2CInit(uint32_t speed_hz);
+// returns false if the transaction is already queued or the queue is full
+bool HAL_I2CSubmit(I2C_XFER_T *xfer);
+void HAL_I2CLoop();
+// blocking, only for init sequences
+bool HAL_I2CWait(I2C_XFER_T *xfer, uint32_t timeout_ms);
+I2C_STATS_T *HAL_I2CStats();
+
+#endif
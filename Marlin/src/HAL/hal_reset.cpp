@@ -20,7 +20,16 @@
  */
 #include "std_library/inc/stm32f10x.h"
 #include "std_library/inc/stm32f10x_iwdg.h"
+#include "std_library/inc/stm32f10x_rcc.h"
+#include "hal_reset.h"
+
+#define RESET_REQUEST_MAGIC 0x52535451
+
+// survives the watchdog reset, tells a requested reset from a hang
+__attribute__((section(".noinit"))) static uint32_t reset_request;
+
 void HAL_reset() {
+  reset_request = RESET_REQUEST_MAGIC;
   IWDG_WriteAccessCmd(IWDG_WriteAccess_Enable);
   IWDG_SetPrescaler(IWDG_Prescaler_64);
   IWDG_SetReload(30);
@@ -28,6 +37,26 @@ void HAL_reset() {
   IWDG_Enable();
 }
 
+RESET_CAUSE_E HAL_reset_cause() {
+  RESET_CAUSE_E cause = RESET_CAUSE_PIN;
+
+  // an internal reset also pulls NRST, so the pin flag is checked last
+  if (RCC_GetFlagStatus(RCC_FLAG_LPWRRST) == SET) {
+    cause = RESET_CAUSE_LOW_POWER;
+  } else if (RCC_GetFlagStatus(RCC_FLAG_WWDGRST) == SET) {
+    cause = RESET_CAUSE_WWDG;
+  } else if (RCC_GetFlagStatus(RCC_FLAG_IWDGRST) == SET) {
+    cause = (reset_request == RESET_REQUEST_MAGIC) ? RESET_CAUSE_REQUEST : RESET_CAUSE_IWDG;
+  } else if (RCC_GetFlagStatus(RCC_FLAG_SFTRST) == SET) {
+    cause = RESET_CAUSE_SOFT;
+  } else if (RCC_GetFlagStatus(RCC_FLAG_PORRST) == SET) {
+    cause = RESET_CAUSE_POWER;
+  }
+  RCC_ClearFlag();
+  reset_request = 0;
+  return cause;
+}
+
 void HAL_JTAGDisable() {
   GPIO_PinRemapConfig(GPIO_Remap_SWJ_JTAGDisable , ENABLE);	
 }
\ No newline at end of file
@@ -21,6 +21,18 @@
 #ifndef MODULES_WHIMSYCWD_MARLIN_SRC_HAL_HAL_GD32F1_HAL_RESET_H_
 #define MODULES_WHIMSYCWD_MARLIN_SRC_HAL_HAL_GD32F1_HAL_RESET_H_
 
+typedef enum {
+  RESET_CAUSE_POWER,
+  RESET_CAUSE_PIN,
+  RESET_CAUSE_SOFT,
+  RESET_CAUSE_IWDG,
+  RESET_CAUSE_WWDG,
+  RESET_CAUSE_LOW_POWER,
+  RESET_CAUSE_REQUEST,    // HAL_reset()
+} RESET_CAUSE_E;
+
 extern void HAL_reset();
 extern void HAL_JTAGDisable();
+// reads and clears the reset flags, call once at boot
+extern RESET_CAUSE_E HAL_reset_cause();
 #endif //MODULES_WHIMSYCWD_MARLIN_SRC_HAL_HAL_GD32F1_HAL_TEMPERATURE_H_
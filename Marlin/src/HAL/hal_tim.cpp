@@ -24,6 +24,7 @@
 #include <src/HAL/std_library/inc/stm32f10x.h>
 //                           1     2     3     4
 TIM_CB_F tim_cb_table[4] = {NULL, NULL, NULL, NULL};
+static bool tim_update_irq[4] = {false, false, false, false};
 static TIM_TypeDef * tim_table[] = {
   TIM1, TIM2, TIM3, TIM4
 };
@@ -101,37 +102,53 @@ void HAL_timer_disable(uint8_t tim) {
   TIM_Cmd(tim_table[tim - 1], DISABLE);
 }
 
+void HAL_timer_set_period(uint8_t tim, uint16_t u16Period) {
+  TIM_TypeDef *timx = tim_table[tim - 1];
+  timx->CR1 &= ~TIM_CR1_ARPE;
+  timx->ARR = u16Period - 1;
+  // already past the new period, restart it rather than wrap through 0xffff
+  if (timx->CNT >= timx->ARR) {
+    timx->EGR = TIM_EGR_UG;
+    // a software restart rather than the end of a period, don't run the callback again for it
+    TIM_ClearITPendingBit(timx, TIM_IT_Update);
+  }
+}
+
+bool HAL_timer_update_irq(uint8_t tim) {
+  return tim_update_irq[tim - 1];
+}
+
+// the update flag is cleared before the callback, so an update while it runs pends the
+// interrupt again instead of being cleared unseen
+static void tim_irq(uint8_t tim) {
+  tim_update_irq[tim] = (TIM_GetITStatus(tim_table[tim], TIM_IT_Update) == SET);
+  if (tim_update_irq[tim]) {
+    TIM_ClearITPendingBit(tim_table[tim], TIM_IT_Update);
+  }
+  if (tim_cb_table[tim]) {
+    tim_cb_table[tim]();
+  }
+}
+
 #ifdef __cplusplus
 extern "C" {  // only need to export C interface if
               // used by C++ source code
 #endif
 
 void __irq_tim1_up() {
-  if (tim_cb_table[0]) {
-    tim_cb_table[0]();
-  }
-  TIM_ClearITPendingBit(TIM1, TIM_IT_Update);
+  tim_irq(0);
 }
 
 void __irq_tim2() {
-  if (tim_cb_table[1]) {
-    tim_cb_table[1]();
-  }
-  TIM_ClearITPendingBit(TIM2, TIM_IT_Update);
+  tim_irq(1);
 }
 
 void __irq_tim3() {
-  if (tim_cb_table[2]) {
-    tim_cb_table[2]();
-  }
-  TIM_ClearITPendingBit(TIM3, TIM_IT_Update);
+  tim_irq(2);
 }
 
 void __irq_tim4() {
-  if (tim_cb_table[3]) {
-    tim_cb_table[3]();
-  }
-  TIM_ClearITPendingBit(TIM4, TIM_IT_Update);
+  tim_irq(3);
 }
 
 #ifdef __cplusplus
@@ -48,5 +48,9 @@ extern void HAL_timer_nvic_init(uint8_t tim, uint8_t PreemptionPriority, uint8_t
 extern void HAL_timer_cb_init(uint8_t tim, TIM_CB_F cb);
 extern void HAL_timer_enable(uint8_t tim);
 extern void HAL_timer_disable(uint8_t tim);
+// takes effect on the running period, called from the update callback to schedule the next event
+extern void HAL_timer_set_period(uint8_t tim, uint16_t u16Period);
+// from a callback, whether this interrupt came from an update event, its flag is already cleared
+extern bool HAL_timer_update_irq(uint8_t tim);
 #endif  // FIRMWARE_USER_HARDWARE_TIM_H_
 
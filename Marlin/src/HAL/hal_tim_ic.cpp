@@ -99,10 +99,9 @@ static void tim_ic_irq(uint8_t timx) {
         return;
     timx -= 1;
 
-    if (TIM_GetITStatus(tim_ic[timx].tim, TIM_IT_Update) == 1) {
+    if (HAL_timer_update_irq(timx + 1)) {
         if (tim_ic[timx].update_cb)
             tim_ic[timx].update_cb();
-        TIM_ClearITPendingBit(tim_ic[timx].tim, TIM_IT_Update);
     }
 
     if (TIM_GetITStatus(tim_ic[timx].tim, TIM_IT_CC1) == 1) {
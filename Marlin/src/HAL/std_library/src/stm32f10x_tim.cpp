@@ -2052,7 +2052,7 @@ void TIM_CCxNCmd(TIM_TypeDef* TIMx, uint16_t TIM_Channel, uint16_t TIM_CCxN)
   */
 void TIM_SelectOCxM(TIM_TypeDef* TIMx, uint16_t TIM_Channel, uint16_t TIM_OCMode)
 {
-  uint32_t tmp = 0;
+  uintptr_t tmp = 0;
   uint16_t tmp1 = 0;
 
   /* Check the parameters */
@@ -2060,7 +2060,7 @@ void TIM_SelectOCxM(TIM_TypeDef* TIMx, uint16_t TIM_Channel, uint16_t TIM_OCMode
   assert_param(IS_TIM_CHANNEL(TIM_Channel));
   assert_param(IS_TIM_OCM(TIM_OCMode));
 
-  tmp = (uint32_t) TIMx;
+  tmp = (uintptr_t) TIMx;
   tmp += CCMR_Offset;
 
   tmp1 = CCER_CCE_Set << (uint16_t)TIM_Channel;
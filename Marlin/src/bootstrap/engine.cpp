@@ -21,8 +21,11 @@
 
 #include <src/registry/registry.h>
 #include <src/core/can_bus.h>
+#include <src/core/log.h>
+#include <src/core/mem_stat.h>
 #include <src/device/temperature.h>
 #include <src/registry/route.h>
+#include <src/registry/report_scheduler.h>
 #include "engine.h"
 
 void Engine::Run() {
@@ -34,6 +37,9 @@ void Engine::Run() {
     registryInstance.ServerHandler();
     registryInstance.SystemHandler();
     routeInstance.ModuleLoop();
+    reportScheduler.Loop();
+    logInstance.Flush();
+    memStatInstance.Loop();
   }
 }
 
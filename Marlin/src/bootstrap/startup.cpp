@@ -23,6 +23,8 @@
 #include <src/core/utils.h>
 #include <src/registry/registry.h>
 #include <src/core/can_bus.h>
+#include <src/core/trace.h>
+#include <src/core/mem_stat.h>
 #include <src/registry/route.h>
 #include "startup.h"
 
@@ -32,6 +34,8 @@ uint32_t Startup::SelfDetct() {
 }
 
 void Startup::BasePeriphInit() {
+  traceInstance.Init();
+  memStatInstance.Paint();
   canbus_g.Init(registryInstance.ModuleCanId());
 }
 
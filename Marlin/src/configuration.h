@@ -34,12 +34,14 @@
 #define MODULE_PARA_SIZE  (1  * 1024)
 #define PUBLIC_PARA_SIZE (1  * 1024)
 #define APP_PARA_SIZE (1  * 1024)
+#define BLACKBOX_SIZE (1  * 1024)
 
 #define FLASH_BOOT_CODE   (FLASH_BASE)
 #define FLASH_MODULE_PARA   (FLASH_BOOT_CODE + BOOT_CODE_SIZE)  // readonly
 #define FLASH_PUBLIC_PARA (FLASH_MODULE_PARA + MODULE_PARA_SIZE)  // read & write
 #define FLASH_APP_PARA    (FLASH_PUBLIC_PARA + PUBLIC_PARA_SIZE)  // read & write
 #define FLASH_APP       (FLASH_APP_PARA + APP_PARA_SIZE)
+#define FLASH_BLACKBOX  (FLASH_BASE + FLASH_TOTAL_SIZE - BLACKBOX_SIZE)  // last page, kept out of the app by the ld script
 
 #define INVALID_VALUE 9999
 
@@ -146,6 +148,16 @@ typedef enum {
   CMD_M_UPDATE_STATUS_REQUEST,  // 15
   CMD_S_UPDATE_STATUS_REACK,    // 16
   CMD_M_UPDATE_START,           // 17
+  CMD_S_MOTOR_TELEMETRY,        // 18
+  CMD_M_SET_LIGHT_ANIMATION,    // 19
+  CMD_M_BLACKBOX_REQUEST,       // 1a
+  CMD_S_BLACKBOX_REACK,         // 1b
+  CMD_M_LOG_ENABLE,             // 1c
+  CMD_S_LOG,                    // 1d
+  CMD_M_MEM_REQUEST,            // 1e
+  CMD_S_MEM_REACK,              // 1f
+  CMD_M_SET_REPORT,             // 20
+  CMD_S_SET_REPORT_REACK,       // 21
   CMD_M_DEBUG_INFO = 0xFE,
   CMD_S_DEBUG_INFO = 0xFF,
 } SYSTEM_CMD;
@@ -223,6 +235,10 @@ typedef enum {
     FUNC_MODULE_LASER_BRANCH_CTRL         ,  // 68
     FUNC_SET_RIGHT_LEVEL_MODE             ,  // 69
     FUNC_REPORT_RIGHT_LEVEL_MODE_INFO     ,  // 70
+    FUNC_REPORT_MOTOR_WARNING_INFO        ,  // 71
+    FUNC_SET_MOTOR_TELEMETRY              ,  // 72
+    FUNC_REPORT_MOTOR_SPECTRUM_INFO       ,  // 73
+    FUNC_SET_LIGHT_ANIMATION              ,  // 74
 } FUNC_ID;
 
 typedef enum {
@@ -0,0 +1,96 @@
+/*
+ * Snapmaker2-Modules Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Modules
+ * (see https://github.com/Snapmaker/Snapmaker2-Modules)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <src/configuration.h>
+#include <src/core/can_bus.h>
+#include <src/core/protocal/Longpack.h>
+#include "src/HAL/std_library/inc/stm32f10x.h"
+#include "log.h"
+
+#define LOG_MASK          (LOG_BUFFER_SIZE - 1)
+#define LOG_PACK_HEAD     3     // cmd, seq, dropped
+#define LONGPACK_HEAD     8
+
+void Log::Enable(bool enable) {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  head_ = tail_ = 0;
+  dropped_ = 0;
+  enabled_ = enable;
+  __set_PRIMASK(primask);
+}
+
+// record: arg count, token, args, all little endian
+void Log::Push(uint32_t *words, uint8_t count) {
+  uint8_t *src = (uint8_t *)words;
+  uint16_t len = count * 4;
+
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  uint16_t head = head_;
+  if (LOG_BUFFER_SIZE - 1 - ((head - tail_) & LOG_MASK) < len + 1) {
+    if (dropped_ < 0xff)
+      dropped_++;
+  } else {
+    buffer_[head++ & LOG_MASK] = count - 1;
+    for (uint16_t i = 0; i < len; i++) {
+      buffer_[head++ & LOG_MASK] = src[i];
+    }
+    head_ = head & LOG_MASK;
+  }
+  __set_PRIMASK(primask);
+}
+
+void Log::Flush() {
+  uint8_t buf[LOG_PACK_SIZE];
+  uint16_t len = LOG_PACK_HEAD;
+  uint16_t head = head_;
+
+  if (!enabled_ || head == tail_) {
+    return;
+  }
+  // leave the extended buffer to the replies when it is busy
+  if (canbus_g.extended_send_buffer_.freeSpace() < LOG_PACK_SIZE + LONGPACK_HEAD) {
+    return;
+  }
+
+  while (tail_ != head) {
+    uint16_t rec_len = 1 + (buffer_[tail_] + 1) * 4;
+    if (len + rec_len > LOG_PACK_SIZE) {
+      break;
+    }
+    for (uint16_t i = 0; i < rec_len; i++) {
+      buf[len++] = buffer_[tail_];
+      tail_ = (tail_ + 1) & LOG_MASK;
+    }
+  }
+
+  buf[0] = CMD_S_LOG;
+  buf[1] = seq_++;
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  buf[2] = dropped_;
+  dropped_ = 0;
+  __set_PRIMASK(primask);
+  longpackInstance.sendLongpack(buf, len);
+}
+
+Log logInstance;
@@ -0,0 +1,89 @@
+/*
+ * Snapmaker2-Modules Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Modules
+ * (see https://github.com/Snapmaker/Snapmaker2-Modules)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MODULES_WHIMSYCWD_MARLIN_SRC_CORE_LOG_H_
+#define MODULES_WHIMSYCWD_MARLIN_SRC_CORE_LOG_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#define LOG_BUFFER_SIZE   256   // power of two
+#define LOG_MAX_ARGS      4
+#define LOG_PACK_SIZE     96
+
+// FNV-1a, only ever evaluated by the compiler
+constexpr uint32_t LogHash(const char *s, uint32_t h = 2166136261u) {
+  return *s ? LogHash(s + 1, (h ^ (uint8_t)*s) * 16777619u) : h;
+}
+
+// every argument travels as one 32 bit word, the format string tells the decoder its type
+template <typename T>
+inline uint32_t LogWord(T v) { return (uint32_t)v; }
+
+inline uint32_t LogWord(float v) {
+  uint32_t w;
+  memcpy(&w, &v, sizeof(w));
+  return w;
+}
+
+inline uint32_t LogWord(double v) { return LogWord((float)v); }
+
+class Log {
+ public:
+  void Enable(bool enable);
+  // sends the buffered records, called from the main loop
+  void Flush();
+
+  template <typename... Args>
+  void Emit(uint32_t token, Args... args) {
+    static_assert(sizeof...(args) <= LOG_MAX_ARGS, "too many log arguments");
+    if (!enabled_)
+      return;
+    uint32_t words[] = {token, LogWord(args)...};
+    Push(words, sizeof(words) / sizeof(words[0]));
+  }
+
+ private:
+  void Push(uint32_t *words, uint8_t count);
+
+ private:
+  bool enabled_ = false;
+  uint8_t seq_ = 0;
+  uint8_t dropped_ = 0;
+  volatile uint16_t head_ = 0;
+  uint16_t tail_ = 0;
+  uint8_t buffer_[LOG_BUFFER_SIZE];
+};
+
+extern Log logInstance;
+
+/*
+ * The format string is kept only in the .log_tokens section, which the ld script
+ * marks as not loaded: it stays in the elf for the host decoder but not in flash.
+ * Arguments: integers, pointers and floats, at most LOG_MAX_ARGS.
+ */
+#define LOG(fmt, ...) do { \
+    static const char log_fmt_[] __attribute__((section(".log_tokens"), used)) = fmt; \
+    constexpr uint32_t log_token_ = LogHash(fmt); \
+    logInstance.Emit(log_token_, ##__VA_ARGS__); \
+  } while (0)
+
+#endif  // MODULES_WHIMSYCWD_MARLIN_SRC_CORE_LOG_H_
@@ -0,0 +1,107 @@
+/*
+ * Snapmaker2-Modules Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Modules
+ * (see https://github.com/Snapmaker/Snapmaker2-Modules)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <src/configuration.h>
+#include <src/core/protocal/Longpack.h>
+#include "src/HAL/std_library/inc/stm32f10x.h"
+#include <libmaple/systick.h>
+#include "mem_stat.h"
+
+extern "C" void *_sbrk(int incr);
+extern char __data_start__;
+extern char _lm_heap_start;
+extern char __msp_init;
+
+void MemStat::Paint() {
+  uint32_t *p = (uint32_t *)(((uint32_t)_sbrk(0) + 3) & ~3);
+  uint32_t *end = (uint32_t *)((__get_MSP() - MEM_PAINT_GUARD) & ~3);
+
+  while (p < end) {
+    *p++ = MEM_PAINT_WORD;
+  }
+  low_water_ = (uint32_t)end;
+}
+
+// the stack only ever dirties paint from above, the first dirty word above the break is its deepest point
+uint32_t MemStat::StackLowWater() {
+  uint32_t *p = (uint32_t *)(((uint32_t)_sbrk(0) + 3) & ~3);
+  uint32_t *end = (uint32_t *)low_water_;
+
+  while (p < end && *p == MEM_PAINT_WORD) {
+    p++;
+  }
+  low_water_ = (uint32_t)p;
+  return low_water_;
+}
+
+void MemStat::OnAlloc(size_t size) {
+  if (size > largest_alloc_)
+    largest_alloc_ = size > 0xffff ? 0xffff : size;
+  if (alloc_count_ < 0xffff)
+    alloc_count_++;
+}
+
+void MemStat::Request(uint8_t period_s) {
+  if (period_s != 0xff) {
+    period_ms_ = period_s * 1000;
+    report_time_ = systick_uptime();
+  }
+  Report();
+}
+
+void MemStat::Loop() {
+  if (period_ms_ && systick_uptime() - report_time_ >= period_ms_) {
+    report_time_ = systick_uptime();
+    Report();
+  }
+}
+
+void MemStat::Report() {
+  uint8_t buf[15];
+  uint8_t index = 0;
+  uint32_t stack_top = (uint32_t)&__msp_init;
+  uint32_t heap_start = (uint32_t)&_lm_heap_start;
+  uint32_t brk = (uint32_t)_sbrk(0);
+  uint32_t low_water = StackLowWater();
+  uint16_t value[7] = {
+    (uint16_t)(stack_top - heap_start),                  // shared by heap and stack
+    (uint16_t)(stack_top - low_water),                   // stack peak
+    (uint16_t)(brk - heap_start),                        // heap peak, the break never moves back
+    (uint16_t)(low_water - brk),                         // least free seen
+    largest_alloc_,
+    alloc_count_,
+    (uint16_t)(heap_start - (uint32_t)&__data_start__),  // data, bss and noinit
+  };
+
+  buf[index++] = CMD_S_MEM_REACK;
+  for (uint8_t i = 0; i < sizeof(value) / sizeof(value[0]); i++) {
+    buf[index++] = value[i] >> 8;
+    buf[index++] = value[i];
+  }
+  longpackInstance.sendLongpack(buf, index);
+}
+
+MemStat memStatInstance;
+
+// called by operator new
+extern "C" void new_alloc_hook(size_t size) {
+  memStatInstance.OnAlloc(size);
+}
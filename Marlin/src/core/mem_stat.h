@@ -0,0 +1,54 @@
+/*
+ * Snapmaker2-Modules Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Modules
+ * (see https://github.com/Snapmaker/Snapmaker2-Modules)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MODULES_WHIMSYCWD_MARLIN_SRC_CORE_MEM_STAT_H_
+#define MODULES_WHIMSYCWD_MARLIN_SRC_CORE_MEM_STAT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MEM_PAINT_WORD      0xa5a5a5a5
+#define MEM_PAINT_GUARD     64    // bytes below the live stack left alone while painting
+
+class MemStat {
+ public:
+  // fills the gap between the heap break and the stack, call once at boot
+  void Paint();
+  void Loop();
+  void OnAlloc(size_t size);
+  // period_s: 0 stops the periodic report, 0xff only answers this request
+  void Request(uint8_t period_s);
+
+ private:
+  void Report();
+  uint32_t StackLowWater();
+
+ private:
+  uint32_t low_water_ = 0;   // lowest stack address seen dirty
+  uint16_t largest_alloc_ = 0;
+  uint16_t alloc_count_ = 0;
+  uint32_t period_ms_ = 0;
+  uint32_t report_time_ = 0;
+};
+
+extern MemStat memStatInstance;
+
+#endif  // MODULES_WHIMSYCWD_MARLIN_SRC_CORE_MEM_STAT_H_
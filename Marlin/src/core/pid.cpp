@@ -120,6 +120,7 @@ uint32_t Pid::output(float actual) {
     }
   }
 
+  output_value_ = ret_val;
   return ((uint32_t ) ret_val);
 }
 void Pid::target(int32_t target) {
@@ -51,6 +51,7 @@ class Pid {
   uint32_t output(float actual);
   void SetPwmDutyLimitAndThreshold(uint8_t count, int32_t threshold);
   uint32_t getTarget();
+  uint32_t getOutput() { return output_value_; }
   float k_p_;
   float k_i_;
   float k_d_;
@@ -0,0 +1,65 @@
+/*
+ * Snapmaker2-Modules Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Modules
+ * (see https://github.com/Snapmaker/Snapmaker2-Modules)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <wirish_time.h>
+#include "report_filter.h"
+
+void ReportFilter::Init(const uint16_t *deadband, uint8_t count, uint16_t min_interval, uint16_t max_interval) {
+  if (count > REPORT_FILTER_FIELDS)
+    count = REPORT_FILTER_FIELDS;
+  memcpy(deadband_, deadband, count * sizeof(deadband_[0]));
+  count_ = count;
+  force_ = true;
+  SetInterval(min_interval, max_interval);
+}
+
+void ReportFilter::SetInterval(uint16_t min_interval, uint16_t max_interval) {
+  min_interval_ = min_interval;
+  max_interval_ = max_interval < min_interval ? min_interval : max_interval;
+}
+
+bool ReportFilter::Due(const int32_t *values, bool force) {
+  uint32_t now = millis();
+  uint32_t elapsed = now - last_time_;
+  bool due = force || force_;
+
+  if (!due) {
+    if (elapsed < min_interval_) {
+      return false;
+    }
+    due = elapsed >= max_interval_;
+    for (uint8_t i = 0; i < count_ && !due; i++) {
+      int32_t diff = values[i] - last_[i];
+      if (diff < 0)
+        diff = -diff;
+      due = diff > deadband_[i];
+    }
+    if (!due) {
+      return false;
+    }
+  }
+
+  memcpy(last_, values, count_ * sizeof(last_[0]));
+  last_time_ = now;
+  force_ = false;
+  return true;
+}
@@ -0,0 +1,54 @@
+/*
+ * Snapmaker2-Modules Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Modules
+ * (see https://github.com/Snapmaker/Snapmaker2-Modules)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MODULES_WHIMSYCWD_MARLIN_SRC_CORE_REPORT_FILTER_H_
+#define MODULES_WHIMSYCWD_MARLIN_SRC_CORE_REPORT_FILTER_H_
+
+#include <stdint.h>
+
+#define REPORT_FILTER_FIELDS  8
+
+/*
+ * Decides when a periodic report is worth a frame: a field moved beyond its
+ * deadband, or max_interval passed without a frame (heartbeat). Never more
+ * often than min_interval.
+ */
+class ReportFilter {
+ public:
+  // deadband: one per field, 0 sends on any change
+  void Init(const uint16_t *deadband, uint8_t count, uint16_t min_interval, uint16_t max_interval);
+  void SetInterval(uint16_t min_interval, uint16_t max_interval);
+  // the next Due() is true whatever the values
+  void Force() { force_ = true; }
+  // true when the values have to be sent now, they then become the reference
+  bool Due(const int32_t *values, bool force = false);
+
+ private:
+  int32_t last_[REPORT_FILTER_FIELDS];
+  uint16_t deadband_[REPORT_FILTER_FIELDS];
+  uint8_t count_ = 0;
+  bool force_ = true;
+  uint16_t min_interval_ = 0;
+  uint16_t max_interval_ = 0;
+  uint32_t last_time_ = 0;
+};
+
+#endif  // MODULES_WHIMSYCWD_MARLIN_SRC_CORE_REPORT_FILTER_H_
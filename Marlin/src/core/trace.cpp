@@ -0,0 +1,165 @@
+/*
+ * Snapmaker2-Modules Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Modules
+ * (see https://github.com/Snapmaker/Snapmaker2-Modules)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <src/configuration.h>
+#include <src/core/protocal/Longpack.h>
+#include "src/HAL/std_library/inc/stm32f10x.h"
+#include "src/HAL/hal_flash.h"
+#include "src/HAL/hal_reset.h"
+#include "trace.h"
+
+typedef struct {
+  uint32_t magic;
+  uint32_t head;          // total emitted, wraps the ring
+  uint32_t fault_magic;   // set by the hard fault handler
+  TRACE_FAULT_T fault;
+  TRACE_T ring[TRACE_LEN];
+} TRACE_RAM_T;
+
+// not cleared by the startup code, the previous run is still here after a reset
+__attribute__((section(".noinit"))) static TRACE_RAM_T trace_ram;
+
+void Trace::Init() {
+  uint8_t cause = HAL_reset_cause();
+
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+  if (trace_ram.magic == TRACE_MAGIC) {
+    if (trace_ram.fault_magic == TRACE_MAGIC) {
+      Persist(cause | BLACKBOX_CAUSE_FAULT);
+    } else if (cause == RESET_CAUSE_IWDG || cause == RESET_CAUSE_WWDG || cause == RESET_CAUSE_SOFT) {
+      Persist(cause);
+    }
+  }
+
+  trace_ram.head = 0;
+  trace_ram.fault_magic = 0;
+  trace_ram.magic = TRACE_MAGIC;
+  Emit(TRACE_EVT_BOOT, cause, 0);
+}
+
+void Trace::Emit(uint8_t event, uint8_t arg8, uint16_t arg16) {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  TRACE_T *rec = &trace_ram.ring[trace_ram.head++ & (TRACE_LEN - 1)];
+  rec->cycles = DWT->CYCCNT;
+  rec->event = event;
+  rec->arg8 = arg8;
+  rec->arg16 = arg16;
+  __set_PRIMASK(primask);
+}
+
+// runs from the boot after the crash, never from the fault handler itself
+void Trace::Persist(uint8_t cause) {
+  BLACKBOX_HEAD_T head;
+  uint32_t addr = FLASH_BLACKBOX;
+  uint32_t count = trace_ram.head < TRACE_LEN ? trace_ram.head : TRACE_LEN;
+  uint32_t first = trace_ram.head - count;
+
+  // keep the first record until the host clears it, a crash loop must not wear the page out
+  if (((BLACKBOX_HEAD_T *)FLASH_BLACKBOX)->magic != 0xffffffff) {
+    return;
+  }
+
+  head.magic = BLACKBOX_MAGIC;
+  head.cause = cause;
+  head.count = count;
+  head.reserved = 0;
+  if (cause & BLACKBOX_CAUSE_FAULT) {
+    head.fault = trace_ram.fault;
+  } else {
+    memset(&head.fault, 0, sizeof(head.fault));
+  }
+  HAL_flash_write(addr, (uint8_t *)&head, sizeof(head));
+  addr += sizeof(head);
+
+  for (uint32_t i = 0; i < count; i++) {
+    HAL_flash_write(addr, (uint8_t *)&trace_ram.ring[(first + i) & (TRACE_LEN - 1)], sizeof(TRACE_T));
+    addr += sizeof(TRACE_T);
+  }
+}
+
+void Trace::ReportBlackBox(uint8_t chunk) {
+  uint8_t buf[3 + BLACKBOX_CHUNK_SIZE];
+  uint8_t chunk_count = (BLACKBOX_DATA_SIZE + BLACKBOX_CHUNK_SIZE - 1) / BLACKBOX_CHUNK_SIZE;
+  uint16_t len = 3;
+
+  if (chunk == BLACKBOX_CHUNK_ERASE) {
+    HAL_flash_erase_page(FLASH_BLACKBOX, 1);
+    chunk_count = 0;
+  } else if (((BLACKBOX_HEAD_T *)FLASH_BLACKBOX)->magic != BLACKBOX_MAGIC) {
+    chunk_count = 0;
+  } else if (chunk < chunk_count) {
+    uint16_t offset = chunk * BLACKBOX_CHUNK_SIZE;
+    uint16_t size = BLACKBOX_DATA_SIZE - offset;
+    if (size > BLACKBOX_CHUNK_SIZE)
+      size = BLACKBOX_CHUNK_SIZE;
+    HAL_flash_read(FLASH_BLACKBOX + offset, buf + 3, size);
+    len += size;
+  }
+
+  buf[0] = CMD_S_BLACKBOX_REACK;
+  buf[1] = chunk;
+  buf[2] = chunk_count;
+  longpackInstance.sendLongpack(buf, len);
+}
+
+Trace traceInstance;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// frame is the exception stack frame: r0-r3, r12, lr, pc, xpsr
+__attribute__((used)) void TraceHardFault(uint32_t *frame) {
+  trace_ram.fault.r0 = frame[0];
+  trace_ram.fault.r1 = frame[1];
+  trace_ram.fault.r2 = frame[2];
+  trace_ram.fault.r3 = frame[3];
+  trace_ram.fault.r12 = frame[4];
+  trace_ram.fault.lr = frame[5];
+  trace_ram.fault.pc = frame[6];
+  trace_ram.fault.xpsr = frame[7];
+  trace_ram.fault.cfsr = SCB->CFSR;
+  trace_ram.fault.hfsr = SCB->HFSR;
+  trace_ram.fault.mmfar = SCB->MMFAR;
+  trace_ram.fault.bfar = SCB->BFAR;
+  trace_ram.fault_magic = TRACE_MAGIC;
+  traceInstance.Emit(TRACE_EVT_FAULT, 0, frame[6] & 0xffff);
+  NVIC_SystemReset();
+}
+
+// overrides the weak libmaple handler that spins forever
+__attribute__((naked)) void __exc_hardfault(void) {
+  __asm volatile(
+    "tst lr, #4         \n"
+    "ite eq             \n"
+    "mrseq r0, msp      \n"
+    "mrsne r0, psp      \n"
+    "b TraceHardFault   \n");
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,91 @@
+/*
+ * Snapmaker2-Modules Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Modules
+ * (see https://github.com/Snapmaker/Snapmaker2-Modules)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MODULES_WHIMSYCWD_MARLIN_SRC_CORE_TRACE_H_
+#define MODULES_WHIMSYCWD_MARLIN_SRC_CORE_TRACE_H_
+
+#include <stdint.h>
+
+#define TRACE_LEN             64    // power of two
+#define TRACE_MAGIC           0x54524345
+#define BLACKBOX_MAGIC        0x424c4b42
+#define BLACKBOX_CAUSE_FAULT  0x80  // or'ed into the RESET_CAUSE_E of the black box
+#define BLACKBOX_CHUNK_SIZE   96
+#define BLACKBOX_CHUNK_ERASE  0xff
+
+typedef enum {
+  TRACE_EVT_BOOT = 0,   // arg8 reset cause
+  TRACE_EVT_CAN_RX,     // arg8 dlc, arg16 std id
+  TRACE_EVT_CAN_TX,     // arg8 dlc, arg16 std id
+  TRACE_EVT_LONGPACK,   // arg8 system cmd, arg16 len
+  TRACE_EVT_STATE,      // arg8 new state, arg16 old state
+  TRACE_EVT_FAULT,      // arg16 low half of the faulting pc
+} TRACE_EVENT_E;
+
+typedef struct {
+  uint32_t cycles;      // DWT cycle counter
+  uint8_t  event;
+  uint8_t  arg8;
+  uint16_t arg16;
+} TRACE_T;
+
+typedef struct {
+  uint32_t r0;
+  uint32_t r1;
+  uint32_t r2;
+  uint32_t r3;
+  uint32_t r12;
+  uint32_t lr;
+  uint32_t pc;
+  uint32_t xpsr;
+  uint32_t cfsr;
+  uint32_t hfsr;
+  uint32_t mmfar;
+  uint32_t bfar;
+} TRACE_FAULT_T;
+
+// layout of the black box page, followed by TRACE_LEN records oldest first
+typedef struct {
+  uint32_t magic;
+  uint8_t  cause;
+  uint8_t  count;
+  uint16_t reserved;
+  TRACE_FAULT_T fault;
+} BLACKBOX_HEAD_T;
+
+#define BLACKBOX_DATA_SIZE    (sizeof(BLACKBOX_HEAD_T) + TRACE_LEN * sizeof(TRACE_T))
+
+class Trace {
+ public:
+  // must run before anything emits, saves the previous run if it died
+  void Init();
+  void Emit(uint8_t event, uint8_t arg8, uint16_t arg16);
+  void ReportBlackBox(uint8_t chunk);
+
+ private:
+  void Persist(uint8_t cause);
+};
+
+extern Trace traceInstance;
+
+#define TRACE(event, arg8, arg16) traceInstance.Emit((event), (arg8), (arg16))
+
+#endif  // MODULES_WHIMSYCWD_MARLIN_SRC_CORE_TRACE_H_
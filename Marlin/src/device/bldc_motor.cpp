@@ -1,6 +1,7 @@
 #include <wirish_math.h>
 #include <board/board.h>
 #include <include/libmaple/libmaple_types.h>
+#include <libmaple/nvic.h>
 #include "src/HAL/std_library/inc/stm32f10x.h"
 #include "src/HAL/hal_tim.h"
 #include "src/HAL/hal_adc.h"
@@ -8,7 +9,6 @@
 #include "bldc_motor.h"
 
 #define BLDC_TIMx                                   TIM1     // All six channels are in one timer, with this way timer must select advanced timer.
-#define BLDC_TIM_PWM_FREQ                           20000 //50000 Hz
 #define BLDC_TIM_PRESCALER                          0          // 72M
 #define BLDC_TIM_PERIOD                             ((uint16_t)(SystemCoreClock/(BLDC_TIM_PRESCALER+1)/BLDC_TIM_PWM_FREQ)) //3600
 #define BLDC_TIM_REPETITIONCOUNTER                  0
@@ -18,20 +18,60 @@
 #define BLDC_TIM_BKIN_PIN_POLARITY                  TIM_BreakPolarity_Low
 
 #define BLDC_PUBLIC_TIMER                           2 //STM32F10X_MD TIM 2\3\4
-#define BLDC_PUBLIC_PRO_TIMES                       100 // 100-> 1000/100 = 10ms
-#define BLDC_PUBLIC_CAPTURE_SPEED_CNT               2 // 2 * 10 = 20ms PID control time
+#define BLDC_PUBLIC_PRO_TIMES                       1000 // 1000-> 1000/1000 = 1ms, telemetry sample tick
+#define BLDC_PUBLIC_CAPTURE_SPEED_CNT               5 // 5 * 1 = 5ms PID control time
+#define BLDC_PID_REFERENCE_MS                       20 // PID parameters were tuned at 20ms control time
+#define BLDC_PID_TIME_SCALE                         (1000.0 * BLDC_PUBLIC_CAPTURE_SPEED_CNT / BLDC_PUBLIC_PRO_TIMES / BLDC_PID_REFERENCE_MS)
 
 #define BLDC_OUTBREAK_RPM_ERROR_TRIGGER             0.3 
-#define BLDC_OUTBREAK_KEEP_MAX_CNT                  50 
-#define BLDC_OUTBREAK_CLOSE_SUM_CNT                 200                  
+#define BLDC_OUTBREAK_KEEP_MAX_CNT                  ((uint32_t)(50 / BLDC_PID_TIME_SCALE))
+#define BLDC_OUTBREAK_CLOSE_SUM_CNT                 ((uint32_t)(200 / BLDC_PID_TIME_SCALE))
+
+// Control law runs in Q16 duty (65536 = 100%), rpm as integer
+#define BLDC_Q16_ONE                                (1L << 16)
+#define BLDC_TO_Q16(x)                              ((int32_t)((x) * BLDC_Q16_ONE + 0.5))
+#define BLDC_MAX_DUTY_Q16                           BLDC_TO_Q16(MAX_DUTY_CYCLE)
+#define BLDC_MIN_DUTY_Q16                           BLDC_TO_Q16(MIN_DUTY_CYCLE)
+#define BLDC_PID_MAX_CHANGE_Q16                     BLDC_TO_Q16(PID_CTRL_MAX_CHANGE_POWER * BLDC_PID_TIME_SCALE)
+#define BLDC_OUTBREAK_RPM_ERROR_TRIGGER_Q16         BLDC_TO_Q16(BLDC_OUTBREAK_RPM_ERROR_TRIGGER)
+#define BLDC_MOTOR_STALL_SCALE_LIMIT_Q16            BLDC_TO_Q16(BLDC_MOTOR_STALL_SCALE_LIMIT)
+// back EMF duty per rpm, (KE / V) in Q32
+#define BLDC_KE_DUTY_PER_RPM_Q32                    ((uint32_t)(USE_PID_CTRL_KE_LIMIT / BLDC_MOTOR_WORKING_VOLTAGE * 4294967296.0 + 0.5))
+#define BLDC_KE_DOWN_DUTY_PER_RPM_Q32               ((uint32_t)(USE_PID_CTRL_KE_LIMIT * 0.4 / BLDC_MOTOR_WORKING_VOLTAGE * 4294967296.0 + 0.5))
+#define BLDC_WORK_SV_DUTY_Q16                       BLDC_TO_Q16(BLDC_MOTOR_RESISTANCE * BLDC_MOTOR_WORK_MAX_CURRENT / BLDC_MOTOR_WORKING_VOLTAGE)
+#define BLDC_BREAK_SV_DUTY_Q16                      BLDC_TO_Q16(BLDC_MOTOR_RESISTANCE * BLDC_MOTOR_BREAK_MAX_CURRENT / BLDC_MOTOR_WORKING_VOLTAGE)
+#define BLDC_CUSTOM_OUTPUT_FAST_Q16                 BLDC_TO_Q16(0.01 * BLDC_PID_TIME_SCALE)
+#define BLDC_CUSTOM_OUTPUT_SLOW_Q16                 BLDC_TO_Q16(0.001 * BLDC_PID_TIME_SCALE)
 
 #define BLDC_PUBLIC_TIMER_PRESCALER                 7200
-#define BLDC_PUBLIC_STALLING_MAX_CNT                25 // 25 * PID control time = 25 * 20 = 500ms  Blocked turn determination time
-#define BLDC_PUBLIC_STALLING_RPM_MAX_CNT            40 
+#define BLDC_PUBLIC_STALLING_MAX_CNT                (250 * BLDC_PUBLIC_PRO_TIMES / 1000) // 250ms without hall edge, blocked turn determination time
+#define BLDC_PUBLIC_STALLING_RPM_MAX_CNT            (800 * BLDC_PUBLIC_PRO_TIMES / 1000 / BLDC_PUBLIC_CAPTURE_SPEED_CNT) // 800ms under block speed
 #define BLDC_PUBLIC_TIMER_PREEMPTIONPRIORITY        2
 #define BLDC_PUBLIC_TIMER_SUBPRIORITY               0
 #define BLDC_PUBLIC_TIMER_PERIOD                    ((uint16_t)(SystemCoreClock/BLDC_PUBLIC_TIMER_PRESCALER/BLDC_PUBLIC_PRO_TIMES))
 
+// Free running 1us counter, hall edges are time stamped with it
+#define BLDC_HALL_CAPTURE_TIMx                      TIM3
+#define BLDC_HALL_CAPTURE_PRESCALER                 72
+// Hall period is 16 bit, drop the window before the counter can wrap
+#define BLDC_HALL_CAPTURE_TIMEOUT_CNT               (40 * BLDC_PUBLIC_PRO_TIMES / 1000) // 40ms
+#define BLDC_HALL_EDGES_PER_POLE_PAIR               6
+
+// Sine drive, rotor angle is 16 bit (65536 = 360 electrical degree)
+#define BLDC_DEG_TO_ANGLE(d)                        ((uint16_t)((d) * 65536UL / 360))
+#define BLDC_ANGLE_60_DEG_Q8                        ((uint32_t)BLDC_DEG_TO_ANGLE(60) << 8)
+#define BLDC_SINE_UPDATE_DIV                        2  // TIM1 update every 2 PWM periods
+#define BLDC_SINE_TICK_US                           (1000000 * BLDC_SINE_UPDATE_DIV / BLDC_TIM_PWM_FREQ)
+// output lags the rotor: the hall edge is half a tick old when it is seen, and the preloaded
+// compare takes the angle at the next update and holds it for one more tick
+#define BLDC_SINE_LEAD_TICKS                        2
+#define BLDC_SINE_DEAD_TIME                         72 // 1us, both switches of a leg are driven in sine mode
+#define BLDC_SINE_AMP_SCALE_Q16                     37837 // 1/sqrt(3), full duty with min-max injection
+#define BLDC_SINE_TIMER_PREEMPTIONPRIORITY          1
+#define BLDC_SINE_TIMER_SUBPRIORITY                 0
+#define BLDC_SINE_CCER_ALL                          (TIM_CCER_CC1E | TIM_CCER_CC1NE | TIM_CCER_CC2E | \
+                                                     TIM_CCER_CC2NE | TIM_CCER_CC3E | TIM_CCER_CC3NE)
+
 #define BLDC_MOTOR_SWJ_REMAP_TYPE                   GPIO_Remap_SWJ_JTAGDisable
 
 #define ADC_CHANNEL_NUM                             5 
@@ -82,11 +122,22 @@
 #define V_ADC                                       PA3 , BLDC_ADC_TIM, BLDC_ADC_PERIOD_US
 #define M_ADC                                       PA0 , BLDC_ADC_TIM, BLDC_ADC_PERIOD_US
 #define P_ADC                                       PA1 , BLDC_ADC_TIM, BLDC_ADC_PERIOD_US
-#define I_ADC                                       PA4 , BLDC_ADC_TIM, BLDC_ADC_PERIOD_US
+#define I_ADC_PIN                                   PA4
+#define I_ADC                                       I_ADC_PIN , BLDC_ADC_TIM, BLDC_ADC_PERIOD_US
+// Injected current sample point in the PWM period, CC4 has no output (PA11 is CAN RX)
+#define BLDC_CURRENT_SAMPLE_POINT                   (BLDC_TIM_PERIOD / 2)
 
 uint32_t BldcMotor::pre_step_ = 0;
 BldcMotor* BldcMotor::p_blcd_motor_dev_ = NULL;
-float BldcMotor::speed_power_ = 0;
+volatile int32_t BldcMotor::speed_power_ = 0;
+uint16_t BldcMotor::pwm_period_ = 0;
+volatile uint16_t BldcMotor::pwm_compare_ = 0;
+BLDC_DRIVE_MODE BldcMotor::drive_mode_ = BLDC_DRIVE_SIX_STEP;
+volatile BLDC_SINE_STATE BldcMotor::sine_state_ = SINE_STATE_OFF;
+volatile uint16_t BldcMotor::sine_sector_angle_ = 0;
+volatile uint32_t BldcMotor::sine_step_ = 0;
+volatile uint8_t BldcMotor::sine_edge_seq_ = 0;
+volatile uint16_t BldcMotor::sine_amplitude_ = 0;
 float BldcMotor::motor_rpm_ = 0;
 MOTOR_BLOCK_STATE BldcMotor::motor_block_ = MOTOR_BLOCK_NORMAL;
 
@@ -104,6 +155,69 @@ volatile uint32_t self_test_send_flag = 0;
 
 uint8_t hall_check_order[CHECK_HALL_CNT] =  {2, 3, 1, 5, 4, 6};
 
+#define COMM_STEP_1   {TIM_CCER_CC3E | TIM_CCER_CC1NE, 2, 0} // C+ A-
+#define COMM_STEP_2   {TIM_CCER_CC1E | TIM_CCER_CC2NE, 0, 1} // A+ B-
+#define COMM_STEP_3   {TIM_CCER_CC3E | TIM_CCER_CC2NE, 2, 1} // C+ B-
+#define COMM_STEP_4   {TIM_CCER_CC2E | TIM_CCER_CC3NE, 1, 2} // B+ C-
+#define COMM_STEP_5   {TIM_CCER_CC2E | TIM_CCER_CC1NE, 1, 0} // B+ A-
+#define COMM_STEP_6   {TIM_CCER_CC1E | TIM_CCER_CC3NE, 0, 2} // A+ C-
+#define COMM_STEP_OFF {0, 0, 0}
+
+// [direction][hall state], CW runs the six steps mirrored (7 - hall)
+static const BLDC_COMMUTATION bldc_commutation_lut[2][8] = {
+  {COMM_STEP_OFF, COMM_STEP_6, COMM_STEP_5, COMM_STEP_4, COMM_STEP_3, COMM_STEP_2, COMM_STEP_1, COMM_STEP_OFF},
+  {COMM_STEP_OFF, COMM_STEP_1, COMM_STEP_2, COMM_STEP_3, COMM_STEP_4, COMM_STEP_5, COMM_STEP_6, COMM_STEP_OFF},
+};
+
+// hall self test index -> commutation step, the CCW run step of the hall sector the rotor
+// sits in, so it pulls the rotor into the next sector of hall_check_order
+static const uint8_t hall_self_test_step[CHECK_HALL_CNT] = {2, 3, 1, 5, 4, 6};
+
+// [direction][hall state] rotor angle at the entry of the hall sector. The sine vector sweeps the
+// 60 degree sector centered on the six step vector, CW forward and CCW backward
+static const uint16_t bldc_sine_sector_angle[2][8] = {
+  {0, BLDC_DEG_TO_ANGLE(0), BLDC_DEG_TO_ANGLE(120), BLDC_DEG_TO_ANGLE(60),
+   BLDC_DEG_TO_ANGLE(240), BLDC_DEG_TO_ANGLE(300), BLDC_DEG_TO_ANGLE(180), 0},
+  {0, BLDC_DEG_TO_ANGLE(240), BLDC_DEG_TO_ANGLE(0), BLDC_DEG_TO_ANGLE(300),
+   BLDC_DEG_TO_ANGLE(120), BLDC_DEG_TO_ANGLE(180), BLDC_DEG_TO_ANGLE(60), 0},
+};
+
+// sin() of one period, Q15
+static const int16_t bldc_sine_table[256] = {
+       0,    804,   1608,   2410,   3212,   4011,   4808,   5602,
+    6393,   7179,   7962,   8739,   9512,  10278,  11039,  11793,
+   12539,  13279,  14010,  14732,  15446,  16151,  16846,  17530,
+   18204,  18868,  19519,  20159,  20787,  21403,  22005,  22594,
+   23170,  23731,  24279,  24811,  25329,  25832,  26319,  26790,
+   27245,  27683,  28105,  28510,  28898,  29268,  29621,  29956,
+   30273,  30571,  30852,  31113,  31356,  31580,  31785,  31971,
+   32137,  32285,  32412,  32521,  32609,  32678,  32728,  32757,
+   32767,  32757,  32728,  32678,  32609,  32521,  32412,  32285,
+   32137,  31971,  31785,  31580,  31356,  31113,  30852,  30571,
+   30273,  29956,  29621,  29268,  28898,  28510,  28105,  27683,
+   27245,  26790,  26319,  25832,  25329,  24811,  24279,  23731,
+   23170,  22594,  22005,  21403,  20787,  20159,  19519,  18868,
+   18204,  17530,  16846,  16151,  15446,  14732,  14010,  13279,
+   12539,  11793,  11039,  10278,   9512,   8739,   7962,   7179,
+    6393,   5602,   4808,   4011,   3212,   2410,   1608,    804,
+       0,   -804,  -1608,  -2410,  -3212,  -4011,  -4808,  -5602,
+   -6393,  -7179,  -7962,  -8739,  -9512, -10278, -11039, -11793,
+  -12539, -13279, -14010, -14732, -15446, -16151, -16846, -17530,
+  -18204, -18868, -19519, -20159, -20787, -21403, -22005, -22594,
+  -23170, -23731, -24279, -24811, -25329, -25832, -26319, -26790,
+  -27245, -27683, -28105, -28510, -28898, -29268, -29621, -29956,
+  -30273, -30571, -30852, -31113, -31356, -31580, -31785, -31971,
+  -32137, -32285, -32412, -32521, -32609, -32678, -32728, -32757,
+  -32767, -32757, -32728, -32678, -32609, -32521, -32412, -32285,
+  -32137, -31971, -31785, -31580, -31356, -31113, -30852, -30571,
+  -30273, -29956, -29621, -29268, -28898, -28510, -28105, -27683,
+  -27245, -26790, -26319, -25832, -25329, -24811, -24279, -23731,
+  -23170, -22594, -22005, -21403, -20787, -20159, -19519, -18868,
+  -18204, -17530, -16846, -16151, -15446, -14732, -14010, -13279,
+  -12539, -11793, -11039, -10278,  -9512,  -8739,  -7962,  -7179,
+   -6393,  -5602,  -4808,  -4011,  -3212,  -2410,  -1608,   -804,
+};
+
 BldcMotor::BldcMotor(){
   bldc_.motor_state = STOP;
   bldc_.motor_speed = 0;
@@ -117,6 +231,13 @@ BldcMotor::BldcMotor(){
   break_close_sum_ = 0;
   break_keep_cnt_ = BLDC_OUTBREAK_KEEP_MAX_CNT;
   break_enable_ = false;
+  hall_rpm_factor_ = 0;
+  BldcResetHallPeriod();
+  telemetry_head_ = 0;
+  telemetry_tail_ = 0;
+  telemetry_drop_ = 0;
+  telemetry_period_ = 0;
+  telemetry_tick_ = 0;
 }
 
 void BldcMotor::BldcTim1GpioConfig(ADVANCED_TIMER1_MAP type) {
@@ -213,14 +334,133 @@ void BldcMotor::BldcTim1SetConfig(void) {
     TIM_OC2PreloadConfig(TIM1,TIM_OCPreload_Enable);
     TIM_OC3PreloadConfig(TIM1,TIM_OCPreload_Enable);
     TIM_ARRPreloadConfig(TIM1, ENABLE);
+    TIM_CCPreloadControl(TIM1, ENABLE);
+    pwm_period_ = BLDC_TIM_PERIOD;
     TIM_Cmd(TIM1, ENABLE);
     TIM_CtrlPWMOutputs(BLDC_TIMx, ENABLE);
-    TIM_CCxCmd(TIM1,TIM_Channel_1,TIM_CCx_Disable);
-    TIM_CCxNCmd(TIM1,TIM_Channel_1,TIM_CCxN_Disable);
-    TIM_CCxCmd(TIM1,TIM_Channel_2,TIM_CCx_Disable);
-    TIM_CCxNCmd(TIM1,TIM_Channel_2,TIM_CCxN_Disable);
-    TIM_CCxCmd(TIM1,TIM_Channel_3,TIM_CCx_Disable);
-    TIM_CCxNCmd(TIM1,TIM_Channel_3,TIM_CCxN_Disable);
+    BldcCommitOutputs(0);
+}
+
+void BldcMotor::BldcHallCaptureTimerInit(void) {
+  TIM_TimeBaseInitTypeDef  TIM_TimeBaseStructure;
+
+  RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM3, ENABLE);
+  TIM_TimeBaseStructure.TIM_Period = 0xFFFF;
+  TIM_TimeBaseStructure.TIM_Prescaler = BLDC_HALL_CAPTURE_PRESCALER - 1;
+  TIM_TimeBaseStructure.TIM_ClockDivision = TIM_CKD_DIV1;
+  TIM_TimeBaseStructure.TIM_CounterMode = TIM_CounterMode_Up;
+  TIM_TimeBaseStructure.TIM_RepetitionCounter = 0;
+  TIM_TimeBaseInit(BLDC_HALL_CAPTURE_TIMx, &TIM_TimeBaseStructure);
+  TIM_Cmd(BLDC_HALL_CAPTURE_TIMx, ENABLE);
+}
+
+void BldcMotor::BldcResetHallPeriod(void) {
+  hall_period_sum_ = 0;
+  hall_period_cnt_ = 0;
+  hall_period_index_ = 0;
+  hall_capture_valid_ = false;
+}
+
+uint8_t BldcMotor::BldcHallPeriodWindow(void) {
+  uint8_t window = bldc_.pole_pair_num * BLDC_HALL_EDGES_PER_POLE_PAIR;
+  if (window == 0 || window > BLDC_HALL_PERIOD_BUF_SIZE)
+    window = BLDC_HALL_PERIOD_BUF_SIZE;
+  return window;
+}
+
+// Called on every hall state change, keeps a running sum of the last mechanical revolution
+void BldcMotor::BldcCaptureHallPeriod(void) {
+  uint16_t now = BLDC_HALL_CAPTURE_TIMx->CNT;
+  if (hall_capture_valid_) {
+    uint8_t window = BldcHallPeriodWindow();
+    uint16_t period = now - hall_last_capture_;
+    if (hall_period_index_ >= window)
+      hall_period_index_ = 0;
+    if (hall_period_cnt_ < window)
+      hall_period_cnt_++;
+    else
+      hall_period_sum_ -= hall_period_buf_[hall_period_index_];
+    hall_period_buf_[hall_period_index_] = period;
+    hall_period_sum_ += period;
+    hall_period_index_++;
+  }
+  hall_last_capture_ = now;
+  hall_capture_valid_ = true;
+}
+
+uint32_t BldcMotor::BldcHallPeriodRpm(void) {
+  uint32_t sum, cnt;
+  nvic_globalirq_disable();
+  if (bldc_.stalling_count > BLDC_HALL_CAPTURE_TIMEOUT_CNT)
+    BldcResetHallPeriod();
+  sum = hall_period_sum_;
+  cnt = hall_period_cnt_;
+  nvic_globalirq_enable();
+
+  if (cnt == 0 || sum == 0)
+    return 0;
+  return hall_rpm_factor_ * cnt / sum;
+}
+
+// Runs in the public timer, a full ring drops the new sample so the reader sees a gap, not a skew
+void BldcMotor::BldcTelemetrySample(void) {
+  uint32_t sum, cnt;
+  uint8_t next;
+  BLDC_TELEMETRY_SAMPLE *sample;
+
+  if (++telemetry_tick_ < telemetry_period_)
+    return;
+  telemetry_tick_ = 0;
+
+  next = (telemetry_head_ + 1) % BLDC_TELEMETRY_BUF_SIZE;
+  if (next == telemetry_tail_) {
+    telemetry_drop_++;
+    return;
+  }
+
+  nvic_globalirq_disable();
+  sum = hall_period_sum_;
+  cnt = hall_period_cnt_;
+  nvic_globalirq_enable();
+
+  sample = &telemetry_buf_[telemetry_head_];
+  if (cnt == 0 || sum == 0 || bldc_.stalling_count > BLDC_HALL_CAPTURE_TIMEOUT_CNT) {
+    sample->rpm = 0;
+    sample->hall_period = 0;
+  } else {
+    uint32_t rpm = hall_rpm_factor_ * cnt / sum;
+    sample->rpm = rpm > 0xFFFF ? 0xFFFF : rpm;
+    sample->hall_period = sum / cnt;
+  }
+  sample->duty = ((uint32_t)speed_power_ * 10000) >> 16;
+  sample->current_adc = BldcGetMultiChannelAdc(I_ADC_CHANNEL, 0);
+  telemetry_head_ = next;
+}
+
+void BldcMotor::BldcTelemetrySetPeriod(uint8_t period_ms) {
+  nvic_globalirq_disable();
+  telemetry_period_ = period_ms;
+  telemetry_tick_ = 0;
+  telemetry_tail_ = telemetry_head_;
+  telemetry_drop_ = 0;
+  nvic_globalirq_enable();
+}
+
+uint8_t BldcMotor::BldcTelemetryGetPeriod(void) {
+  return telemetry_period_;
+}
+
+bool BldcMotor::BldcTelemetryRead(BLDC_TELEMETRY_SAMPLE *sample) {
+  uint8_t tail = telemetry_tail_;
+  if (tail == telemetry_head_)
+    return false;
+  *sample = telemetry_buf_[tail];
+  telemetry_tail_ = (tail + 1) % BLDC_TELEMETRY_BUF_SIZE;
+  return true;
+}
+
+uint32_t BldcMotor::BldcTelemetryDropCount(void) {
+  return telemetry_drop_;
 }
 
 void BldcMotor::BldcMosEnableGpioInit(void) {
@@ -298,26 +538,37 @@ bool BldcMotor::BldcSetMotorDirection(MOTOR_DIR dir){
 }
 
 float BldcMotor::BldcGetMotorRpm(void) {
-  return bldc_.motor_speed;
+  return (float)bldc_.motor_speed;
 }
 
 void BldcMotor::BldcSetMotorSpeedPower(float new_power) {
   if (!CheckInit())
     return;
-  if (speed_power_ < MIN_DUTY_CYCLE)
-    speed_power_ = MIN_DUTY_CYCLE;
-  else if (speed_power_ >= MAX_DUTY_CYCLE)
-    speed_power_ = MAX_DUTY_CYCLE;
+  if (speed_power_ < BLDC_MIN_DUTY_Q16)
+    BldcUpdateSpeedPower(BLDC_MIN_DUTY_Q16);
+  else if (speed_power_ >= BLDC_MAX_DUTY_Q16)
+    BldcUpdateSpeedPower(BLDC_MAX_DUTY_Q16);
   else
-    speed_power_ = new_power;
+    BldcUpdateSpeedPower(BLDC_TO_Q16(new_power));
+}
+
+void BldcMotor::BldcUpdateSpeedPower(int32_t power) {
+  speed_power_ = power;
+  pwm_compare_ = (uint16_t)(((uint32_t)power * pwm_period_) >> 16);
+  sine_amplitude_ = (uint16_t)(((uint32_t)pwm_compare_ * BLDC_SINE_AMP_SCALE_Q16) >> 16);
 }
 
 float BldcMotor::BldcGetMotorSpeedPower(void) {
-  return speed_power_;
+  return (float)speed_power_ / BLDC_Q16_ONE;
 }
 
 void BldcMotor::BldcSetMotorPolePairNum(uint8_t num) {
+  nvic_globalirq_disable();
   bldc_.pole_pair_num = num;
+  // 60s * 1000000us / edges per revolution, rpm = factor * edges / period sum
+  hall_rpm_factor_ = num ? 60000000UL / (num * BLDC_HALL_EDGES_PER_POLE_PAIR) : 0;
+  BldcResetHallPeriod();
+  nvic_globalirq_enable();
 }
 
 bool BldcMotor::BldcControlMotorRunProcess(MOTOR_STATE ctr) {
@@ -327,15 +578,10 @@ bool BldcMotor::BldcControlMotorRunProcess(MOTOR_STATE ctr) {
   switch (ctr) {
     case STOP:
       if(bldc_.motor_state == RUN) {
-        speed_power_ = 0;
+        BldcUpdateSpeedPower(0);
         BldcSetMosEnableState(false);
         BldcSetMotorFanEnableState(false);
-        TIM_CCxCmd(BLDC_TIMx,TIM_Channel_1,TIM_CCx_Disable);
-        TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_1,TIM_CCxN_Disable);
-        TIM_CCxCmd(BLDC_TIMx,TIM_Channel_2,TIM_CCx_Disable);
-        TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_2,TIM_CCxN_Disable);
-        TIM_CCxCmd(BLDC_TIMx,TIM_Channel_3,TIM_CCx_Disable);
-        TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_3,TIM_CCxN_Disable);
+        BldcCommitOutputs(0);
         bldc_.motor_state = STOPING; 
       }
       break;
@@ -344,6 +590,7 @@ bool BldcMotor::BldcControlMotorRunProcess(MOTOR_STATE ctr) {
       if(bldc_.motor_state != RUN){
         bldc_.stalling_count = 0;
         bldc_.step_counter = 0;
+        BldcResetHallPeriod();
         bldc_pid_parm_.LastError = 0;
         bldc_pid_parm_.PrevError = 0;
         bldc_pid_parm_.TargetRpmDown = false;
@@ -353,9 +600,10 @@ bool BldcMotor::BldcControlMotorRunProcess(MOTOR_STATE ctr) {
         break_close_sum_ = 0;
         break_keep_cnt_ = BLDC_OUTBREAK_KEEP_MAX_CNT;
         BldcSetMotorBlockState(MOTOR_BLOCK_NORMAL);
+        sine_state_ = SINE_STATE_OFF;
         BldcSetMosEnableState(true);
         BldcSetMotorFanEnableState(true);
-        speed_power_ = MIN_DUTY_CYCLE;    
+        BldcUpdateSpeedPower(BLDC_MIN_DUTY_Q16);    
         EXTI_ClearITPendingBit(HALL_U_EXITLINE|HALL_V_EXITLINE|HALL_W_EXITLINE|HARD_FAULT_EXITLINE);    
         NVIC_EnableIRQ(HALL_EXTI_IRQn_U);
         NVIC_EnableIRQ(HALL_EXTI_IRQn_V);
@@ -373,17 +621,21 @@ bool BldcMotor::BldcControlMotorRunProcess(MOTOR_STATE ctr) {
 }
 
 void BldcMotor::BldcSetMotorTargetRpm(float rpm) {
+  int32_t set_point;
   if (rpm < MOTOR_MIN_SPEED) {
-    rpm = MOTOR_MIN_SPEED;
+    set_point = MOTOR_MIN_SPEED;
   }
   else if (rpm > MOTOR_RATED_SPEED) {
-    rpm = MOTOR_RATED_SPEED;
+    set_point = MOTOR_RATED_SPEED;
+  }
+  else {
+    set_point = (int32_t)rpm;
   }
-  if (bldc_pid_parm_.SetPoint > rpm) 
+  if (bldc_pid_parm_.SetPoint > set_point) 
     bldc_pid_parm_.TargetRpmDown = true;
   else 
     bldc_pid_parm_.TargetRpmDown = false;
-  bldc_pid_parm_.SetPoint = rpm;
+  bldc_pid_parm_.SetPoint = set_point;
 }
 
 bool BldcMotor::BldcGetMotorPidControl(void) {
@@ -407,169 +659,189 @@ void BldcMotor::BldcSetMotorBlockState(MOTOR_BLOCK_STATE state) {
   motor_block_ = state;
 }
 
-void BldcMotor::BldcPhaseChange(unsigned int step) {
+void BldcMotor::BldcCommitOutputs(uint16_t ccer) {
+  // CCxE/CCxNE are preloaded (CCPC), the COM event latches all six outputs at once
+  BLDC_TIMx->CCER = ccer;
+  BLDC_TIMx->EGR = TIM_EGR_COMG;
+}
+
+void BldcMotor::BldcApplyCommutation(const BLDC_COMMUTATION *comm, uint16_t compare) {
+  volatile uint16_t *ccr = &BLDC_TIMx->CCR1;
+  if (comm->ccer) {
+    ccr[comm->pwm_ch << 1] = compare;
+    ccr[comm->low_ch << 1] = pwm_period_;
+  }
+  BldcCommitOutputs(comm->ccer);
+}
+
+void BldcMotor::BldcPhaseChange(unsigned int hall) {
   if (!p_blcd_motor_dev_ || bldc_self_test_step)
     return;
 
-  switch(step) {
-    case 4: //B+ C-
-      /* Next step: Step 2 Configuration -------------------------------------- */ 
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_1,TIM_CCx_Disable);
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_1,TIM_CCxN_Disable);
-      
-      /*  Channel1 configuration */
-      /*  Channel2 configuration */ 
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_2,TIM_CCxN_Disable);   
-      TIM_SetCompare2(BLDC_TIMx,BLDC_TIM_PERIOD*speed_power_);
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_2,TIM_CCx_Enable);
-
-      /*  Channel3 configuration */
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_3,TIM_CCx_Disable);
-      TIM_SetCompare3(BLDC_TIMx,BLDC_TIM_PERIOD);
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_3,TIM_CCxN_Enable);
-      break;
-
-    case 5: //B+ A-
-      /* Next step: Step 3 Configuration -------------------------------------- */      
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_3,TIM_CCx_Disable);
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_3,TIM_CCxN_Disable);
-      
-      /*  Channel1 configuration */
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_1,TIM_CCx_Disable);
-      TIM_SetCompare1(BLDC_TIMx,BLDC_TIM_PERIOD);
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_1,TIM_CCxN_Enable);
-    
-      /*  Channel2 configuration */
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_2,TIM_CCxN_Disable);
-      TIM_SetCompare2(BLDC_TIMx,BLDC_TIM_PERIOD*speed_power_);
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_2,TIM_CCx_Enable);
-      /*  Channel3 configuration */
-      break;
+  uint8_t dir = p_blcd_motor_dev_->bldc_.motor_direction;
+  hall &= 0x7;
+  if (drive_mode_ == BLDC_DRIVE_SINE) {
+    uint32_t sum = p_blcd_motor_dev_->hall_period_sum_;
+    // sine needs one revolution of hall periods, six step until then
+    if (hall != 0 && hall != 7 && sum >= p_blcd_motor_dev_->hall_period_cnt_ && \
+        p_blcd_motor_dev_->hall_period_cnt_ >= p_blcd_motor_dev_->BldcHallPeriodWindow()) {
+      sine_sector_angle_ = bldc_sine_sector_angle[dir][hall];
+      // 60 degree per average hall period
+      sine_step_ = BLDC_ANGLE_60_DEG_Q8 * BLDC_SINE_TICK_US / (sum / p_blcd_motor_dev_->hall_period_cnt_);
+      sine_edge_seq_++;
+      if (sine_state_ == SINE_STATE_OFF)
+        sine_state_ = SINE_STATE_LOAD;
+    }
+    else {
+      sine_state_ = SINE_STATE_OFF;
+    }
+    if (sine_state_ == SINE_STATE_RUN)
+      return;
+  }
+  BldcApplyCommutation(&bldc_commutation_lut[dir][hall], pwm_compare_);
+}
 
-    case 1: //C+ A-
-      /* Next step: Step 4 Configuration -------------------------------------- */
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_2,TIM_CCx_Disable);
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_2,TIM_CCxN_Disable);
-    
-      /*  Channel1 configuration */
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_1,TIM_CCx_Disable);
-      TIM_SetCompare1(BLDC_TIMx,BLDC_TIM_PERIOD);
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_1,TIM_CCxN_Enable);
-      
-      /*  Channel2 configuration */ 
-      /*  Channel3 configuration */
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_3,TIM_CCxN_Disable);
-      TIM_SetCompare3(BLDC_TIMx,BLDC_TIM_PERIOD*speed_power_);
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_3,TIM_CCx_Enable);
-      break;
+void BldcMotor::BldcSineOutput(uint16_t angle) {
+  volatile uint16_t *ccr = &BLDC_TIMx->CCR1;
+  uint8_t index = (angle >> 8) + 64; // cos
+  int32_t amp = sine_amplitude_;
+  int32_t v[3];
+  v[0] = (amp * bldc_sine_table[index]) >> 15;
+  v[1] = (amp * bldc_sine_table[(uint8_t)(index - 85)]) >> 15; // -120 degree
+  v[2] = (amp * bldc_sine_table[(uint8_t)(index + 85)]) >> 15; // +120 degree
+
+  // min-max zero sequence injection, same line voltages as SVPWM
+  int32_t v_max = v[0], v_min = v[0];
+  for (int i = 1; i < 3; i++) {
+    if (v[i] > v_max)
+      v_max = v[i];
+    else if (v[i] < v_min)
+      v_min = v[i];
+  }
+  int32_t offset = (pwm_period_ >> 1) - ((v_max + v_min) >> 1);
+  for (int i = 0; i < 3; i++) {
+    int32_t duty = v[i] + offset;
+    if (duty < 0)
+      duty = 0;
+    else if (duty > pwm_period_)
+      duty = pwm_period_;
+    ccr[i << 1] = duty;
+  }
+}
 
-    case 3: //C+ B-
-      /* Next step: Step 5 Configuration -------------------------------------- */
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_1,TIM_CCx_Disable);
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_1,TIM_CCxN_Disable);    
-    
-      /*  Channel1 configuration */      
-      /*  Channel2 configuration */   
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_2,TIM_CCx_Disable);
-      TIM_SetCompare2(BLDC_TIMx,BLDC_TIM_PERIOD);
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_2,TIM_CCxN_Enable);
-    
-      /*  Channel3 configuration */    
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_3,TIM_CCxN_Disable);  
-      TIM_SetCompare3(BLDC_TIMx,BLDC_TIM_PERIOD*speed_power_);
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_3,TIM_CCx_Enable);
-      break;
+void BldcMotor::BldcSineTimerCallBack(void) {
+  static uint8_t edge_seq = 0;
+  static uint32_t advance = 0;
+  if (!p_blcd_motor_dev_ || sine_state_ == SINE_STATE_OFF)
+    return;
+  if (p_blcd_motor_dev_->bldc_.motor_state != RUN) {
+    sine_state_ = SINE_STATE_OFF;
+    return;
+  }
 
-    case 2: //A+ B-
-      /* Next step: Step 6 Configuration -------------------------------------- */
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_3,TIM_CCx_Disable);
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_3,TIM_CCxN_Disable);
-      
-      /*  Channel1 configuration */
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_1,TIM_CCxN_Disable);
-      TIM_SetCompare1(BLDC_TIMx,BLDC_TIM_PERIOD*speed_power_);
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_1,TIM_CCx_Enable);
-
-      /*  Channel2 configuration */
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_2,TIM_CCx_Disable);
-      TIM_SetCompare2(BLDC_TIMx,BLDC_TIM_PERIOD);
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_2,TIM_CCxN_Enable);
-      /*  Channel3 configuration */
-      break;
-      
-    case 6: //A+ C-
-      /* Next step: Step 1 Configuration -------------------------------------- */
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_2,TIM_CCx_Disable);
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_2,TIM_CCxN_Disable);
-      
-      /*  Channel1 configuration */
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_1,TIM_CCxN_Disable);
-      TIM_SetCompare1(BLDC_TIMx,BLDC_TIM_PERIOD*speed_power_);
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_1,TIM_CCx_Enable);
-      /*  Channel2 configuration */      
-      /*  Channel3 configuration */
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_3,TIM_CCx_Disable);
-      TIM_SetCompare3(BLDC_TIMx,BLDC_TIM_PERIOD);
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_3,TIM_CCxN_Enable);
-      break;
+  // interpolate the rotor angle inside the hall sector, never run past the next edge
+  if (edge_seq != sine_edge_seq_) {
+    edge_seq = sine_edge_seq_;
+    advance = 0;
+  }
+  else if (advance < BLDC_ANGLE_60_DEG_Q8) {
+    advance += sine_step_;
+    if (advance > BLDC_ANGLE_60_DEG_Q8)
+      advance = BLDC_ANGLE_60_DEG_Q8;
+  }
+  uint16_t angle = sine_sector_angle_;
+  uint32_t lead = advance + sine_step_ * BLDC_SINE_LEAD_TICKS;
+  if (p_blcd_motor_dev_->bldc_.motor_direction == CW)
+    angle += lead >> 8;
+  else
+    angle -= lead >> 8;
+  BldcSineOutput(angle);
 
-    default:
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_1,TIM_CCx_Disable);
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_1,TIM_CCxN_Disable);
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_2,TIM_CCx_Disable);
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_2,TIM_CCxN_Disable);
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_3,TIM_CCx_Disable);
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_3,TIM_CCxN_Disable);
-      break;
+  // compare preload needs one update before all six outputs switch over
+  if (sine_state_ == SINE_STATE_LOAD) {
+    sine_state_ = SINE_STATE_COMMIT;
   }
+  else if (sine_state_ == SINE_STATE_COMMIT) {
+    nvic_globalirq_disable();
+    if (sine_state_ == SINE_STATE_COMMIT) {
+      BldcCommitOutputs(BLDC_SINE_CCER_ALL);
+      sine_state_ = SINE_STATE_RUN;
+    }
+    nvic_globalirq_enable();
+  }
+}
+
+BLDC_DRIVE_MODE BldcMotor::BldcGetMotorDriveMode(void) {
+  return drive_mode_;
 }
 
+bool BldcMotor::BldcSetMotorDriveMode(BLDC_DRIVE_MODE mode) {
+  if (!CheckInit() || bldc_.motor_state != STOP || mode > BLDC_DRIVE_SINE)
+    return false;
+
+  sine_state_ = SINE_STATE_OFF;
+  drive_mode_ = mode;
+  if (mode == BLDC_DRIVE_SINE) {
+    BLDC_TIMx->BDTR = (BLDC_TIMx->BDTR & ~TIM_BDTR_DTG) | BLDC_SINE_DEAD_TIME;
+    BLDC_TIMx->RCR = BLDC_SINE_UPDATE_DIV - 1;
+    HAL_timer_cb_init(1, BldcSineTimerCallBack);
+    HAL_timer_nvic_init(1, BLDC_SINE_TIMER_PREEMPTIONPRIORITY, BLDC_SINE_TIMER_SUBPRIORITY);
+  }
+  else {
+    TIM_ITConfig(BLDC_TIMx, TIM_IT_Update, DISABLE);
+    HAL_timer_cb_init(1, NULL);
+    BLDC_TIMx->RCR = BLDC_TIM_REPETITIONCOUNTER;
+    BLDC_TIMx->BDTR = (BLDC_TIMx->BDTR & ~TIM_BDTR_DTG) | BLDC_TIM_DEAD_TIME;
+  }
+  return true;
+}
 
 void BldcMotor::BldcPublicTimerCallBack(void) {
   static unsigned int time_count = 0;
-  float pid_result = 0;
+  int32_t pid_result = 0;
+  if (p_blcd_motor_dev_ && p_blcd_motor_dev_->telemetry_period_)
+    p_blcd_motor_dev_->BldcTelemetrySample();
   if (p_blcd_motor_dev_ && bldc_self_test_step == SELF_TEST_IDLE) {
     if (p_blcd_motor_dev_->bldc_.motor_state != STOP) {
       time_count++;
       if (time_count >= BLDC_PUBLIC_CAPTURE_SPEED_CNT) { 
         //  (1000 / BLDC_PUBLIC_PRO_TIMES * BLDC_PUBLIC_CAPTURE_SPEED_CNT) MS
-        float seep_rpm_tmp = ((p_blcd_motor_dev_->bldc_.step_counter *  BLDC_PUBLIC_PRO_TIMES * 10) \
-           / (p_blcd_motor_dev_->bldc_.pole_pair_num * BLDC_PUBLIC_CAPTURE_SPEED_CNT));
+        int32_t seep_rpm_tmp = p_blcd_motor_dev_->BldcHallPeriodRpm();
         p_blcd_motor_dev_->bldc_.motor_speed = seep_rpm_tmp;
         
         if (p_blcd_motor_dev_->bldc_.motor_state == RUN) {
           if (p_blcd_motor_dev_->BldcGetMotorPidControl()) {
-            float tmp_speed_power = speed_power_;
-            float limit_stall_speed = p_blcd_motor_dev_->bldc_pid_parm_.SetPoint * BLDC_MOTOR_STALL_SCALE_LIMIT;
-            if (seep_rpm_tmp < MOTOR_BLOCK_SPEED || seep_rpm_tmp < limit_stall_speed)
+            int32_t tmp_speed_power = speed_power_;
+            int32_t set_point = p_blcd_motor_dev_->bldc_pid_parm_.SetPoint;
+            if (seep_rpm_tmp < (int32_t)MOTOR_BLOCK_SPEED || \
+                ((int64_t)seep_rpm_tmp << 16) < set_point * BLDC_MOTOR_STALL_SCALE_LIMIT_Q16)
               p_blcd_motor_dev_-> rpm_block_cnt_++;
             else 
               p_blcd_motor_dev_-> rpm_block_cnt_ = 0;
 
             #ifdef USE_PID_CTRL_MOTOR_RPM
               pid_result = p_blcd_motor_dev_->BldcIncPIDCalc(&p_blcd_motor_dev_->bldc_pid_parm_, seep_rpm_tmp);
-              pid_result = pid_result / BLDC_TIM_PERIOD; 
-
-              if (pid_result > PID_CTRL_MAX_CHANGE_POWER) 
-                pid_result = PID_CTRL_MAX_CHANGE_POWER;
+              if (pid_result > BLDC_PID_MAX_CHANGE_Q16) 
+                pid_result = BLDC_PID_MAX_CHANGE_Q16;
             #else
-              pid_result = p_blcd_motor_dev_->BldcCalCustomOutput(seep_rpm_tmp, p_blcd_motor_dev_->bldc_pid_parm_.SetPoint);
+              pid_result = p_blcd_motor_dev_->BldcCalCustomOutput(seep_rpm_tmp, set_point);
             #endif
             if (pid_result + tmp_speed_power < 0)
               tmp_speed_power = 0;
-            else if((pid_result + tmp_speed_power) > MAX_DUTY_CYCLE)
-              tmp_speed_power = MAX_DUTY_CYCLE;
+            else if((pid_result + tmp_speed_power) > BLDC_MAX_DUTY_Q16)
+              tmp_speed_power = BLDC_MAX_DUTY_Q16;
             else
               tmp_speed_power += pid_result; 
             #ifdef USE_PID_CTRL_KE_LIMIT
-              float v_out = tmp_speed_power * BLDC_MOTOR_WORKING_VOLTAGE;
-              float v_ke = seep_rpm_tmp * USE_PID_CTRL_KE_LIMIT;
+              // voltages are compared as duty, scaled by 1 / BLDC_MOTOR_WORKING_VOLTAGE
+              int32_t v_out = tmp_speed_power;
+              int32_t v_ke = (int32_t)(((uint64_t)seep_rpm_tmp * BLDC_KE_DUTY_PER_RPM_Q32) >> 16);
               #ifdef USE_PID_BREAK_MODE_MOTOR_RPM
-              float s_v = 0;
+              int32_t s_v = 0;
               if (p_blcd_motor_dev_->break_enable_)
-                s_v = BLDC_MOTOR_RESISTANCE * BLDC_MOTOR_BREAK_MAX_CURRENT;
+                s_v = BLDC_BREAK_SV_DUTY_Q16;
               else 
-                s_v = BLDC_MOTOR_RESISTANCE * BLDC_MOTOR_WORK_MAX_CURRENT;
+                s_v = BLDC_WORK_SV_DUTY_Q16;
 
               if (v_out - v_ke > s_v) {
                 if (p_blcd_motor_dev_->bldc_pid_parm_.ErrorLimit) {
@@ -577,13 +849,13 @@ void BldcMotor::BldcPublicTimerCallBack(void) {
                     p_blcd_motor_dev_->break_enable_ = true;
                   }
                 }
-                tmp_speed_power = (s_v + v_ke) / BLDC_MOTOR_WORKING_VOLTAGE;
+                tmp_speed_power = s_v + v_ke;
               }
               #endif
               if (p_blcd_motor_dev_->bldc_pid_parm_.TargetRpmDown) {
-                v_ke = p_blcd_motor_dev_->bldc_pid_parm_.SetPoint * USE_PID_CTRL_KE_LIMIT *0.4;
+                v_ke = (int32_t)(((uint64_t)set_point * BLDC_KE_DOWN_DUTY_PER_RPM_Q32) >> 16);
                 if (v_out < v_ke)
-                  tmp_speed_power = v_ke / BLDC_MOTOR_WORKING_VOLTAGE;
+                  tmp_speed_power = v_ke;
               }
               #ifdef USE_PID_BREAK_MODE_MOTOR_RPM
               if (p_blcd_motor_dev_->break_enable_) {
@@ -605,7 +877,7 @@ void BldcMotor::BldcPublicTimerCallBack(void) {
               }
               #endif
             #endif
-            speed_power_ = tmp_speed_power;
+            BldcUpdateSpeedPower(tmp_speed_power);
           }
           else {
             p_blcd_motor_dev_-> rpm_block_cnt_ = 0;
@@ -631,12 +903,7 @@ void BldcMotor::BldcPublicTimerCallBack(void) {
         NVIC_DisableIRQ(HALL_EXTI_IRQn_U);
         NVIC_DisableIRQ(HALL_EXTI_IRQn_V);
         NVIC_DisableIRQ(HALL_EXTI_IRQn_W);
-        TIM_CCxCmd(BLDC_TIMx,TIM_Channel_1,TIM_CCx_Disable);
-        TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_1,TIM_CCxN_Disable);
-        TIM_CCxCmd(BLDC_TIMx,TIM_Channel_2,TIM_CCx_Disable);
-        TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_2,TIM_CCxN_Disable);
-        TIM_CCxCmd(BLDC_TIMx,TIM_Channel_3,TIM_CCx_Disable);
-        TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_3,TIM_CCxN_Disable);  
+        BldcCommitOutputs(0);  
         p_blcd_motor_dev_->bldc_.stalling_count = 0;   
         p_blcd_motor_dev_-> rpm_block_cnt_ = 0;
         p_blcd_motor_dev_->BldcSetMosEnableState(false); 
@@ -653,16 +920,14 @@ void BldcMotor::BldcPublicTimerCallBack(void) {
 void BldcMotor::BldcHallIrqCallBack(uint8_t line) {
   if (p_blcd_motor_dev_) {
     unsigned int uwStep = GET_HALL_STATE;
-    if (p_blcd_motor_dev_->BldcGetMotorState() == RUN) {
-      if (p_blcd_motor_dev_->BldcGetMotorDirection() == CW) {
-        uwStep = 7 - uwStep;
-      }
+    if (p_blcd_motor_dev_->bldc_.motor_state == RUN) {
       BldcPhaseChange(uwStep);
     }
 
     if (p_blcd_motor_dev_->BldcGetMotorState() != STOP) {
       if (pre_step_ != uwStep) {
         p_blcd_motor_dev_->bldc_.step_counter ++;
+        p_blcd_motor_dev_->BldcCaptureHallPeriod();
       }
       pre_step_ = uwStep;
     }
@@ -693,12 +958,7 @@ void BldcMotor::BldcHardProductIrqCallBack(uint8_t line) {
       NVIC_DisableIRQ(HALL_EXTI_IRQn_U);
       NVIC_DisableIRQ(HALL_EXTI_IRQn_V);
       NVIC_DisableIRQ(HALL_EXTI_IRQn_W);
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_1,TIM_CCx_Disable);
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_1,TIM_CCxN_Disable);
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_2,TIM_CCx_Disable);
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_2,TIM_CCxN_Disable);
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_3,TIM_CCx_Disable);
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_3,TIM_CCxN_Disable);  
+      BldcCommitOutputs(0);  
       p_blcd_motor_dev_->bldc_.stalling_count = 0;  
       p_blcd_motor_dev_->BldcSetMosEnableState(false); 
       p_blcd_motor_dev_->BldcSetMotorFanEnableState(false);       
@@ -730,6 +990,24 @@ void BldcMotor::BldcIncPIDInit(void) {
   bldc_pid_parm_.SetPoint    = 0;                        //Desired Value
   bldc_pid_parm_.TargetRpmDown = false;
   bldc_pid_parm_.ErrorLimit = false;
+  BldcIncPIDUpdateGain();
+}
+
+// Fold the PWM period and the control time scale into fixed point gains,
+// so the ISR gets Q16 duty change straight from rpm error
+void BldcMotor::BldcIncPIDUpdateGain(void) {
+  float scale = 4294967296.0 / BLDC_TIM_PERIOD;
+  bldc_pid_parm_.KpQ = BldcGainToQ(bldc_pid_parm_.Proportion * scale);
+  bldc_pid_parm_.KiQ = BldcGainToQ(bldc_pid_parm_.Integral * BLDC_PID_TIME_SCALE * scale);
+  bldc_pid_parm_.KdQ = BldcGainToQ(bldc_pid_parm_.Derivative / BLDC_PID_TIME_SCALE * scale);
+}
+
+int32_t BldcMotor::BldcGainToQ(float gain) {
+  if (gain > INT32_MAX)
+    return INT32_MAX;
+  else if (gain < INT32_MIN)
+    return INT32_MIN;
+  return (int32_t)gain;
 }
 
 void BldcMotor::BldcIncPIDSetPID(uint8_t index, float parm) {
@@ -749,6 +1027,7 @@ void BldcMotor::BldcIncPIDSetPID(uint8_t index, float parm) {
     default:
       break;
   }
+  BldcIncPIDUpdateGain();
 }
 
 float BldcMotor::BldcIncPIDGetPID(uint8_t index) {
@@ -772,15 +1051,16 @@ float BldcMotor::BldcIncPIDGetPID(uint8_t index) {
   return value;
 }
 
-float BldcMotor::BldcIncPIDCalc(PID *bldc_pid, float NextPoint) {
-  float iError, iIncpid;  
+int32_t BldcMotor::BldcIncPIDCalc(PID *bldc_pid, int32_t NextPoint) {
+  int32_t iError;
+  int64_t iIncpid;
   iError  = bldc_pid->SetPoint - NextPoint; 
 
-  if (abs(iError) <= 200) 
+  if (iError <= 200 && iError >= -200) 
     iError = 0; 
 
 
-  if ((iError  > 0 ) && (iError > BLDC_OUTBREAK_RPM_ERROR_TRIGGER * bldc_pid->SetPoint)) 
+  if ((iError  > 0 ) && ((iError << 16) > BLDC_OUTBREAK_RPM_ERROR_TRIGGER_Q16 * bldc_pid->SetPoint)) 
     bldc_pid->ErrorLimit = true;
   else
     bldc_pid->ErrorLimit = false;
@@ -789,42 +1069,58 @@ float BldcMotor::BldcIncPIDCalc(PID *bldc_pid, float NextPoint) {
   //             -(bldc_pid->Integral * bldc_pid->PrevError)     
   //             +(bldc_pid->Derivative * bldc_pid->LastError);  
 
-  iIncpid = (bldc_pid->Proportion * (iError - bldc_pid->PrevError))                   
-               +(bldc_pid->Integral * iError)     
-               +(bldc_pid->Derivative * (iError - 2*bldc_pid->PrevError + bldc_pid->LastError)); 
+  iIncpid = ((int64_t)bldc_pid->KpQ * (iError - bldc_pid->PrevError))                   
+               +((int64_t)bldc_pid->KiQ * iError)     
+               +((int64_t)bldc_pid->KdQ * (iError - 2*bldc_pid->PrevError + bldc_pid->LastError)); 
 
   bldc_pid->LastError = bldc_pid->PrevError;
   bldc_pid->PrevError = iError;   
-  return (iIncpid);                                    
+  return (int32_t)(iIncpid >> 16);                                    
 }
 
-float BldcMotor::BldcCalCustomOutput(float cur_prm, float target_prm) {
-  float output_ = 0.01;
-  float error = 0;
+int32_t BldcMotor::BldcCalCustomOutput(int32_t cur_prm, int32_t target_prm) {
+  int32_t output_ = BLDC_CUSTOM_OUTPUT_FAST_Q16;
+  int32_t error = 0;
   error = target_prm - cur_prm;
 
-  if (abs(error) <= 1000)
-    output_ = 0.001;
+  if (error <= 1000 && error >= -1000)
+    output_ = BLDC_CUSTOM_OUTPUT_SLOW_Q16;
   
-  if (abs(error) <= 150) {
+  if (error <= 150 && error >= -150) {
     error = 0;
     output_ = 0;
   }
     
   if (error < 0)
-    output_ = -1 * output_ * 0.1;
+    output_ = -output_ / 10;
   return output_;                                    
 }
 
+// High rate current capture for spectrum analysis, one injected conversion per PWM period
+bool BldcMotor::BldcCurrentSampleInit(ADC_CB_F cb) {
+  TIM_OCInitTypeDef  TIM_OCInitStructure;
+  if (!CheckInit())
+    return false;
+
+  TIM_OCStructInit(&TIM_OCInitStructure);
+  TIM_OCInitStructure.TIM_OCMode = TIM_OCMode_PWM1;
+  TIM_OCInitStructure.TIM_OutputState = TIM_OutputState_Disable;
+  TIM_OCInitStructure.TIM_Pulse = BLDC_CURRENT_SAMPLE_POINT;
+  TIM_OC4Init(TIM1, &TIM_OCInitStructure);
+  return HAL_adc_injected_init(I_ADC_PIN, ADC_ExternalTrigInjecConv_T1_CC4, cb) != ADC_ERROR;
+}
+
 bool BldcMotor::Init(void) {
   if (p_blcd_motor_dev_ == NULL) {
     p_blcd_motor_dev_ = this;
+    BldcSetMotorPolePairNum(bldc_.pole_pair_num);
     BldcIncPIDInit();
     BldcTim1GpioConfig(PARTIAL_REMAP);
     BldcTim1SetConfig();
     BldcMosEnableGpioInit();
     BldcMotorFanGpioInit();
     BldcAdcInit();
+    BldcHallCaptureTimerInit();
     BldcPublicTimerInit();
     BldcHallIrqInit();
     this->init_ok_ = true;
@@ -838,12 +1134,7 @@ void BldcMotor::BldcDisableAllIrq(void) {
   NVIC_DisableIRQ(HALL_EXTI_IRQn_U);
   NVIC_DisableIRQ(HALL_EXTI_IRQn_V);
   NVIC_DisableIRQ(HALL_EXTI_IRQn_W);
-  TIM_CCxCmd(BLDC_TIMx,TIM_Channel_1,TIM_CCx_Disable);
-  TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_1,TIM_CCxN_Disable);
-  TIM_CCxCmd(BLDC_TIMx,TIM_Channel_2,TIM_CCx_Disable);
-  TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_2,TIM_CCxN_Disable);
-  TIM_CCxCmd(BLDC_TIMx,TIM_Channel_3,TIM_CCx_Disable);
-  TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_3,TIM_CCxN_Disable);
+  BldcCommitOutputs(0);
   if (p_blcd_motor_dev_) {
     p_blcd_motor_dev_->BldcSetMosEnableState(false);
     p_blcd_motor_dev_->BldcSetMotorFanEnableState(false);
@@ -885,45 +1176,15 @@ void BldcMotor::BldcSelfTestMosEnableIrq(BLDC_SELF_TEST_MOS_EXCEPTIONAL index) {
   NVIC_EnableIRQ(HALL_EXTI_IRQn_U);
   NVIC_EnableIRQ(HALL_EXTI_IRQn_V);
   NVIC_EnableIRQ(HALL_EXTI_IRQn_W);
-  switch (index) {
-    case SELF_TEST_MOS_UH_INDEX:
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_1,TIM_CCx_Disable);
-      TIM_SetCompare1(BLDC_TIMx,BLDC_TIM_PERIOD * BLDC_MOS_SELF_TEST_DUTY_CYCLE);
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_1,TIM_CCxN_Enable);
-    break;
-
-    case SELF_TEST_MOS_VH_INDEX:
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_2,TIM_CCx_Disable);
-      TIM_SetCompare2(BLDC_TIMx,BLDC_TIM_PERIOD * BLDC_MOS_SELF_TEST_DUTY_CYCLE);
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_2,TIM_CCxN_Enable);
-    break;
-
-    case SELF_TEST_MOS_WH_INDEX:
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_3,TIM_CCx_Disable);
-      TIM_SetCompare3(BLDC_TIMx,BLDC_TIM_PERIOD * BLDC_MOS_SELF_TEST_DUTY_CYCLE);
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_3,TIM_CCxN_Enable);
-    break;
-
-    case SELF_TEST_MOS_UL_INDEX:
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_1,TIM_CCxN_Disable);
-      TIM_SetCompare1(BLDC_TIMx,BLDC_TIM_PERIOD * BLDC_MOS_SELF_TEST_DUTY_CYCLE);
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_1,TIM_CCx_Enable);
-    break;
-
-    case SELF_TEST_MOS_VL_INDEX:
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_2,TIM_CCxN_Disable);   
-      TIM_SetCompare2(BLDC_TIMx,BLDC_TIM_PERIOD * BLDC_MOS_SELF_TEST_DUTY_CYCLE);
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_2,TIM_CCx_Enable);
-    break;
-
-    case SELF_TEST_MOS_WL_INDEX:
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_3,TIM_CCxN_Disable);  
-      TIM_SetCompare3(BLDC_TIMx,BLDC_TIM_PERIOD * BLDC_MOS_SELF_TEST_DUTY_CYCLE);
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_3,TIM_CCx_Enable);
-    break;
-
-    default:
-    break;
+  // High side index drives the complementary output, low side the main output
+  static const uint16_t mos_test_ccer[SELF_TEST_MOS_INVALID_INDEX] = {
+    TIM_CCER_CC1NE, TIM_CCER_CC2NE, TIM_CCER_CC3NE,
+    TIM_CCER_CC1E, TIM_CCER_CC2E, TIM_CCER_CC3E
+  };
+  if (index < SELF_TEST_MOS_INVALID_INDEX) {
+    volatile uint16_t *ccr = &BLDC_TIMx->CCR1;
+    ccr[(index % 3) << 1] = (uint16_t)(pwm_period_ * BLDC_MOS_SELF_TEST_DUTY_CYCLE);
+    BldcCommitOutputs(mos_test_ccer[index]);
   }
 
   if (p_blcd_motor_dev_) {
@@ -938,94 +1199,9 @@ void BldcMotor::BldcStartHallSelfTest(uint8_t index) {
   NVIC_EnableIRQ(HALL_EXTI_IRQn_V);
   NVIC_EnableIRQ(HALL_EXTI_IRQn_W);
 
-  switch (index) {
-    case 0: 
-      //B+ A-
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_3,TIM_CCx_Disable);
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_3,TIM_CCxN_Disable);
-    
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_1,TIM_CCx_Disable);
-      TIM_SetCompare1(BLDC_TIMx,BLDC_TIM_PERIOD);
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_1,TIM_CCxN_Enable);
-    
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_2,TIM_CCxN_Disable);
-      TIM_SetCompare2(BLDC_TIMx,BLDC_TIM_PERIOD*BLDC_HALL_SELF_TEST_DUTY_CYCLE);
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_2,TIM_CCx_Enable);
- 
-    break;
-
-    case 1:
-      //B+ C-
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_1,TIM_CCx_Disable);
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_1,TIM_CCxN_Disable);
-      
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_2,TIM_CCxN_Disable);   
-      TIM_SetCompare2(BLDC_TIMx,BLDC_TIM_PERIOD*BLDC_HALL_SELF_TEST_DUTY_CYCLE);
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_2,TIM_CCx_Enable);
-
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_3,TIM_CCx_Disable);
-      TIM_SetCompare3(BLDC_TIMx,BLDC_TIM_PERIOD);
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_3,TIM_CCxN_Enable);
-    break;      
-    
-    case 2:
-      //A+ C-
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_2,TIM_CCx_Disable);
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_2,TIM_CCxN_Disable);
-      
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_1,TIM_CCxN_Disable);
-      TIM_SetCompare1(BLDC_TIMx,BLDC_TIM_PERIOD*BLDC_HALL_SELF_TEST_DUTY_CYCLE);
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_1,TIM_CCx_Enable);
-
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_3,TIM_CCx_Disable);
-      TIM_SetCompare3(BLDC_TIMx,BLDC_TIM_PERIOD);
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_3,TIM_CCxN_Enable);
-    break;      
-    
-    case 3:
-      //A+ B-
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_3,TIM_CCx_Disable);
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_3,TIM_CCxN_Disable);
-
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_1,TIM_CCxN_Disable);
-      TIM_SetCompare1(BLDC_TIMx,BLDC_TIM_PERIOD*BLDC_HALL_SELF_TEST_DUTY_CYCLE);
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_1,TIM_CCx_Enable);
-
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_2,TIM_CCx_Disable);
-      TIM_SetCompare2(BLDC_TIMx,BLDC_TIM_PERIOD);
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_2,TIM_CCxN_Enable);
-    break;      
-    
-    case 4:
-      //C+ B-
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_1,TIM_CCx_Disable);
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_1,TIM_CCxN_Disable);    
-  
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_2,TIM_CCx_Disable);
-      TIM_SetCompare2(BLDC_TIMx,BLDC_TIM_PERIOD);
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_2,TIM_CCxN_Enable);
-    
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_3,TIM_CCxN_Disable);  
-      TIM_SetCompare3(BLDC_TIMx,BLDC_TIM_PERIOD*BLDC_HALL_SELF_TEST_DUTY_CYCLE);
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_3,TIM_CCx_Enable);
-    break;      
-    
-    case 5:
-      //C+ A-
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_2,TIM_CCx_Disable);
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_2,TIM_CCxN_Disable);
-    
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_1,TIM_CCx_Disable);
-      TIM_SetCompare1(BLDC_TIMx,BLDC_TIM_PERIOD);
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_1,TIM_CCxN_Enable);
-      
-      TIM_CCxNCmd(BLDC_TIMx,TIM_Channel_3,TIM_CCxN_Disable);
-      TIM_SetCompare3(BLDC_TIMx,BLDC_TIM_PERIOD*BLDC_HALL_SELF_TEST_DUTY_CYCLE);
-      TIM_CCxCmd(BLDC_TIMx,TIM_Channel_3,TIM_CCx_Enable);
-    break;  
-
-    default:
-    break;
+  if (index < CHECK_HALL_CNT) {
+    BldcApplyCommutation(&bldc_commutation_lut[CCW][hall_self_test_step[index]],
+                         (uint16_t)(pwm_period_ * BLDC_HALL_SELF_TEST_DUTY_CYCLE));
   }
   p_blcd_motor_dev_->BldcSetMosEnableState(true);
   p_blcd_motor_dev_->BldcSetMotorFanEnableState(true);
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include "device_base.h"
+#include "src/HAL/hal_adc.h"
 
 #define USE_PID_CTRL_MOTOR_RPM 
 // #define USE_PID_BREAK_MODE_MOTOR_RPM 
@@ -16,6 +17,7 @@
 #define BLDC_SLOW_START_KEEP_TIME    (100) 
 
 #define BLDC_MOTOR_STALL_SCALE_LIMIT  (0.5)
+#define BLDC_TIM_PWM_FREQ             20000 //50000 Hz
 
 // Default PID parameters
 #define  P_DEFAULT_DATA                   0.0001 //0.1  //0.14               
@@ -40,6 +42,9 @@
 
 #define CHECK_HALL_CNT                    (6)
 
+#define BLDC_HALL_PERIOD_BUF_SIZE         (24)  // hall edges of one revolution, up to 4 pole pairs
+#define BLDC_TELEMETRY_BUF_SIZE           (64)  // samples buffered between public timer and main loop
+
 // F103TB Only two types of supporters  
 typedef enum {
   DEFAULT_REMAP = 0,
@@ -60,6 +65,18 @@ typedef enum {
   STOPING
 } MOTOR_STATE;
 
+typedef enum {
+  BLDC_DRIVE_SIX_STEP = 0,  // trapezoidal, commutated on hall edges
+  BLDC_DRIVE_SINE,          // sinusoidal, rotor angle interpolated between hall edges
+} BLDC_DRIVE_MODE;
+
+typedef enum {
+  SINE_STATE_OFF = 0,
+  SINE_STATE_LOAD,
+  SINE_STATE_COMMIT,
+  SINE_STATE_RUN,
+} BLDC_SINE_STATE;
+
 typedef enum {
   MOTOR_BLOCK_NORMAL = 0,
   MOTOR_BLOCK_S_SPIN,
@@ -68,7 +85,7 @@ typedef enum {
 
 // Motor equipment
 typedef struct {
-  volatile float            motor_speed;           
+  volatile uint32_t         motor_speed;           
   volatile uint32_t         step_counter;       
   volatile uint16_t         stalling_count;
   volatile uint8_t          pole_pair_num;      
@@ -87,16 +104,33 @@ typedef enum {
 
 // PID
 typedef struct {
-  float SetPoint;      
+  int32_t SetPoint;      
   float Proportion;   
   float Integral;     
   float Derivative;  
-  float PrevError;   
-  float LastError; 
+  int32_t KpQ;        // Q16 duty change per rpm error, Q16 fraction
+  int32_t KiQ;
+  int32_t KdQ;
+  int32_t PrevError;   
+  int32_t LastError; 
   bool  TargetRpmDown;  
   bool  ErrorLimit;    
 } PID;
 
+// One commutation step: CCER output mask, PWM (high side) and low side channel index
+typedef struct {
+  uint16_t ccer;
+  uint8_t  pwm_ch;
+  uint8_t  low_ch;
+} BLDC_COMMUTATION;
+
+typedef struct {
+  uint16_t rpm;
+  uint16_t duty;          // 0.01%
+  uint16_t current_adc;   // raw I_ADC_CHANNEL
+  uint16_t hall_period;   // us, average of the last revolution
+} BLDC_TELEMETRY_SAMPLE;
+
 typedef enum {
   SELF_TEST_IDLE = 0,
   SELF_TEST_START,
@@ -146,16 +180,25 @@ public:
   float BldcIncPIDGetPID(uint8_t index);
   float BldcGetMotorSpeedPower(void);
   float BldcGetMotorRpm(void);
-  float BldcCalCustomOutput(float cur_prm, float target_prm);
+  int32_t BldcCalCustomOutput(int32_t cur_prm, int32_t target_prm);
   uint32_t BldcGetMultiChannelAdc(MultiChannel channel,uint8_t mode);
+  bool BldcCurrentSampleInit(ADC_CB_F cb);
    
   MOTOR_STATE BldcGetMotorState(void);
   MOTOR_DIR BldcGetMotorDirection(void);
   bool BldcGetMotorPidControl(void);
   bool BldcSetMotorPidControl(bool operation);
+  BLDC_DRIVE_MODE BldcGetMotorDriveMode(void);
+  bool BldcSetMotorDriveMode(BLDC_DRIVE_MODE mode);
   MOTOR_BLOCK_STATE BldcGetMotorBlockState(void);
   void BldcSetMotorBlockState(MOTOR_BLOCK_STATE state);
 
+  // sampled in the public timer every period_ms, 0 stops
+  void BldcTelemetrySetPeriod(uint8_t period_ms);
+  uint8_t BldcTelemetryGetPeriod(void);
+  bool BldcTelemetryRead(BLDC_TELEMETRY_SAMPLE *sample);
+  uint32_t BldcTelemetryDropCount(void);
+
   // bldc self test api interface
   static bool BldcStartSelfTest(void);
   static void BldcSelfTestLoop(uint32_t cur_tick);
@@ -167,13 +210,26 @@ private:
   bool CheckInit(void);
   void BldcMosEnableGpioInit(void);
   void BldcMotorFanGpioInit(void);
-  float BldcIncPIDCalc(PID *bldc_pid, float NextPoint);
-  static void BldcPhaseChange(unsigned int step);
+  int32_t BldcIncPIDCalc(PID *bldc_pid, int32_t NextPoint);
+  void BldcIncPIDUpdateGain(void);
+  static int32_t BldcGainToQ(float gain);
+  static void BldcUpdateSpeedPower(int32_t power);
+  static void BldcCommitOutputs(uint16_t ccer);
+  static void BldcApplyCommutation(const BLDC_COMMUTATION *comm, uint16_t compare);
+  static void BldcPhaseChange(unsigned int hall);
+  static void BldcSineOutput(uint16_t angle);
+  static void BldcSineTimerCallBack(void);
   static void BldcPublicTimerCallBack(void);
   static void BldcHallIrqCallBack(uint8_t line);
   static void BldcHardProductIrqCallBack(uint8_t line); 
   static void BldcPublicTimerInit(void); 
   static void BldcHallIrqInit(void);
+  void BldcHallCaptureTimerInit(void);
+  void BldcResetHallPeriod(void);
+  uint8_t BldcHallPeriodWindow(void);
+  void BldcCaptureHallPeriod(void);
+  uint32_t BldcHallPeriodRpm(void);
+  void BldcTelemetrySample(void);
 
   static void BldcSelfTestMosEnableIrq(BLDC_SELF_TEST_MOS_EXCEPTIONAL index);
   static void BldcDisableAllIrq(void);
@@ -182,7 +238,15 @@ private:
   static void BldcStartHallSelfTest(uint8_t index);
 
 private:
-  static float speed_power_;
+  static volatile int32_t speed_power_;  // Q16 duty
+  static uint16_t pwm_period_;
+  static volatile uint16_t pwm_compare_;  // BLDC_TIM_PERIOD * speed_power_, cached for the hall ISR
+  static BLDC_DRIVE_MODE drive_mode_;
+  static volatile BLDC_SINE_STATE sine_state_;
+  static volatile uint16_t sine_sector_angle_;
+  static volatile uint32_t sine_step_;     // Q8 angle advance per sine update
+  static volatile uint8_t sine_edge_seq_;
+  static volatile uint16_t sine_amplitude_;  // peak phase voltage in compare counts
   static uint32_t pre_step_;
   static float motor_rpm_;
   static MOTOR_BLOCK_STATE motor_block_;
@@ -197,5 +261,22 @@ private:
   uint32 break_keep_cnt_;
   uint32 break_close_sum_;
   uint32 rpm_block_cnt_;
+
+  // hall edge periods in us over one mechanical revolution
+  volatile uint16_t hall_period_buf_[BLDC_HALL_PERIOD_BUF_SIZE];
+  volatile uint32_t hall_period_sum_;
+  volatile uint8_t hall_period_cnt_;
+  volatile uint8_t hall_period_index_;
+  volatile uint16_t hall_last_capture_;
+  volatile bool hall_capture_valid_;
+  uint32_t hall_rpm_factor_;
+
+  // public timer (producer) to main loop (consumer) sample ring
+  BLDC_TELEMETRY_SAMPLE telemetry_buf_[BLDC_TELEMETRY_BUF_SIZE];
+  volatile uint8_t telemetry_head_;
+  volatile uint8_t telemetry_tail_;
+  volatile uint32_t telemetry_drop_;
+  volatile uint8_t telemetry_period_;
+  uint8_t telemetry_tick_;
 };
 #endif
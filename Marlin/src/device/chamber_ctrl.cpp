@@ -0,0 +1,48 @@
+/*
+ * Snapmaker2-Modules Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Modules
+ * (see https://github.com/Snapmaker/Snapmaker2-Modules)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "chamber_ctrl.h"
+
+// The integrator stops while the setpoint is clamped, or while the inner loop is at
+// full or zero power and can not reach it, and the chamber error would push further
+// the same way. Back calculating it down to the block temperature instead drags the
+// setpoint into the inner bang-bang band while the heater is power limited.
+float ChamberCtrl::Update(float target, float chamber, float heater, int8_t heater_sat, float dt) {
+  float err = target - chamber;
+  float sp = target + CHAMBER_CTRL_KP * err + i_term_;
+  bool high = sp >= max_sp_ || (heater_sat > 0 && heater < sp);
+  bool low = sp <= min_sp_ || (heater_sat < 0 && heater > sp);
+
+  if (sp > max_sp_) {
+    sp = max_sp_;
+  } else if (sp < min_sp_) {
+    sp = min_sp_;
+  }
+
+  if (dt > CHAMBER_CTRL_MAX_DT) {
+    dt = CHAMBER_CTRL_MAX_DT;
+  }
+  if (!(high && err > 0) && !(low && err < 0)) {
+    i_term_ += dt * CHAMBER_CTRL_KI * err;
+  }
+
+  sp_ = sp;
+  return sp;
+}
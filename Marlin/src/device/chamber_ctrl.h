@@ -0,0 +1,48 @@
+/*
+ * Snapmaker2-Modules Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Modules
+ * (see https://github.com/Snapmaker/Snapmaker2-Modules)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MODULES_WHIMSYCWD_MARLIN_SRC_DEVICE_CHAMBER_CTRL_H_
+#define MODULES_WHIMSYCWD_MARLIN_SRC_DEVICE_CHAMBER_CTRL_H_
+
+#include <stdint.h>
+
+// outer loop of the chamber cascade, turns the chamber error into a heater setpoint
+#define CHAMBER_CTRL_KP          6.0f     // heater degree per chamber degree
+#define CHAMBER_CTRL_KI          0.05f    // heater degree per chamber degree second
+#define CHAMBER_CTRL_I_INIT      20.0f    // typical heater to chamber gradient
+#define CHAMBER_CTRL_MAX_DT      1.0f     // s, a stale sample does not kick the integrator
+
+class ChamberCtrl {
+ public:
+  void Reset() { i_term_ = CHAMBER_CTRL_I_INIT; }
+  void SetLimit(float min_sp, float max_sp) { min_sp_ = min_sp; max_sp_ = max_sp; }
+  // heater_sat: 1 when the inner loop is at full power, -1 when it is off, else 0
+  float Update(float target, float chamber, float heater, int8_t heater_sat, float dt);
+  float Setpoint() { return sp_; }
+
+ private:
+  float i_term_ = CHAMBER_CTRL_I_INIT;
+  float min_sp_ = 0;
+  float max_sp_ = 0;
+  float sp_ = 0;
+};
+
+#endif  // MODULES_WHIMSYCWD_MARLIN_SRC_DEVICE_CHAMBER_CTRL_H_
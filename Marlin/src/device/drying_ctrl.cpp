@@ -0,0 +1,162 @@
+/*
+ * Snapmaker2-Modules Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Modules
+ * (see https://github.com/Snapmaker/Snapmaker2-Modules)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <math.h>
+#include "drying_ctrl.h"
+
+#define DRYING_HISTORY_LEN   (DRYING_HISTORY + 1)
+
+// Magnus formula, g/m3
+float DryingCtrl::AbsoluteHumidity(float temp, float rh) {
+  float svp = 6.112f * expf(17.67f * temp / (temp + 243.5f));  // hPa
+  return svp * rh * 2.1674f / (273.15f + temp);
+}
+
+void DryingCtrl::Start(uint32_t max_time_s) {
+  phase_ = DRYING_WARMUP;
+  elapsed_s_ = 0;
+  max_time_s_ = max_time_s;
+  sample_tick_ = 0;
+  plateau_cnt_ = 0;
+  fan_duty_ = DRYING_FAN_WARMUP;
+  remain_s_ = max_time_s;
+  ah_ = 0;
+  ah_ref_ = 0;
+  history_cnt_ = 0;
+  history_index_ = 0;
+}
+
+void DryingCtrl::Update(float temp, float rh, bool at_temp, bool sensor_ok) {
+  float ah;
+  int32_t duty;
+
+  if (phase_ == DRYING_DONE) {
+    return;
+  }
+  elapsed_s_++;
+  if (elapsed_s_ >= max_time_s_) {
+    phase_ = DRYING_DONE;
+    remain_s_ = 0;
+    return;
+  }
+
+  if (!sensor_ok) {
+    // no humidity, run to the time limit
+    fan_duty_ = DRYING_FAN_MAX;
+    remain_s_ = max_time_s_ - elapsed_s_;
+    return;
+  }
+
+  ah = AbsoluteHumidity(temp, rh);
+  if (ah_ == 0) {
+    ah_ = ah;
+    ah_ref_ = ah;
+  } else {
+    ah_ += (ah - ah_) * 0.0625f;
+  }
+  if (ah_ < ah_ref_) {
+    ah_ref_ = ah_;
+  }
+
+  if (phase_ == DRYING_WARMUP) {
+    remain_s_ = max_time_s_ - elapsed_s_;
+    if (!at_temp) {
+      return;
+    }
+    phase_ = DRYING_ACTIVE;
+    sample_tick_ = 0;
+  }
+
+  // the excess over ambient follows the drying rate, vent it while it is high
+  // and keep the heat in once the spool gives off little water
+  duty = DRYING_FAN_MIN + (int32_t)((ah_ - ah_ref_) * DRYING_FAN_GAIN);
+  fan_duty_ = duty > DRYING_FAN_MAX ? DRYING_FAN_MAX : duty;
+
+  if (++sample_tick_ >= DRYING_SAMPLE_S) {
+    sample_tick_ = 0;
+    Sample();
+  }
+}
+
+void DryingCtrl::Sample() {
+  float newest, oldest;
+
+  history_[history_index_] = ah_;
+  history_index_ = (history_index_ + 1) % DRYING_HISTORY_LEN;
+  if (history_cnt_ < DRYING_HISTORY_LEN) {
+    history_cnt_++;
+  }
+  if (history_cnt_ < DRYING_HISTORY_LEN) {
+    remain_s_ = max_time_s_ - elapsed_s_;
+    return;
+  }
+
+  // history_index_ now points at the oldest point
+  newest = history_[(history_index_ + DRYING_HISTORY) % DRYING_HISTORY_LEN];
+  oldest = history_[history_index_];
+  if (fabsf(newest - oldest) < DRYING_PLATEAU_SLOPE) {
+    plateau_cnt_++;
+  } else {
+    plateau_cnt_ = 0;
+  }
+
+  EstimateRemain();
+
+  if (elapsed_s_ < DRYING_MIN_TIME_S) {
+    return;
+  }
+  // a long flat curve ends the cycle even if the ambient reference is off, as long as
+  // it is flat against the excess too, the tail of a slow spool still falls a few percent
+  if ((plateau_cnt_ >= DRYING_PLATEAU_CONFIRM && newest - ah_ref_ <= DRYING_END_EXCESS) ||
+      (plateau_cnt_ >= 3 * DRYING_PLATEAU_CONFIRM &&
+       fabsf(newest - oldest) < DRYING_STALL_RATIO * (newest - ah_ref_))) {
+    phase_ = DRYING_DONE;
+    remain_s_ = 0;
+  }
+}
+
+// the excess humidity decays roughly exponentially in the falling rate period,
+// fit it over the last DRYING_FIT_SPAN minutes and solve for DRYING_END_EXCESS
+void DryingCtrl::EstimateRemain() {
+  float e1, e2, tau;
+  int32_t remain;
+  int32_t lower = DRYING_MIN_TIME_S - (int32_t)elapsed_s_;
+  int32_t upper = max_time_s_ - elapsed_s_;
+
+  e2 = history_[(history_index_ + DRYING_HISTORY) % DRYING_HISTORY_LEN] - ah_ref_;
+  e1 = history_[(history_index_ + DRYING_HISTORY - DRYING_FIT_SPAN) % DRYING_HISTORY_LEN] - ah_ref_;
+  if (e2 <= DRYING_END_EXCESS) {
+    remain = (DRYING_PLATEAU_CONFIRM - plateau_cnt_) * DRYING_SAMPLE_S;
+  } else if (e1 > e2) {
+    tau = DRYING_FIT_SPAN * DRYING_SAMPLE_S / logf(e1 / e2);
+    remain = (int32_t)(tau * logf(e2 / DRYING_END_EXCESS));
+  } else {
+    // still rising, no estimate yet
+    remain = upper;
+  }
+
+  if (remain < lower) {
+    remain = lower;
+  }
+  if (remain > upper) {
+    remain = upper;
+  }
+  remain_s_ = remain < 0 ? 0 : remain;
+}
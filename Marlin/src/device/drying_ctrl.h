@@ -0,0 +1,82 @@
+/*
+ * Snapmaker2-Modules Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Modules
+ * (see https://github.com/Snapmaker/Snapmaker2-Modules)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MODULES_WHIMSYCWD_MARLIN_SRC_DEVICE_DRYING_CTRL_H_
+#define MODULES_WHIMSYCWD_MARLIN_SRC_DEVICE_DRYING_CTRL_H_
+
+#include <stdint.h>
+
+// Update() runs once per second, the drying curve is kept as one absolute humidity
+// point per minute
+#define DRYING_SAMPLE_S           60
+#define DRYING_HISTORY            10      // minutes, window of the plateau slope
+#define DRYING_FIT_SPAN           (DRYING_HISTORY / 2)
+#define DRYING_MIN_TIME_S         (30 * 60)
+#define DRYING_MAX_TIME_S         (12 * 60 * 60)
+#define DRYING_AT_TEMP_BAND       3       // degree below the chamber target
+#define DRYING_PLATEAU_SLOPE      0.05f   // g/m3 across the history window
+#define DRYING_PLATEAU_CONFIRM    5       // consecutive minutes
+#define DRYING_END_EXCESS         0.3f    // g/m3 over ambient, the spool is taken as dry below it
+#define DRYING_STALL_RATIO        0.02f   // of the excess across the history window, beyond 8h
+#define DRYING_SENSOR_STALE_S     5
+#define DRYING_FAN_WARMUP         102     // 40%, keep the heat in while warming up
+#define DRYING_FAN_MIN            102
+#define DRYING_FAN_MAX            255
+#define DRYING_FAN_GAIN           96      // duty per g/m3 of excess humidity
+
+typedef enum {
+  DRYING_WARMUP,
+  DRYING_ACTIVE,
+  DRYING_DONE,
+} DRYING_PHASE;
+
+class DryingCtrl {
+ public:
+  void Start(uint32_t max_time_s);
+  void SetMaxTime(uint32_t max_time_s) { max_time_s_ = max_time_s; }
+  // sensor_ok: a fresh GXHT3x sample arrived recently
+  void Update(float temp, float rh, bool at_temp, bool sensor_ok);
+  bool Done() { return phase_ == DRYING_DONE; }
+  uint8_t FanDuty() { return fan_duty_; }
+  int32_t RemainTime() { return remain_s_; }
+  float Humidity() { return ah_; }
+  static float AbsoluteHumidity(float temp, float rh);
+
+ private:
+  void Sample();
+  void EstimateRemain();
+
+ private:
+  DRYING_PHASE phase_ = DRYING_DONE;
+  uint32_t elapsed_s_ = 0;
+  uint32_t max_time_s_ = DRYING_MAX_TIME_S;
+  uint8_t sample_tick_ = 0;
+  uint8_t plateau_cnt_ = 0;
+  uint8_t fan_duty_ = DRYING_FAN_WARMUP;
+  int32_t remain_s_ = 0;
+  float ah_ = 0;            // g/m3, filtered
+  float ah_ref_ = 0;        // lowest filtered value since start, close to ambient
+  uint8_t history_cnt_ = 0;
+  uint8_t history_index_ = 0;
+  float history_[DRYING_HISTORY + 1];
+};
+
+#endif  // MODULES_WHIMSYCWD_MARLIN_SRC_DEVICE_DRYING_CTRL_H_
@@ -0,0 +1,124 @@
+/*
+ * Snapmaker2-Modules Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Modules
+ * (see https://github.com/Snapmaker/Snapmaker2-Modules)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "fire_sensor.h"
+
+void FireSensor::Init(uint16_t block_ms, uint16_t trigger) {
+  block_ms_ = block_ms;
+  settle_blocks_ = FIRE_SENSOR_SETTLE_MS / block_ms;
+  level_blocks_ = FIRE_SENSOR_LEVEL_MS / block_ms;
+  hold_blocks_ = FIRE_SENSOR_HOLD_MS / block_ms;
+  trigger_ = trigger;
+  raw_ = 0;
+  triggered_ = false;
+  latency_ms_ = 0;
+  settle_cnt_ = 0;
+  hold_cnt_ = 0;
+  for (uint8_t i = 0; i < FIRE_SENSOR_FAST_WINDOW; i++)
+    fast_buf_[i] = 0;
+  fast_sum_ = 0;
+  fast_index_ = 0;
+  fast_cnt_ = 0;
+  level_cnt_ = 0;
+  baseline_ = 0;
+  onset_ms_ = 0;
+}
+
+// Fast stage: a short window that trips when it drops well under the ambient baseline and the threshold.
+// Slow stage: the baseline itself, tracking ambient drift, trips once it has followed a level under the threshold.
+// Level stage: the short window under the threshold for FIRE_SENSOR_LEVEL_MS trips on its own, as the
+// baseline is frozen while a level sits between the threshold and the flare delta.
+bool FireSensor::Update(uint16_t sample, uint32_t now_ms) {
+  bool trigger = false;
+  uint16_t threshold = trigger_;
+  uint16_t fast;
+  uint16_t baseline;
+
+  raw_ = sample;
+  fast_sum_ += sample;
+  fast_sum_ -= fast_buf_[fast_index_];
+  fast_buf_[fast_index_] = sample;
+  if (++fast_index_ >= FIRE_SENSOR_FAST_WINDOW)
+    fast_index_ = 0;
+  fast = fast_sum_ / FIRE_SENSOR_FAST_WINDOW;
+
+  if (settle_cnt_ < settle_blocks_) {
+    if (settle_cnt_++ == 0)
+      baseline_ = sample << 4;
+    else
+      baseline_ += ((int32_t)(sample << 4) - (int32_t)baseline_) >> 3;
+    onset_ms_ = now_ms;
+    return triggered_;
+  }
+
+  baseline = baseline_ >> 4;
+  if (threshold <= FIRE_SENSOR_TRIGGER_LIMIT) {
+    // the next block, the first one under the threshold, starts converting now
+    if (sample > threshold) {
+      onset_ms_ = now_ms;
+    }
+
+    if (fast + FIRE_SENSOR_FLARE_DELTA <= baseline && fast <= threshold) {
+      if (fast_cnt_ < FIRE_SENSOR_FAST_CONFIRM)
+        fast_cnt_++;
+      if (fast_cnt_ >= FIRE_SENSOR_FAST_CONFIRM)
+        trigger = true;
+    }
+    else {
+      fast_cnt_ = 0;
+    }
+
+    if (fast <= threshold) {
+      if (level_cnt_ < level_blocks_)
+        level_cnt_++;
+      if (level_cnt_ >= level_blocks_)
+        trigger = true;
+    }
+    else {
+      level_cnt_ = 0;
+    }
+
+    if (baseline <= threshold)
+      trigger = true;
+  }
+  else {
+    fast_cnt_ = 0;
+    level_cnt_ = 0;
+    hold_cnt_ = 0;
+  }
+
+  // hold the baseline while a flare is building under the threshold, so it is not learnt as ambient
+  if (fast + FIRE_SENSOR_FLARE_DELTA / 2 > baseline || fast > threshold)
+    baseline_ += ((int32_t)(sample << 4) - (int32_t)baseline_) >> FIRE_SENSOR_BASELINE_SHIFT;
+
+  if (trigger) {
+    if (!triggered_)
+      latency_ms_ = now_ms - onset_ms_;
+    triggered_ = true;
+    hold_cnt_ = hold_blocks_;
+  }
+  else {
+    if (hold_cnt_)
+      hold_cnt_--;
+    else
+      triggered_ = false;
+  }
+  return triggered_;
+}
@@ -0,0 +1,71 @@
+/*
+ * Snapmaker2-Modules Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Modules
+ * (see https://github.com/Snapmaker/Snapmaker2-Modules)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MODULES_WHIMSYCWD_MARLIN_SRC_DEVICE_FIRE_SENSOR_H_
+#define MODULES_WHIMSYCWD_MARLIN_SRC_DEVICE_FIRE_SENSOR_H_
+
+#include <stdint.h>
+
+// flame detector on the fire sensor adc, a flame pulls the reading down. Update() runs
+// once per adc dma block
+#define FIRE_SENSOR_FAST_WINDOW       4       // blocks, flare detector window
+#define FIRE_SENSOR_FAST_CONFIRM      2       // consecutive blocks before a flare trips
+#define FIRE_SENSOR_FLARE_DELTA       300     // adc drop below the baseline seen as a flare
+#define FIRE_SENSOR_BASELINE_SHIFT    8       // baseline ema, 256 blocks
+#define FIRE_SENSOR_SETTLE_MS         1000
+// a level under the threshold held this long trips even with the baseline frozen, the
+// worst case of the former 256 sample average at 100Hz
+#define FIRE_SENSOR_LEVEL_MS          2560
+#define FIRE_SENSOR_HOLD_MS           5000    // trip kept after the last detection
+#define FIRE_SENSOR_TRIGGER_LIMIT     4095    // 12 bit adc, trigger values above it disable detection
+
+class FireSensor {
+ public:
+  void Init(uint16_t block_ms, uint16_t trigger);
+  void SetTrigger(uint16_t trigger) { trigger_ = trigger; }
+  // sample: mean of one adc block, returns true while tripped
+  bool Update(uint16_t sample, uint32_t now_ms);
+  bool Triggered() { return triggered_; }
+  uint16_t Raw() { return raw_; }
+  // of the last detection, from the start of the first block under the threshold
+  uint16_t Latency() { return latency_ms_; }
+
+ private:
+  uint16_t block_ms_;
+  uint16_t settle_blocks_;
+  uint16_t level_blocks_;
+  uint16_t hold_blocks_;
+  volatile uint16_t trigger_;
+  volatile uint16_t raw_;
+  volatile bool triggered_;
+  volatile uint16_t latency_ms_;
+  uint16_t settle_cnt_;
+  uint16_t hold_cnt_;
+  uint16_t fast_buf_[FIRE_SENSOR_FAST_WINDOW];
+  uint32_t fast_sum_;
+  uint8_t fast_index_;
+  uint8_t fast_cnt_;
+  uint16_t level_cnt_;
+  uint32_t baseline_;     // Q4
+  uint32_t onset_ms_;
+};
+
+#endif  // MODULES_WHIMSYCWD_MARLIN_SRC_DEVICE_FIRE_SENSOR_H_
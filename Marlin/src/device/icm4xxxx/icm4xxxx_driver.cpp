@@ -1,6 +1,8 @@
 
+#include <board/board.h>
 #include "icm4xxxx_driver.h"
 #include "../../HAL/std_library/inc/stm32f10x.h"
+#include "../../HAL/hal_exti.h"
 #include "icm4xxxx_delay.h"
 #include <math.h>
 #include "icm42670/system_interface.h"
@@ -16,6 +18,17 @@ static int32_t icm_mounting_matrix[9] = {  0,          0,          -(1<<30),
 
 ICM4xxxxDriver icm42670;
 
+// SPI1 is owned by the FIFO DMA transfer while set, polled access waits for it
+static volatile bool spi_dma_busy = false;
+static const uint8_t spi_dma_dummy = 0xff;
+
+static void SPIWaitDmaIdle() {
+	uint32_t retry = 0;
+	while (spi_dma_busy) {
+		if (++retry > 100000) break;
+	}
+}
+
 static uint8_t SPIReadWriteByte(const uint8_t TxData)
 {
 	uint8_t retry=0;
@@ -56,6 +69,7 @@ static uint8_t HAL_SPI_Receive(uint8_t *pData, uint16_t size) {
 unsigned char MPU_Write_Len(unsigned char addr,unsigned char reg,unsigned char len, const unsigned char *buf)
 {
 	uint8_t status;
+	SPIWaitDmaIdle();
 	ICM4xxxx_ENABLE();
 	status = HAL_SPI_Transmit(&reg, 1);
 	status = HAL_SPI_Transmit(buf, len);
@@ -67,6 +81,7 @@ unsigned char MPU_Write_Len(unsigned char addr,unsigned char reg,unsigned char l
 unsigned char MPU_Read_Len(unsigned char addr,unsigned char reg,unsigned char len,unsigned char *buf)
 {
 	uint8_t status;
+	SPIWaitDmaIdle();
 	ICM4xxxx_ENABLE();
 	reg = reg|0x80;
 	status=HAL_SPI_Transmit(&reg, 1);
@@ -88,6 +103,7 @@ unsigned char MPU_Read_Len(unsigned char addr,unsigned char reg,unsigned char le
 static uint8_t ICM4xxxx_Read_Reg(uint8_t reg)
 {
 	uint8_t reg_val;
+	SPIWaitDmaIdle();
 	ICM4xxxx_ENABLE();
 	reg = reg|0x80;
 	HAL_SPI_Transmit(&reg, 1);
@@ -124,7 +140,8 @@ void ICM4xxxxDriver::SPIInit() {
 	SPI_InitStructure.SPI_CPOL = SPI_CPOL_Low;
 	SPI_InitStructure.SPI_CPHA = SPI_CPHA_1Edge;
 	SPI_InitStructure.SPI_NSS = SPI_NSS_Soft;
-	SPI_InitStructure.SPI_BaudRatePrescaler = SPI_BaudRatePrescaler_256;
+	// 4.5MHz, the ICM42670 takes up to 24MHz
+	SPI_InitStructure.SPI_BaudRatePrescaler = SPI_BaudRatePrescaler_16;
 	SPI_InitStructure.SPI_FirstBit = SPI_FirstBit_MSB;
 	SPI_InitStructure.SPI_CRCPolynomial = 10;
 	SPI_Init(SPI1, &SPI_InitStructure);
@@ -166,6 +183,75 @@ static void apply_mounting_matrix(const int32_t matrix[9], int32_t raw[3]) {
 	raw[2] = (int32_t)(data_q30[2]>>30);
 }
 
+static inline int32_t MulQ30(int32_t a, int32_t b) {
+	return (int32_t)(((int64_t)a * b) >> 30);
+}
+
+// 1/sqrt(x) = y * 2^-(30 + shift), y in [1, 2] as Q30
+static uint32_t InvSqrt(uint32_t x, uint8_t *shift) {
+	if (x == 0) {
+		*shift = 0;
+		return 0;
+	}
+
+	uint8_t z = __builtin_clz(x) & ~1;
+	uint32_t u = (x << z) >> 2;  // Q30 in [0.25, 1)
+
+	// linear guess exact at both ends of the range, then Newton
+	uint32_t y = 2505397589u - (uint32_t)(((uint64_t)1431655765u * u) >> 30);
+	for (uint8_t i = 0; i < 4; i++) {
+		uint64_t y2 = ((uint64_t)y * y) >> 30;
+		uint64_t t = ((uint64_t)u * y2) >> 30;
+		y = (uint32_t)(((uint64_t)y * ((3ull << 30) - t)) >> 31);
+	}
+
+	*shift = 16 - z / 2;
+	return y;
+}
+
+// Q30 in, Q29 radians out, polynomial error below 1e-5 rad
+static int32_t Atan2Q29(int32_t y, int32_t x) {
+	uint32_t ax = x < 0 ? -(uint32_t)x : x;
+	uint32_t ay = y < 0 ? -(uint32_t)y : y;
+	bool swap = ay > ax;
+	uint32_t num = swap ? ax : ay;
+	uint32_t den = swap ? ay : ax;
+	int32_t z, r;
+
+	if (den == 0) {
+		return 0;
+	}
+
+	// 32 bit hardware divide on 16 bit operands, z = num / den in Q30
+	uint8_t k = __builtin_clz(den);
+	den = (den << k) >> 16;
+	num = (num << k) >> 16;
+	z = (int32_t)(((num << 15) / den) << 15);
+
+	// atan(z) = z * (a1 + a3 z^2 + a5 z^4 + a7 z^6 + a9 z^8), Abramowitz & Stegun 4.4.49
+	int32_t z2 = MulQ30(z, z);
+	r = 22371518;                   // 0.0208351
+	r = MulQ30(r, z2) - 91410863;   // 0.0851330
+	r = MulQ30(r, z2) + 193424926;  // 0.1801410
+	r = MulQ30(r, z2) - 354656388;  // 0.3302995
+	r = MulQ30(r, z2) + 1073597943; // 0.9998660
+	r = MulQ30(r, z) >> 1;
+	if (swap) r = 843314857 - r;   // pi/2 in Q29
+	if (x < 0) r = 1686629713 - r; // pi in Q29
+	return y < 0 ? -r : r;
+}
+
+// Q30 in, Q29 radians out
+static int32_t AsinQ29(int32_t s) {
+	uint8_t shift;
+	if (s > Q30_ONE) s = Q30_ONE;
+	if (s < -Q30_ONE) s = -Q30_ONE;
+	uint32_t c2 = Q30_ONE - MulQ30(s, s);
+	uint32_t y = InvSqrt(c2, &shift);
+	int32_t c = (int32_t)(((uint64_t)c2 * y) >> (shift + 15));
+	return Atan2Q29(s, c);
+}
+
 static void get_accel_and_gyr_fsr(uint16_t * accel_fsr_g, uint16_t * gyro_fsr_dps) {
 	ACCEL_CONFIG0_FS_SEL_t accel_fsr_bitfield;
 	GYRO_CONFIG0_FS_SEL_t gyro_fsr_bitfield;
@@ -393,7 +479,8 @@ bool ICM4xxxxDriver::ChipInit() {
 		setup_mcu(&icm_serif_);
 		setup_imu_device(&icm_serif_);
 		configure_imu_device();
-		return true;
+		attitude_solving_stage = ATTITUDE_SOLVING_PREPARE;
+		return BatchReadInit();
 	} else {
 		return false;
 	}
@@ -416,27 +503,310 @@ bool ICM4xxxxDriver::GetRawDataFromFIFO() {
 	return get_imu_data();
 }
 
+bool ICM4xxxxDriver::BatchReadInit() {
+	DMA_InitTypeDef DMA_InitStruct;
+	NVIC_InitTypeDef NVIC_InitStruct;
+	inv_imu_interrupt_parameter_t config_int;
+	int rc = 0;
+	uint8_t data;
+
+	// INT1 carries the FIFO watermark until SetProtectMode() adds the APEX events, pulsed
+	// so nothing has to be acknowledged
+	rc |= inv_imu_read_reg(&icm_driver_, INT_CONFIG, 1, &data);
+	data &= ~INT_CONFIG_INT1_MODE_MASK;
+	data |= (uint8_t)INT_CONFIG_INT1_MODE_PULSED;
+	rc |= inv_imu_write_reg(&icm_driver_, INT_CONFIG, 1, &data);
+
+	rc |= inv_imu_get_config_int1(&icm_driver_, &config_int);
+	config_int.INV_FIFO_THS      = INV_IMU_ENABLE;
+	config_int.INV_FIFO_FULL     = INV_IMU_DISABLE;
+	config_int.INV_SMD           = INV_IMU_DISABLE;
+	config_int.INV_WOM_X         = INV_IMU_DISABLE;
+	config_int.INV_WOM_Y         = INV_IMU_DISABLE;
+	config_int.INV_WOM_Z         = INV_IMU_DISABLE;
+	config_int.INV_FF            = INV_IMU_DISABLE;
+	config_int.INV_LOWG          = INV_IMU_DISABLE;
+	config_int.INV_STEP_DET      = INV_IMU_DISABLE;
+	config_int.INV_STEP_CNT_OVFL = INV_IMU_DISABLE;
+	config_int.INV_TILT_DET      = INV_IMU_DISABLE;
+	rc |= inv_imu_set_config_int1(&icm_driver_, &config_int);
+
+	// WM_GT_TH is set by inv_imu_configure_fifo, INT1 fires on every ODR while count >= watermark
+	data = ICM4xxxx_FIFO_WATERMARK & FIFO_CONFIG2_FIFO_WM_MASK;
+	rc |= inv_imu_write_reg(&icm_driver_, FIFO_CONFIG2, 1, &data);
+	data = (ICM4xxxx_FIFO_WATERMARK >> 8) & FIFO_CONFIG3_FIFO_WM_MASK;
+	rc |= inv_imu_write_reg(&icm_driver_, FIFO_CONFIG3, 1, &data);
+	rc |= inv_imu_reset_fifo(&icm_driver_);
+	if (rc != INV_ERROR_SUCCESS) {
+		return false;
+	}
+
+	// the estimator works on cached scales, no register read per sample
+	uint16_t accel_fsr_g, gyro_fsr_dps;
+	get_accel_and_gyr_fsr(&accel_fsr_g, &gyro_fsr_dps);
+	gyro_scale_q24_ = (int32_t)((float)gyro_fsr_dps * (PI / 180) / INT16_MAX * (1 << 24));
+	timestamp_res_us_ = inv_imu_get_fifo_timestamp_resolution_us_q24(&icm_driver_) >> 24;
+	if ((timestamp_res_us_ == 0) || (timestamp_res_us_ > 16)) {
+		timestamp_res_us_ = 16;
+	}
+
+	// SPI1 RX on DMA1 channel 2, TX on channel 3 clocks out the dummy byte
+	RCC_AHBPeriphClockCmd(RCC_AHBPeriph_DMA1, ENABLE);
+	DMA_DeInit(DMA1_Channel2);
+	DMA_InitStruct.DMA_PeripheralBaseAddr = (uint32_t)(uintptr_t)&SPI1->DR;
+	DMA_InitStruct.DMA_MemoryBaseAddr = (uint32_t)(uintptr_t)batch_[0].buf;
+	DMA_InitStruct.DMA_DIR = DMA_DIR_PeripheralSRC;
+	DMA_InitStruct.DMA_BufferSize = FIFO_PACKET_SIZE;
+	DMA_InitStruct.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+	DMA_InitStruct.DMA_MemoryInc = DMA_MemoryInc_Enable;
+	DMA_InitStruct.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Byte;
+	DMA_InitStruct.DMA_MemoryDataSize = DMA_MemoryDataSize_Byte;
+	DMA_InitStruct.DMA_Mode = DMA_Mode_Normal;
+	DMA_InitStruct.DMA_Priority = DMA_Priority_High;
+	DMA_InitStruct.DMA_M2M = DMA_M2M_Disable;
+	DMA_Init(DMA1_Channel2, &DMA_InitStruct);
+
+	DMA_DeInit(DMA1_Channel3);
+	DMA_InitStruct.DMA_MemoryBaseAddr = (uint32_t)(uintptr_t)&spi_dma_dummy;
+	DMA_InitStruct.DMA_DIR = DMA_DIR_PeripheralDST;
+	DMA_InitStruct.DMA_MemoryInc = DMA_MemoryInc_Disable;
+	DMA_InitStruct.DMA_Priority = DMA_Priority_Medium;
+	DMA_Init(DMA1_Channel3, &DMA_InitStruct);
+
+	NVIC_InitStruct.NVIC_IRQChannel = DMA1_Channel2_IRQn;
+	NVIC_InitStruct.NVIC_IRQChannelPreemptionPriority = 2;
+	NVIC_InitStruct.NVIC_IRQChannelSubPriority = 1;
+	NVIC_InitStruct.NVIC_IRQChannelCmd = ENABLE;
+	DMA_ITConfig(DMA1_Channel2, DMA_IT_TC, ENABLE);
+	NVIC_Init(&NVIC_InitStruct);
+
+	batch_time_ = (uint32_t)inv_imu_get_time_us();
+	return true;
+}
+
+void ICM4xxxxDriver::EnableFifoInt(uint8_t pin) {
+	if (fifo_int_enabled_) {
+		return;
+	}
+	ExtiInit(pin, EXTI_Rising, FifoIntCallBack, EXTI_MODE_IPD);
+	fifo_int_enabled_ = true;
+}
+
+void ICM4xxxxDriver::FifoIntCallBack(uint8_t pin_source) {
+	icm42670.fifo_int_pending_ = true;
+}
+
+void ICM4xxxxDriver::BatchDmaCallBack(void) {
+	DMA_Cmd(DMA1_Channel2, DISABLE);
+	DMA_Cmd(DMA1_Channel3, DISABLE);
+	SPI_I2S_DMACmd(SPI1, SPI_I2S_DMAReq_Rx | SPI_I2S_DMAReq_Tx, DISABLE);
+	ICM4xxxx_DISABLE();
+
+	icm42670.batch_[icm42670.batch_fill_].count = icm42670.batch_dma_count_;
+	icm42670.batch_fill_ ^= 1;
+	spi_dma_busy = false;
+}
+
+void ICM4xxxxDriver::BatchReadStart() {
+	ICM_BATCH_BUF *batch = &batch_[batch_fill_];
+	uint8_t data[2];
+	uint16_t packets;
+
+	// both buffers still wait for decoding, the FIFO holds the data meanwhile
+	if (spi_dma_busy || batch->count) {
+		return;
+	}
+
+	fifo_int_pending_ = false;
+	batch_time_ = (uint32_t)inv_imu_get_time_us();
+
+	// record mode, little endian count, see inv_imu_configure_fifo. The gyro runs in
+	// low noise mode so MCLK stays on between the count and the data read
+	MPU_Read_Len(0, REG_ICM42670P_FIFO_COUNTH, 2, data);
+	packets = data[0] | (data[1] << 8);
+	if (packets == 0) {
+		return;
+	}
+	if (packets > ICM4xxxx_BATCH_MAX) {
+		packets = ICM4xxxx_BATCH_MAX;
+	}
+	batch_dma_count_ = packets;
+
+	spi_dma_busy = true;
+	ICM4xxxx_ENABLE();
+	SPIReadWriteByte(REG_ICM42670P_FIFO_DATA | 0x80);
+	DMA1_Channel2->CMAR = (uint32_t)(uintptr_t)batch->buf;
+	DMA_SetCurrDataCounter(DMA1_Channel2, packets * FIFO_PACKET_SIZE);
+	DMA_SetCurrDataCounter(DMA1_Channel3, packets * FIFO_PACKET_SIZE);
+	SPI_I2S_DMACmd(SPI1, SPI_I2S_DMAReq_Rx | SPI_I2S_DMAReq_Tx, ENABLE);
+	DMA_Cmd(DMA1_Channel2, ENABLE);
+	DMA_Cmd(DMA1_Channel3, ENABLE);
+}
+
+// 16 bytes packet: header, accel xyz, gyro xyz, temperature, timestamp
+uint8_t ICM4xxxxDriver::BatchDecode(ICM_BATCH_BUF *batch) {
+	bool big_endian = (icm_driver_.endianness_data == INTF_CONFIG0_DATA_BIG_ENDIAN);
+	uint8_t solved = 0;
+	int16_t value[6];
+
+	for (uint8_t i = 0; i < batch->count; i++) {
+		uint8_t *packet = &batch->buf[i * FIFO_PACKET_SIZE];
+		fifo_header_t *header = (fifo_header_t *)packet;
+		bool valid = true;
+
+		if (header->bits.msg_bit || !header->bits.accel_bit || !header->bits.gyro_bit) {
+			continue;
+		}
+
+		for (uint8_t j = 0; j < 6; j++) {
+			uint8_t *p = &packet[FIFO_HEADER_SIZE + j * 2];
+			value[j] = big_endian ? (int16_t)((p[0] << 8) | p[1]) : (int16_t)((p[1] << 8) | p[0]);
+			// sensor still starting up
+			if (value[j] == INVALID_VALUE_FIFO) {
+				valid = false;
+			}
+		}
+		if (!valid) {
+			continue;
+		}
+
+		// FIFO timestamp ticks since the previous sample, wraps every 65536 ticks
+		uint16_t timestamp = big_endian ? ((packet[14] << 8) | packet[15]) : ((packet[15] << 8) | packet[14]);
+		sample_dt_us_ = (uint16_t)(timestamp - timestamp_last_) * timestamp_res_us_;
+		if (!timestamp_valid_ || (sample_dt_us_ == 0) || (sample_dt_us_ > ATTITUDE_DT_MAX_US)) {
+			sample_dt_us_ = ICM4xxxx_ODR_PERIOD_MS * 1000;
+		}
+		timestamp_last_ = timestamp;
+		timestamp_valid_ = true;
+
+		accel_x_raw_ = value[0];
+		accel_y_raw_ = value[1];
+		accel_z_raw_ = value[2];
+		gyro_x_raw_  = value[3];
+		gyro_y_raw_  = value[4];
+		gyro_z_raw_  = value[5];
+		imu_temperature_ = 25 + ((float)(int8_t)packet[FIFO_HEADER_SIZE + 12] / 2);
+
+		AttitudeUpdate();
+		solved++;
+	}
+
+	return solved;
+}
+
+bool ICM4xxxxDriver::SetProtectMode(ICM_PROTECT_MODE mode) {
+	inv_imu_apex_parameters_t apex_inputs;
+	inv_imu_interrupt_parameter_t config_int;
+	inv_imu_interrupt_value apex_int;
+	int rc = 0;
+
+	if (mode == ICM_PROTECT_APEX) {
+		rc |= inv_imu_apex_init_parameters_struct(&icm_driver_, &apex_inputs);
+		apex_inputs.tilt_wait_time = APEX_CONFIG5_TILT_WAIT_TIME_0_S;
+		apex_inputs.power_save = APEX_CONFIG0_DMP_POWER_SAVE_DIS;
+		apex_inputs.ff_debounce_duration = APEX_CONFIG9_FF_DEBOUNCE_DURATION_0_MS;
+		rc |= inv_imu_apex_set_frequency(&icm_driver_, APEX_CONFIG1_DMP_ODR_50Hz);
+		rc |= inv_imu_apex_configure_parameters(&icm_driver_, &apex_inputs);
+		rc |= inv_imu_apex_enable_tilt(&icm_driver_);
+		rc |= inv_imu_apex_enable_ff(&icm_driver_);
+		rc |= inv_imu_configure_wom(&icm_driver_, ICM4xxxx_WOM_THRESHOLD, ICM4xxxx_WOM_THRESHOLD, ICM4xxxx_WOM_THRESHOLD,
+		                            WOM_CONFIG_WOM_INT_MODE_ORED, WOM_CONFIG_WOM_INT_DUR_1_SMPL);
+		rc |= inv_imu_enable_wom(&icm_driver_);
+		apex_int = INV_IMU_ENABLE;
+	} else {
+		rc |= inv_imu_apex_disable_tilt(&icm_driver_);
+		rc |= inv_imu_apex_disable_ff(&icm_driver_);
+		rc |= inv_imu_disable_wom(&icm_driver_);
+		apex_int = INV_IMU_DISABLE;
+	}
+
+	// the vendor WOM calls toggle FIFO_THS, INT1 always keeps it
+	rc |= inv_imu_get_config_int1(&icm_driver_, &config_int);
+	config_int.INV_FIFO_THS = INV_IMU_ENABLE;
+	config_int.INV_WOM_X    = apex_int;
+	config_int.INV_WOM_Y    = apex_int;
+	config_int.INV_WOM_Z    = apex_int;
+	config_int.INV_FF       = apex_int;
+	config_int.INV_TILT_DET = apex_int;
+	rc |= inv_imu_set_config_int1(&icm_driver_, &config_int);
+
+	if (rc != INV_ERROR_SUCCESS) {
+		return false;
+	}
+
+	protect_mode_ = mode;
+	events_ = 0;
+	active_time_ = (uint32_t)inv_imu_get_time_us();
+	return true;
+}
+
+uint8_t ICM4xxxxDriver::GetEvents() {
+	uint8_t events = events_;
+	events_ = 0;
+	return events;
+}
+
+void ICM4xxxxDriver::ApexEventRead(uint32_t now) {
+	uint8_t status[2];
+	uint8_t events = 0;
+
+	// INT_STATUS2 and INT_STATUS3, both clear on read
+	MPU_Read_Len(0, REG_ICM42670P_INT_STATUS2, 2, status);
+	if (status[0] & (INT_STATUS2_WOM_X_INT_MASK | INT_STATUS2_WOM_Y_INT_MASK | INT_STATUS2_WOM_Z_INT_MASK)) {
+		events |= ICM_EVENT_MOTION;
+	}
+	if (status[1] & INT_STATUS3_TILT_DET_INT_MASK) {
+		events |= ICM_EVENT_TILT;
+	}
+	if (status[1] & INT_STATUS3_FF_DET_INT_MASK) {
+		events |= ICM_EVENT_FREE_FALL;
+	}
+
+	if (events) {
+		events_ |= events;
+		active_time_ = now;
+	}
+}
+
 bool ICM4xxxxDriver::AttitudeSolving() {
-	bool ret;
-	bool gesture_solved = false;
+	uint8_t solved = 0;
+	uint32_t now = (uint32_t)inv_imu_get_time_us();
+
+	uint32_t period_ms = fifo_int_enabled_ ? ICM4xxxx_INT_TIMEOUT_MS : ICM4xxxx_POLL_PERIOD_MS;
+
+	if (fifo_int_pending_ || ((now - batch_time_) >= period_ms * 1000)) {
+		// the only place the APEX flags are read, see ICM4xxxx_EVENT_LATENCY_MS
+		if (protect_mode_ == ICM_PROTECT_APEX) {
+			ApexEventRead(now);
+		}
+		BatchReadStart();
+	}
+
+	background_ = (protect_mode_ == ICM_PROTECT_APEX) && (gesture_preprocessing_count_ > 100)
+	              && ((now - active_time_) >= ICM4xxxx_ACTIVE_HOLD_MS * 1000);
+
+	while (batch_[batch_read_].count) {
+		ICM_BATCH_BUF *batch = &batch_[batch_read_];
+		solved += BatchDecode(batch);
+		batch->count = 0;
+		batch_read_ ^= 1;
+	}
+
+	// attitude is reported once the filter has converged
+	return (solved > 0) && (gesture_preprocessing_count_ > 100);
+}
 
+void ICM4xxxxDriver::AttitudeUpdate() {
 	if (attitude_solving_stage == ATTITUDE_SOLVING_PREPARE) {
-		do {
-			ret = GetRawDataFromFIFO();
-		}	while (ret);
-
-		do {
-			ret = GetRawDataFromFIFO();
-			if (ret) {
-				accel_x_raw_buff_[sliding_window_index_] = accel_x_raw_;
-				accel_y_raw_buff_[sliding_window_index_] = accel_y_raw_;
-				accel_z_raw_buff_[sliding_window_index_] = accel_z_raw_;
-				gyro_x_raw_buff_[sliding_window_index_]  = gyro_x_raw_;
-				gyro_y_raw_buff_[sliding_window_index_]  = gyro_y_raw_;
-				gyro_z_raw_buff_[sliding_window_index_]  = gyro_z_raw_;
-				sliding_window_index_++;
-			}
-		} while(sliding_window_index_ < SLIDING_WINDOW_SIZE);
+		accel_x_raw_buff_[sliding_window_index_] = accel_x_raw_;
+		accel_y_raw_buff_[sliding_window_index_] = accel_y_raw_;
+		accel_z_raw_buff_[sliding_window_index_] = accel_z_raw_;
+		gyro_x_raw_buff_[sliding_window_index_]  = gyro_x_raw_;
+		gyro_y_raw_buff_[sliding_window_index_]  = gyro_y_raw_;
+		gyro_z_raw_buff_[sliding_window_index_]  = gyro_z_raw_;
+		if (++sliding_window_index_ < SLIDING_WINDOW_SIZE) {
+			return;
+		}
 
 		accel_x_raw_acc_ = 0;
 		accel_y_raw_acc_ = 0;
@@ -454,143 +824,142 @@ bool ICM4xxxxDriver::AttitudeSolving() {
 		}
 
 		attitude_solving_stage = ATTITUDE_SOLVING_DOING;
+		return;
+	}
 
-		gesture_solved = false;
-	}
-	else if (attitude_solving_stage == ATTITUDE_SOLVING_DOING) {
-		// sliding window filtering
-		do {
-			ret = GetRawDataFromFIFO();
-			if (ret) {
-				if (sliding_window_index_ == SLIDING_WINDOW_SIZE) {
-					sliding_window_index_ = 0;
-				}
-
-				accel_x_raw_acc_ -= accel_x_raw_buff_[sliding_window_index_];
-				accel_y_raw_acc_ -= accel_y_raw_buff_[sliding_window_index_];
-				accel_z_raw_acc_ -= accel_z_raw_buff_[sliding_window_index_];
-				gyro_x_raw_acc_  -= gyro_x_raw_buff_[sliding_window_index_];
-				gyro_y_raw_acc_  -= gyro_y_raw_buff_[sliding_window_index_];
-				gyro_z_raw_acc_  -= gyro_z_raw_buff_[sliding_window_index_];
-
-				accel_x_raw_buff_[sliding_window_index_] = accel_x_raw_;
-				accel_y_raw_buff_[sliding_window_index_] = accel_y_raw_;
-				accel_z_raw_buff_[sliding_window_index_] = accel_z_raw_;
-				gyro_x_raw_buff_[sliding_window_index_]  = gyro_x_raw_;
-				gyro_y_raw_buff_[sliding_window_index_]  = gyro_y_raw_;
-				gyro_z_raw_buff_[sliding_window_index_]  = gyro_z_raw_;
-
-				accel_x_raw_acc_ += accel_x_raw_buff_[sliding_window_index_];
-				accel_y_raw_acc_ += accel_y_raw_buff_[sliding_window_index_];
-				accel_z_raw_acc_ += accel_z_raw_buff_[sliding_window_index_];
-				gyro_x_raw_acc_  += gyro_x_raw_buff_[sliding_window_index_];
-				gyro_y_raw_acc_  += gyro_y_raw_buff_[sliding_window_index_];
-				gyro_z_raw_acc_  += gyro_z_raw_buff_[sliding_window_index_];
-
-				sliding_window_index_++;
-
-				accel_x_raw_filter_ = accel_x_raw_acc_ / SLIDING_WINDOW_SIZE;
-				accel_y_raw_filter_ = accel_y_raw_acc_ / SLIDING_WINDOW_SIZE;
-				accel_z_raw_filter_ = accel_z_raw_acc_ / SLIDING_WINDOW_SIZE;
-				gyro_x_raw_filter_  = gyro_x_raw_acc_ / SLIDING_WINDOW_SIZE;
-				gyro_y_raw_filter_  = gyro_y_raw_acc_ / SLIDING_WINDOW_SIZE;
-				gyro_z_raw_filter_  = gyro_z_raw_acc_ / SLIDING_WINDOW_SIZE;
-
-				int32_t accel[3], gyro[3];
-				accel[0] = accel_x_raw_filter_;
-				accel[1] = accel_y_raw_filter_;
-				accel[2] = accel_z_raw_filter_;
-				gyro[0]  = gyro_x_raw_filter_;
-				gyro[1]  = gyro_y_raw_filter_;
-				gyro[2]  = gyro_z_raw_filter_;
-
-				apply_mounting_matrix(icm_mounting_matrix, accel);
-				apply_mounting_matrix(icm_mounting_matrix, gyro);
-
-				uint16_t accel_fsr_g, gyro_fsr_dps;
-				get_accel_and_gyr_fsr(&accel_fsr_g, &gyro_fsr_dps);
-
-				float accel_x, accel_y, accel_z;
-				float gyro_x, gyro_y, gyro_z;
-				accel_x  = (float)(accel[0] * accel_fsr_g)  / INT16_MAX;
-				accel_y  = (float)(accel[1] * accel_fsr_g)  / INT16_MAX;
-				accel_z  = (float)(accel[2] * accel_fsr_g)  / INT16_MAX;
-				gyro_x   = (float)(gyro[0]  * gyro_fsr_dps) / INT16_MAX;
-				gyro_y   = (float)(gyro[1]  * gyro_fsr_dps) / INT16_MAX;
-				gyro_z   = (float)(gyro[2]  * gyro_fsr_dps) / INT16_MAX;
-
-				gyro_x = (PI / 180) * gyro_x;
-				gyro_y = (PI / 180) * gyro_y;
-				gyro_z = (PI / 180) * gyro_z;
-
-				ImuUpdate(accel_x, accel_y, accel_z, gyro_x, gyro_y, gyro_z);
-				if (++gesture_preprocessing_count_ > 100) gesture_preprocessing_count_ = 101;
-
-				gesture_solved = true;
-			}
-		}while(gesture_preprocessing_count_ <= 100);
-	}
-
-	return gesture_solved;
-}
-
-void ICM4xxxxDriver::ImuUpdate(float accel_x, float accel_y, float accel_z, float gyro_x, float gyro_y, float gyro_z) {
-  float q0temp,q1temp,q2temp,q3temp;
-  float norm;
-  float vx, vy, vz;
-  float ex, ey, ez;
-  float q0q0 = q0_*q0_;
-  float q0q1 = q0_*q1_;
-  float q0q2 = q0_*q2_;
-  float q1q1 = q1_*q1_;
-  float q1q3 = q1_*q3_;
-  float q2q2 = q2_*q2_;
-  float q2q3 = q2_*q3_;
-  float q3q3 = q3_*q3_;
-
-  norm = sqrt(accel_x*accel_x + accel_y*accel_y + accel_z*accel_z);
-  accel_x = accel_x /norm;
-  accel_y = accel_y / norm;
-  accel_z = accel_z / norm;
-
-  vx = 2*(q1q3 - q0q2);
-  vy = 2*(q0q1 + q2q3);
-  vz = q0q0 - q1q1 - q2q2 + q3q3;
-
-  ex = (accel_y*vz - accel_z*vy) ;
-  ey = (accel_z*vx - accel_x*vz) ;
-  ez = (accel_x*vy - accel_y*vx) ;
-
-  exInt_ = exInt_ + ex * Ki;
-  eyInt_ = eyInt_ + ey * Ki;
-  ezInt_ = ezInt_ + ez * Ki;
-
-  gyro_x = gyro_x + Kp*ex + exInt_;
-  gyro_y = gyro_y + Kp*ey + eyInt_;
-  gyro_z = gyro_z + Kp*ez + ezInt_;
-
-  q0temp = q0_;
-  q1temp = q1_;
-  q2temp = q2_;
-  q3temp = q3_;
-
-  q0_ = q0temp + (-q1temp*gyro_x - q2temp*gyro_y -q3temp*gyro_z)*halfT;
-  q1_ = q1temp + (q0temp*gyro_x + q2temp*gyro_z -q3temp*gyro_y)*halfT;
-  q2_ = q2temp + (q0temp*gyro_y - q1temp*gyro_z +q3temp*gyro_x)*halfT;
-  q3_ = q3temp + (q0temp*gyro_z + q1temp*gyro_y -q2temp*gyro_x)*halfT;
-
-  norm = sqrt(q0_*q0_ + q1_*q1_ + q2_*q2_ + q3_*q3_);
-  q0_ = q0_ / norm;
-  q1_ = q1_ / norm;
-  q2_ = q2_ / norm;
-  q3_ = q3_ / norm;
-
-  roll_ = atan2(2 * q2_ * q3_ + 2 * q0_ * q1_, -2 * q1_ * q1_ - 2 * q2_* q2_ + 1)* 57.3;
-	if (fabs(roll_) < 90.0) {
-		pitch_ = asin(-2 * q1_ * q3_ + 2 * q0_* q2_) * 57.3;
+	// sliding window filtering
+	if (sliding_window_index_ == SLIDING_WINDOW_SIZE) {
+		sliding_window_index_ = 0;
+	}
+
+	accel_x_raw_acc_ -= accel_x_raw_buff_[sliding_window_index_];
+	accel_y_raw_acc_ -= accel_y_raw_buff_[sliding_window_index_];
+	accel_z_raw_acc_ -= accel_z_raw_buff_[sliding_window_index_];
+	gyro_x_raw_acc_  -= gyro_x_raw_buff_[sliding_window_index_];
+	gyro_y_raw_acc_  -= gyro_y_raw_buff_[sliding_window_index_];
+	gyro_z_raw_acc_  -= gyro_z_raw_buff_[sliding_window_index_];
+
+	accel_x_raw_buff_[sliding_window_index_] = accel_x_raw_;
+	accel_y_raw_buff_[sliding_window_index_] = accel_y_raw_;
+	accel_z_raw_buff_[sliding_window_index_] = accel_z_raw_;
+	gyro_x_raw_buff_[sliding_window_index_]  = gyro_x_raw_;
+	gyro_y_raw_buff_[sliding_window_index_]  = gyro_y_raw_;
+	gyro_z_raw_buff_[sliding_window_index_]  = gyro_z_raw_;
+
+	accel_x_raw_acc_ += accel_x_raw_buff_[sliding_window_index_];
+	accel_y_raw_acc_ += accel_y_raw_buff_[sliding_window_index_];
+	accel_z_raw_acc_ += accel_z_raw_buff_[sliding_window_index_];
+	gyro_x_raw_acc_  += gyro_x_raw_buff_[sliding_window_index_];
+	gyro_y_raw_acc_  += gyro_y_raw_buff_[sliding_window_index_];
+	gyro_z_raw_acc_  += gyro_z_raw_buff_[sliding_window_index_];
+
+	sliding_window_index_++;
+
+	// in the background only every few samples reach the filter, dt spans the skipped ones
+	bg_dt_us_ += sample_dt_us_;
+	if (background_ && (++bg_skip_ < ICM4xxxx_BG_DECIMATION)) {
+		return;
+	}
+	bg_skip_ = 0;
+
+	accel_x_raw_filter_ = accel_x_raw_acc_ / SLIDING_WINDOW_SIZE;
+	accel_y_raw_filter_ = accel_y_raw_acc_ / SLIDING_WINDOW_SIZE;
+	accel_z_raw_filter_ = accel_z_raw_acc_ / SLIDING_WINDOW_SIZE;
+	gyro_x_raw_filter_  = gyro_x_raw_acc_ / SLIDING_WINDOW_SIZE;
+	gyro_y_raw_filter_  = gyro_y_raw_acc_ / SLIDING_WINDOW_SIZE;
+	gyro_z_raw_filter_  = gyro_z_raw_acc_ / SLIDING_WINDOW_SIZE;
+
+	int32_t accel[3], gyro[3];
+	accel[0] = accel_x_raw_filter_;
+	accel[1] = accel_y_raw_filter_;
+	accel[2] = accel_z_raw_filter_;
+	gyro[0]  = gyro_x_raw_filter_;
+	gyro[1]  = gyro_y_raw_filter_;
+	gyro[2]  = gyro_z_raw_filter_;
+
+	apply_mounting_matrix(icm_mounting_matrix, accel);
+	apply_mounting_matrix(icm_mounting_matrix, gyro);
+
+	// Q24 rad/s, the accel only gives a direction so it stays raw
+	gyro[0] *= gyro_scale_q24_;
+	gyro[1] *= gyro_scale_q24_;
+	gyro[2] *= gyro_scale_q24_;
+
+	ImuUpdate(accel, gyro, bg_dt_us_);
+	bg_dt_us_ = 0;
+	if (++gesture_preprocessing_count_ > 100) gesture_preprocessing_count_ = 101;
+}
+
+void ICM4xxxxDriver::ImuUpdate(const int32_t accel[3], const int32_t gyro[3], uint32_t dt_us) {
+	int32_t a[3], v[3], e[3], h[3];
+	int32_t q0, q1, q2, q3;
+	int32_t dt_q30, ki_dt;
+	uint32_t norm, y;
+	uint8_t shift;
+
+	if (dt_us > ATTITUDE_DT_MAX_US) {
+		dt_us = ATTITUDE_DT_MAX_US;
+	}
+
+	// normalised gravity direction, scale of the raw accel does not matter
+	norm = (uint32_t)(accel[0] * accel[0]) + (uint32_t)(accel[1] * accel[1]) + (uint32_t)(accel[2] * accel[2]);
+	if (norm == 0) {
+		return;
+	}
+	y = InvSqrt(norm, &shift);
+	for (uint8_t i = 0; i < 3; i++) {
+		a[i] = (int32_t)(((int64_t)accel[i] * y) >> shift);
+	}
+
+	int32_t q0q0 = MulQ30(q0_, q0_);
+	int32_t q0q1 = MulQ30(q0_, q1_);
+	int32_t q0q2 = MulQ30(q0_, q2_);
+	int32_t q1q1 = MulQ30(q1_, q1_);
+	int32_t q1q3 = MulQ30(q1_, q3_);
+	int32_t q2q2 = MulQ30(q2_, q2_);
+	int32_t q2q3 = MulQ30(q2_, q3_);
+	int32_t q3q3 = MulQ30(q3_, q3_);
+
+	v[0] = 2 * (q1q3 - q0q2);
+	v[1] = 2 * (q0q1 + q2q3);
+	v[2] = q0q0 - q1q1 - q2q2 + q3q3;
+
+	e[0] = MulQ30(a[1], v[2]) - MulQ30(a[2], v[1]);
+	e[1] = MulQ30(a[2], v[0]) - MulQ30(a[0], v[2]);
+	e[2] = MulQ30(a[0], v[1]) - MulQ30(a[1], v[0]);
+
+	// dt in Q30 seconds, 2^46 / 1e6 = 70368744
+	dt_q30 = (int32_t)(((uint64_t)dt_us * 70368744u) >> 16);
+	ki_dt = MulQ30(MAHONY_KI_Q30, dt_q30);
+	for (uint8_t i = 0; i < 3; i++) {
+		e_int_[i] += (int32_t)(((int64_t)e[i] * ki_dt) >> 36);
+		int32_t w = gyro[i] + (int32_t)(((int64_t)e[i] * MAHONY_KP_Q16) >> 22) + e_int_[i];
+		int64_t half = ((int64_t)w * (dt_q30 >> 1)) >> 24;  // half angle, Q30 rad
+		h[i] = (int32_t)(half > Q30_ONE ? Q30_ONE : (half < -Q30_ONE ? -Q30_ONE : half));
+	}
+
+	q0 = q0_ - MulQ30(q1_, h[0]) - MulQ30(q2_, h[1]) - MulQ30(q3_, h[2]);
+	q1 = q1_ + MulQ30(q0_, h[0]) + MulQ30(q2_, h[2]) - MulQ30(q3_, h[1]);
+	q2 = q2_ + MulQ30(q0_, h[1]) - MulQ30(q1_, h[2]) + MulQ30(q3_, h[0]);
+	q3 = q3_ + MulQ30(q0_, h[2]) + MulQ30(q1_, h[1]) - MulQ30(q2_, h[0]);
+
+	norm = (uint32_t)(((int64_t)q0 * q0 + (int64_t)q1 * q1 + (int64_t)q2 * q2 + (int64_t)q3 * q3) >> 30);
+	y = InvSqrt(norm, &shift);
+	shift += 15;
+	q0_ = (int32_t)(((int64_t)q0 * y) >> shift);
+	q1_ = (int32_t)(((int64_t)q1 * y) >> shift);
+	q2_ = (int32_t)(((int64_t)q2 * y) >> shift);
+	q3_ = (int32_t)(((int64_t)q3 * y) >> shift);
+
+	// degrees = Q29 rad * 180 / pi / 2^29
+	int32_t roll = Atan2Q29(2 * (MulQ30(q2_, q3_) + MulQ30(q0_, q1_)), Q30_ONE - 2 * (MulQ30(q1_, q1_) + MulQ30(q2_, q2_)));
+	int32_t pitch = AsinQ29(2 * (MulQ30(q0_, q2_) - MulQ30(q1_, q3_)));
+	roll_ = (float)roll * (57.29578f / (1 << 29));
+	if ((roll > -843314857) && (roll < 843314857)) {  // |roll| < 90 degrees
+		pitch_ = (float)pitch * (57.29578f / (1 << 29));
 	}
 	else {
-		pitch_ = (fabs(q0_ * q2_ - q1_ * q3_) / (q0_ * q2_ - q1_ * q3_)) * (180.0 - fabs(asin(-2 * q1_ * q3_ + 2 * q0_ * q2_) * 57.3));
+		pitch_ = (pitch < 0 ? -180.0f : 180.0f) - (float)pitch * (57.29578f / (1 << 29));
 	}
 }
 
@@ -604,4 +973,10 @@ uint8_t ICM4xxxxDriver::GetGesture(float & yaw, float & pitch, float & roll) {
 
 float ICM4xxxxDriver::GetTemperature() {
 	return imu_temperature_;
-}
\ No newline at end of file
+}
+extern "C" void __irq_dma1_channel2() {
+	if (DMA_GetITStatus(DMA1_IT_TC2) != RESET) {
+		DMA_ClearITPendingBit(DMA1_IT_GL2);
+		ICM4xxxxDriver::BatchDmaCallBack();
+	}
+}
@@ -5,10 +5,33 @@
 #include "../device_base.h"
 #include "icm42670/inv_imu_transport.h"
 #include "icm42670/inv_imu_driver.h"
+#include "icm42670/inv_imu_apex.h"
 
 #define ICM4xxxx_ENABLE() {GPIO_ResetBits(GPIOA, GPIO_Pin_4);}
 #define ICM4xxxx_DISABLE() {GPIO_SetBits(GPIOA, GPIO_Pin_4);}
 
+#define ICM4xxxx_ODR_PERIOD_MS        20    // 50Hz
+#define ICM4xxxx_FIFO_WATERMARK       5     // packets, one batch every 100ms
+#define ICM4xxxx_BATCH_MAX            8     // packets per DMA transfer
+// no head has INT1 wired to the MCU on record, so the FIFO is polled once per watermark
+// period unless the head hands its verified INT1 pin to EnableFifoInt()
+#define ICM4xxxx_POLL_PERIOD_MS       (ICM4xxxx_ODR_PERIOD_MS * ICM4xxxx_FIFO_WATERMARK)
+// with INT1 enabled, no interrupt seen for this long, read anyway
+#define ICM4xxxx_INT_TIMEOUT_MS       150
+
+// APEX protection: the DMP watches tilt, free fall and sudden motion and the attitude
+// filter only runs in the background while nothing happens. The events are routed to
+// INT1 too, but INT_STATUS2/3 are only read ahead of a FIFO batch, so without INT1 they
+// reach GetEvents() up to one poll period after the DMP flagged them
+#define ICM4xxxx_EVENT_LATENCY_MS     ICM4xxxx_POLL_PERIOD_MS
+#define ICM4xxxx_BG_DECIMATION        5       // 10Hz filter updates while still
+#define ICM4xxxx_ACTIVE_HOLD_MS       2000    // full rate after an event
+#define ICM4xxxx_WOM_THRESHOLD        50      // 1/256g change between two samples
+
+#define ICM_EVENT_TILT                (1<<0)
+#define ICM_EVENT_FREE_FALL           (1<<1)
+#define ICM_EVENT_MOTION              (1<<2)
+
 #define WHO_AM_I_ICM42605     0x42
 #define WHO_AM_I_ICM42670P    0x67
 #define FIFO_PACKET_SIZE      16
@@ -54,6 +77,7 @@
 #define REG_ICM42670P_MADDR_R           0x7D
 #define REG_ICM42670P_M_R               0x7E
 #define REG_ICM42670P_PWR_MEMT0         0x1F
+#define REG_ICM42670P_INT_STATUS2       0x3B
 #define REG_ICM42670P_FIFO_COUNTH       0x3D
 #define REG_ICM42670P_FIFO_COUNTL       0x3E
 #define REG_ICM42670P_FIFO_DATA         0x3F
@@ -81,11 +105,14 @@
 
 #define SLIDING_WINDOW_SIZE   8
 
-#define Kp 10.0f                        // 这里的KpKi是用于调整加速度计修正陀螺仪的速度
+#define Q30_ONE               (1 << 30)
 
-#define Ki 0.008f
+// 这里的KpKi是用于调整加速度计修正陀螺仪的速度
+#define MAHONY_KP_Q16         (10 << 16)                        // rad/s per unit of tilt error
+#define MAHONY_KI_Q30         ((int32_t)(0.4f * Q30_ONE))       // per second, 0.008 per 20ms sample before
 
-#define halfT 0.01f                    // 采样周期的一半，用于求解四元数微分方程时计算角增量
+// FIFO timestamps give the real sample spacing, a gap beyond this falls back to the ODR period
+#define ATTITUDE_DT_MAX_US    200000
 
 /*
  * Select communication link between SmartMotion and IMU
@@ -126,19 +153,48 @@ typedef enum {
   ATTITUDE_SOLVING_DOING,
 }ATTITUDE_SOLVING_STAGE_TYPE;
 
+typedef enum {
+  ICM_PROTECT_POLLING,    // attitude solved for every sample
+  ICM_PROTECT_APEX,       // on-chip events, attitude solved in the background
+} ICM_PROTECT_MODE;
+
+typedef struct {
+  uint8_t buf[ICM4xxxx_BATCH_MAX * FIFO_PACKET_SIZE];
+  volatile uint8_t count;   // packets held, 0 when the buffer is free
+} ICM_BATCH_BUF;
+
 class ICM4xxxxDriver {
   public:
     ICM4xxxxDriver () {
-      q0_ = 1;
+      q0_ = Q30_ONE;
       q1_ = 0;
       q2_ = 0;
       q3_ = 0;
-      exInt_ = 0;
-      eyInt_ = 0;
-      ezInt_ = 0;
+      e_int_[0] = 0;
+      e_int_[1] = 0;
+      e_int_[2] = 0;
+      gyro_scale_q24_ = 0;
+      timestamp_res_us_ = 16;
+      timestamp_last_ = 0;
+      timestamp_valid_ = false;
+      sample_dt_us_ = ICM4xxxx_ODR_PERIOD_MS * 1000;
+      protect_mode_ = ICM_PROTECT_POLLING;
+      events_ = 0;
+      active_time_ = 0;
+      background_ = false;
+      bg_skip_ = 0;
+      bg_dt_us_ = 0;
       gesture_preprocessing_count_ = 0;
       who_am_i_ = 0xff;
       imu_inited_ = false;
+      fifo_int_enabled_ = false;
+      fifo_int_pending_ = false;
+      batch_fill_ = 0;
+      batch_read_ = 0;
+      batch_dma_count_ = 0;
+      batch_time_ = 0;
+      batch_[0].count = 0;
+      batch_[1].count = 0;
     }
     void SPIInit();
     int setup_mcu(struct inv_imu_serif *icm_serif);
@@ -146,12 +202,25 @@ class ICM4xxxxDriver {
     int configure_imu_device();
     bool get_imu_data(void);
     bool ChipInit();
+    // after a successful ChipInit(), only for hardware where INT1 is known to reach this pin
+    void EnableFifoInt(uint8_t pin);
     void GetRawDataFromDataReg();
     bool GetRawDataFromFIFO();
     bool AttitudeSolving();
-    void ImuUpdate(float accel_x, float accel_y, float accel_z, float gyro_x, float gyro_y, float gyro_z);
+    void ImuUpdate(const int32_t accel[3], const int32_t gyro[3], uint32_t dt_us);
     uint8_t GetGesture(float & yaw, float & pitch, float & roll);
     float GetTemperature();
+    bool SetProtectMode(ICM_PROTECT_MODE mode);
+    // APEX events seen since the last call
+    uint8_t GetEvents();
+    static void FifoIntCallBack(uint8_t pin_source);
+    static void BatchDmaCallBack(void);
+  private:
+    bool BatchReadInit();
+    void BatchReadStart();
+    uint8_t BatchDecode(ICM_BATCH_BUF *batch);
+    void ApexEventRead(uint32_t now);
+    void AttitudeUpdate();
   private:
     uint8_t who_am_i_;
     bool imu_inited_;
@@ -184,12 +253,33 @@ class ICM4xxxxDriver {
     uint16_t gesture_preprocessing_count_;
 
     ATTITUDE_SOLVING_STAGE_TYPE attitude_solving_stage;
-    float q0_, q1_, q2_, q3_;
-    float exInt_, eyInt_, ezInt_;
+    int32_t q0_, q1_, q2_, q3_;     // Q30
+    int32_t e_int_[3];              // Q24 rad/s
+    int32_t gyro_scale_q24_;        // rad/s per LSB
+    uint32_t timestamp_res_us_;
+    uint16_t timestamp_last_;
+    bool timestamp_valid_;
+    uint32_t sample_dt_us_;
+
+    ICM_PROTECT_MODE protect_mode_;
+    uint8_t events_;
+    uint32_t active_time_;          // us, last APEX event
+    bool background_;
+    uint8_t bg_skip_;
+    uint32_t bg_dt_us_;
 
     float yaw_;
     float pitch_;
     float roll_;
+
+    // FIFO batches land here by DMA, one buffer is filled while the other is decoded
+    ICM_BATCH_BUF batch_[2];
+    bool fifo_int_enabled_;
+    volatile bool fifo_int_pending_;
+    volatile uint8_t batch_fill_;
+    uint8_t batch_read_;
+    uint8_t batch_dma_count_;
+    uint32_t batch_time_;   // us
   public:
     struct inv_imu_serif icm_serif_;
     struct inv_imu_device icm_driver_;
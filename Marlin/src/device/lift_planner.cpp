@@ -0,0 +1,104 @@
+/*
+ * Snapmaker2-Modules Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Modules
+ * (see https://github.com/Snapmaker/Snapmaker2-Modules)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <math.h>
+#include "lift_planner.h"
+
+// the lift screw has no cornering, only a direction change forces a full stop
+static float JunctionSpeed(const move_block_t *prev, const move_block_t *next) {
+  if (prev->stepps == 0 || next->stepps == 0 || ((prev->length < 0) != (next->length < 0))) {
+    return 0;
+  }
+  return (prev->speed < next->speed) ? prev->speed : next->speed;
+}
+
+float LiftPlanExitSpeed(const move_block_t *queue, uint8_t head, uint8_t tail, float entry_speed) {
+  // backward pass over the queue: the fastest each later block may be entered
+  // at and still come to a stop at the end of the queue
+  float limit_speed = 0;
+  for (uint8_t i = tail; i != head; ) {
+    uint8_t j = (i + Z_MOVE_QUEUE_SIZE - 1) % Z_MOVE_QUEUE_SIZE;
+    if (j == head) {
+      break;
+    }
+    uint8_t prev = (j + Z_MOVE_QUEUE_SIZE - 1) % Z_MOVE_QUEUE_SIZE;
+    float junction = JunctionSpeed(&queue[prev], &queue[j]);
+    limit_speed = sqrt(limit_speed * limit_speed + 2 * Z_ACCELERATION * fabs(queue[j].length));
+    if (limit_speed > junction) {
+      limit_speed = junction;
+    }
+    i = j;
+  }
+
+  float exit_speed = sqrt(entry_speed * entry_speed + 2 * Z_ACCELERATION * fabs(queue[head].length));
+  if (exit_speed > limit_speed) {
+    exit_speed = limit_speed;
+  }
+  return exit_speed;
+}
+
+void LiftPlanSpeedCtrl(speed_node_t *speed_ctrl, uint32_t stepps_sum, float length,
+                       float entry_speed, float speed, float exit_speed) {
+  if (stepps_sum == 0) {
+    for (int32_t i = 0; i < Z_SPEED_CTRL_NODES; i++) {
+      speed_ctrl[i].pulse_count = 0;
+      speed_ctrl[i].timer_time  = 100;
+    }
+    return;
+  }
+
+  // calculate the number of pulses needed to accelerate from the entry speed and decelerate to the exit speed
+  float acc_time = (speed - entry_speed) / Z_ACCELERATION;
+  float dec_time = (speed - exit_speed) / Z_ACCELERATION;
+  float acc_stepps = (entry_speed + speed) / 2 * acc_time * Z_AXIS_STEPS_PER_UNIT;
+  float dec_stepps = (speed + exit_speed) / 2 * dec_time * Z_AXIS_STEPS_PER_UNIT;
+
+  if (acc_stepps + dec_stepps > stepps_sum) {
+    // no room to reach the nominal speed, peak where both ramps meet
+    speed = sqrt((2 * Z_ACCELERATION * length + entry_speed * entry_speed + exit_speed * exit_speed) / 2);
+    acc_time = (speed - entry_speed) / Z_ACCELERATION;
+    dec_time = (speed - exit_speed) / Z_ACCELERATION;
+    dec_stepps = (speed + exit_speed) / 2 * dec_time * Z_AXIS_STEPS_PER_UNIT;
+  }
+
+  // calculate the number of pulses to be traveled for each portion of the acceleration process
+  float quantum = acc_time / 10;
+  float t = quantum;
+  for (int32_t i = 0; i < 10; i++) {
+    speed_ctrl[i].pulse_count = (entry_speed * t + Z_ACCELERATION * (t * t) / 2) * Z_AXIS_STEPS_PER_UNIT;
+    speed_ctrl[i].timer_time  = 1000000 / ((entry_speed + Z_ACCELERATION * t) * Z_AXIS_STEPS_PER_UNIT);
+    t += quantum;
+  }
+
+  // the last acceleration portion runs on through the uniform process
+  speed_ctrl[9].pulse_count = stepps_sum - (uint32_t)dec_stepps;
+
+  // calculate the number of pulses to be traveled for each portion of the decleration process
+  quantum = dec_time / 10;
+  t = quantum;
+  for (int32_t i = 0; i < 10; i++) {
+    speed_ctrl[10+i].pulse_count = speed_ctrl[9].pulse_count + (speed * t - Z_ACCELERATION * (t * t) / 2) * Z_AXIS_STEPS_PER_UNIT;
+    speed_ctrl[10+i].timer_time  = 1000000 / ((speed - Z_ACCELERATION * (t - quantum)) * Z_AXIS_STEPS_PER_UNIT);
+    t += quantum;
+  }
+
+  // just in case
+  speed_ctrl[Z_SPEED_CTRL_NODES - 1].pulse_count = stepps_sum;
+}
@@ -0,0 +1,56 @@
+/*
+ * Snapmaker2-Modules Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Modules
+ * (see https://github.com/Snapmaker/Snapmaker2-Modules)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MODULES_WHIMSYCWD_MARLIN_SRC_DEVICE_LIFT_PLANNER_H_
+#define MODULES_WHIMSYCWD_MARLIN_SRC_DEVICE_LIFT_PLANNER_H_
+
+#include <stdint.h>
+
+// speed planning of the dual extruder lift, the stepper ISR walks the speed control
+// table of the running block and swaps to the staged one at its end
+// #define Z_AXIS_STEPS_PER_UNIT          1600         // 2mm/r
+#define Z_AXIS_STEPS_PER_UNIT          3200         // 1mm/r
+#define Z_ACCELERATION                 40           // mm/s2
+#define Z_MOVE_QUEUE_SIZE              8            // blocks waiting behind the running one
+#define Z_SPEED_CTRL_NODES             20
+
+typedef struct {
+  uint32_t pulse_count;
+  uint16_t timer_time;
+}speed_node_t;
+
+typedef struct {
+  uint32_t stepps;
+  float length;       // signed relative distance, mm
+  float position;     // position once the block is finished, mm
+  float speed;        // nominal speed, mm/s
+  uint8_t report;     // send a completion event to the host
+}move_block_t;
+
+// exit speed of the queued block at head when entered at entry_speed, as fast as it
+// gets there but slow enough for the blocks behind it to stop at the end of the queue
+float LiftPlanExitSpeed(const move_block_t *queue, uint8_t head, uint8_t tail, float entry_speed);
+// 10 acceleration nodes from the entry speed, the last one cruising, then 10
+// deceleration nodes down to the exit speed
+void LiftPlanSpeedCtrl(speed_node_t *speed_ctrl, uint32_t stepps_sum, float length,
+                       float entry_speed, float speed, float exit_speed);
+
+#endif  // MODULES_WHIMSYCWD_MARLIN_SRC_DEVICE_LIFT_PLANNER_H_
@@ -0,0 +1,190 @@
+/*
+ * Snapmaker2-Modules Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Modules
+ * (see https://github.com/Snapmaker/Snapmaker2-Modules)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <libmaple/systick.h>
+#include "src/device/light_timeline.h"
+
+// 2.2 gamma, perceptually even fades from 8 bit keyframes
+static const uint8_t light_gamma[256] = {
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   1,
+    1,   1,   1,   1,   1,   1,   1,   1,   1,   2,   2,   2,   2,   2,   2,   2,
+    3,   3,   3,   3,   3,   4,   4,   4,   4,   5,   5,   5,   5,   6,   6,   6,
+    6,   7,   7,   7,   8,   8,   8,   9,   9,   9,  10,  10,  11,  11,  11,  12,
+   12,  13,  13,  13,  14,  14,  15,  15,  16,  16,  17,  17,  18,  18,  19,  19,
+   20,  20,  21,  22,  22,  23,  23,  24,  25,  25,  26,  26,  27,  28,  28,  29,
+   30,  30,  31,  32,  33,  33,  34,  35,  35,  36,  37,  38,  39,  39,  40,  41,
+   42,  43,  43,  44,  45,  46,  47,  48,  49,  49,  50,  51,  52,  53,  54,  55,
+   56,  57,  58,  59,  60,  61,  62,  63,  64,  65,  66,  67,  68,  69,  70,  71,
+   73,  74,  75,  76,  77,  78,  79,  81,  82,  83,  84,  85,  87,  88,  89,  90,
+   91,  93,  94,  95,  97,  98,  99, 100, 102, 103, 105, 106, 107, 109, 110, 111,
+  113, 114, 116, 117, 119, 120, 121, 123, 124, 126, 127, 129, 130, 132, 133, 135,
+  137, 138, 140, 141, 143, 145, 146, 148, 149, 151, 153, 154, 156, 158, 159, 161,
+  163, 165, 166, 168, 170, 172, 173, 175, 177, 179, 181, 182, 184, 186, 188, 190,
+  192, 194, 196, 197, 199, 201, 203, 205, 207, 209, 211, 213, 215, 217, 219, 221,
+  223, 225, 227, 229, 231, 234, 236, 238, 240, 242, 244, 246, 248, 251, 253, 255,
+};
+
+LightTimeline *LightTimeline::p_timeline_ = NULL;
+
+bool LightTimeline::Set(const LIGHT_KEYFRAME_T *keys, uint8_t count, uint8_t flags, uint16_t spread_ms) {
+  int32_t t = 0;
+  if (count == 0 || count > LIGHT_KEYFRAME_MAX)
+    return false;
+
+  Stop();
+  for (uint8_t i = 0; i < count; i++) {
+    keys_[i] = keys[i];
+    if (i > 0)
+      t += keys[i].fade_ms;
+    key_ms_[i] = t;
+    fade_recip_[i] = keys[i].fade_ms ? ((1u << 24) / keys[i].fade_ms) : 0;
+  }
+  // a loop closes with the fade back into the first keyframe
+  total_ms_ = (flags & LIGHT_TIMELINE_LOOP) ? t + keys[0].fade_ms : t;
+  if ((flags & LIGHT_TIMELINE_LOOP) && total_ms_ == 0)
+    return false;
+  key_count_ = count;
+  flags_ = flags;
+  spread_ms_ = spread_ms;
+  return true;
+}
+
+bool LightTimeline::Set(uint8_t *data, uint16_t data_len) {
+  LIGHT_KEYFRAME_T keys[LIGHT_KEYFRAME_MAX];
+  uint8_t count;
+  if (data_len < 4)
+    return false;
+  count = data[1];
+  if (count == 0 || count > LIGHT_KEYFRAME_MAX || data_len < 4 + count * LIGHT_KEYFRAME_DATA_LEN)
+    return false;
+
+  uint8_t *p = data + 4;
+  for (uint8_t i = 0; i < count; i++, p += LIGHT_KEYFRAME_DATA_LEN) {
+    keys[i].color.r = p[0];
+    keys[i].color.g = p[1];
+    keys[i].color.b = p[2];
+    keys[i].fade_ms = (p[3] << 8) | p[4];
+  }
+  return Set(keys, count, data[0], (data[2] << 8) | data[3]);
+}
+
+void LightTimeline::Start(uint8_t led_count) {
+  Stop();
+  led_count_ = led_count > LIGHT_TIMELINE_LED_MAX ? LIGHT_TIMELINE_LED_MAX : led_count;
+  time_ms_ = 0;
+  frame_tick_ = LIGHT_TIMELINE_FRAME_MS;  // render the first frame on the next tick
+  frame_ready_ = false;
+  if (p_timeline_ == NULL) {
+    systick_attach_callback(TickCallBack);
+  }
+  p_timeline_ = this;
+  running_ = (key_count_ > 0);
+}
+
+void LightTimeline::Stop() {
+  running_ = false;
+  frame_ready_ = false;
+}
+
+bool LightTimeline::TakeFrame(RGB_T *dst) {
+  if (!frame_ready_)
+    return false;
+  for (uint8_t i = 0; i < led_count_; i++) {
+    dst[i] = frame_[i];
+  }
+  frame_ready_ = false;
+  return true;
+}
+
+void LightTimeline::TickCallBack(void) {
+  if (p_timeline_ && p_timeline_->running_)
+    p_timeline_->Tick();
+}
+
+void LightTimeline::Tick() {
+  if (++time_ms_ >= total_ms_ && (flags_ & LIGHT_TIMELINE_LOOP))
+    time_ms_ -= total_ms_;
+
+  if (frame_tick_ < LIGHT_TIMELINE_FRAME_MS)
+    frame_tick_++;
+  // the owner has not taken the last frame yet, hold the frame and keep the time
+  if (frame_tick_ < LIGHT_TIMELINE_FRAME_MS || frame_ready_)
+    return;
+  frame_tick_ = 0;
+
+  for (uint8_t i = 0; i < led_count_; i++) {
+    Eval(time_ms_ - (int32_t)spread_ms_ * i, &frame_[i]);
+  }
+  frame_ready_ = true;
+
+  // a one shot ends once every led has reached the last keyframe, its final frame is still taken
+  if (!(flags_ & LIGHT_TIMELINE_LOOP) && time_ms_ >= total_ms_ + (int32_t)spread_ms_ * led_count_)
+    running_ = false;
+}
+
+void LightTimeline::Eval(int32_t t, RGB_T *out) {
+  uint8_t i = 0;
+  uint8_t next;
+  uint32_t frac;
+  RGB_T color;
+
+  if (flags_ & LIGHT_TIMELINE_LOOP) {
+    while (t < 0)
+      t += total_ms_;
+  } else if (t < 0) {
+    t = 0;
+  }
+
+  while (i + 1 < key_count_ && t >= key_ms_[i + 1])
+    i++;
+
+  if (i + 1 < key_count_) {
+    next = i + 1;
+  } else if (flags_ & LIGHT_TIMELINE_LOOP) {
+    next = 0;
+  } else {
+    next = i;
+  }
+
+  if (next == i || keys_[next].fade_ms == 0) {
+    color = keys_[i].color;
+  } else {
+    // Q16 position inside the fade, 65536 lands exactly on the keyframe
+    uint32_t dt = t - key_ms_[i];
+    if (dt >= keys_[next].fade_ms) {
+      frac = 65536;
+    } else {
+      // dt < fade_ms keeps dt * (2^24 / fade_ms) below 2^24
+      frac = (dt * fade_recip_[next]) >> 8;
+      if (frac > 65536)
+        frac = 65536;
+    }
+    color.r = keys_[i].color.r + (((int32_t)keys_[next].color.r - keys_[i].color.r) * (int32_t)frac >> 16);
+    color.g = keys_[i].color.g + (((int32_t)keys_[next].color.g - keys_[i].color.g) * (int32_t)frac >> 16);
+    color.b = keys_[i].color.b + (((int32_t)keys_[next].color.b - keys_[i].color.b) * (int32_t)frac >> 16);
+  }
+
+  if (flags_ & LIGHT_TIMELINE_GAMMA) {
+    color.r = light_gamma[color.r];
+    color.g = light_gamma[color.g];
+    color.b = light_gamma[color.b];
+  }
+  *out = color;
+}
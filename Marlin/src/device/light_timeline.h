@@ -0,0 +1,76 @@
+/*
+ * Snapmaker2-Modules Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Modules
+ * (see https://github.com/Snapmaker/Snapmaker2-Modules)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef MODULES_WHIMSYCWD_MARLIN_SRC_DEVICE_LIGHT_TIMELINE_H_
+#define MODULES_WHIMSYCWD_MARLIN_SRC_DEVICE_LIGHT_TIMELINE_H_
+
+#include <stdint.h>
+#include "src/HAL/hal_RGB.h"
+
+#define LIGHT_KEYFRAME_MAX       16
+#define LIGHT_TIMELINE_LED_MAX   16
+#define LIGHT_TIMELINE_FRAME_MS  10    // 100Hz, counted on the 1ms systick
+#define LIGHT_KEYFRAME_DATA_LEN  5     // r, g, b, fade_ms high, fade_ms low
+
+#define LIGHT_TIMELINE_LOOP      (1<<0)
+#define LIGHT_TIMELINE_GAMMA     (1<<1)
+
+typedef struct {
+  RGB_T color;
+  uint16_t fade_ms;  // time to move from the previous keyframe to this one
+} LIGHT_KEYFRAME_T;
+
+// Keyframe animation shared by the light devices.
+// The systick callback advances the time and renders each frame into an internal buffer,
+// the owner takes the frame from its loop and pushes it to the hardware.
+class LightTimeline {
+ public:
+  bool Set(const LIGHT_KEYFRAME_T *keys, uint8_t count, uint8_t flags, uint16_t spread_ms = 0);
+  // flags, count, spread_ms (2 bytes), then count * LIGHT_KEYFRAME_DATA_LEN bytes
+  bool Set(uint8_t *data, uint16_t data_len);
+  void Start(uint8_t led_count);
+  void Stop();
+  bool Running() { return running_; }
+  // copies the new frame into dst, false when none is pending
+  bool TakeFrame(RGB_T *dst);
+
+ private:
+  static void TickCallBack(void);
+  void Tick();
+  void Eval(int32_t t, RGB_T *out);
+
+ private:
+  static LightTimeline *p_timeline_;
+  volatile bool running_ = false;
+  volatile bool frame_ready_ = false;
+  uint8_t flags_ = 0;
+  uint8_t key_count_ = 0;
+  uint8_t led_count_ = 0;
+  uint8_t frame_tick_ = 0;
+  uint16_t spread_ms_ = 0;
+  int32_t time_ms_ = 0;
+  int32_t total_ms_ = 0;
+  LIGHT_KEYFRAME_T keys_[LIGHT_KEYFRAME_MAX];
+  int32_t key_ms_[LIGHT_KEYFRAME_MAX];      // time each keyframe is reached
+  uint32_t fade_recip_[LIGHT_KEYFRAME_MAX]; // Q24 2^24 / fade_ms, no divide per frame
+  RGB_T frame_[LIGHT_TIMELINE_LED_MAX];
+};
+
+#endif  // MODULES_WHIMSYCWD_MARLIN_SRC_DEVICE_LIGHT_TIMELINE_H_
@@ -20,23 +20,39 @@
  */
 #include <string.h>
 #include <io.h>
-#include "src/device/soft_pwm.h"
 #include "src/device/rgb_light.h"
 #include <wirish_time.h>
 
-#define BREATH_ONCE_TIME_MS 5
-
 void RGBLight::FullColor(RGB_T rgb) {
   for (uint8_t i = 0; i < light_count_; i++) {
       light_list_[i] = rgb;
   }
-  HAL_SetAllRGB(light_pin_, light_list_, light_count_);
+  Show(light_list_);
+}
+
+void RGBLight::Show(RGB_T *rgb) {
+  if (memcmp(frame_, rgb, light_count_ * sizeof(RGB_T)) != 0) {
+    CopyRGB(frame_, rgb, light_count_);
+    frame_dirty_ = true;
+  }
+  Flush();
+}
+
+void RGBLight::Flush() {
+  if (!frame_dirty_ || HAL_RGBBusy() || (millis() - frame_time_) < RGB_FRAME_GAP_MS)
+    return;
+  if (HAL_SetAllRGB(frame_, light_count_)) {
+    frame_dirty_ = false;
+    frame_time_ = millis();
+  }
 }
 
 void RGBLight::Loop() {
   switch (cur_mode_) {
     case MODE_BREATH:
-      BreathProcess();
+    case MODE_FLICKER:
+    case MODE_TIMELINE:
+      TimelineProcess();
       break;
     case MODE_STATIC:
       StaticProcess();
@@ -44,11 +60,10 @@ void RGBLight::Loop() {
     case MODE_WATERFALL:
       WaterfallProcess();
       break;
-    case MODE_FLICKER:
-      FlickeringProcess();
     default:
       break;
   }
+  Flush();
 }
 
 void RGBLight::CopyRGB(RGB_T *dst, RGB_T *src, uint8_t count) {
@@ -57,87 +72,75 @@ void RGBLight::CopyRGB(RGB_T *dst, RGB_T *src, uint8_t count) {
   }
 }
 
-void RGBLight::Init(uint8_t pin, uint8_t light_count, SOFT_EXTI_LINE_E exti) {
+void RGBLight::Init(uint8_t pin, uint8_t light_count) {
   RGB_T default_color = {0, 0, 0};
   light_count_ = light_count;
   light_pin_ = pin;
   light_list_ = new RGB_T[light_count_];
-  HAL_RGBInit(light_pin_, exti);
+  frame_ = new RGB_T[light_count_];
+  frame_dirty_ = true;  // the first frame is always sent
+  HAL_RGBInit(light_pin_, light_count_);
   FullColor(default_color);
   cur_mode_ = MODE_STATIC;
 }
 
 void RGBLight::BreathLight(RGB_T min_color, RGB_T max_color, uint32_t breathe_period_ms) {
-  uint8_t i = 0;
-  uint32_t pwm_period = SOFT_PWM_MS(BREATH_ONCE_TIME_MS);
-  total_step_ = breathe_period_ms / BREATH_ONCE_TIME_MS / 2;
-  uint8_t * p_min = (uint8_t *)&min_color;
-  uint8_t * p_max = (uint8_t *)&max_color;
-  for (i = 0; i < 3; i++) {
-    if (p_min[i] > 255)
-      p_min[i] = 0;
-    if (p_max[i] < p_min[i] || p_max[i] > 255)
-      p_max[i] = 255;
-    breathe_min_pwm[i] = pwm_period * p_min[i] / 255;
-    breathe_max_pwm[i] = pwm_period * p_max[i] / 255;
-    one_step_[i] = (float)(breathe_max_pwm[i] - breathe_min_pwm[i]) / total_step_;
+  uint16_t half = breathe_period_ms / 2 > 0xffff ? 0xffff : breathe_period_ms / 2;
+  LIGHT_KEYFRAME_T keys[2] = {{min_color, half}, {max_color, half}};
+  if (timeline_.Set(keys, 2, LIGHT_TIMELINE_LOOP | LIGHT_TIMELINE_GAMMA)) {
+    timeline_.Start(light_count_);
+    cur_mode_ = MODE_BREATH;
   }
-  cur_mode_ = MODE_BREATH;
-  cur_step_ = 0;
-  dir_ = true;
+}
+
+bool RGBLight::Animate(uint8_t *data, uint16_t data_len) {
+  if (!timeline_.Set(data, data_len))
+    return false;
+  timeline_.Start(light_count_);
+  cur_mode_ = MODE_TIMELINE;
+  return true;
 }
 
 
 void RGBLight::WaterfallLight(RGB_T *color, uint32_t delay_ms) {
+  timeline_.Stop();
   CopyRGB(light_list_, color, light_count_);
   wait_ms_ = delay_ms;
   cur_mode_ = MODE_WATERFALL;
 }
 
 void RGBLight::StaticLight(RGB_T *color) {
+  timeline_.Stop();
   CopyRGB(light_list_, color, light_count_);
-  HAL_SetAllRGB(light_pin_, light_list_, light_count_);
+  Show(light_list_);
   cur_mode_ = MODE_STATIC;
 }
 
 void RGBLight::StaticLight(RGB_T rgb) {
+  timeline_.Stop();
   FullColor(rgb);
   cur_mode_ = MODE_STATIC;
 }
 
 void RGBLight::FlickeringLight(RGB_T rgb, uint32_t delay_ms) {
-  FullColor(rgb);
-  wait_ms_ = delay_ms;
-  cur_mode_ = MODE_FLICKER;
+  uint16_t wait = delay_ms > 0xffff ? 0xffff : delay_ms;
+  RGB_T off = {0, 0, 0};
+  LIGHT_KEYFRAME_T keys[4] = {{rgb, 0}, {rgb, wait}, {off, 0}, {off, wait}};
+  if (timeline_.Set(keys, 4, LIGHT_TIMELINE_LOOP)) {
+    timeline_.Start(light_count_);
+    cur_mode_ = MODE_FLICKER;
+  }
 }
 
-void RGBLight::BreathProcess() {
-  if ((execute_time_ + BREATH_ONCE_TIME_MS) < millis()) {
-    execute_time_ = millis();
-    uint8_t out[3];
-    for (int i = 0; i < 3; i++) {
-      uint32_t temp = (uint32_t)(cur_step_ * one_step_[i]) + breathe_min_pwm[i];
-      out[i] = temp > 255 ? 255 : temp;
-    }
-    FullColor(*((RGB_T *)out));
-    if (dir_) {
-      cur_step_++;
-      if (cur_step_ >= (total_step_)) {
-        dir_ = false;
-      }
-    } else {
-      cur_step_--;
-      if (cur_step_ == 0) {
-        dir_ = true;
-      }
-    }
-  }
+void RGBLight::TimelineProcess() {
+  if (timeline_.TakeFrame(light_list_))
+    Show(light_list_);
 }
 
 void RGBLight::WaterfallProcess() {
   if ((execute_time_ + wait_ms_) < millis()) {
     execute_time_ = millis();
-    HAL_SetAllRGB(light_pin_, light_list_, light_count_);
+    Show(light_list_);
     RGB_T temp_color = light_list_[light_count_ - 1];
     for (uint8_t i = 1; i < light_count_; i++) {
       light_list_[light_count_ - i] = light_list_[light_count_ - i - 1];
@@ -147,23 +150,6 @@ void RGBLight::WaterfallProcess() {
 }
 
 void RGBLight::StaticProcess() {
-  if (execute_time_ < millis()) {
-    execute_time_ = millis() + 300;
-    HAL_SetAllRGB(light_pin_, light_list_, light_count_);
-  }
-}
-
-void RGBLight::FlickeringProcess() {
-  static uint8_t flag = 0;
-  if (execute_time_ < millis()) {
-    execute_time_ = millis() + wait_ms_;
-    if (flag) {
-      HAL_SetAllRGB(light_pin_, light_list_, light_count_);
-    } else {
-      RGB_T rgb[] = {{0,0,0}, {0,0,0}, {0,0,0},  {0,0,0}, {0,0,0}, {0,0,0}, {0,0,0}, {0,0,0}, {0,0,0}, {0,0,0}, {0,0,0}, {0,0,0}};
-      HAL_SetAllRGB(light_pin_, rgb, light_count_);
-    }
-    flag = !flag;
-  }
+  Show(light_list_);
 }
 
@@ -23,44 +23,48 @@
 
 #include <stdint.h>
 #include "src/HAL/hal_RGB.h"
+#include "src/device/light_timeline.h"
 #define TIM_FREQUENCY 100000
+#define RGB_FRAME_GAP_MS 2  // > 280us low between frames so the strip latches
 
 typedef enum {
   MODE_BREATH,
   MODE_WATERFALL,
   MODE_STATIC,
   MODE_FLICKER,
+  MODE_TIMELINE,
 }LIGHT_MODE_t;
 
 class RGBLight {
  public:
-  void Init(uint8_t pin, uint8_t light_count, SOFT_EXTI_LINE_E exti);
+  void Init(uint8_t pin, uint8_t light_count);
   void BreathLight(RGB_T min_color, RGB_T max_color, uint32_t breathe_period_ms);
   void WaterfallLight(RGB_T *rgb_list, uint32_t delay_ms);
   void StaticLight(RGB_T *rgb_list);
   void StaticLight(RGB_T rgb);
   void FlickeringLight(RGB_T rgb, uint32_t delay_ms);
+  // keyframes defined by the host, see LightTimeline::Set
+  bool Animate(uint8_t *data, uint16_t data_len);
   void Loop();
 
  private:
   void FullColor(RGB_T rgb);
-  void BreathProcess();
   void WaterfallProcess();
   void StaticProcess();
-  void FlickeringProcess();
+  void TimelineProcess();
   void CopyRGB(RGB_T *dst, RGB_T *src, uint8_t count);
+  void Show(RGB_T *rgb);
+  void Flush();
 
  private:
   uint8_t light_count_ = 0;
   uint8_t light_pin_;
   RGB_T * light_list_;
+  RGB_T * frame_;  // last frame handed to Show(), sent only when it changed
+  bool frame_dirty_ = false;
+  uint32_t frame_time_ = 0;
   uint32_t execute_time_ = 0;
-  float one_step_[3];
-  uint32_t total_step_= 0;
-  uint32_t cur_step_ = 0;
-  bool dir_ = true;
-  uint32_t breathe_min_pwm[3];
-  uint32_t breathe_max_pwm[3];
+  LightTimeline timeline_;
 
   uint32_t wait_ms_ = 0;
 
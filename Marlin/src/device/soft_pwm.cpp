@@ -22,6 +22,7 @@
 #include <stdexcept>
 #include <board/board.h>
 #include <io.h>
+#include <boards.h>
 #include <src/HAL/hal_tim.h>
 #include "src/device/soft_pwm.h"
 
@@ -35,41 +36,104 @@ void SoftPwm::HalTimInit() {
   if (this->tim_init_falg_ == true) {
     return ;
   }
-  HAL_timer_init(SOFT_PWM_TIM, 72, 10);
+  this->next_ticks_ = SOFT_PWM_MIN_TICKS;
+  HAL_timer_init(SOFT_PWM_TIM, SOFT_PWM_TIM_PRESCALER, SOFT_PWM_MIN_TICKS);
   HAL_timer_nvic_init(SOFT_PWM_TIM, 3, 3);
   HAL_timer_cb_init(SOFT_PWM_TIM, PwmTimIsrCallBack);
   HAL_timer_enable(SOFT_PWM_TIM);
   this->tim_init_falg_ = true;
 }
 
+// the timer is shared, restart every channel from the start of its period
+void SoftPwm::ScheduleReset() {
+  for (int i = 0; i < this->used_count_; i++) {
+    this->remaining_[i] = 0;
+    this->at_start_[i] = true;
+  }
+  this->next_ticks_ = SOFT_PWM_MIN_TICKS;
+}
+
 void SoftPwm::TimStart() {
-  HAL_timer_init(SOFT_PWM_TIM, 72, 10);
+  ScheduleReset();
+  HAL_timer_init(SOFT_PWM_TIM, SOFT_PWM_TIM_PRESCALER, SOFT_PWM_MIN_TICKS);
   HAL_timer_nvic_init(SOFT_PWM_TIM, 3, 3);
   HAL_timer_cb_init(SOFT_PWM_TIM, PwmTimIsrCallBack);
   HAL_timer_enable(SOFT_PWM_TIM);
 }
 
 void SoftPwm::Isr() {
-  for (int i = 0; i < this->used_count_; i++) {
-    if (this->cnt_[i] < (this->threshold_[i])) {
-      digitalWrite(this->pin_list_[i], HIGH);
-    } else {
-      digitalWrite(this->pin_list_[i], LOW);
+  uint32_t bsrr[PWM_MAX_COUNT] = {0};
+  uint8_t count = this->used_count_;
+  int32_t elapsed = this->next_ticks_;
+  int32_t next;
+
+  do {
+    next = SOFT_PWM_MAX_TICKS;
+    for (int i = 0; i < count; i++) {
+      uint32_t *port_bsrr = &bsrr[this->port_index_[i]];
+      uint32_t mask = this->pin_mask_[i];
+      this->remaining_[i] -= elapsed;
+      while (this->remaining_[i] <= 0) {
+        if (this->at_start_[i]) {
+          uint32_t threshold = this->threshold_[i];
+          this->active_threshold_[i] = threshold;
+          if (threshold == 0) {
+            *port_bsrr = (*port_bsrr & ~mask) | (mask << 16);
+            this->remaining_[i] += this->period_[i];
+          } else if (threshold >= this->period_[i]) {
+            *port_bsrr = (*port_bsrr & ~(mask << 16)) | mask;
+            this->remaining_[i] += this->period_[i];
+          } else {
+            *port_bsrr = (*port_bsrr & ~(mask << 16)) | mask;
+            this->remaining_[i] += threshold;
+            this->at_start_[i] = false;
+          }
+        } else {
+          *port_bsrr = (*port_bsrr & ~mask) | (mask << 16);
+          this->remaining_[i] += this->period_[i] - this->active_threshold_[i];
+          this->at_start_[i] = true;
+        }
+      }
+      if (this->remaining_[i] < next) {
+        next = this->remaining_[i];
+      }
+    }
+    elapsed = next;
+  } while (next < SOFT_PWM_MIN_TICKS);
+
+  for (int i = 0; i < this->port_count_; i++) {
+    if (bsrr[i]) {
+      *this->port_bsrr_[i] = bsrr[i];
     }
-    this->cnt_[i] = (this->cnt_[i] + 1) % this->period_[i];
   }
+  this->next_ticks_ = next;
+  HAL_timer_set_period(SOFT_PWM_TIM, next);
 }
 
 int SoftPwm::AddPwm(uint8_t pwm_pin, uint32_t period) {
   uint8_t cur_index = this->used_count_;
-  if (cur_index >= PWM_MAX_COUNT) {
+  uint8_t port;
+  if (cur_index >= PWM_MAX_COUNT || period == 0 || period > SOFT_PWM_MAX_TICKS) {
     return -1;
   }
+  volatile uint32_t *bsrr = (volatile uint32_t *)&PIN_MAP[pwm_pin].gpio_device->regs->BSRR;
+  for (port = 0; port < this->port_count_; port++) {
+    if (this->port_bsrr_[port] == bsrr)
+      break;
+  }
+  if (port == this->port_count_) {
+    this->port_bsrr_[port] = bsrr;
+    this->port_count_++;
+  }
   HalTimInit();
   this->pin_list_[cur_index] = pwm_pin;
   this->threshold_[cur_index] = 0;
   this->period_[cur_index] = period;
-  this->cnt_[cur_index] = 0;
+  this->active_threshold_[cur_index] = 0;
+  this->remaining_[cur_index] = 0;
+  this->at_start_[cur_index] = true;
+  this->port_index_[cur_index] = port;
+  this->pin_mask_[cur_index] = 1 << PIN_MAP[pwm_pin].gpio_bit;
   pinMode(this->pin_list_[cur_index], OUTPUT);
   this->used_count_++;
   return cur_index;
@@ -27,10 +27,15 @@
 
 #define PWM_MAX_COUNT 5
 #define SOFT_PWM_TIM 3
+#define SOFT_PWM_TIM_PRESCALER 720   // 10us per count, the soft pwm tick
+#define SOFT_PWM_MIN_TICKS 2         // shortest timer period, closer edges are applied together
+#define SOFT_PWM_MAX_TICKS 0xffff
 
 #define SOFT_PWM_US(us) (us / 10)
 #define SOFT_PWM_MS(ms) SOFT_PWM_US(ms * 1000)
 
+// The timer fires only on pwm edges: every interrupt applies the edges that are due,
+// one BSRR write per port, then programs the timer period up to the nearest next edge.
 class SoftPwm {
  public:
   void Isr();
@@ -40,12 +45,22 @@ class SoftPwm {
 
  private:
   void HalTimInit();
+  void ScheduleReset();
   bool tim_init_falg_ = false;
-  uint8_t used_count_ = 0;
+  volatile uint8_t used_count_ = 0;
+  uint8_t port_count_ = 0;
   uint32_t pin_list_[PWM_MAX_COUNT];
   uint32_t  threshold_[PWM_MAX_COUNT];
   uint32_t  period_[PWM_MAX_COUNT];
-  uint32_t  cnt_[PWM_MAX_COUNT];
+  // threshold latched at the start of the running period
+  uint32_t  active_threshold_[PWM_MAX_COUNT];
+  // ticks until the next edge of each channel
+  int32_t  remaining_[PWM_MAX_COUNT];
+  bool  at_start_[PWM_MAX_COUNT];
+  uint8_t  port_index_[PWM_MAX_COUNT];
+  uint16_t  pin_mask_[PWM_MAX_COUNT];
+  volatile uint32_t * port_bsrr_[PWM_MAX_COUNT];
+  uint16_t next_ticks_ = SOFT_PWM_MIN_TICKS;
   uint32_t delay_close_time[PWM_MAX_COUNT];
   uint32_t delay_start_time[PWM_MAX_COUNT];
 };
@@ -0,0 +1,97 @@
+/*
+ * Snapmaker2-Modules Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Modules
+ * (see https://github.com/Snapmaker/Snapmaker2-Modules)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "spindle_guard.h"
+
+void SpindleGuard::Init(uint16_t interval_ms, float block_rpm) {
+  interval_ms_ = interval_ms;
+  block_rpm_ = block_rpm;
+  derate_ = 1.0;
+  rpm_last_ = 0;
+  rpm_slope_ = 0;
+  heat_ = 0;
+  stall_risk_cnt_ = 0;
+  flags_ = 0;
+}
+
+// Stall risk: under load the rpm trend reaches the block speed within the horizon,
+// or the speed loop is saturated while the rpm keeps falling behind the target.
+// Overload: I2t thermal model of the winding above its continuous rating.
+float SpindleGuard::Update(float current_ma, float rpm, float duty, float target_rpm, bool running, bool pid) {
+  uint8_t flags = 0;
+  float derate_target = 1.0;
+  float i_ratio = current_ma / I2T_RATED_CURRENT;
+
+  heat_ += (i_ratio * i_ratio - heat_) * interval_ms_ / I2T_TIME_CONSTANT;
+  if (heat_ > I2T_WARNING_LEVEL) {
+    float level = (heat_ - I2T_WARNING_LEVEL) / (I2T_DERATE_FULL_LEVEL - I2T_WARNING_LEVEL);
+    if (level > 1)
+      level = 1;
+    derate_target = 1 - level * (1 - MOTOR_DERATE_MIN);
+    flags |= (1 << SPINDLE_GUARD_FLAG_OVERLOAD);
+  }
+
+  if (running) {
+    float slope = (rpm - rpm_last_) * 1000 / interval_ms_;
+    bool risk = false;
+    rpm_last_ = rpm;
+    rpm_slope_ += (slope - rpm_slope_) * RPM_SLOPE_FILTER_RATIO;
+
+    if (rpm_slope_ < 0) {
+      if (current_ma > STALL_PREDICT_CURRENT && \
+          (rpm - block_rpm_) * 1000 < -rpm_slope_ * STALL_PREDICT_HORIZON_MS)
+        risk = true;
+      if (pid && duty >= STALL_PREDICT_DUTY && \
+          rpm < target_rpm * derate_ * STALL_PREDICT_RPM_RATIO)
+        risk = true;
+    }
+    if (risk) {
+      if (stall_risk_cnt_ < STALL_PREDICT_SAMP_CNT)
+        stall_risk_cnt_++;
+    }
+    else {
+      stall_risk_cnt_ = 0;
+    }
+    if (stall_risk_cnt_ >= STALL_PREDICT_SAMP_CNT) {
+      derate_target = MOTOR_DERATE_MIN;
+      flags |= (1 << SPINDLE_GUARD_FLAG_STALL_RISK);
+    }
+  }
+  else {
+    rpm_last_ = 0;
+    rpm_slope_ = 0;
+    stall_risk_cnt_ = 0;
+  }
+
+  if (derate_ > derate_target) {
+    derate_ -= MOTOR_DERATE_DOWN_STEP;
+    if (derate_ < derate_target)
+      derate_ = derate_target;
+  }
+  else if (derate_ < derate_target) {
+    derate_ += MOTOR_DERATE_UP_STEP;
+    if (derate_ > derate_target)
+      derate_ = derate_target;
+  }
+  if (derate_ < 1)
+    flags |= (1 << SPINDLE_GUARD_FLAG_DERATING);
+  flags_ = flags;
+  return derate_;
+}
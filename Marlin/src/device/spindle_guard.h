@@ -0,0 +1,71 @@
+/*
+ * Snapmaker2-Modules Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Modules
+ * (see https://github.com/Snapmaker/Snapmaker2-Modules)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MODULES_WHIMSYCWD_MARLIN_SRC_DEVICE_SPINDLE_GUARD_H_
+#define MODULES_WHIMSYCWD_MARLIN_SRC_DEVICE_SPINDLE_GUARD_H_
+
+#include <stdint.h>
+
+// predictive spindle protection, derates before the hard stall, over current and
+// temperature stops trip. Update() runs once per control interval
+#define STALL_PREDICT_HORIZON_MS 200     // warn when block speed would be reached within this time
+#define STALL_PREDICT_CURRENT 5000       // mA, rpm trend is only trusted under load
+#define STALL_PREDICT_DUTY 0.9           // speed loop is running out of voltage
+#define STALL_PREDICT_RPM_RATIO 0.8
+#define STALL_PREDICT_SAMP_CNT 3
+#define RPM_SLOPE_FILTER_RATIO 0.3
+#define I2T_RATED_CURRENT 6000           // mA, continuous rating
+#define I2T_TIME_CONSTANT 60000          // ms, motor winding thermal time constant
+#define I2T_WARNING_LEVEL 1.0            // (I / I_rated)^2 settled value
+#define I2T_DERATE_FULL_LEVEL 1.3        // derating reaches MOTOR_DERATE_MIN here
+#define MOTOR_DERATE_MIN 0.6
+#define MOTOR_DERATE_DOWN_STEP 0.02
+#define MOTOR_DERATE_UP_STEP 0.002
+
+typedef enum {
+  SPINDLE_GUARD_FLAG_STALL_RISK = 0,
+  SPINDLE_GUARD_FLAG_OVERLOAD,
+  SPINDLE_GUARD_FLAG_DERATING,
+}SPINDLE_GUARD_FLAG;
+
+class SpindleGuard {
+ public:
+  void Init(uint16_t interval_ms, float block_rpm);
+  // current_ma: working current, duty: speed power, target_rpm: requested before the
+  // derating, pid: the speed loop runs on rpm. Returns the derate factor
+  float Update(float current_ma, float rpm, float duty, float target_rpm, bool running, bool pid);
+  float Derate() { return derate_; }
+  uint8_t Flags() { return flags_; }
+  float Heat() { return heat_; }
+  float RpmSlope() { return rpm_slope_; }
+
+ private:
+  uint16_t interval_ms_;
+  float block_rpm_;
+  float derate_;
+  float rpm_last_;
+  float rpm_slope_;   // rpm/s
+  float heat_;        // I2t model, (I / I_rated)^2 filtered by the thermal time constant
+  uint8_t stall_risk_cnt_;
+  uint8_t flags_;
+};
+
+#endif  // MODULES_WHIMSYCWD_MARLIN_SRC_DEVICE_SPINDLE_GUARD_H_
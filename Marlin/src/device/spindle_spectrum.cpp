@@ -0,0 +1,229 @@
+/*
+ * Snapmaker2-Modules Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Modules
+ * (see https://github.com/Snapmaker/Snapmaker2-Modules)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <wirish_time.h>
+#include <wirish_math.h>
+#include <cr4_fft_stm32.h>
+#include "spindle_spectrum.h"
+#include "src/HAL/hal_adc.h"
+
+#define SPECTRUM_HALF_POINTS          (SPECTRUM_FFT_POINTS / 2)
+#define SPECTRUM_ADC_TO_MA(adc)       ((adc) * 16500.0f / 4095)  // 0.01R * 20
+// cr4 FFT output is scaled by 1/N, a Hann windowed sine of amplitude A
+// leaves A^2 * 3 / 32 summed over its bins
+#define SPECTRUM_POWER_TO_AMP2        (32.0f / 3)
+
+// Periodic Hann window, Q15, first half, w[N - n] = w[n]
+static const uint16_t spectrum_hann_window[SPECTRUM_HALF_POINTS + 1] = {
+  0, 5, 20, 44, 79, 123, 177, 241, 315, 398, 491, 593,
+  705, 827, 958, 1098, 1247, 1406, 1573, 1749, 1935, 2128, 2331, 2542,
+  2761, 2989, 3224, 3468, 3719, 3978, 4244, 4518, 4799, 5086, 5381, 5682,
+  5990, 6304, 6624, 6950, 7281, 7618, 7961, 8308, 8660, 9017, 9379, 9744,
+  10114, 10487, 10864, 11244, 11628, 12014, 12403, 12794, 13187, 13583, 13980, 14378,
+  14778, 15178, 15580, 15981, 16383, 16786, 17187, 17589, 17989, 18389, 18787, 19184,
+  19580, 19973, 20364, 20753, 21139, 21523, 21903, 22280, 22653, 23023, 23388, 23750,
+  24107, 24459, 24806, 25149, 25486, 25817, 26143, 26463, 26777, 27085, 27386, 27681,
+  27968, 28249, 28523, 28789, 29048, 29299, 29543, 29778, 30006, 30225, 30436, 30639,
+  30832, 31018, 31194, 31361, 31520, 31669, 31809, 31940, 32062, 32174, 32276, 32369,
+  32452, 32526, 32590, 32644, 32688, 32723, 32747, 32762, 32767,
+};
+
+SpindleSpectrum *SpindleSpectrum::p_spectrum_ = NULL;
+
+bool SpindleSpectrum::Init(BldcMotor *motor) {
+  if (p_spectrum_ == NULL) {
+    p_spectrum_ = this;
+    init_ok_ = motor->BldcCurrentSampleInit(CaptureIrqCallBack);
+  }
+  return init_ok_;
+}
+
+// Injected conversion done, once per PWM period while capturing
+void SpindleSpectrum::CaptureIrqCallBack(void) {
+  SpindleSpectrum *p = p_spectrum_;
+  uint16_t sum;
+  if (p == NULL || p->state_ != SPECTRUM_CAPTURE) {
+    HAL_adc_injected_enable(false);
+    return;
+  }
+  sum = p->decim_sum_ + HAL_adc_injected_get();
+  if (++p->decim_cnt_ < SPECTRUM_DECIMATION) {
+    p->decim_sum_ = sum;
+    return;
+  }
+  p->in_[p->capture_index_] = sum;
+  p->decim_sum_ = 0;
+  p->decim_cnt_ = 0;
+  if (++p->capture_index_ >= SPECTRUM_FFT_POINTS) {
+    HAL_adc_injected_enable(false);
+    p->state_ = SPECTRUM_READY;
+  }
+}
+
+void SpindleSpectrum::StartCapture(uint32_t rpm) {
+  capture_index_ = 0;
+  decim_sum_ = 0;
+  decim_cnt_ = 0;
+  capture_rpm_ = rpm;
+  state_ = SPECTRUM_CAPTURE;
+  HAL_adc_injected_enable(true);
+}
+
+void SpindleSpectrum::StopCapture(void) {
+  HAL_adc_injected_enable(false);
+  state_ = SPECTRUM_IDLE;
+}
+
+bool SpindleSpectrum::Loop(uint32_t rpm, bool running) {
+  uint32_t drift;
+  if (!init_ok_)
+    return false;
+
+  if (!running || rpm < SPECTRUM_MIN_RPM) {
+    if (state_ != SPECTRUM_IDLE)
+      StopCapture();
+    confirm_cnt_[SPECTRUM_FLAG_CHATTER] = 0;
+    confirm_cnt_[SPECTRUM_FLAG_IMBALANCE] = 0;
+    result_.flags = 0;
+    return false;
+  }
+
+  switch (state_) {
+    case SPECTRUM_IDLE:
+      if ((int32_t)(millis() - next_time_) >= 0)
+        StartCapture(rpm);
+      break;
+
+    case SPECTRUM_READY:
+      state_ = SPECTRUM_IDLE;
+      next_time_ = millis() + SPECTRUM_INTERVAL_MS;
+      // harmonics smear over several bins while the speed is changing
+      drift = rpm > capture_rpm_ ? rpm - capture_rpm_ : capture_rpm_ - rpm;
+      if (drift * SPECTRUM_RPM_DRIFT_RATIO > capture_rpm_)
+        break;
+      Analyse((rpm + capture_rpm_) / 2);
+      return true;
+
+    default:
+      break;
+  }
+  return false;
+}
+
+void SpindleSpectrum::Confirm(uint8_t flag, bool hit) {
+  if (hit) {
+    if (confirm_cnt_[flag] < SPECTRUM_CONFIRM_CNT)
+      confirm_cnt_[flag]++;
+  }
+  else if (confirm_cnt_[flag] > 0) {
+    confirm_cnt_[flag]--;
+  }
+
+  if (confirm_cnt_[flag] >= SPECTRUM_CONFIRM_CNT)
+    result_.flags |= (1 << flag);
+  else if (confirm_cnt_[flag] == 0)
+    result_.flags &= ~(1 << flag);
+}
+
+// Rotation harmonics, including the commutation ripple folded back from above
+// the Nyquist frequency, are synchronous. Imbalance or a bent bit shows up at 1x,
+// chatter as energy that does not follow the rotation.
+void SpindleSpectrum::Analyse(uint32_t rpm) {
+  uint32_t sync_mask[SPECTRUM_HALF_POINTS / 32] = {0};
+  uint32_t sum = 0, peak = 0, mean;
+  uint64_t total = 0, sync = 0, rotation = 0, chatter = 0;
+  uint32_t peak_power = 0;
+  uint16_t peak_bin = 0;
+  uint8_t gain = 0;
+  int32_t i, b;
+
+  for (i = 0; i < SPECTRUM_FFT_POINTS; i++)
+    sum += in_[i];
+  mean = sum / SPECTRUM_FFT_POINTS;
+  for (i = 0; i < SPECTRUM_FFT_POINTS; i++) {
+    int32_t v = (int32_t)in_[i] - (int32_t)mean;
+    if (v < 0)
+      v = -v;
+    if ((uint32_t)v > peak)
+      peak = v;
+  }
+  // block floating point, use the 16 bit input range without overflowing the butterflies
+  while (gain < SPECTRUM_MAX_GAIN_SHIFT && (peak << (gain + 1)) <= 32767)
+    gain++;
+  for (i = 0; i < SPECTRUM_FFT_POINTS; i++) {
+    int32_t v = (((int32_t)in_[i] - (int32_t)mean) << gain) >> 1;
+    uint16_t w = spectrum_hann_window[i <= SPECTRUM_HALF_POINTS ? i : SPECTRUM_FFT_POINTS - i];
+    in_[i] = (uint16_t)((v * w) >> 15);
+  }
+
+  cr4_fft_256_stm32(out_, in_, SPECTRUM_FFT_POINTS);
+
+  for (i = 0; i < SPECTRUM_HALF_POINTS; i++) {
+    int32_t re = (int16_t)(out_[i] & 0xffff);
+    int32_t im = (int16_t)(out_[i] >> 16);
+    out_[i] = (uint32_t)(re * re) + (uint32_t)(im * im);
+  }
+
+  uint32_t rot_q8 = rpm * SPECTRUM_FFT_POINTS * 256 / (60 * SPECTRUM_SAMPLE_HZ);
+  for (uint32_t h = 1; h <= SPECTRUM_SYNC_HARMONICS; h++) {
+    int32_t bin = ((h * rot_q8 + 128) >> 8) % SPECTRUM_FFT_POINTS;
+    if (bin > SPECTRUM_HALF_POINTS)
+      bin = SPECTRUM_FFT_POINTS - bin;
+    for (b = bin - SPECTRUM_SYNC_HALF_WIDTH; b <= bin + SPECTRUM_SYNC_HALF_WIDTH; b++) {
+      if (b < 0 || b >= SPECTRUM_HALF_POINTS)
+        continue;
+      sync_mask[b >> 5] |= (1UL << (b & 31));
+      if (h == 1)
+        rotation += out_[b];
+    }
+  }
+
+  // bin 0 and 1 only hold the window leakage of the mean and slow drift
+  for (i = 2; i < SPECTRUM_HALF_POINTS; i++) {
+    total += out_[i];
+    if (sync_mask[i >> 5] & (1UL << (i & 31))) {
+      sync += out_[i];
+    }
+    else if (out_[i] > peak_power) {
+      peak_power = out_[i];
+      peak_bin = i;
+    }
+  }
+  if (peak_bin) {
+    for (b = peak_bin - 1; b <= peak_bin + 1 && b < SPECTRUM_HALF_POINTS; b++)
+      chatter += out_[b];
+  }
+
+  // back to ADC counts, one decimated sample is DECIMATION counts, scaled by 2^gain / 2
+  float amp_scale = 2.0f / ((uint32_t)SPECTRUM_DECIMATION << gain);
+  result_.rpm = rpm;
+  result_.mean_ma = SPECTRUM_ADC_TO_MA((float)mean / SPECTRUM_DECIMATION);
+  result_.rotation_ma = SPECTRUM_ADC_TO_MA(sqrtf(rotation * SPECTRUM_POWER_TO_AMP2) * amp_scale);
+  result_.chatter_ma = SPECTRUM_ADC_TO_MA(sqrtf(chatter * SPECTRUM_POWER_TO_AMP2) * amp_scale);
+  result_.chatter_hz = (uint32_t)peak_bin * SPECTRUM_SAMPLE_HZ / SPECTRUM_FFT_POINTS;
+  result_.chatter_ratio = total ? (total - sync) * 100 / total : 0;
+
+  Confirm(SPECTRUM_FLAG_CHATTER, result_.chatter_ratio >= SPECTRUM_CHATTER_RATIO && \
+                                 result_.chatter_ma >= SPECTRUM_CHATTER_MIN_MA);
+  Confirm(SPECTRUM_FLAG_IMBALANCE, result_.rotation_ma >= SPECTRUM_IMBALANCE_MIN_MA && \
+                                   result_.rotation_ma * 100 >= (uint32_t)result_.mean_ma * SPECTRUM_IMBALANCE_RATIO);
+}
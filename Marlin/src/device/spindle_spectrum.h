@@ -0,0 +1,94 @@
+/*
+ * Snapmaker2-Modules Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Modules
+ * (see https://github.com/Snapmaker/Snapmaker2-Modules)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MODULES_WHIMSYCWD_MARLIN_SRC_DEVICE_SPINDLE_SPECTRUM_H_
+#define MODULES_WHIMSYCWD_MARLIN_SRC_DEVICE_SPINDLE_SPECTRUM_H_
+
+#include <stdint.h>
+#include "bldc_motor.h"
+
+#define SPECTRUM_FFT_POINTS           256
+#define SPECTRUM_DECIMATION           5     // PWM rate samples summed into one, boxcar anti-alias
+#define SPECTRUM_SAMPLE_HZ            (BLDC_TIM_PWM_FREQ / SPECTRUM_DECIMATION)  // 4kHz, 15.6Hz per bin
+#define SPECTRUM_INTERVAL_MS          500
+#define SPECTRUM_MIN_RPM              6000
+#define SPECTRUM_RPM_DRIFT_RATIO      20    // 1/20, window dropped when the rpm moved more
+#define SPECTRUM_MAX_GAIN_SHIFT       7
+#define SPECTRUM_SYNC_HARMONICS       (6 * MOTOR_POLE_PAIR_NUM)  // up to the commutation ripple
+#define SPECTRUM_SYNC_HALF_WIDTH      1     // bins either side of a rotation harmonic
+#define SPECTRUM_CHATTER_RATIO        40    // % of AC energy away from rotation harmonics
+#define SPECTRUM_CHATTER_MIN_MA       200
+#define SPECTRUM_IMBALANCE_RATIO      15    // % of mean current at 1x rotation
+#define SPECTRUM_IMBALANCE_MIN_MA     150
+#define SPECTRUM_CONFIRM_CNT          3
+
+typedef enum {
+  SPECTRUM_IDLE = 0,
+  SPECTRUM_CAPTURE,
+  SPECTRUM_READY,
+} SPECTRUM_STATE;
+
+typedef enum {
+  SPECTRUM_FLAG_CHATTER = 0,
+  SPECTRUM_FLAG_IMBALANCE,
+} SPECTRUM_FLAG;
+
+typedef struct {
+  uint8_t  flags;
+  uint8_t  chatter_ratio;   // %
+  uint16_t chatter_hz;      // strongest peak away from rotation harmonics
+  uint16_t chatter_ma;
+  uint16_t rotation_ma;     // 1x rotation component
+  uint16_t mean_ma;
+  uint16_t rpm;
+} SPECTRUM_RESULT;
+
+class SpindleSpectrum {
+ public:
+  bool Init(BldcMotor *motor);
+  // returns true when a new result is available
+  bool Loop(uint32_t rpm, bool running);
+  SPECTRUM_RESULT * Result(void) { return &result_; }
+
+ private:
+  static void CaptureIrqCallBack(void);
+  void StartCapture(uint32_t rpm);
+  void StopCapture(void);
+  void Analyse(uint32_t rpm);
+  void Confirm(uint8_t flag, bool hit);
+
+ private:
+  static SpindleSpectrum *p_spectrum_;
+  bool init_ok_ = false;
+  volatile SPECTRUM_STATE state_ = SPECTRUM_IDLE;
+  volatile uint16_t capture_index_ = 0;
+  volatile uint16_t decim_sum_ = 0;
+  volatile uint8_t decim_cnt_ = 0;
+  uint32_t capture_rpm_ = 0;
+  uint32_t next_time_ = 0;
+  uint8_t confirm_cnt_[2] = {0, 0};
+  SPECTRUM_RESULT result_ = {0};
+  // real in the low half word, imaginary in the high half word
+  uint32_t in_[SPECTRUM_FFT_POINTS];
+  uint32_t out_[SPECTRUM_FFT_POINTS];
+};
+
+#endif  // MODULES_WHIMSYCWD_MARLIN_SRC_DEVICE_SPINDLE_SPECTRUM_H_
@@ -71,11 +71,14 @@ void Temperature::InitOutCtrl(uint8_t tim_num, uint8_t tim_chn, uint8_t tim_pin,
   HAL_PwmInit(tim_num, tim_chn, tim_pin, pre_scaler, 255);
 }
 
-void Temperature::ReportTemprature() {
+void Temperature::ReportTemprature(bool periodic) {
   uint16_t msgid = registryInstance.FuncId2MsgId(FUNC_REPORT_TEMPEARTURE);
   if (msgid != INVALID_VALUE) {
     int16_t temp = (int16_t)(this->detect_celsius_ * 10);
     int16_t target = (int16_t)this->pid_.getTarget();
+    int32_t values[2] = {temp, target};
+    if (!report_filter_.Due(values, !periodic))
+      return;
 
     uint8_t u8DataBuf[8], u8Index = 0;
     u8DataBuf[u8Index++] = temp >> 8;
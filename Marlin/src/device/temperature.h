@@ -27,19 +27,27 @@
 #include "../HAL/hal_adc.h"
 #include "src/HAL/hal_pwm.h"
 #include "src/core/thermistor_table.h"
+#include "src/core/report_filter.h"
+
+#define TEMP_REPORT_DEADBAND      5     // 0.5 degree
+#define TEMP_REPORT_MIN_INTERVAL  0     // paced by the report scheduler
+#define TEMP_REPORT_MAX_INTERVAL  2000
 
 class Temperature {
  public:
   Temperature() {
     thermistor_type_ = THERMISTOR_NTC3950;
     is_temp_ready_ = false;
+    const uint16_t deadband[2] = {TEMP_REPORT_DEADBAND, 0};
+    report_filter_.Init(deadband, 2, TEMP_REPORT_MIN_INTERVAL, TEMP_REPORT_MAX_INTERVAL);
   }
   static uint8_t TempertuerStatus();
   void SetAdcIndex(uint8_t index) { adc_index_ = index; }
   void SetThermistorType(thermistor_type_e type = THERMISTOR_NTC3950) { thermistor_type_ = type; }
   uint8_t InitCapture(uint8_t adc_pin, ADC_TIM_E adc_tim);
   void InitOutCtrl(uint8_t tim_num, uint8_t tim_chn, uint8_t tim_pin, uint32_t pre_scaler=1000000);
-  void ReportTemprature();
+  // periodic: only sent when it moved beyond the deadband or the heartbeat is due
+  void ReportTemprature(bool periodic = false);
   void ReportPid();
   void SetPID(uint8_t pid_index, float val);
   void TemperatureOut();
@@ -47,6 +55,7 @@ class Temperature {
   void GetTemperature(float &celsius);
   uint16_t GetCurTemprature() {return detect_celsius_ * 10;}
   uint16_t GetTargetTemprature() {return pid_.getTarget();}
+  uint32_t GetOutput() {return pid_.getOutput();}
   void SetPwmDutyLimitAndThreshold(uint8_t count, int32_t threshold);
   void ShutDown();
   float GetTemp();
@@ -69,6 +78,7 @@ class Temperature {
   int count_;
   bool enabled_;
   bool is_temp_ready_;
+  ReportFilter report_filter_;
   void InitPID();
   void SavePID();
 };
@@ -2,7 +2,9 @@
 #include <wirish_math.h>
 #include "cnc_head_200w.h"
 #include "src/registry/registry.h"
+#include "src/registry/report_scheduler.h"
 #include "src/core/can_bus.h"
+#include "src/core/protocal/Longpack.h"
 #include "src/core/thermistor_table.h"
 
 extern BLDC_SELF_TEST_STEP bldc_self_test_step;
@@ -17,6 +19,15 @@ extern uint8_t hall_check_order[CHECK_HALL_CNT];
 
 void CncHead200W::Init(void) {
   bldc_module_dev_.Init();
+  spectrum_.Init(&bldc_module_dev_);
+  guard_.Init(MOTOR_CTR_INTERVAL_TIME, MOTOR_BLOCK_SPEED);
+  // rpm, five state bytes, power; motor and pcb temperature, current, voltage
+  const uint16_t state_deadband[7] = {REPORT_RPM_DEADBAND, 0, 0, 0, 0, 0, REPORT_POWER_DEADBAND};
+  const uint16_t sensor_deadband[4] = {REPORT_TEMP_DEADBAND, REPORT_TEMP_DEADBAND, REPORT_CURRENT_DEADBAND, REPORT_VOLTAGE_DEADBAND};
+  state_filter_.Init(state_deadband, 7, REPORT_MIN_INTERVAL, REPORT_MAX_INTERVAL);
+  sensor_filter_.Init(sensor_deadband, 4, REPORT_MIN_INTERVAL, REPORT_MAX_INTERVAL);
+  reportScheduler.Register(FUNC_REPORT_MOTOR_SENSOR_INFO, REPORT_PERIOD);
+  reportScheduler.Register(FUNC_REPORT_MOTOR_STATUS_INFO, REPORT_PERIOD);
   // target_speed_duty_ = MAX_DUTY_CYCLE;
   // bldc_module_dev_.BldcControlMotorRunProcess(RUN);
 }
@@ -39,7 +50,7 @@ void CncHead200W::ReportConfigResult(uint16_t func_id, uint8_t * data, uint8_t d
 }
 
 // report motor state msg
-void CncHead200W::ReportMotorState(void) {
+void CncHead200W::ReportMotorState(bool periodic) {
   uint16_t msgid = registryInstance.FuncId2MsgId(FUNC_REPORT_MOTOR_STATUS_INFO);
   if (msgid != INVALID_VALUE) {
     uint16_t cur_speed = (uint16_t)bldc_module_dev_.BldcGetMotorRpm();
@@ -66,11 +77,14 @@ void CncHead200W::ReportMotorState(void) {
     data[index++] = bldc_self_test_step & 0xff;
     cur_speed = bldc_module_dev_.BldcGetMotorSpeedPower() * 100;
     data[index++] = cur_speed & 0xff;
+    int32_t values[7] = {(data[0] << 8) | data[1], data[2], data[3], data[4], data[5], data[6], data[7]};
+    if (!state_filter_.Due(values, !periodic))
+      return;
     canbus_g.PushSendStandardData(msgid, data, index);
   }
 }
 
-void CncHead200W::ReportMotorTemperature(void) {
+void CncHead200W::ReportMotorTemperature(bool periodic) {
   uint16_t msgid = registryInstance.FuncId2MsgId(FUNC_REPORT_MOTOR_SENSOR_INFO);
   int16_t tmp_adc = 0;
   uint8_t data[8];
@@ -95,6 +109,10 @@ void CncHead200W::ReportMotorTemperature(void) {
     tmp_adc = motor_voltage_ * 100;
     data[index++] = (tmp_adc >> 8) & 0xff;
     data[index++] = (tmp_adc >> 0) & 0xff;
+    int32_t values[4] = {(int16_t)((data[0] << 8) | data[1]), (int16_t)((data[2] << 8) | data[3]),
+                         (int16_t)((data[4] << 8) | data[5]), (int16_t)((data[6] << 8) | data[7])};
+    if (!sensor_filter_.Due(values, !periodic))
+      return;
     canbus_g.PushSendStandardData(msgid, data, index);
   }
 }
@@ -139,13 +157,13 @@ void CncHead200W::SetMotorSpeedPower(uint8_t power) {
   if (power) {
     // optimization options: An instruction to clear the exception can be added later
     if (bldc_module_dev_.BldcGetMotorState() != RUN){
-      time_ = millis() + 500;
       bldc_module_dev_.BldcSetMotorBlockState(MOTOR_BLOCK_NORMAL);
       ReportMotorState();
     }
     if (bldc_module_dev_.BldcGetMotorPidControl()) {
       rpm = ((float)power * MOTOR_RATED_SPEED/100);
-      bldc_module_dev_.BldcSetMotorTargetRpm((float)rpm);
+      target_rpm_ = rpm;
+      bldc_module_dev_.BldcSetMotorTargetRpm(target_rpm_ * guard_.Derate());
     }
     else {
       val_f = (float)power / 100;
@@ -174,12 +192,12 @@ void CncHead200W::SetMotorSpeedRpm(uint16_t rpm) {
   if (rpm) {
     // optimization options: An instruction to clear the exception can be added later
     if (bldc_module_dev_.BldcGetMotorState() != RUN){
-      time_ = millis() + 500;
       bldc_module_dev_.BldcSetMotorBlockState(MOTOR_BLOCK_NORMAL);
       ReportMotorState();
     }
     if (bldc_module_dev_.BldcGetMotorPidControl()) {
-      bldc_module_dev_.BldcSetMotorTargetRpm((float)rpm);
+      target_rpm_ = rpm;
+      bldc_module_dev_.BldcSetMotorTargetRpm(target_rpm_ * guard_.Derate());
     }
     else {
       val_f = (float)rpm / MOTOR_RATED_SPEED;
@@ -198,14 +216,17 @@ void CncHead200W::SetMotorSpeedRpm(uint16_t rpm) {
   ReportConfigResult(FUNC_SET_MOTOR_SPEED_RPM, ack_buff, 1);
 }
 
-void CncHead200W::SetMotorCtrMode(bool pid_mode) {
+void CncHead200W::SetMotorCtrMode(bool pid_mode, uint8_t drive_mode) {
   bool ret = false;
-  uint8_t ack_buff[2];
+  uint8_t ack_buff[3];
   ret = bldc_module_dev_.BldcSetMotorPidControl(!!pid_mode);
+  if (ret && drive_mode != MOTOR_DRIVE_MODE_KEEP)
+    ret = bldc_module_dev_.BldcSetMotorDriveMode((BLDC_DRIVE_MODE)drive_mode);
   ack_buff[0] = (uint8_t)ret;
   ack_buff[1] = (uint8_t)bldc_module_dev_.BldcGetMotorPidControl();
+  ack_buff[2] = (uint8_t)bldc_module_dev_.BldcGetMotorDriveMode();
   ReportMotorState();
-  ReportConfigResult(FUNC_SET_MOTOR_CTR_MODE, ack_buff, 2);
+  ReportConfigResult(FUNC_SET_MOTOR_CTR_MODE, ack_buff, 3);
 }
 
 void CncHead200W::SetMotorDirState(uint8_t dir) {
@@ -281,7 +302,8 @@ void CncHead200W::HandModule(uint16_t func_id, uint8_t * data, uint8_t data_len)
     break;
 
     case FUNC_SET_MOTOR_CTR_MODE:
-      SetMotorCtrMode(data[0]);
+      // data[1]: optional drive mode, 0 six step, 1 sine
+      SetMotorCtrMode(data[0], data_len > 1 ? data[1] : MOTOR_DRIVE_MODE_KEEP);
     break;
 
     case FUNC_SET_MOTOR_RUN_DIRECTION:
@@ -314,6 +336,19 @@ void CncHead200W::HandModule(uint16_t func_id, uint8_t * data, uint8_t data_len)
       SetMotorFan(!!data[0]);
     break;
 
+    case FUNC_REPORT_MOTOR_WARNING_INFO:
+      ReportMotorWarning();
+    break;
+
+    case FUNC_REPORT_MOTOR_SPECTRUM_INFO:
+      ReportMotorSpectrum();
+    break;
+
+    case FUNC_SET_MOTOR_TELEMETRY:
+      // data[1]: optional sample period in ms
+      SetMotorTelemetry(!!data[0], data_len > 1 ? data[1] : TELEMETRY_DEFAULT_PERIOD);
+    break;
+
     default:
     break;
   }
@@ -326,18 +361,19 @@ void CncHead200W::MotorSpeedControlLoop(void) {
     if (bldc_module_dev_.BldcGetMotorState() == RUN) {
       float speed_power = bldc_module_dev_.BldcGetMotorSpeedPower();
       if (!bldc_module_dev_.BldcGetMotorPidControl()) {
-        if (target_speed_duty_ != speed_power) {
-          if (target_speed_duty_ > speed_power) {
-            if (target_speed_duty_ > speed_power + PWM_MODE_CHANGE_RANGE)
+        float target_duty = target_speed_duty_ * guard_.Derate();
+        if (target_duty != speed_power) {
+          if (target_duty > speed_power) {
+            if (target_duty > speed_power + PWM_MODE_CHANGE_RANGE)
               bldc_module_dev_.BldcSetMotorSpeedPower(speed_power + PWM_MODE_CHANGE_RANGE);
             else
-              bldc_module_dev_.BldcSetMotorSpeedPower(target_speed_duty_);
+              bldc_module_dev_.BldcSetMotorSpeedPower(target_duty);
           }
-          else if (target_speed_duty_ < speed_power) {
-            if (target_speed_duty_ + PWM_MODE_CHANGE_RANGE < speed_power)
+          else if (target_duty < speed_power) {
+            if (target_duty + PWM_MODE_CHANGE_RANGE < speed_power)
               bldc_module_dev_.BldcSetMotorSpeedPower(speed_power - PWM_MODE_CHANGE_RANGE);
             else
-              bldc_module_dev_.BldcSetMotorSpeedPower(target_speed_duty_);
+              bldc_module_dev_.BldcSetMotorSpeedPower(target_duty);
           }
         }
       }
@@ -426,14 +462,155 @@ void CncHead200W::MotorSpeedControlLoop(void) {
     if (tmp_sta != motor_block_bak_)
       report_msg_ = true;
     motor_block_bak_ = tmp_sta;
+
+    MotorPredictiveProtect();
+  }
+}
+
+// Derate the spindle before the hard stall/overcurrent/temperature protection trips,
+// see SpindleGuard
+void CncHead200W::MotorPredictiveProtect(void) {
+  bool running = bldc_module_dev_.BldcGetMotorState() == RUN;
+  bool pid = bldc_module_dev_.BldcGetMotorPidControl();
+  float derate = guard_.Derate();
+  uint8_t warning = 0;
+
+  guard_.Update(motor_current_, running ? bldc_module_dev_.BldcGetMotorRpm() : 0,
+                bldc_module_dev_.BldcGetMotorSpeedPower(), target_rpm_, running, pid);
+  if (guard_.Derate() != derate && running && pid)
+    bldc_module_dev_.BldcSetMotorTargetRpm(target_rpm_ * guard_.Derate());
+  if (guard_.Flags() & (1 << SPINDLE_GUARD_FLAG_STALL_RISK))
+    warning |= (1 << CNC_WARNING_STALL_RISK);
+  if (guard_.Flags() & (1 << SPINDLE_GUARD_FLAG_OVERLOAD))
+    warning |= (1 << CNC_WARNING_OVERLOAD);
+  if (guard_.Flags() & (1 << SPINDLE_GUARD_FLAG_DERATING))
+    warning |= (1 << CNC_WARNING_DERATING);
+  if (spectrum_.Result()->flags & (1 << SPECTRUM_FLAG_CHATTER))
+    warning |= (1 << CNC_WARNING_CHATTER);
+  if (spectrum_.Result()->flags & (1 << SPECTRUM_FLAG_IMBALANCE))
+    warning |= (1 << CNC_WARNING_IMBALANCE);
+
+  if (warning != motor_warning_) {
+    motor_warning_ = warning;
+    ReportMotorWarning();
+  }
+}
+
+void CncHead200W::ReportMotorWarning(void) {
+  uint16_t msgid = registryInstance.FuncId2MsgId(FUNC_REPORT_MOTOR_WARNING_INFO);
+  if (msgid != INVALID_VALUE) {
+    uint8_t data[8];
+    uint8_t index = 0;
+    uint16_t heat = guard_.Heat() * 100;
+    int16_t slope = guard_.RpmSlope() / 100;
+    data[index++] = motor_warning_;
+    data[index++] = (uint8_t)(guard_.Derate() * 100);
+    data[index++] = (heat >> 8) & 0xff;
+    data[index++] = (heat >> 0) & 0xff;
+    data[index++] = (slope >> 8) & 0xff;
+    data[index++] = (slope >> 0) & 0xff;
+    canbus_g.PushSendStandardData(msgid, data, index);
+  }
+}
+
+void CncHead200W::ReportMotorSpectrum(void) {
+  uint16_t msgid = registryInstance.FuncId2MsgId(FUNC_REPORT_MOTOR_SPECTRUM_INFO);
+  if (msgid != INVALID_VALUE) {
+    SPECTRUM_RESULT *result = spectrum_.Result();
+    uint8_t data[8];
+    uint8_t index = 0;
+    data[index++] = result->flags;
+    data[index++] = result->chatter_ratio;
+    data[index++] = (result->chatter_hz >> 8) & 0xff;
+    data[index++] = (result->chatter_hz >> 0) & 0xff;
+    data[index++] = (result->chatter_ma >> 8) & 0xff;
+    data[index++] = (result->chatter_ma >> 0) & 0xff;
+    data[index++] = (result->rotation_ma >> 8) & 0xff;
+    data[index++] = (result->rotation_ma >> 0) & 0xff;
+    canbus_g.PushSendStandardData(msgid, data, index);
+  }
+}
+
+void CncHead200W::SetMotorTelemetry(bool enable, uint8_t period_ms) {
+  uint8_t ack_buff[6];
+  uint32_t drop = bldc_module_dev_.BldcTelemetryDropCount();
+  int i = 0;
+  if (enable && period_ms == 0)
+    period_ms = TELEMETRY_DEFAULT_PERIOD;
+  bldc_module_dev_.BldcTelemetrySetPeriod(enable ? period_ms : 0);
+  telemetry_cnt_ = 0;
+  telemetry_seq_ = 0;
+  telemetry_flush_time_ = millis() + TELEMETRY_FLUSH_MS;
+  ack_buff[i++] = (uint8_t)enable;
+  ack_buff[i++] = bldc_module_dev_.BldcTelemetryGetPeriod();
+  // drops of the stream just stopped, lets the host judge the last capture
+  ack_buff[i++] = (drop >> 24) & 0xff;
+  ack_buff[i++] = (drop >> 16) & 0xff;
+  ack_buff[i++] = (drop >> 8) & 0xff;
+  ack_buff[i++] = (drop >> 0) & 0xff;
+  ReportConfigResult(FUNC_SET_MOTOR_TELEMETRY, ack_buff, i);
+}
+
+// [cmd, seq(2), drop(2), period, count, count * [rpm(2), duty 0.01%(2), current mA(2), hall period us(2)]]
+void CncHead200W::SendMotorTelemetry(void) {
+  uint8_t len = TELEMETRY_HEAD_BYTES + telemetry_cnt_ * TELEMETRY_SAMPLE_BYTES;
+  uint32_t drop = bldc_module_dev_.BldcTelemetryDropCount();
+  uint8_t index = 0;
+  // a long pack that does not fit is cut short by the ring buffer, wait for room instead
+  if (canbus_g.extended_send_buffer_.freeSpace() < (int32_t)(len + sizeof(PackHead)))
+    return;
+  drop = drop > 0xffff ? 0xffff : drop;
+  telemetry_pack_[index++] = CMD_S_MOTOR_TELEMETRY;
+  telemetry_pack_[index++] = (telemetry_seq_ >> 8) & 0xff;
+  telemetry_pack_[index++] = (telemetry_seq_ >> 0) & 0xff;
+  telemetry_pack_[index++] = (drop >> 8) & 0xff;
+  telemetry_pack_[index++] = (drop >> 0) & 0xff;
+  telemetry_pack_[index++] = bldc_module_dev_.BldcTelemetryGetPeriod();
+  telemetry_pack_[index++] = telemetry_cnt_;
+  longpackInstance.sendLongpack(telemetry_pack_, len);
+  telemetry_seq_++;
+  telemetry_cnt_ = 0;
+  telemetry_flush_time_ = millis() + TELEMETRY_FLUSH_MS;
+}
+
+void CncHead200W::MotorTelemetryLoop(void) {
+  BLDC_TELEMETRY_SAMPLE sample;
+  if (!bldc_module_dev_.BldcTelemetryGetPeriod())
+    return;
+
+  while (telemetry_cnt_ < TELEMETRY_PACK_SAMPLES && bldc_module_dev_.BldcTelemetryRead(&sample)) {
+    uint8_t *p = &telemetry_pack_[TELEMETRY_HEAD_BYTES + telemetry_cnt_ * TELEMETRY_SAMPLE_BYTES];
+    uint16_t current = (uint32_t)sample.current_adc * 16500 / 4095;  // 0.01R * 20
+    p[0] = (sample.rpm >> 8) & 0xff;
+    p[1] = (sample.rpm >> 0) & 0xff;
+    p[2] = (sample.duty >> 8) & 0xff;
+    p[3] = (sample.duty >> 0) & 0xff;
+    p[4] = (current >> 8) & 0xff;
+    p[5] = (current >> 0) & 0xff;
+    p[6] = (sample.hall_period >> 8) & 0xff;
+    p[7] = (sample.hall_period >> 0) & 0xff;
+    telemetry_cnt_++;
   }
+
+  if (telemetry_cnt_ >= TELEMETRY_PACK_SAMPLES ||
+      (telemetry_cnt_ && ELAPSED(millis(), telemetry_flush_time_)))
+    SendMotorTelemetry();
+}
+
+void CncHead200W::PeriodicReport(uint16_t func_id, bool raw) {
+  if (func_id == FUNC_REPORT_MOTOR_SENSOR_INFO)
+    ReportMotorTemperature(!raw);
+  else if (func_id == FUNC_REPORT_MOTOR_STATUS_INFO)
+    ReportMotorState(!raw);
 }
 
 void CncHead200W::Loop(void) {
   MotorSpeedControlLoop();
+  MotorTelemetryLoop();
+  if (spectrum_.Loop(bldc_module_dev_.BldcGetMotorRpm(), bldc_module_dev_.BldcGetMotorState() == RUN))
+    ReportMotorSpectrum();
   bldc_module_dev_.BldcSelfTestLoop(millis());
-  if (ELAPSED(millis(), time_) || report_msg_) {
-    time_ = millis() + 500;
+  if (report_msg_) {
     ReportMotorTemperature();
     ReportMotorState();
     report_msg_ = false;
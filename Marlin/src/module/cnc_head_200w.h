@@ -2,6 +2,9 @@
 #define SNAPMAKERMODULES_MARLIN_SRC_MODULE_CNC_HEAD_200W_H_
 #include "src/configuration.h"
 #include "src/device/bldc_motor.h"
+#include "src/device/spindle_spectrum.h"
+#include "src/device/spindle_guard.h"
+#include "src/core/report_filter.h"
 #include "module_base.h"
 
 #define PWM_MODE_CHANGE_RANGE 0.01
@@ -17,6 +20,22 @@
 #define MIN_MOTOR_VOLTAGE_LIMIT 22
 #define MAX_MOTOR_VOLTAGE_LIMIT 26
 #define MAX_MOTOR_VOLTAGE_SAMP_CNT 300
+#define MOTOR_DRIVE_MODE_KEEP 0xff
+// Telemetry stream, samples are packed into one long pack per TELEMETRY_PACK_SAMPLES
+#define TELEMETRY_PACK_SAMPLES 8
+#define TELEMETRY_SAMPLE_BYTES 8
+#define TELEMETRY_HEAD_BYTES 7
+#define TELEMETRY_FLUSH_MS 20            // send a partial pack after this long
+#define TELEMETRY_DEFAULT_PERIOD 1       // ms
+// Status and sensor reports, sent on change beyond the deadband or as a heartbeat
+#define REPORT_MIN_INTERVAL 0            // ms, paced by the report scheduler
+#define REPORT_PERIOD 500                // ms
+#define REPORT_MAX_INTERVAL 2000         // ms
+#define REPORT_RPM_DEADBAND 100
+#define REPORT_POWER_DEADBAND 1          // %
+#define REPORT_TEMP_DEADBAND 5           // 0.1 degree
+#define REPORT_CURRENT_DEADBAND 200      // mA
+#define REPORT_VOLTAGE_DEADBAND 20       // 10mV
 #define PENDING(NOW,SOON) ((int32_t)(NOW-(SOON))<0)
 #define ELAPSED(NOW,SOON) (!PENDING(NOW,SOON))
 #define NOMORE(P, V) (P > V ? P = V : P)
@@ -30,21 +49,35 @@ typedef enum {
   CNC_EXCEPTIONAL_V_POWER,
 }CNC_EXCEPTIONAL_STATE;
 
+typedef enum {
+  CNC_WARNING_STALL_RISK = 0,
+  CNC_WARNING_OVERLOAD,
+  CNC_WARNING_DERATING,
+  CNC_WARNING_CHATTER,
+  CNC_WARNING_IMBALANCE,
+}CNC_WARNING_STATE;
+
 class CncHead200W : public ModuleBase {
   public:
     void Init();
     void HandModule(uint16_t func_id, uint8_t * data, uint8_t data_len);
     void Loop();
     void EmergencyStop();
-    void ReportMotorState(void);
-    void ReportMotorTemperature(void);
+    void PeriodicReport(uint16_t func_id, bool raw);
+    void ReportMotorState(bool periodic = false);
+    void ReportMotorTemperature(bool periodic = false);
     void ReportMotorPidValue(uint8_t index);
     void SetMotorDirState(uint8_t dir);
     void SetMotorSpeedPower(uint8_t power);
     void SetMotorSpeedRpm(uint16_t rpm);
-    void SetMotorCtrMode(bool pid_mode);
+    void SetMotorCtrMode(bool pid_mode, uint8_t drive_mode = MOTOR_DRIVE_MODE_KEEP);
     void SetMotorFan(bool ctr);
     void MotorSpeedControlLoop(void);
+    void MotorPredictiveProtect(void);
+    void ReportMotorWarning(void);
+    void ReportMotorSpectrum(void);
+    void SetMotorTelemetry(bool enable, uint8_t period_ms);
+    void MotorTelemetryLoop(void);
     void CncHeadReportHWVersion(void);
 
     // TEST
@@ -54,22 +87,32 @@ class CncHead200W : public ModuleBase {
 
   private:
     void ReportConfigResult(uint16_t func_id, uint8_t * data, uint8_t data_len);
+    void SendMotorTelemetry(void);
 
   private:
     bool report_msg_ = false;
     uint8_t curtten_cnc_state_ = 0;
-    uint32_t time_ = 0;
     uint32_t loop_ctr_time_ = 0;
     uint32_t overcurrent_  = 0;
     uint32_t pcb_protect_cnt_ = 0;
     uint32_t motor_protect_cnt_ = 0;  
     uint32_t voltage_protect_cnt_ = 0; 
     float target_speed_duty_  = 0;
+    float target_rpm_ = 0;
+    uint8_t motor_warning_ = 0;
+    uint16_t telemetry_seq_ = 0;
+    uint8_t telemetry_cnt_ = 0;
+    uint32_t telemetry_flush_time_ = 0;
+    uint8_t telemetry_pack_[TELEMETRY_HEAD_BYTES + TELEMETRY_PACK_SAMPLES * TELEMETRY_SAMPLE_BYTES];
     float temp_pcb_  = 0;
     float temp_motor_  = 0;
     float motor_current_ = 0;
     float motor_voltage_ = 0;
     BldcMotor bldc_module_dev_;
+    SpindleSpectrum spectrum_;
+    SpindleGuard guard_;
+    ReportFilter state_filter_;
+    ReportFilter sensor_filter_;
     MOTOR_BLOCK_STATE motor_block_bak_ = MOTOR_BLOCK_NORMAL;
 };
 #endif 
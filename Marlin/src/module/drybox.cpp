@@ -23,6 +23,8 @@
 #include "src/HAL/hal_flash.h"
 #include "src/registry/registry.h"
 #include "src/core/can_bus.h"
+#include "src/core/trace.h"
+#include "src/core/log.h"
 #include <wirish_time.h>
 #include "../registry/route.h"
 #include <src/HAL/hal_tim.h>
@@ -30,12 +32,26 @@
 #include "drybox.h"
 
 void DryBox::Init() {
+  AppParmInfo *param = &registryInstance.cfg_;
+
+  // unset or still the extruder defaults Temperature falls back to, the heater block
+  // is slower and has its own gains
+  if (param->parm_mark[0] != 0xaa || param->parm_mark[1] != 0x55 ||
+      (param->temp_P == 0 && param->temp_I == 0 && param->temp_D == 0) ||
+      (param->temp_P == (float)TEMP_DEFAULT_KP && param->temp_I == (float)TEMP_DEFAULT_KI &&
+       param->temp_D == (float)TEMP_DEFAULT_KD)) {
+    param->temp_P = HEATER_DEFAULT_KP;
+    param->temp_I = HEATER_DEFAULT_KI;
+    param->temp_D = HEATER_DEFAULT_KD;
+    registryInstance.SaveCfg();
+  }
+
   fan_.Init(FAN_PIN);
   heater_.InitCapture(THERMISTOR_TEMP_PIN, ADC_TIM_4);
   heater_.SetThermistorType(THERMISTOR_NTC3950);
   heater_.InitOutCtrl(PWM_TIM2, PWM_CH4, HEATING_BLOCK_PIN, 25500);  // 100Hz
-  chamber_.InitOutCtrl(PWM_TIM2, PWM_CH4, HEATING_BLOCK_PIN, 25500); // 100Hz
-  temp_humidity_sensor_.Init(I2C_SDA, I2C_SCL);
+  sensor_xfer_.state = I2C_XFER_IDLE;
+  HAL_I2CInit(GXHT3X_I2C_SPEED);
   power_source_detect_.Init(POWER_SOURCE_DETECT_PIN);
   heater_power_monitor_.Init(HEATER_POWER_MONITOR_PIN);
   cover_detect_.Init(COVER_DET_PIN, INPUT_FLOATING);
@@ -46,7 +62,7 @@ void DryBox::Init() {
 }
 
 void DryBox::InitLight() {
-  light_.Init(DRYBOX_LIGHT_PIN, DRYBOX_LIGHT_COUNT, DRYBOX_LIGHT_EXTI);
+  light_.Init(DRYBOX_LIGHT_PIN, DRYBOX_LIGHT_COUNT);
   RGB_T color = {0, 0, 0};
   light_.StaticLight(color);
 }
@@ -69,11 +85,11 @@ void DryBox::HandModule(uint16_t func_id, uint8_t * data, uint8_t data_len) {
       ReportTempHumidity();
       break;
     case FUNC_REPORT_TEMP_PID:
-        chamber_.ReportPid();
+        heater_.ReportPid();
       break;
     case FUNC_SET_PID:
       val = (float)(((data[1]) << 24) | ((data[2]) << 16) | ((data[3]) << 8 | (data[4]))) / 1000;
-      chamber_.SetPID(data[0], val);
+      heater_.SetPID(data[0], val);
       break;
     case FUNC_MODULE_START:
       StartHeating(data[0]);
@@ -90,6 +106,10 @@ void DryBox::HandModule(uint16_t func_id, uint8_t * data, uint8_t data_len) {
     case FUNC_REPORT_DRYBOX_STATE:
       ReportDryBoxState();
       break;
+    case FUNC_SET_LIGHT_ANIMATION:
+      // kept until the next state change sets the light again
+      light_.Animate(data, data_len);
+      break;
     default:
       break;
   }
@@ -101,6 +121,8 @@ void DryBox::ReportTempHumidity() {
   int16_t heater_temp = heater_temp_;
   int16_t chamber_temp = chamber_temp_;
   int16_t chamber_humidity = chamber_humidity_;
+  I2C_STATS_T *i2c = HAL_I2CStats();
+  uint32_t bus_error = i2c->error + i2c->timeout;
 
   uint16_t msgid = registryInstance.FuncId2MsgId(FUNC_REPORT_TEMP_HUMIDITY);
   if (msgid != INVALID_VALUE) {
@@ -110,6 +132,9 @@ void DryBox::ReportTempHumidity() {
       buf[index++] = chamber_temp & 0xff;
       buf[index++] = chamber_humidity >> 8;
       buf[index++] = chamber_humidity & 0xff;
+      // sensor health, saturated
+      buf[index++] = sensor_crc_error_ > 0xff ? 0xff : sensor_crc_error_;
+      buf[index++] = bus_error > 0xff ? 0xff : bus_error;
       canbus_g.PushSendStandardData(msgid, buf, index);
   }
 }
@@ -144,69 +169,62 @@ void DryBox::ReportDryBoxState() {
   }
 }
 
-bool DryBox::ResetGXHT3X() {
-    bool ret = true;
-    uint8_t wirte_header = (ADDR_GXHT3X<<1) & (~0x01);
-    temp_humidity_sensor_.IICStart();
-    temp_humidity_sensor_.IICSendByte(wirte_header);
-    if (temp_humidity_sensor_.IICWaitAck() == false) {
-        ret = false;
-        goto EXIT;
+// Sensirion CRC-8, poly 0x31, init 0xff, over each 16 bit word
+static uint8_t Gxht3xCrc8(uint8_t *data) {
+  uint8_t crc = 0xff;
+  for (uint8_t i = 0; i < 2; i++) {
+    crc ^= data[i];
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x80) ? (crc << 1) ^ 0x31 : (crc << 1);
     }
-    temp_humidity_sensor_.IICSendByte(0x30);
-    if (temp_humidity_sensor_.IICWaitAck() == false) {
-        ret = false;
-        goto EXIT;
+  }
+  return crc;
+}
+
+// blocking, only used while initializing the sensor
+bool DryBox::SensorCommand(uint8_t msb, uint8_t lsb) {
+    sensor_xfer_.addr = ADDR_GXHT3X;
+    sensor_xfer_.tx[0] = msb;
+    sensor_xfer_.tx[1] = lsb;
+    sensor_xfer_.tx_len = 2;
+    sensor_xfer_.rx_len = 0;
+    sensor_xfer_.retry = GXHT3X_I2C_RETRY;
+    if (!HAL_I2CSubmit(&sensor_xfer_)) {
+        return false;
     }
-    temp_humidity_sensor_.IICSendByte(0xA2);
-    if (temp_humidity_sensor_.IICWaitAck() == false) {
-        ret = false;
-        goto EXIT;
+    bool ret = HAL_I2CWait(&sensor_xfer_, 100);
+    if (sensor_xfer_.state != I2C_XFER_PENDING && sensor_xfer_.state != I2C_XFER_BUSY) {
+        sensor_xfer_.state = I2C_XFER_IDLE;
     }
+    return ret;
+}
 
-EXIT:
+// data: temp_h, temp_l, crc, humidity_h, humidity_l, crc
+bool DryBox::ParseTempHumidity(uint8_t *data) {
+    if (Gxht3xCrc8(&data[0]) != data[2] || Gxht3xCrc8(&data[3]) != data[5]) {
+        sensor_crc_error_++;
+        LOG("drybox gxht3x crc error %u", sensor_crc_error_);
+        return false;
+    }
+    chamber_temp_ = ((data[0]<<8)|data[1]) * 175.0f / 65535 - 45;
+    chamber_humidity_ = ((data[3]<<8)|data[4]) * 100.0f / 65535;
+    temp_humidity_sample_time_ = millis();
+    return true;
+}
+
+bool DryBox::ResetGXHT3X() {
+    bool ret = SensorCommand(0x30, 0xA2);
     uint32_t time = millis();
     while(time + 1000 > millis());
     return ret;
 }
 
 bool DryBox::StartSingleConvert(uint8_t clock_stretching, uint8_t accuracy) {
-    bool ret = true;
-    uint8_t wirte_header = (ADDR_GXHT3X<<1) & (~0x01);
-    temp_humidity_sensor_.IICStart();
-    temp_humidity_sensor_.IICSendByte(wirte_header);
-    if (temp_humidity_sensor_.IICWaitAck() == false) {
-        ret = false;
-        goto EXIT;
-    }
-    temp_humidity_sensor_.IICSendByte(clock_stretching);
-    if (temp_humidity_sensor_.IICWaitAck() == false) {
-        ret = false;
-        goto EXIT;
-    }
-    temp_humidity_sensor_.IICSendByte(accuracy);
-    if (temp_humidity_sensor_.IICWaitAck() == false) {
-        ret = false;
-        goto EXIT;
-    }
-
-EXIT:
-    return ret;
+    return SensorCommand(clock_stretching, accuracy);
 }
 
 void DryBox::StartCyclicConvert(uint8_t freq, uint8_t accuracy) {
-    uint8_t wirte_header = (ADDR_GXHT3X<<1) & (~0x01);
-    temp_humidity_sensor_.IICStart();
-    temp_humidity_sensor_.IICSendByte(wirte_header);
-    if (temp_humidity_sensor_.IICWaitAck() == false) {
-        return;
-    }
-    temp_humidity_sensor_.IICSendByte(freq);
-    if (temp_humidity_sensor_.IICWaitAck() == false) {
-        return;
-    }
-    temp_humidity_sensor_.IICSendByte(accuracy);
-    if (temp_humidity_sensor_.IICWaitAck() == false) {
+    if (SensorCommand(freq, accuracy) == false) {
         return;
     }
 
@@ -218,62 +236,30 @@ void DryBox::StopCyclicConvert() {
 
 }
 
+// blocking read of a single shot conversion
 bool DryBox::GetTempHumidity() {
-    uint8_t read_header;
-    uint8_t temp_h, temp_l;
-    uint8_t humidity_h, humidity_l;
-    read_header = (ADDR_GXHT3X<<1) | 0x01;
-    temp_humidity_sensor_.IICStart();
-    temp_humidity_sensor_.IICSendByte(read_header);
-    if (temp_humidity_sensor_.IICWaitAck() == false) {
+    sensor_xfer_.addr = ADDR_GXHT3X;
+    sensor_xfer_.tx_len = 0;
+    sensor_xfer_.rx = sensor_data_;
+    sensor_xfer_.rx_len = sizeof(sensor_data_);
+    sensor_xfer_.retry = GXHT3X_I2C_RETRY;
+    if (!HAL_I2CSubmit(&sensor_xfer_) || !HAL_I2CWait(&sensor_xfer_, 100)) {
         return false;
     }
-    temp_h = temp_humidity_sensor_.IICReadByte(true);
-    temp_l = temp_humidity_sensor_.IICReadByte(true);
-    temp_humidity_sensor_.IICReadByte(true);                  // read crc
-    humidity_h = temp_humidity_sensor_.IICReadByte(true);
-    humidity_l = temp_humidity_sensor_.IICReadByte(true);
-    temp_humidity_sensor_.IICReadByte(false);                 // read crc
-    chamber_temp_ = ((temp_h<<8)|temp_l)*175/65535 - 45;
-    chamber_humidity_ = ((humidity_h<<8)|humidity_l)*100/65535;
-    return true;
+    sensor_xfer_.state = I2C_XFER_IDLE;
+    return ParseTempHumidity(sensor_data_);
 }
 
+// queue a fetch of the periodic result, ReadTempHumidityCyclic picks it up
 bool DryBox::GetTempHumidityCyclic() {
-    uint8_t read_header, write_header;
-    uint8_t temp_h, temp_l;
-    uint8_t humidity_h, humidity_l;
-
-    write_header = (ADDR_GXHT3X<<1) & (~0x01);
-    temp_humidity_sensor_.IICStart();
-    temp_humidity_sensor_.IICSendByte(write_header);
-    if (temp_humidity_sensor_.IICWaitAck() == false) {
-        return false;
-    }
-    temp_humidity_sensor_.IICSendByte(0xE0);
-    if (temp_humidity_sensor_.IICWaitAck() == false) {
-        return false;
-    }
-    temp_humidity_sensor_.IICSendByte(0x00);
-    if (temp_humidity_sensor_.IICWaitAck() == false) {
-        return false;
-    }
-
-    read_header = (ADDR_GXHT3X<<1) | 0x01;
-    temp_humidity_sensor_.IICStart();
-    temp_humidity_sensor_.IICSendByte(read_header);
-    if (temp_humidity_sensor_.IICWaitAck() == false) {
-        return false;
-    }
-    temp_h = temp_humidity_sensor_.IICReadByte(true);
-    temp_l = temp_humidity_sensor_.IICReadByte(true);
-    temp_humidity_sensor_.IICReadByte(true);                  // read crc
-    humidity_h = temp_humidity_sensor_.IICReadByte(true);
-    humidity_l = temp_humidity_sensor_.IICReadByte(true);
-    temp_humidity_sensor_.IICReadByte(false);                 // read crc
-    chamber_temp_ = ((temp_h<<8)|temp_l)*175/65535 - 45;
-    chamber_humidity_ = ((humidity_h<<8)|humidity_l)*100/65535;
-    return true;
+    sensor_xfer_.addr = ADDR_GXHT3X;
+    sensor_xfer_.tx[0] = 0xE0;
+    sensor_xfer_.tx[1] = 0x00;
+    sensor_xfer_.tx_len = 2;
+    sensor_xfer_.rx = sensor_data_;
+    sensor_xfer_.rx_len = sizeof(sensor_data_);
+    sensor_xfer_.retry = GXHT3X_I2C_RETRY;
+    return HAL_I2CSubmit(&sensor_xfer_);
 }
 
 void DryBox::ReadTempHumidityCyclic() {
@@ -281,29 +267,23 @@ void DryBox::ReadTempHumidityCyclic() {
         return;
     }
 
-    if (temp_humidity_time_elaspe_ + 110 < millis()) {
+    HAL_I2CLoop();
+    if (sensor_xfer_.state == I2C_XFER_DONE) {
+        sensor_xfer_.state = I2C_XFER_IDLE;
+        // a command that finished after its wait timed out carries no data
+        if (sensor_xfer_.rx_len == sizeof(sensor_data_) && ParseTempHumidity(sensor_data_) == true) {
+            chamber_temp_ready_ = true;
+        }
+    }
+
+    if (temp_humidity_time_elaspe_ + GXHT3X_FETCH_MS < millis()) {
         temp_humidity_time_elaspe_ = millis();
     } else {
         return;
     }
 
-    if (GetTempHumidityCyclic() == true) {
-        chamber_temp_ready_ = true;
-        // uint8_t buf[8] = {0};
-        // uint8_t index = 0;
-        // uint16_t msgid = registryInstance.FuncId2MsgId(FUNC_REPORT_TEMP_HUMIDITY);
-        // if (msgid != INVALID_VALUE) {
-        //     buf[index++] = ((uint8_t *)(&chamber_temp_))[0];
-        //     buf[index++] = ((uint8_t *)(&chamber_temp_))[1];
-        //     buf[index++] = ((uint8_t *)(&chamber_temp_))[2];
-        //     buf[index++] = ((uint8_t *)(&chamber_temp_))[3];
-        //     buf[index++] = ((uint8_t *)(&chamber_humidity_))[0];
-        //     buf[index++] = ((uint8_t *)(&chamber_humidity_))[1];
-        //     buf[index++] = ((uint8_t *)(&chamber_humidity_))[2];
-        //     buf[index++] = ((uint8_t *)(&chamber_humidity_))[3];
-        //     canbus_g.PushSendStandardData(msgid, buf, index);
-        // }
-    }
+    // a fetch still on the bus is not queued again
+    GetTempHumidityCyclic();
 }
 
 void DryBox::TempAndHumidityProcess() {
@@ -326,6 +306,10 @@ void DryBox::StartHeating(uint8_t state) {
     } else {
       RequestSystemEnterState(DRYBOX_STATE_HEATING_FREE);
     }
+  } else if (state == 2) {
+    // ends by itself when the drying curve flattens, the heating time is only a limit
+    drying_.Start(target_heating_time_ > 0 ? target_heating_time_ : DRYING_MAX_TIME_S);
+    RequestSystemEnterState(DRYBOX_STATE_HEATING_AUTO);
   } else if (state == 0) {
     RequestSystemEnterState(DRYBOX_STATE_IDLE);
   }
@@ -334,15 +318,16 @@ void DryBox::StartHeating(uint8_t state) {
 void DryBox::SetTargetTemp(int16_t heater_temp, int16_t chamber_temp) {
   heater_target_temp_ = heater_temp;
   chamber_target_temp_ = chamber_temp;
-  heater_.ChangeTarget(heater_temp);
-  chamber_.ChangeTarget(chamber_temp);
+  // the heater target is only the ceiling of the cascade
 }
 
 void DryBox::SetTargetHeatingTime(uint32_t time) {
   target_heating_time_ = time;
   remain_heating_time_ = target_heating_time_ - timing_heating_time_;
 
-  if (drybox_state_ == DRYBOX_STATE_HEATING_FREE) {
+  if (drybox_state_ == DRYBOX_STATE_HEATING_AUTO) {
+    drying_.SetMaxTime(time > 0 ? time : DRYING_MAX_TIME_S);
+  } else if (drybox_state_ == DRYBOX_STATE_HEATING_FREE) {
     drybox_state_ = DRYBOX_STATE_HEATING_TIMING;
   } else if (drybox_state_ == DRYBOX_STATE_HEATING_TIMING) {
     if (target_heating_time_ == 0) {
@@ -388,28 +373,31 @@ void DryBox::HeaterTempMonitor() {
   }
 }
 
+void DryBox::ResetTempCtrl() {
+  chamber_ctrl_.Reset();
+  chamber_ctrl_time_ = 0;
+  chamber_temp_ready_ = false;
+  // until the first chamber sample the heater only goes to the chamber target
+  heater_.ChangeTarget(chamber_target_temp_);
+}
+
+// cascade: the chamber loop sets the heater block target, the heater loop drives the pwm
 void DryBox::TempCtrl() {
-  switch (temp_ctrl_stage_) {
-    case TEMP_CTRL_PRE_HEAT:
-      heater_.SetPwmDutyLimitAndThreshold(204, 0);
-      heater_.PrfetchTempMaintain();
-      if ((heater_temp_ >= heater_target_temp_) && (heater_target_temp_ > 70)) {
-        temp_ctrl_stage_ = TEMP_CTRL_CHAMBER_HEAT;
-      }
-      break;
-    case TEMP_CTRL_CHAMBER_HEAT:
-      heater_.SetPwmDutyLimitAndThreshold(255, 0);
-      // if heater temp lower than target, switch to heater for heating
-      if (heater_temp_ < heater_target_temp_) {
-        temp_ctrl_stage_ = TEMP_CTRL_PRE_HEAT;
-      } else if (chamber_temp_ready_) {
-        chamber_temp_ready_ = false;
-        chamber_.TempMaintain(chamber_temp_);
-      }
-      break;
-    default:
-      break;
+  if (chamber_temp_ready_) {
+    uint32_t now = millis();
+    float dt = chamber_ctrl_time_ ? (now - chamber_ctrl_time_) / 1000.0f : 0;
+    uint32_t pwm = heater_.GetOutput();
+    int8_t heater_sat = pwm >= HEATER_PWM_MAX ? 1 : (pwm == 0 ? -1 : 0);
+    float max_sp = heater_target_temp_ < HEATER_MAX_SETPOINT ? heater_target_temp_ : HEATER_MAX_SETPOINT;
+
+    chamber_temp_ready_ = false;
+    chamber_ctrl_time_ = now;
+    chamber_ctrl_.SetLimit(chamber_target_temp_, max_sp);
+    heater_.ChangeTarget(chamber_ctrl_.Update(chamber_target_temp_, chamber_temp_, heater_temp_, heater_sat, dt));
   }
+
+  heater_.SetPwmDutyLimitAndThreshold(HEATER_PWM_MAX, HEATER_PID_BAND);
+  heater_.PrfetchTempMaintain();
 }
 
 void DryBox::HeatingTimeProcess() {
@@ -428,6 +416,24 @@ void DryBox::HeatingTimeProcess() {
     if (remain_heating_time_ <= 0) {
       RequestSystemEnterState(DRYBOX_STATE_IDLE);
     }
+  } else if (drybox_state_ == DRYBOX_STATE_HEATING_AUTO) {
+    accumulate_dry_time_++;
+    timing_heating_time_++;
+    DryingProcess();
+  }
+}
+
+// runs once a second from HeatingTimeProcess
+void DryBox::DryingProcess() {
+  bool at_temp = chamber_temp_ >= chamber_target_temp_ - DRYING_AT_TEMP_BAND;
+  bool sensor_ok = temp_humidity_sample_time_ &&
+                   (millis() - temp_humidity_sample_time_ < DRYING_SENSOR_STALE_S * 1000);
+
+  drying_.Update(chamber_temp_, chamber_humidity_, at_temp, sensor_ok);
+  fan_.ChangePwm(drying_.FanDuty(), 0);
+  remain_heating_time_ = drying_.RemainTime();
+  if (drying_.Done()) {
+    RequestSystemEnterState(DRYBOX_STATE_IDLE);
   }
 }
 
@@ -545,7 +551,6 @@ bool DryBox::RequestSystemEnterState(drybox_state_e state) {
   if (state == DRYBOX_STATE_IDLE) {
     if (drybox_fault_state_ == 0) {
       heater_.ShutDown();
-      chamber_.ShutDown();
       fan_.ChangePwm(0, 0);
       clear_heating_time();
       light_.StaticLight(WHITE_LIGHT);
@@ -564,6 +569,7 @@ bool DryBox::RequestSystemEnterState(drybox_state_e state) {
       fan_.ChangePwm(255, 0);
       drybox_prev_state_ = drybox_state_;
       drybox_state_ = DRYBOX_STATE_HEATING_FREE;
+      ResetTempCtrl();
       light_.BreathLight(BLACK_LIGHT, WHITE_LIGHT, 6000);
       goto EXIT;
     } else {
@@ -578,6 +584,22 @@ bool DryBox::RequestSystemEnterState(drybox_state_e state) {
       fan_.ChangePwm(255, 0);
       drybox_prev_state_ = drybox_state_;
       drybox_state_ = DRYBOX_STATE_HEATING_TIMING;
+      ResetTempCtrl();
+      light_.BreathLight(BLACK_LIGHT, WHITE_LIGHT, 6000);
+      goto EXIT;
+    } else {
+      state = DRYBOX_STATE_FAULT;
+      ret = false;
+    }
+  }
+
+  // enter auto drying mode
+  if (state == DRYBOX_STATE_HEATING_AUTO) {
+    if (drybox_fault_state_ == 0) {
+      fan_.ChangePwm(drying_.FanDuty(), 0);
+      drybox_prev_state_ = drybox_state_;
+      drybox_state_ = DRYBOX_STATE_HEATING_AUTO;
+      ResetTempCtrl();
       light_.BreathLight(BLACK_LIGHT, WHITE_LIGHT, 6000);
       goto EXIT;
     } else {
@@ -589,7 +611,6 @@ bool DryBox::RequestSystemEnterState(drybox_state_e state) {
   // enter fault mode
   if (state == DRYBOX_STATE_FAULT) {
     heater_.ShutDown();
-    chamber_.ShutDown();
     fan_.ChangePwm(0, 0);
     if (drybox_state_ != DRYBOX_STATE_FAULT) {
       drybox_prev_state_ = drybox_state_;
@@ -607,7 +628,8 @@ bool DryBox::RequestSystemEnterState(drybox_state_e state) {
         light_.FlickeringLight(light_color_, 500);
       }
     } else {
-      if ((drybox_prev_state_ == DRYBOX_STATE_HEATING_FREE) || (drybox_prev_state_ == DRYBOX_STATE_HEATING_TIMING)) {
+      if ((drybox_prev_state_ == DRYBOX_STATE_HEATING_FREE) || (drybox_prev_state_ == DRYBOX_STATE_HEATING_TIMING) ||
+          (drybox_prev_state_ == DRYBOX_STATE_HEATING_AUTO)) {
         light_color_ = RED_LIGHT;
       } else {
         light_color_ = WHITE_LIGHT;
@@ -633,13 +655,14 @@ bool DryBox::RequestSystemEnterState(drybox_state_e state) {
   }
 
 EXIT:
+  TRACE(TRACE_EVT_STATE, drybox_state_, drybox_prev_state_);
+  LOG("drybox state %u -> %u fault 0x%x", drybox_prev_state_, drybox_state_, drybox_fault_state_);
   ReportDryBoxState();
   return ret;
 }
 
 void DryBox::EmergencyStop() {
   heater_.ShutDown();
-  chamber_.ShutDown();
   drybox_state_ = DRYBOX_STATE_IDLE;
 }
 
@@ -667,6 +690,7 @@ void DryBox::Loop() {
 
     case DRYBOX_STATE_HEATING_FREE:
     case DRYBOX_STATE_HEATING_TIMING:
+    case DRYBOX_STATE_HEATING_AUTO:
       {
         HeatingProcess();
       }
@@ -28,7 +28,9 @@
 #include "src/device/analog_io_ctrl.h"
 #include "module_base.h"
 #include "src/device/temperature.h"
-#include "../device/soft_i2c.h"
+#include "src/device/drying_ctrl.h"
+#include "src/device/chamber_ctrl.h"
+#include "src/HAL/hal_i2c.h"
 
 #define BOARD_SM_NULL                    (0xffff)
 #define BOARD_SM_CONTROLLER2019_V1       (4300)
@@ -36,8 +38,6 @@
 
 #define CAN_DATA_FRAME_LENGTH    (8)
 
-#define I2C_SDA                  PB7
-#define I2C_SCL                  PB6
 #define THERMISTOR_TEMP_PIN      PA2
 #define HEATING_BLOCK_PIN        PA3
 #define POWER_SOURCE_DETECT_PIN  PA5
@@ -47,28 +47,33 @@
 #define POWER_SELECT_PIN         PB5
 
 #define ADDR_GXHT3X           0x44
+#define GXHT3X_I2C_SPEED      100000
+#define GXHT3X_I2C_RETRY      1
+#define GXHT3X_FETCH_MS       110
 
 #define DRYBOX_LIGHT_PIN PA7
 #define DRYBOX_LIGHT_COUNT 12
-#define DRYBOX_LIGHT_EXTI SOFT_EXTI_LINE2  // Using software interrupts
 
 #define HEATER_PROTECT_TEMP  130
 #define HEATER_RECOVER_TEMP  80
+#define HEATER_MAX_SETPOINT  (HEATER_PROTECT_TEMP - 10)
+#define HEATER_PWM_MAX       255
+#define HEATER_PID_BAND      10    // bang-bang outside, PID inside
+// heater block loop, per thermistor sample (38.4ms), pwm count per degree
+#define HEATER_DEFAULT_KP    6
+#define HEATER_DEFAULT_KI    0.01
+#define HEATER_DEFAULT_KD    40
 
 #define GET_STATUS(S, B) ((S >> B) & 0x01)
 #define SET_BIT(S, B) (S |= (0x01 << B))
 #define CLR_BIT(S, B) (S &= ~(0x01 << B))
 
-typedef enum {
-  TEMP_CTRL_PRE_HEAT,
-  TEMP_CTRL_CHAMBER_HEAT,
-}temp_ctrl_e;
-
 typedef enum {
   DRYBOX_STATE_IDLE,
   DRYBOX_STATE_HEATING_FREE,
   DRYBOX_STATE_HEATING_TIMING,
   DRYBOX_STATE_FAULT,
+  DRYBOX_STATE_HEATING_AUTO,
 }drybox_state_e;
 
 typedef enum {
@@ -82,11 +87,13 @@ typedef enum {
 class DryBox : public ModuleBase {
   public:
     DryBox () {
-      temp_ctrl_stage_ = TEMP_CTRL_PRE_HEAT;
       chamber_temp_ready_ = false;
+      chamber_ctrl_time_ = 0;
       is_cyclic_convert_start_ = false;
       temp_humidity_time_elaspe_ = 0;
       info_report_time_ = 0;
+      sensor_crc_error_ = 0;
+      temp_humidity_sample_time_ = 0;
 
       mainctrl_type_ = BOARD_SM_NULL;
       power_source_state_ = 0xff;
@@ -110,6 +117,8 @@ class DryBox : public ModuleBase {
     void ReportHeaterPowerState();
     void ReportCoverState();
     void ReportDryBoxState();
+    bool SensorCommand(uint8_t msb, uint8_t lsb);
+    bool ParseTempHumidity(uint8_t *data);
     bool ResetGXHT3X();
     bool StartSingleConvert(uint8_t clock_stretching, uint8_t accuracy);
     void StartCyclicConvert(uint8_t freq, uint8_t accuracy);
@@ -124,7 +133,9 @@ class DryBox : public ModuleBase {
     void SetTargetHeatingTime(uint32_t time);
     void CoverDetect();
     void HeatingTimeProcess();
+    void DryingProcess();
     void HeaterTempMonitor();
+    void ResetTempCtrl();
     void TempCtrl();
     void HeatingProcess();
     void ExternalPowerDetection();
@@ -137,7 +148,6 @@ class DryBox : public ModuleBase {
     void Loop();
 
     Temperature heater_;
-    Temperature chamber_;
     Fan fan_;
     SwitchInput power_source_detect_;
     SwitchInput heater_power_monitor_;
@@ -146,14 +156,19 @@ class DryBox : public ModuleBase {
     RGBLight light_;
 
   private:
-    SoftI2C temp_humidity_sensor_;
+    I2C_XFER_T sensor_xfer_;
+    uint8_t sensor_data_[6];
+    uint32_t sensor_crc_error_;
+    uint32_t temp_humidity_sample_time_;
+    DryingCtrl drying_;
     uint16_t heater_target_temp_;
     uint16_t chamber_target_temp_;
     float heater_temp_;
     float chamber_temp_;
     float chamber_humidity_;
-    temp_ctrl_e temp_ctrl_stage_;
     bool chamber_temp_ready_;
+    ChamberCtrl chamber_ctrl_;
+    uint32_t chamber_ctrl_time_;
     bool is_cyclic_convert_start_;
     uint32_t temp_humidity_time_elaspe_;
     uint32_t info_report_time_;
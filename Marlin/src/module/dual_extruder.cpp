@@ -25,6 +25,7 @@
 #include "src/core/can_bus.h"
 #include <wirish_time.h>
 #include "../registry/route.h"
+#include "../registry/report_scheduler.h"
 #include <src/HAL/hal_tim.h>
 #include <math.h>
 #include "dual_extruder.h"
@@ -35,11 +36,11 @@
 
 #define Z_MAX_POS                      9.0
 #define STEPPER_TIMER                  3
-// #define Z_AXIS_STEPS_PER_UNIT          1600         // 2mm/r
-#define Z_AXIS_STEPS_PER_UNIT          3200         // 1mm/r
-#define ACCELERATION                   40
+#define Z_MIN_FEEDRATE                 0.5
+#define Z_MAX_FEEDRATE                 10
 
 #define TEMP_REPORT_INTERVAL    (500)
+#define OVER_TEMP_CHECK_INTERVAL (500)
 #define OVER_TEMP_DEBOUNCE      (1000)
 
 #define DEFAULT_PID_P (150)
@@ -164,7 +165,10 @@ void DualExtruder::Init() {
   nozzle_identify_1_.SetAdcIndex(adc_index1_identify);
   nozzle_identify_1_.SetNozzleTypeCheckArray(THERMISTOR_PT100);
 
-  temp_report_time_ = millis() + TEMP_REPORT_INTERVAL;
+  overtemp_check_time_ = millis() + OVER_TEMP_CHECK_INTERVAL;
+  reportScheduler.Register(FUNC_REPORT_TEMPEARTURE, TEMP_REPORT_INTERVAL);
+  const uint16_t deadband[4] = {TEMP_REPORT_DEADBAND, 0, TEMP_REPORT_DEADBAND, 0};
+  temp_report_filter_.Init(deadband, 4, TEMP_REPORT_MIN_INTERVAL, TEMP_REPORT_MAX_INTERVAL);
   overtemp_debounce_[0] = millis() + OVER_TEMP_DEBOUNCE;
   overtemp_debounce_[1] = millis() + OVER_TEMP_DEBOUNCE;
 }
@@ -272,9 +276,15 @@ void DualExtruder::HandModule(uint16_t func_id, uint8_t * data, uint8_t data_len
 }
 
 void DualExtruder::Stepper() {
+  speed_node_t *speed_ctrl = speed_ctrl_buffer_[speed_ctrl_active_];
+
   if (end_stop_enable_ == true) {
     if (probe_right_extruder_optocoupler_.Read()) {
       hit_state_ = 1;
+      // whatever is still queued was planned from a position we never reached,
+      // FlushAbortedMoves() drops it before another block is accepted
+      abort_stepps_ = stepps_sum_ - stepps_count_;
+      move_abort_ = true;
       stepps_count_ = 0;
       stepps_sum_   = 0;
       motor_state_  = 0;
@@ -286,19 +296,13 @@ void DualExtruder::Stepper() {
     }
   }
 
-  while (stepps_count_ == speed_ctrl_buffer_[speed_ctrl_index_].pulse_count) {
-    if (speed_ctrl_index_ != 19) {
+  while (stepps_count_ == speed_ctrl[speed_ctrl_index_].pulse_count) {
+    if (speed_ctrl_index_ != Z_SPEED_CTRL_NODES - 1) {
       speed_ctrl_index_++;
       StepperTimerStop();
-      StepperTimerStart(speed_ctrl_buffer_[speed_ctrl_index_].timer_time);
+      StepperTimerStart(speed_ctrl[speed_ctrl_index_].timer_time);
     } else {
-      stepps_count_ = 0;
-      stepps_sum_   = 0;
-      motor_state_  = 0;
-      z_motor_step_.Out(0);
-      z_motor_en_.Out(0);
-      z_motor_cur_ctrl_.Out(1);
-      StepperTimerStop();
+      StepperLoadNextBlock();
       return;
     }
   }
@@ -312,16 +316,44 @@ void DualExtruder::Stepper() {
     z_motor_step_.Out(0);
 
     if (stepps_count_ == stepps_sum_) {
-      stepps_count_ = 0;
-      stepps_sum_   = 0;
-      motor_state_  = 0;
-      z_motor_en_.Out(0);
-      z_motor_cur_ctrl_.Out(1);
-      StepperTimerStop();
+      StepperLoadNextBlock();
     }
   }
 }
 
+// called from the stepper ISR when the running block is finished,
+// the staged block continues at the junction speed it was planned with
+void DualExtruder::StepperLoadNextBlock() {
+  uint8_t done_next = (move_done_tail_ + 1) % Z_MOVE_QUEUE_SIZE;
+  if (active_report_ && done_next != move_done_head_) {
+    move_done_pos_[move_done_tail_] = active_position_;
+    move_done_tail_ = done_next;
+  }
+
+  step_pin_state_ = 0;
+  z_motor_step_.Out(0);
+  stepps_count_ = 0;
+
+  if (next_block_ready_) {
+    speed_ctrl_active_ ^= 1;
+    speed_ctrl_index_ = 0;
+    stepps_sum_ = next_stepps_sum_;
+    active_report_ = next_report_;
+    active_position_ = next_position_;
+    active_dir_ = next_dir_;
+    z_motor_dir_.Out(next_dir_);
+    next_block_ready_ = false;
+    StepperTimerStart(speed_ctrl_buffer_[speed_ctrl_active_][0].timer_time);
+    return;
+  }
+
+  stepps_sum_   = 0;
+  motor_state_  = 0;
+  z_motor_en_.Out(0);
+  z_motor_cur_ctrl_.Out(1);
+  StepperTimerStop();
+}
+
 void DualExtruder::StepperTimerStart(uint16_t time) {
   HAL_timer_disable(STEPPER_TIMER);
 
@@ -336,13 +368,31 @@ void DualExtruder::StepperTimerStop() {
   soft_pwm_g.TimStart();
 }
 
+bool DualExtruder::MoveQueueBusy() {
+  return motor_state_ || next_block_ready_ || (move_queue_head_ != move_queue_tail_);
+}
+
 void DualExtruder::MoveSync() {
-  while(motor_state_) {
+  while(MoveQueueBusy()) {
+    if (move_abort_) {
+      FlushAbortedMoves();
+      break;
+    }
     canbus_g.Handler();
     registryInstance.ConfigHandler();
     registryInstance.SystemHandler();
     routeInstance.ModuleLoop();
   }
+  FlushAbortedMoves();
+}
+
+// one move, waited for; false when the queue did not take it
+bool DualExtruder::MoveZSync(float length, float speed) {
+  if (!QueueMoveZ(length, speed)) {
+    return false;
+  }
+  MoveSync();
+  return true;
 }
 
 move_state_e DualExtruder::GoHome(bool init_index/*=true*/) {
@@ -353,15 +403,22 @@ move_state_e DualExtruder::GoHome(bool init_index/*=true*/) {
 
   move_state_e move_state = MOVE_STATE_SUCCESS;
 
+  // homing moves are relative, let the queued ones land first
+  MoveSync();
+
   // if endstop triggered, leave current position
   uint32_t i = 0;
   for (i = 0; i < 4; i++) {
     if (digitalRead(PROBE_RIGHT_EXTRUDER_OPTOCOUPLER_PIN)) {
-      DoBlockingMoveToZ(-2, 9);
-      MoveSync();
+      if (!MoveZSync(-2, 9)) {
+        move_state = MOVE_STATE_FAIL;
+        goto EXIT;
+      }
     } else {
-      DoBlockingMoveToZ(-0.2, 9);
-      MoveSync();
+      if (!MoveZSync(-0.2, 9)) {
+        move_state = MOVE_STATE_FAIL;
+        goto EXIT;
+      }
       break;
     }
   }
@@ -372,34 +429,32 @@ move_state_e DualExtruder::GoHome(bool init_index/*=true*/) {
   }
 
   end_stop_enable_ = true;
-  DoBlockingMoveToZ(9, 9);
-  MoveSync();
-  if (hit_state_ == 1) {
-    hit_state_ = 0;
-  } else {
+  if (!MoveZSync(9, 9) || hit_state_ != 1) {
     move_state = MOVE_STATE_FAIL;
     goto EXIT;
   }
+  hit_state_ = 0;
   end_stop_enable_ = false;
 
   // bump
-  DoBlockingMoveToZ(-1, 9);
-  MoveSync();
+  if (!MoveZSync(-1, 9)) {
+    move_state = MOVE_STATE_FAIL;
+    goto EXIT;
+  }
 
   end_stop_enable_ = true;
-  DoBlockingMoveToZ(1.5, 1);
-  MoveSync();
-  if (hit_state_ == 1) {
-    hit_state_ = 0;
-  } else {
+  if (!MoveZSync(1.5, 1) || hit_state_ != 1) {
     move_state = MOVE_STATE_FAIL;
     goto EXIT;
   }
+  hit_state_ = 0;
   end_stop_enable_ = false;
 
   // go to the home position
-  DoBlockingMoveToZ(-raise_for_home_pos_, 6);
-  MoveSync();
+  if (!MoveZSync(-raise_for_home_pos_, 6)) {
+    move_state = MOVE_STATE_FAIL;
+    goto EXIT;
+  }
 
   homed_state_ = 1;
   current_position_ = 0;
@@ -541,14 +596,38 @@ EXIT:
 void DualExtruder::MoveToDestination(uint8_t *data, uint8_t data_len) {
   move_type_t move_type = (move_type_t)data[0];
   uint8_t move_state = MOVE_STATE_SUCCESS;
+  float position, speed;
 
   switch (move_type) {
     case GO_HOME:
       move_state = GoHome();
       break;
     case MOVE_SYNC:
-      break;
     case MOVE_ASYNC:
+      // data[1-4]: target position in um, data[5-6]: speed in 0.01mm/s
+      if (data_len < 7) {
+        move_state = MOVE_PARAM_ERR;
+        break;
+      }
+      if (!homed_state_) {
+        move_state = MOVE_STATE_FAIL;
+        break;
+      }
+      position = (float)(int32_t)((data[1] << 24) | (data[2] << 16) | (data[3] << 8) | data[4]) / 1000;
+      speed = (float)((data[5] << 8) | data[6]) / 100;
+      if (speed < Z_MIN_FEEDRATE) {
+        speed = Z_MIN_FEEDRATE;
+      } else if (speed > Z_MAX_FEEDRATE) {
+        speed = Z_MAX_FEEDRATE;
+      }
+      if (!PrepareMoveToDestination(position, speed, move_type == MOVE_ASYNC)) {
+        move_state = MOVE_STATE_FAIL;
+        break;
+      }
+      // async moves are answered by ReportMoveDone() once the block is finished
+      if (move_type == MOVE_ASYNC)
+        return;
+      MoveSync();
       break;
     case SENSOR_LEVELING:
     case EXTRUDER_COMPRESS:
@@ -571,107 +650,185 @@ void DualExtruder::MoveToDestination(uint8_t *data, uint8_t data_len) {
   if (msgid != INVALID_VALUE) {
     buf[index++] = (uint8_t)move_type;
     buf[index++] = (uint8_t)move_state;
+    if (move_type == MOVE_SYNC) {
+      int32_t pos = current_position_ * 1000;
+      buf[index++] = pos >> 24;
+      buf[index++] = pos >> 16;
+      buf[index++] = pos >> 8;
+      buf[index++] = pos;
+    }
     canbus_g.PushSendStandardData(msgid, buf, index);
   }
 }
 
-void DualExtruder::PrepareMoveToDestination(float position, float speed) {
+void DualExtruder::ReportMoveFail(int32_t pos) {
+  uint16_t msgid = registryInstance.FuncId2MsgId(FUNC_MOVE_TO_DEST);
+  if (msgid != INVALID_VALUE) {
+    uint8_t buf[8], index = 0;
+    buf[index++] = (uint8_t)MOVE_ASYNC;
+    buf[index++] = (uint8_t)MOVE_STATE_FAIL;
+    buf[index++] = pos >> 24;
+    buf[index++] = pos >> 16;
+    buf[index++] = pos >> 8;
+    buf[index++] = pos;
+    canbus_g.PushSendStandardData(msgid, buf, index);
+  }
+}
+
+// the endstop stopped the motor: drop the interrupted, staged and queued blocks,
+// take back the distance they did not travel and fail the async ones
+void DualExtruder::FlushAbortedMoves() {
+  if (!move_abort_) {
+    return;
+  }
+
+  nvic_globalirq_disable();
+  bool staged = next_block_ready_;
+  uint8_t staged_report = next_report_;
+  int32_t staged_pos = next_position_;
+  int32_t staged_stepps = next_dir_ ? (int32_t)next_stepps_sum_ : -(int32_t)next_stepps_sum_;
+  uint8_t aborted_report = active_report_;
+  int32_t aborted_pos = active_position_;
+  int32_t aborted_stepps = active_dir_ ? (int32_t)abort_stepps_ : -(int32_t)abort_stepps_;
+  next_block_ready_ = false;
+  active_report_ = 0;
+  abort_stepps_ = 0;
+  move_abort_ = false;
+  nvic_globalirq_enable();
+
+  // keep the host's order: what finished before the hit goes first
+  ReportMoveDone();
+
+  current_position_ -= (float)aborted_stepps / Z_AXIS_STEPS_PER_UNIT;
+  if (aborted_report)
+    ReportMoveFail(aborted_pos);
+  if (staged) {
+    current_position_ -= (float)staged_stepps / Z_AXIS_STEPS_PER_UNIT;
+    if (staged_report)
+      ReportMoveFail(staged_pos);
+  }
+  while (move_queue_head_ != move_queue_tail_) {
+    move_block_t *block = &move_queue_[move_queue_head_];
+    current_position_ -= block->length;
+    if (block->report)
+      ReportMoveFail(block->position * 1000);
+    move_queue_head_ = (move_queue_head_ + 1) % Z_MOVE_QUEUE_SIZE;
+  }
+  planned_exit_speed_ = 0;
+}
+
+void DualExtruder::ReportMoveDone() {
+  uint16_t msgid = registryInstance.FuncId2MsgId(FUNC_MOVE_TO_DEST);
+
+  while (move_done_head_ != move_done_tail_) {
+    int32_t pos = move_done_pos_[move_done_head_];
+    move_done_head_ = (move_done_head_ + 1) % Z_MOVE_QUEUE_SIZE;
+    if (msgid != INVALID_VALUE) {
+      uint8_t buf[8], index = 0;
+      buf[index++] = (uint8_t)MOVE_ASYNC;
+      buf[index++] = (uint8_t)MOVE_STATE_SUCCESS;
+      buf[index++] = pos >> 24;
+      buf[index++] = pos >> 16;
+      buf[index++] = pos >> 8;
+      buf[index++] = pos;
+      canbus_g.PushSendStandardData(msgid, buf, index);
+    }
+  }
+}
+
+bool DualExtruder::PrepareMoveToDestination(float position, float speed, bool report/*=false*/) {
   if (position > Z_MAX_POS) {
     position = Z_MAX_POS;
   } else if (position < 0) {
     position = 0;
   }
 
-  DoBlockingMoveToZ(position - current_position_, speed);
+  if (!QueueMoveZ(position - current_position_, speed, report)) {
+    return false;
+  }
   current_position_ = position;
+  return true;
 }
 
-// relative motion, the range of motion will not be checked here
-void DualExtruder::DoBlockingMoveToZ(float length, float speed) {
-  if (motor_state_) {
+// stage the oldest queued block behind the running one, the stepper ISR
+// only swaps speed control buffers so all float math stays in the main loop
+void DualExtruder::PlanMoveQueue() {
+  FlushAbortedMoves();
+
+  if (move_queue_head_ == move_queue_tail_ || next_block_ready_) {
     return;
   }
 
-  speed_ctrl_index_ = 0;
+  uint8_t head = move_queue_head_;
+  move_block_t *block = &move_queue_[head];
+  float length = fabs(block->length);
 
-  float length_tmp = length;
+  nvic_globalirq_disable();
+  bool running = motor_state_;
+  nvic_globalirq_enable();
 
-  // set motor rotation direction
-  if (length < 0) {
-    z_motor_dir_.Out(0);
-    length = -length;
-  }
-  else {
-    z_motor_dir_.Out(1);
-  }
+  float entry_speed = running ? planned_exit_speed_ : 0;
 
-  // convert motion distance to number of pulses
-  stepps_sum_ = Z_AXIS_STEPS_PER_UNIT * length + 0.5;
-  uint32_t half_stepps_sum = stepps_sum_ / 2;
-
-  // calculate the number of pulses needed to accelerate and decelerate to the target speed
-  uint32_t acc_dec_stepps = ((speed * speed) / (2 * ACCELERATION)) * Z_AXIS_STEPS_PER_UNIT;
-  float acc_dec_time;
-  float acc_dec_time_quantum;
-
-  if (acc_dec_stepps <= half_stepps_sum) {
-    // calculation of acceleration and deceleration time
-    acc_dec_time = speed / ACCELERATION;
-    acc_dec_time_quantum = acc_dec_time / 10;
-    float acc_time = acc_dec_time_quantum;
-
-    // calculate the number of pulses to be traveled for each portion of the acceleration process
-    for (int32_t i = 0; i < 10; i++) {
-      speed_ctrl_buffer_[i].pulse_count = (ACCELERATION * (acc_time * acc_time) / 2) * Z_AXIS_STEPS_PER_UNIT;
-      speed_ctrl_buffer_[i].timer_time  = 1000000 / (ACCELERATION * acc_time * Z_AXIS_STEPS_PER_UNIT);
-      acc_time += acc_dec_time_quantum;
-    }
+  float exit_speed = LiftPlanExitSpeed(move_queue_, head, move_queue_tail_, entry_speed);
 
-    // calculate the number of pulses that need to go for each share of time for uniform process
-    speed_ctrl_buffer_[9].pulse_count = stepps_sum_ - acc_dec_stepps;
+  uint8_t buf_index = running ? (speed_ctrl_active_ ^ 1) : speed_ctrl_active_;
+  LiftPlanSpeedCtrl(speed_ctrl_buffer_[buf_index], block->stepps, length, entry_speed, block->speed, exit_speed);
 
-    // calculate the number of pulses to be traveled for each portion of the decleration process
-    acc_time = acc_dec_time_quantum;
-    for (int32_t i = 0; i < 10; i++) {
-      speed_ctrl_buffer_[10+i].pulse_count = speed_ctrl_buffer_[9].pulse_count + (speed*acc_time - ACCELERATION*(acc_time * acc_time)/2) * Z_AXIS_STEPS_PER_UNIT;
-      speed_ctrl_buffer_[10+i].timer_time  = 1000000 / ((speed - ACCELERATION * (acc_time-acc_dec_time_quantum)) * Z_AXIS_STEPS_PER_UNIT);
-      acc_time += acc_dec_time_quantum;
+  if (running) {
+    nvic_globalirq_disable();
+    if (!motor_state_) {
+      // finished while we were planning, plan again from standstill
+      nvic_globalirq_enable();
+      return;
     }
-
-    // just in case
-    speed_ctrl_buffer_[19].pulse_count = stepps_sum_;
+    next_stepps_sum_ = block->stepps;
+    next_dir_ = (block->length < 0) ? 0 : 1;
+    next_report_ = block->report;
+    next_position_ = block->position * 1000;
+    next_block_ready_ = true;
+    nvic_globalirq_enable();
   } else {
-    // calculation of acceleration and deceleration time
-    acc_dec_time = sqrt(length/ACCELERATION);
-    acc_dec_time_quantum = acc_dec_time / 10;
-    float acc_time = acc_dec_time_quantum;
-    float velocity = ACCELERATION * acc_dec_time;
-
-    // calculate the number of pulses to be traveled for each portion of the acceleration process
-    for (int32_t i = 0; i < 10; i++) {
-      speed_ctrl_buffer_[i].pulse_count = (ACCELERATION * (acc_time * acc_time) / 2) * Z_AXIS_STEPS_PER_UNIT;
-      speed_ctrl_buffer_[i].timer_time  = 1000000 / (ACCELERATION * acc_time * Z_AXIS_STEPS_PER_UNIT);
-      acc_time += acc_dec_time_quantum;
-    }
+    speed_ctrl_index_ = 0;
+    stepps_count_ = 0;
+    step_pin_state_ = 0;
+    stepps_sum_ = block->stepps;
+    active_report_ = block->report;
+    active_position_ = block->position * 1000;
+    active_dir_ = (block->length < 0) ? 0 : 1;
+    z_motor_dir_.Out(active_dir_);
+
+    // wakeup
+    motor_state_ = 1;
+    z_motor_cur_ctrl_.Out(0);
+    z_motor_en_.Out(0);
+    StepperTimerStart(speed_ctrl_buffer_[buf_index][0].timer_time);
+  }
 
-    // calculate the number of pulses to be traveled for each portion of the decleration process
-    acc_time = acc_dec_time_quantum;
-    for (int32_t i = 0; i < 10; i++) {
-      speed_ctrl_buffer_[10+i].pulse_count = speed_ctrl_buffer_[9].pulse_count + (velocity*acc_time - ACCELERATION*(acc_time * acc_time)/2) * Z_AXIS_STEPS_PER_UNIT;
-      speed_ctrl_buffer_[10+i].timer_time  = 1000000 / ((velocity - ACCELERATION * (acc_time-acc_dec_time_quantum)) * Z_AXIS_STEPS_PER_UNIT);
-      acc_time += acc_dec_time_quantum;
-    }
+  planned_exit_speed_ = exit_speed;
+  move_queue_head_ = (head + 1) % Z_MOVE_QUEUE_SIZE;
+}
 
-    // just in case
-    speed_ctrl_buffer_[19].pulse_count = stepps_sum_;
+// relative motion, the range of motion will not be checked here
+bool DualExtruder::QueueMoveZ(float length, float speed, bool report/*=false*/) {
+  FlushAbortedMoves();
+  uint8_t tail = move_queue_tail_;
+  uint8_t next = (tail + 1) % Z_MOVE_QUEUE_SIZE;
+  if (next == move_queue_head_) {
+    return false;
   }
 
-  // wakeup
-  motor_state_ = 1;
-  z_motor_cur_ctrl_.Out(0);
-  z_motor_en_.Out(0);
-  current_position_ += length_tmp;
-  StepperTimerStart(speed_ctrl_buffer_[0].timer_time);
+  move_block_t *block = &move_queue_[tail];
+  // convert motion distance to number of pulses
+  block->stepps = Z_AXIS_STEPS_PER_UNIT * fabs(length) + 0.5;
+  block->length = length;
+  block->speed = speed;
+  block->report = report;
+  current_position_ += length;
+  block->position = current_position_;
+  move_queue_tail_ = next;
+
+  PlanMoveQueue();
+  return true;
 }
 
 void DualExtruder::ReportOutOfMaterial() {
@@ -734,7 +891,25 @@ void DualExtruder::SetTemperature(uint8_t *data) {
 #define ERR_OVERTEMP_BIT_MASK         (0)
 #define ERR_INVALID_NOZZLE_BIT_MASK   (1)
 
-void DualExtruder::ReportTemprature() {
+// keeps its own pace, the temperature report may be slowed down or unsubscribed
+void DualExtruder::CheckOverTemp() {
+  Temperature *temperature[2] = {&temperature_0_, &temperature_1_};
+
+  for (uint8_t i = 0; i < 2; i++) {
+    if (temperature[i]->GetCurTemprature() >= PROTECTION_TEMPERATURE * 10) {
+      if (ELAPSED(millis(), overtemp_debounce_[i])) {
+        temperature[i]->ChangeTarget(0);
+        overtemp_[i] = true;
+      }
+    }
+    else {
+      overtemp_debounce_[i] = millis() + OVER_TEMP_DEBOUNCE;
+      overtemp_[i] = false;
+    }
+  }
+}
+
+void DualExtruder::ReportTemprature(bool periodic) {
   int16_t msgid = registryInstance.FuncId2MsgId(FUNC_REPORT_TEMPEARTURE);
   if (msgid != INVALID_VALUE) {
     uint16_t temp;
@@ -745,19 +920,11 @@ void DualExtruder::ReportTemprature() {
     if (nozzle_identify_0_.GetNozzleType() == NOZZLE_TYPE_MAX) {
       temp_error |= (1<<ERR_INVALID_NOZZLE_BIT_MASK);
     }
-
-    temp = temperature_0_.GetCurTemprature();
-
-    if (temp >= PROTECTION_TEMPERATURE * 10) {
-      if (ELAPSED(millis(), overtemp_debounce_[0])) {
-        temperature_0_.ChangeTarget(0);
-        temp_error |= (1<<ERR_OVERTEMP_BIT_MASK);
-      }
-    }
-    else {
-      overtemp_debounce_[0] = millis() + OVER_TEMP_DEBOUNCE;
+    if (overtemp_[0]) {
+      temp_error |= (1<<ERR_OVERTEMP_BIT_MASK);
     }
 
+    temp = temperature_0_.GetCurTemprature();
     buf[index++] = temp >> 8;
     buf[index++] = temp;
     buf[index++] = temp_error;
@@ -767,24 +934,19 @@ void DualExtruder::ReportTemprature() {
     if (nozzle_identify_1_.GetNozzleType() == NOZZLE_TYPE_MAX) {
       temp_error |= (1<<ERR_INVALID_NOZZLE_BIT_MASK);
     }
-
-    temp = temperature_1_.GetCurTemprature();
-
-    if (temp >= PROTECTION_TEMPERATURE * 10) {
-      if (ELAPSED(millis(), overtemp_debounce_[1])) {
-        temperature_1_.ChangeTarget(0);
-        temp_error |= (1<<ERR_OVERTEMP_BIT_MASK);
-      }
-    }
-    else {
-      overtemp_debounce_[1] = millis() + OVER_TEMP_DEBOUNCE;
+    if (overtemp_[1]) {
+      temp_error |= (1<<ERR_OVERTEMP_BIT_MASK);
     }
 
+    temp = temperature_1_.GetCurTemprature();
     buf[index++] = temp >> 8;
     buf[index++] = temp;
     buf[index++] = temp_error;
     buf[index++] = temp_error;
 
+    int32_t values[4] = {(buf[0] << 8) | buf[1], buf[2], (buf[4] << 8) | buf[5], buf[6]};
+    if (!temp_report_filter_.Due(values, !periodic))
+      return;
     canbus_g.PushSendStandardData(msgid, buf, index);
   }
 }
@@ -867,6 +1029,8 @@ void DualExtruder::ExtruderSwitcingWithMotor(uint8_t *data, uint8_t data_len) {
   // won't move extruder if didn't home
   if (homed_state_) {
     extruder_check_status_ = EXTRUDER_STATUS_IDLE;
+    // let queued lift moves finish so the switch move is never dropped
+    MoveSync();
     if (target_extruder_ == 1) {
       PrepareMoveToDestination(z_max_position_ + (add_offset ? z_cail_position_ : 0), 9);
     } else if (target_extruder_ == 0) {
@@ -1154,6 +1318,11 @@ void DualExtruder::EmergencyStop() {
   extruder_cs_1_.Out(0);
 }
 
+void DualExtruder::PeriodicReport(uint16_t func_id, bool raw) {
+  if (func_id == FUNC_REPORT_TEMPEARTURE)
+    ReportTemprature(!raw);
+}
+
 void DualExtruder::Loop() {
   if (hal_adc_status()) {
     temperature_0_.TemperatureOut();
@@ -1165,9 +1334,9 @@ void DualExtruder::Loop() {
     hw_ver_.UpdateVersion();
   }
 
-  if (ELAPSED(millis(), temp_report_time_)) {
-    temp_report_time_ = millis() + TEMP_REPORT_INTERVAL;
-    ReportTemprature();
+  if (ELAPSED(millis(), overtemp_check_time_)) {
+    overtemp_check_time_ = millis() + OVER_TEMP_CHECK_INTERVAL;
+    CheckOverTemp();
   }
 
   if (out_of_material_detect_0_.CheckStatusLoop() || out_of_material_detect_1_.CheckStatusLoop()) {
@@ -1183,6 +1352,9 @@ void DualExtruder::Loop() {
     ReportProbe();
   }
 
+  PlanMoveQueue();
+  ReportMoveDone();
+
   ExtruderStatusCheck();
   left_model_fan_.Loop();
   right_model_fan_.Loop();
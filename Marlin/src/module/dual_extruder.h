@@ -30,6 +30,7 @@
 #include "src/device/temperature.h"
 #include "../device/nozzle_identify.h"
 #include "../device/hw_version.h"
+#include "../device/lift_planner.h"
 
 #define CAN_DATA_FRAME_LENGTH     (8)
 #define TOOLHEAD_3DP_EXTRUDER0    (0)
@@ -83,11 +84,6 @@ typedef enum {
   EXTRUDER_STATUS_IDLE,
 }extruder_status_e;
 
-typedef struct {
-  uint32_t pulse_count;
-  uint16_t timer_time;
-}speed_node_t;
-
 typedef enum {
   GO_HOME,
   MOVE_SYNC,
@@ -125,7 +121,7 @@ class DualExtruder : public ModuleBase {
       active_extruder_    = TOOLHEAD_3DP_EXTRUDER0;
       target_extruder_    = TOOLHEAD_3DP_EXTRUDER0;
       nozzle_check_time_  = 0;
-      temp_report_time_   = 0;
+      overtemp_check_time_ = 0;
       extruder_check_status_    = EXTRUDER_STATUS_IDLE;
       extruder_switching_time_elapse_ = 0;
       need_to_report_extruder_info_ = false;
@@ -138,6 +134,23 @@ class DualExtruder : public ModuleBase {
       motor_state_ = 0;
       homed_state_ = 0;
       speed_ctrl_index_ = 0;
+      speed_ctrl_active_ = 0;
+      move_queue_head_ = 0;
+      move_queue_tail_ = 0;
+      planned_exit_speed_ = 0;
+      next_block_ready_ = false;
+      move_abort_ = false;
+      abort_stepps_ = 0;
+      active_dir_ = 0;
+      next_stepps_sum_ = 0;
+      next_dir_ = 0;
+      next_report_ = 0;
+      next_position_ = 0;
+      active_report_ = 0;
+      active_position_ = 0;
+      move_done_head_ = 0;
+      move_done_tail_ = 0;
+      current_position_ = 0;
       raise_for_home_pos_ = DEFAULT_RAISE_FOR_HOME_POS;
       z_max_position_ = DEFAULT_Z_MAX_POSITION;
       z_cail_position_ = 0;
@@ -152,13 +165,21 @@ class DualExtruder : public ModuleBase {
     void MoveSync();
     move_state_e GoHome(bool init_index=true);
     void MoveToDestination(uint8_t *data, uint8_t data_len);
-    void PrepareMoveToDestination(float position, float speed);
-    void DoBlockingMoveToZ(float length, float speed);
+    bool PrepareMoveToDestination(float position, float speed, bool report=false);
+    bool QueueMoveZ(float length, float speed, bool report=false);
+    bool MoveZSync(float length, float speed);
+    bool MoveQueueBusy();
+    void PlanMoveQueue();
+    void FlushAbortedMoves();
+    void ReportMoveFail(int32_t pos);
+    void StepperLoadNextBlock();
+    void ReportMoveDone();
     void ReportOutOfMaterial();
     void ReportProbe();
     void FanCtrl(fan_e fan, uint8_t duty_cycle, uint16_t delay_sec_kill);
     void SetTemperature(uint8_t *data);
-    void ReportTemprature();
+    void ReportTemprature(bool periodic = false);
+    void CheckOverTemp();
     void ActiveExtruder(uint8_t extruder);
     void ExtruderStatusCheckCtrl(extruder_status_e status);
     void ExtruderStatusCheck();
@@ -176,6 +197,7 @@ class DualExtruder : public ModuleBase {
     void ReportHWVersion();
     void EmergencyStop();
     void Loop();
+    void PeriodicReport(uint16_t func_id, bool raw);
     void SetRightLevelMode(uint8_t *data, uint8_t data_len);
     void ReportRightLevelModeInfo(void);
     uint8_t MoveSensorCalibrationPosition(uint8_t mode, bool is_home=true);
@@ -208,7 +230,7 @@ class DualExtruder : public ModuleBase {
 
 
   private:
-    uint32_t temp_report_time_;
+    uint32_t overtemp_check_time_;
     uint8_t active_extruder_;
     uint8_t target_extruder_;
     uint32_t nozzle_check_time_;
@@ -218,8 +240,26 @@ class DualExtruder : public ModuleBase {
     bool extruder_status_;
     volatile float current_position_;
     volatile bool end_stop_enable_;
-    speed_node_t speed_ctrl_buffer_[20];
+    speed_node_t speed_ctrl_buffer_[2][Z_SPEED_CTRL_NODES];  // running block and staged next block
+    volatile uint8_t speed_ctrl_active_;
     volatile uint8_t speed_ctrl_index_;
+    move_block_t move_queue_[Z_MOVE_QUEUE_SIZE];
+    volatile uint8_t move_queue_head_;
+    volatile uint8_t move_queue_tail_;
+    float planned_exit_speed_;            // exit speed of the last staged block
+    volatile bool next_block_ready_;
+    volatile bool move_abort_;
+    volatile uint32_t abort_stepps_;      // steps the aborted block still had to go
+    volatile uint8_t active_dir_;
+    volatile uint32_t next_stepps_sum_;
+    volatile uint8_t next_dir_;
+    volatile uint8_t next_report_;
+    volatile int32_t next_position_;
+    volatile uint8_t active_report_;
+    volatile int32_t active_position_;    // um
+    volatile int32_t move_done_pos_[Z_MOVE_QUEUE_SIZE];
+    volatile uint8_t move_done_head_;
+    volatile uint8_t move_done_tail_;
     volatile uint32_t stepps_count_;
     volatile uint32_t stepps_sum_;
     volatile uint8_t step_pin_state_;
@@ -234,6 +274,8 @@ class DualExtruder : public ModuleBase {
     bool right_level_enable_;
 
     uint32_t overtemp_debounce_[2];
+    bool overtemp_[2] = {false, false};
+    ReportFilter temp_report_filter_;
 
     HWVersion hw_ver_;
 };
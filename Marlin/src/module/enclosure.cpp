@@ -28,6 +28,11 @@ void EnclosureModule::Init() {
   report_statu_ = enclosure_.Read();
   this->light_.Init();
   this->fan_.Init(ENCLOSURE_FAN_PIN);
+  // Take a breath when the light is starting up
+  const LIGHT_KEYFRAME_T start_up[] = {
+    {{0, 0, 0}, 0}, {{100, 100, 100}, 1500}, {{0, 0, 0}, 1500},
+  };
+  this->light_.Animate(start_up, 3, 0);
 }
 
 void EnclosureModule::HandModule(uint16_t func_id, uint8_t * data, uint8_t data_len) {
@@ -36,6 +41,7 @@ void EnclosureModule::HandModule(uint16_t func_id, uint8_t * data, uint8_t data_
       this->ReportStatus();
       break;
     case FUNC_SET_ENCLOSURE_LIGHT:
+    case FUNC_SET_LIGHT_ANIMATION:
       this->light_.HandModule(func_id, data, data_len);
       break;
     case FUNC_SET_FAN_MODULE:
@@ -46,38 +52,14 @@ void EnclosureModule::HandModule(uint16_t func_id, uint8_t * data, uint8_t data_
 
 void EnclosureModule::EmergencyStop() {
   fan_.ChangePwm(0, 0);
+  light_.StopAnimation();
   light_.SetRGB(0, 0, 0);
 }
 
-void EnclosureModule::StartingUpLight() {
-  static uint8_t start_flag_ = 1;
-  static uint8_t out = 0;
-  static uint32_t time = 0;
-  if (!start_flag_) {
-    return;
-  }
-  if (start_flag_ && (time < millis())) {
-    time = millis() + 15;
-    if (start_flag_ == 1) {
-      out += 1;
-      if (out == 100) {
-        start_flag_ = 2;
-      }
-    } else if (start_flag_ == 2) {
-      out -= 1;
-      if (out == 0) {
-        start_flag_ = 0;
-      }
-    }
-    light_.SetRGB(out, out, out);
-  }
-}
-
 void EnclosureModule::Loop() {
   uint8_t cur_statu = 0;
-  // Take a breath when the light is startint up
-  StartingUpLight();
-  
+  this->light_.Loop();
+
   this->fan_.Loop();
   
   this->enclosure_.CheckStatusLoop();
@@ -36,7 +36,6 @@ class EnclosureModule : public ModuleBase {
   void HandModule(uint16_t func_id, uint8_t * data, uint8_t data_len);
   void Loop();
   void EmergencyStop();
-  void StartingUpLight();
  private:
   void ReportStatus();
   SwitchInput enclosure_;
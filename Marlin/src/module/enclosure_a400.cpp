@@ -59,7 +59,10 @@ void EnclosureA400Module::Init() {
   // fan_.Init(ENCLOSURE_A400_FAN_PIN);
   adc_index_ = HAL_adc_init(ENCLOSURE_A400_LIGHT_ADC_PIN , ADC_TIM_4, 1000);
   loop_next_time_ = millis();
-  light_next_time_ = 0;
+  const LIGHT_KEYFRAME_T start_up[] = {
+    {{0, 0, 0}, 0}, {{200, 200, 200}, 600}, {{0, 0, 0}, 600},
+  };
+  light_.Animate(start_up, 3, 0);
 
   if (mac_info->hw_version == 0xFF) {
     fan_.Init(ENCLOSURE_A400_FAN_PIN);
@@ -72,29 +75,16 @@ void EnclosureA400Module::Init() {
 
 // Process before reuse to keep the effect consistent
 void EnclosureA400Module::StartLightEffect() {
-  if (!start_flag_) {
-    return;
-  }
-  if (start_flag_ && (light_next_time_ < millis())) {
-    light_next_time_ = millis() + 3;
-    if (start_flag_ == 1) {
-      light_out_ += 1;
-      if (light_out_ == 200) {
-        start_flag_ = 2;
-      }
-    } else if (start_flag_ == 2) {
-      light_out_ -= 1;
-      if (light_out_ == 0) {
-        start_flag_ = 0;
-      }
-    }
-    light_.SetRGB(light_out_, light_out_, light_out_);
+  light_.Loop();
+  if (start_flag_ && !light_.Animating()) {
+    start_flag_ = 0;
   }
 }
 
 void EnclosureA400Module::EmergencyStop() {
   start_flag_ = 0;
   fan_.ChangePwm(0, 0);
+  light_.StopAnimation();
   light_.SetRGB(0, 0, 0);
 }
 
@@ -154,6 +144,10 @@ void EnclosureA400Module::HandModule(uint16_t func_id, uint8_t * data, uint8_t d
       buf[index++] = !!start_flag_;   // 0: success, 1: fail
       ReportConfigResult(FUNC_SET_ENCLOSURE_LIGHT, buf, index);
       break;
+    case FUNC_SET_LIGHT_ANIMATION:
+      if (!start_flag_)
+        light_.HandModule(func_id, data, data_len);
+      break;
     case FUNC_SET_FAN_MODULE:
       fan_.ChangePwm(data[1], data[0]);
       buf[index++] = 0;    // 0: success, 1: fail
@@ -186,7 +180,7 @@ void EnclosureA400Module::Loop() {
   light_adc = ADC_Get(adc_index_);
   // after the light bar is initialized, it is detected
   if (light_adc >= ENCLOSURE_A400_LIGHT_ADC_LOWER_LIMIT && \
-      light_adc < ENCLOSURE_A400_LIGHT_ADC_UPPER_LIMIT && !start_flag_) {
+      light_adc < ENCLOSURE_A400_LIGHT_ADC_UPPER_LIMIT && !light_.Animating()) {
     light_limit_sta = 0;
   }
   else {
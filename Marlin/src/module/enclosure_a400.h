@@ -50,14 +50,12 @@ class EnclosureA400Module : public ModuleBase {
   uint8_t door_1_sta_ = 0;
   uint8_t door_2_sta_ = 0;
   uint8_t start_flag_ = 1;
-  uint8_t light_out_ = 0;
   uint8_t light_limit_sta_ = 1;
   uint8_t adc_index_;
 
   uint32_t door_1_check_time_ = 0;
   uint32_t door_2_check_time_ = 0;
   uint32_t light_limit_time_;
-  uint32_t light_next_time_;
   uint32_t loop_next_time_;
 };
 #endif //SNAPMAKERMODULES_MARLIN_SRC_MODULE_ENCLOSURE_A400_HEAD_H_
@@ -65,6 +65,9 @@ void LaserHead10W::Init() {
     security_status_ |= FAULT_LASER_PWM_PIN;
     if (icm42670.ChipInit() == false) {
         security_status_ |= FAULT_IMU_CONNECTION;
+    } else {
+        // stays on full rate polling if the DMP does not come up
+        icm42670.SetProtectMode(ICM_PROTECT_APEX);
     }
 }
 
@@ -157,6 +160,13 @@ void LaserHead10W::SecurityStatusCheck() {
         if (icm42670.AttitudeSolving() == true) {
             icm42670.GetGesture(yaw_, pitch_, roll_);
         }
+
+        if (icm42670.GetEvents() & ICM_EVENT_FREE_FALL) {
+            free_fall_tick_ms_ = millis();
+            free_fall_hold_ = true;
+        } else if (free_fall_hold_ && ((millis() - free_fall_tick_ms_) >= LASER_FREE_FALL_HOLD_MS)) {
+            free_fall_hold_ = false;
+        }
     }
 
     if (laser_celsius_ > protect_temp_) {
@@ -165,7 +175,7 @@ void LaserHead10W::SecurityStatusCheck() {
         security_status_ &= ~FAULT_LASER_TEMP;
     }
 
-    if ((roll_ <= roll_min_) || (roll_ >= roll_max_) || (pitch_ <= pitch_min_) || (pitch_ >= pitch_max_)) {
+    if ((roll_ <= roll_min_) || (roll_ >= roll_max_) || (pitch_ <= pitch_min_) || (pitch_ >= pitch_max_) || free_fall_hold_) {
         security_status_ |= FAULT_LASER_GESTURE;
     } else {
         security_status_ &= ~FAULT_LASER_GESTURE;
@@ -47,6 +47,9 @@
 
 #define LASER_TEMP_LIMIT    55
 #define LASER_TEMP_RECOVERY 45
+// gesture fault kept after an IMU free fall event, counted from when the event is read,
+// which is up to ICM4xxxx_EVENT_LATENCY_MS after the impact
+#define LASER_FREE_FALL_HOLD_MS 2000
 
 #define LSAER_FAN_FB_IC_TIM       TIM_2
 #define LSAER_FAN_FB_IT_CH        TIM_IT_CH4
@@ -69,6 +72,8 @@ class LaserHead10W : public ModuleBase {
             sync_id_ = 0xffffffff;
             imu_celsius_ = 25;
             hw_version_.number = 0xAA;
+            free_fall_tick_ms_ = 0;
+            free_fall_hold_ = false;
         }
 
         void Init();
@@ -105,6 +110,8 @@ class LaserHead10W : public ModuleBase {
         float pitch_;
         uint8_t security_status_;
         uint8_t security_status_pre_;
+        uint32_t free_fall_tick_ms_;
+        bool free_fall_hold_;
         float laser_celsius_;
         uint32_t sync_id_;
         int8_t protect_temp_;
@@ -30,6 +30,8 @@
 #include <math.h>
 #include "laser_head_20w_40W.h"
 
+LaserHead20W40W *LaserHead20W40W::p_laser_head_ = NULL;
+
 void LaserHead20W40W::Init()
 {
   afio_cfg_debug_ports(AFIO_DEBUG_SW_ONLY);
@@ -63,14 +65,15 @@ void LaserHead20W40W::Init()
     param->laser_parm_checksum = LaserParmChecksumCal(param);
     registryInstance.SaveCfg();
   }
-  pre_check_cnt_ = 0;
   sync_id_ = param->module_sync_id;
   protect_temp_ = param->laser_protect_temp;
   recovery_temp_ = param->laser_recovery_temp;
   fire_sensor_trigger_value_ = param->fire_sensor_trigger_value;
-  fire_sensor_trigger_ = false;
+  fire_sensor_.Init(LASER_FIRE_SENSOR_BLOCK_MS, fire_sensor_trigger_value_);
   fire_sensor_raw_data_report_tick_ms_ = millis();
   fire_sensor_raw_data_report_interval_ms_ = 0;
+  p_laser_head_ = this;
+  HAL_adc_capture_cb_init(FireSensorCaptureCallBack);
   crosslight_offset_x_ = param->laser_crosslight_offset_x;
   crosslight_offset_y_ = param->laser_crosslight_offset_y;
 
@@ -89,6 +92,11 @@ void LaserHead20W40W::Init()
   {
     security_status_ |= FAULT_IMU_CONNECTION;
   }
+  else
+  {
+    // stays on full rate polling if the DMP does not come up
+    icm42670.SetProtectMode(ICM_PROTECT_APEX);
+  }
 }
 
 void LaserHead20W40W::GetHwVersion()
@@ -136,7 +144,6 @@ void LaserHead20W40W::Loop()
   cross_light_.OutCtrlLoop();
   laser2_off_ctrl_.OutCtrlLoop();
   SecurityStatusCheck();
-  LaserFireSensorLoop();
   LaserFireSensorReportLoop();
 }
 
@@ -245,6 +252,16 @@ void LaserHead20W40W::SecurityStatusCheck()
     {
       icm42670.GetGesture(yaw_, pitch_, roll_);
     }
+
+    if (icm42670.GetEvents() & ICM_EVENT_FREE_FALL)
+    {
+      free_fall_tick_ms_ = millis();
+      free_fall_hold_ = true;
+    }
+    else if (free_fall_hold_ && ((millis() - free_fall_tick_ms_) >= LASER_FREE_FALL_HOLD_MS))
+    {
+      free_fall_hold_ = false;
+    }
   }
 
   if (laser_celsius_ > protect_temp_)
@@ -256,7 +273,7 @@ void LaserHead20W40W::SecurityStatusCheck()
     security_status_ &= ~FAULT_LASER_TEMP;
   }
 
-  if ((roll_ <= roll_min_) || (roll_ >= roll_max_) || (pitch_ <= pitch_min_) || (pitch_ >= pitch_max_))
+  if ((roll_ <= roll_min_) || (roll_ >= roll_max_) || (pitch_ <= pitch_min_) || (pitch_ >= pitch_max_) || free_fall_hold_)
   {
     security_status_ |= FAULT_LASER_GESTURE;
   }
@@ -274,7 +291,7 @@ void LaserHead20W40W::SecurityStatusCheck()
     security_status_ &= ~FAULT_LASER_FAN_RUN;
   }
 
-  if (fire_sensor_trigger_)
+  if (fire_sensor_.Triggered())
   {
     security_status_ |= FAULT_FIRE_DECT;
   }
@@ -322,7 +339,7 @@ void LaserHead20W40W::ReportSecurityStatus()
     buf[index++] = roll_int16 & 0xff;
     buf[index++] = celsius_int8;
     buf[index++] = (uint8_t)imu_celsius_;
-    buf[index++] = fire_sensor_trigger_;
+    buf[index++] = fire_sensor_.Triggered();
     canbus_g.PushSendStandardData(msgid, buf, index);
   }
 }
@@ -518,6 +535,7 @@ void LaserHead20W40W::LaserSetFireSensorSensitivity(uint8_t fds, bool need_save)
     break;
 
   }
+  fire_sensor_.SetTrigger(fire_sensor_trigger_value_);
 
   if (need_save) {
     AppParmInfo *param = &registryInstance.cfg_;
@@ -533,6 +551,7 @@ void LaserHead20W40W::LaserSetFireSensorSensitivity(uint16_t fdv, bool need_save
     fdv = FIRE_DETECT_TRIGGER_DISABLE_ADC_VALUE;
 
   fire_sensor_trigger_value_ = fdv;
+  fire_sensor_.SetTrigger(fire_sensor_trigger_value_);
 
   if (need_save) {
     AppParmInfo *param = &registryInstance.cfg_;
@@ -579,14 +598,19 @@ void LaserHead20W40W::LaserSetCrosslightOffset(float x, float y)
 
 void LaserHead20W40W::LaserReportFireSensorRawData(void)
 {
-  uint8_t buf[2];
+  uint8_t buf[4];
   uint16_t msgid = registryInstance.FuncId2MsgId(FUNC_REPORT_FIRE_SENSOR_RAW_DATA);
   uint8_t index = 0;
 
   if (msgid != INVALID_VALUE)
   {
-    buf[index++] = fire_sensor_raw_adc_ & 0xff;
-    buf[index++] = (fire_sensor_raw_adc_ >> 8) & 0xff;
+    uint16_t raw = fire_sensor_.Raw();
+    uint16_t latency = fire_sensor_.Latency();
+    buf[index++] = raw & 0xff;
+    buf[index++] = (raw >> 8) & 0xff;
+    // latency of the last detection, from the start of the first block under the threshold
+    buf[index++] = latency & 0xff;
+    buf[index++] = (latency >> 8) & 0xff;
     canbus_g.PushSendStandardData(msgid, buf, index);
   }
 }
@@ -618,39 +642,14 @@ void LaserHead20W40W::LaserFireSensorReportLoop(void)
   }
 }
 
-void LaserHead20W40W::LaserFireSensorLoop(void)
+void LaserHead20W40W::FireSensorCaptureCallBack(void)
 {
-  bool trigger = false;
-  if (PENDING(millis(), fire_sensor_maf_last_ms_))
-    return;
-
-  fire_sensor_maf_last_ms_ = millis() + 1000 / LASER_FIRE_SENSOR_SAMPLE_FREQ;
-  fire_sensor_raw_adc_ = ADC_Get(fire_sensor_adc_index_);
-  fire_sensor_maf_.addValue(fire_sensor_raw_adc_);
-
-  if (pre_check_cnt_ < LASER_FIRE_SENSOR_PRE_CHECK_CNT) {
-    pre_check_cnt_++;
-    if (pre_check_cnt_ < LASER_FIRE_SENSOR_PRE_CHECK_CNT)
-      return;
-  }
-
-  if (fire_sensor_trigger_value_ <= FIRE_DETECT_TRIGGER_LIMIT_ADC_VALUE) {
-    if (fire_sensor_maf_.getMovingAverage() <= fire_sensor_trigger_value_) {
-      trigger = true;
-    }
-  }
-  else {
-    fire_sensor_trigger_reset_delay_ = 0;
-  }
+  if (p_laser_head_)
+    p_laser_head_->LaserFireSensorLoop();
+}
 
-  if (trigger) {
-    fire_sensor_trigger_ = 1;
-    fire_sensor_trigger_reset_delay_ = 5 * LASER_FIRE_SENSOR_SAMPLE_FREQ;   // 5 second delay
-  }
-  else {
-    if (fire_sensor_trigger_reset_delay_)
-      fire_sensor_trigger_reset_delay_--;
-    else
-      fire_sensor_trigger_ = 0;
-  }
+// Called once per adc dma block, so the sample rate follows the adc timer instead of the main loop
+void LaserHead20W40W::LaserFireSensorLoop(void)
+{
+  fire_sensor_.Update(ADC_Get(fire_sensor_adc_index_), millis());
 }
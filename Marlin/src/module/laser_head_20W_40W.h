@@ -28,7 +28,7 @@
 #include "src/device/analog_io_ctrl.h"
 #include "module_base.h"
 #include "src/device/temperature.h"
-#include "src/core/moving_average_filter.h"
+#include "src/device/fire_sensor.h"
 #include "laser_hw_version.h"
 
 #define LASER_20W_40W_FAN_PIN                       PA2
@@ -41,9 +41,8 @@
 #define LASER_40W_LASER2_OFF_CTRL_PIN               PA10
 #define LASER_20W_40W_FIRE_SENSOR_ADC_TIMER         ADC_TIM_4
 #define LASER_20W_40W_FIRE_SENSOR_ADC_PERIOD_US     (1000)
-#define LASER_FIRE_SENSOR_MAF_SIZE                  (256)   // moving average filter size
-#define LASER_FIRE_SENSOR_SAMPLE_FREQ               (100)   // fire sensor sample frequency
-#define LASER_FIRE_SENSOR_PRE_CHECK_CNT             (LASER_FIRE_SENSOR_MAF_SIZE * 1.5)
+// one sample per ADC DMA block, the mean of ADC_DEEP conversions on the TIM4 trigger
+#define LASER_FIRE_SENSOR_BLOCK_MS                  (ADC_DEEP * LASER_20W_40W_FIRE_SENSOR_ADC_PERIOD_US / 1000)
 
 // security info
 #define FAULT_IMU_CONNECTION                        (1<<0)
@@ -54,6 +53,9 @@
 #define FAULT_FIRE_DECT                             (1<<5)
 
 #define LASER_20W_40W_TEMP_LIMIT                    55
+// gesture fault kept after an IMU free fall event, counted from when the event is read,
+// which is up to ICM4xxxx_EVENT_LATENCY_MS after the impact
+#define LASER_FREE_FALL_HOLD_MS                     2000
 #define LASER_20W_40W_TEMP_RECOVERY                 45
 #define FIRE_DETECT_SENSITIVITY_HIGHT               (3)
 #define FIRE_DETECT_SENSITIVITY_MID                 (2)
@@ -63,7 +65,7 @@
 #define FIRE_DETECT_SENSITIVITY_MID_ADC_VALUE       (1500)
 #define FIRE_DETECT_SENSITIVITY_LOW_ADC_VALUE       (500)
 #define FIRE_DETECT_TRIGGER_ADC_VALUE               (500)
-#define FIRE_DETECT_TRIGGER_LIMIT_ADC_VALUE         (4095)
+#define FIRE_DETECT_TRIGGER_LIMIT_ADC_VALUE         (FIRE_SENSOR_TRIGGER_LIMIT)
 #define FIRE_DETECT_TRIGGER_DISABLE_ADC_VALUE       (0xFFFF)
 
 #define LSAER_FAN_FB_IC_TIM                         TIM_2
@@ -79,7 +81,7 @@
 
 class LaserHead20W40W : public ModuleBase {
     public:
-      LaserHead20W40W() : ModuleBase(), fire_sensor_maf_(LASER_FIRE_SENSOR_MAF_SIZE)
+      LaserHead20W40W() : ModuleBase()
       {
         roll_min_ = -20;
         roll_max_ = 20;
@@ -94,7 +96,8 @@ class LaserHead20W40W : public ModuleBase {
         sync_id_ = 0xffffffff;
         imu_celsius_ = 25;
         hw_version_.number = 0xAA;
-        fire_sensor_maf_last_ms_ = 0;
+        free_fall_tick_ms_ = 0;
+        free_fall_hold_ = false;
       }
 
         void Init();
@@ -124,7 +127,7 @@ class LaserHead20W40W : public ModuleBase {
         void LaserGetCrosslightOffset(void);
         void LaserFireSensorReportLoop(void);
         void LaserFireSensorLoop(void);
-        void LaserFireSensorDetectFilter(void);
+        static void FireSensorCaptureCallBack(void);
         uint16_t LaserParmChecksumCal(AppParmInfo *param);
 
         FanFeedBack  fan_;
@@ -135,6 +138,7 @@ class LaserHead20W40W : public ModuleBase {
         SwitchOutput laser2_off_ctrl_;
 
     private:
+        static LaserHead20W40W *p_laser_head_;
         volatile float roll_min_;
         volatile float roll_max_;
         volatile float pitch_min_;
@@ -144,6 +148,8 @@ class LaserHead20W40W : public ModuleBase {
         float pitch_;
         uint8_t security_status_;
         uint8_t security_status_pre_;
+        uint32_t free_fall_tick_ms_;
+        bool free_fall_hold_;
         float laser_celsius_;
         uint32_t sync_id_;
         int8_t protect_temp_;
@@ -152,15 +158,11 @@ class LaserHead20W40W : public ModuleBase {
         float crosslight_offset_x_;
         float crosslight_offset_y_;
         uint8_t fire_sensor_adc_index_;
-        uint16_t fire_sensor_raw_adc_;
         uint16_t fire_sensor_trigger_value_;
-        uint8_t fire_sensor_trigger_;
         uint32_t fire_sensor_raw_data_report_tick_ms_;
         uint32_t fire_sensor_raw_data_report_interval_ms_;
-        uint32_t fire_sensor_maf_last_ms_;
-        uint32_t fire_sensor_trigger_reset_delay_;
-        uint32_t pre_check_cnt_;
-        MovingAverage fire_sensor_maf_;
+        // runs in the adc dma interrupt
+        FireSensor fire_sensor_;
         hw_version_t hw_version_;
 };
 
@@ -31,6 +31,12 @@ void LightModule::Init() {
 }
 
 void LightModule::HandModule(uint16_t func_id, uint8_t * data, uint8_t data_len) {
+  if (func_id == FUNC_SET_LIGHT_ANIMATION) {
+    if (timeline_.Set(data, data_len))
+      timeline_.Start(1);
+    return;
+  }
+  timeline_.Stop();
   if (data[0] == 0) {
     switch (data[1]) {
       case LED_COLOR_OFF :
@@ -55,7 +61,16 @@ void LightModule::HandModule(uint16_t func_id, uint8_t * data, uint8_t data_len)
 }
 
 void LightModule::Loop() {
+  RGB_T color;
+  if (timeline_.TakeFrame(&color))
+    SetRGB(color.r, color.g, color.b);
+}
 
+bool LightModule::Animate(const LIGHT_KEYFRAME_T *keys, uint8_t count, uint8_t flags) {
+  if (!timeline_.Set(keys, count, flags))
+    return false;
+  timeline_.Start(1);
+  return true;
 }
 
 void LightModule::SetColor(uint8_t chn, uint8_t val) {
@@ -25,6 +25,7 @@
 #include "src/configuration.h"
 #include "module_base.h"
 #include "src/HAL/hal_pwm.h"
+#include "src/device/light_timeline.h"
 
 #define LED_PWM_TIM PWM_TIM1
 
@@ -53,8 +54,12 @@ class LightModule : public ModuleBase {
   void Loop();
   void SetRGB(uint8_t r, uint8_t g, uint8_t b);
   void SetColor(uint8_t chn, uint8_t val);
+  bool Animate(const LIGHT_KEYFRAME_T *keys, uint8_t count, uint8_t flags);
+  bool Animating() { return timeline_.Running(); }
+  void StopAnimation() { timeline_.Stop(); }
 
  private:
+  LightTimeline timeline_;
   uint8_t r_chn_;
   uint8_t g_chn_;
   uint8_t b_chn_;
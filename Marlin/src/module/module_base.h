@@ -27,6 +27,8 @@ class ModuleBase {
   virtual void Init() {};
   virtual void Loop() {};
   virtual void HandModule(uint16_t func_id, uint8_t * data, uint8_t data_len) {};
+  // called by the report scheduler, raw: send even if nothing moved
+  virtual void PeriodicReport(uint16_t func_id, bool raw) {};
   virtual void EmergencyStop() {};
 };
 
@@ -24,6 +24,7 @@
 #include "print_head.h"
 #include "src/registry/context.h"
 #include "src/core/can_bus.h"
+#include "src/registry/report_scheduler.h"
 #include <wirish_time.h>
 #include "io.h"
 //  Periph initialization according schema
@@ -38,6 +39,7 @@ void PrintHead::Init() {
   switch_cut_.Init(PB0);
   temperature_.InitCapture(PA6, ADC_TIM_4);
   temperature_.InitOutCtrl(PWM_TIM2, PWM_CH2, PA1);
+  reportScheduler.Register(FUNC_REPORT_TEMPEARTURE, 500);
   uint32_t moduleType = registryInstance.module();
   if (MODULE_PRINT_V_SM1 == moduleType) {
     pinMode(PA2, OUTPUT);
@@ -81,12 +83,13 @@ void PrintHead::EmergencyStop() {
   fan_2_.ChangePwm(0, 0);
 }
 
+void PrintHead::PeriodicReport(uint16_t func_id, bool raw) {
+  if (func_id == FUNC_REPORT_TEMPEARTURE)
+    temperature_.ReportTemprature(!raw);
+}
+
 void PrintHead::Loop() {
   this->temperature_.Maintain();
-  if ((temp_report_time_ + 500) < millis()) {
-    temp_report_time_ = millis();
-    temperature_.ReportTemprature();
-  }
 
   if (switch_cut_.CheckStatusLoop()) {
     switch_cut_.ReportStatus(FUNC_REPORT_CUT);
@@ -39,6 +39,7 @@ class PrintHead : public ModuleBase {
   void HandModule(uint16_t func_id, uint8_t * data, uint8_t data_len);
   void Loop();
   void EmergencyStop();
+  void PeriodicReport(uint16_t func_id, bool raw);
 
   Fan fan_1_;
   Fan fan_2_;
@@ -47,7 +48,6 @@ class PrintHead : public ModuleBase {
   Temperature  temperature_;
 
  private:
-  uint32_t temp_report_time_ = 0;
 };
 
 #endif //MODULES_WHIMSYCWD_MARLIN_SRC_MODULE_PRINTHEAD_H_
@@ -74,7 +74,7 @@ void PurifierModule::InitAdcCheck() {
 }
 
 void PurifierModule::InitLight() {
-  light_.Init(PURIFIER_LIGHT_PIN, PURIFIER_LIGHT_COUNT, PURIFIER_LIGHT_EXTI);
+  light_.Init(PURIFIER_LIGHT_PIN, PURIFIER_LIGHT_COUNT);
   RGB_T color = {0, 0, 0};
   light_.StaticLight(color);
 }
@@ -402,6 +402,10 @@ void PurifierModule::HandModule(uint16_t func_id, uint8_t * data, uint8_t data_l
       }
       break;
     }
+    case FUNC_SET_LIGHT_ANIMATION:
+      if (light_.Animate(data, data_len))
+        is_debug_ = true;
+      break;
     case FUNC_REPORT_PURIFIER: {
       switch (data[0]) {
         case PURIFIER_REPORT_LIFETIME:
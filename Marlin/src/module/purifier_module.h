@@ -38,7 +38,6 @@
 
 #define PURIFIER_LIGHT_PIN PA8
 #define PURIFIER_LIGHT_COUNT 12
-#define PURIFIER_LIGHT_EXTI SOFT_EXTI_LINE2  // Using software interrupts
 
 #define PURIFIER_ADC_PERIOD_US 1000
 #define PURIFIER_ADC_TIM ADC_TIM_4
@@ -28,6 +28,10 @@
 #include "src/device/module_index.h"
 #include "src/HAL/hal_reset.h"
 #include "src/HAL/hal_flash.h"
+#include "src/core/trace.h"
+#include "src/core/log.h"
+#include "src/core/mem_stat.h"
+#include "report_scheduler.h"
 #include "src/module/laser_head.h"
 #include "src/utils/str.h"
 #include <wirish_time.h>
@@ -100,6 +104,7 @@ void Registry::SystemHandler() {
   }
   uint8_t cmd = longpackInstance.cmd[0];
   uint8_t * cmdData = longpackInstance.cmd + 1;
+  TRACE(TRACE_EVT_LONGPACK, cmd, longpackInstance.len_);
 
   switch (cmd) {
     case CMD_M_CONFIG :
@@ -137,6 +142,23 @@ void Registry::SystemHandler() {
     case CMD_M_DEBUG_INFO:
       ReportFuncidAndMsgid();
       break;
+    case CMD_M_SET_LIGHT_ANIMATION:
+      // keyframes do not fit a standard frame, hand them to the module like a function call
+      if (longpackInstance.len_ > 1 && longpackInstance.len_ <= 0xff + 1)
+        routeInstance.module_->HandModule(FUNC_SET_LIGHT_ANIMATION, cmdData, longpackInstance.len_ - 1);
+      break;
+    case CMD_M_BLACKBOX_REQUEST:
+      traceInstance.ReportBlackBox(longpackInstance.len_ > 1 ? cmdData[0] : 0);
+      break;
+    case CMD_M_LOG_ENABLE:
+      logInstance.Enable(longpackInstance.len_ > 1 && cmdData[0]);
+      break;
+    case CMD_M_MEM_REQUEST:
+      memStatInstance.Request(longpackInstance.len_ > 1 ? cmdData[0] : 0xff);
+      break;
+    case CMD_M_SET_REPORT:
+      reportScheduler.Set(cmdData, longpackInstance.len_ - 1);
+      break;
   }
   longpackInstance.cmd_clean();
 }
@@ -0,0 +1,127 @@
+/*
+ * Snapmaker2-Modules Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Modules
+ * (see https://github.com/Snapmaker/Snapmaker2-Modules)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <src/configuration.h>
+#include <src/core/can_bus.h>
+#include <src/core/protocal/Longpack.h>
+#include <wirish_time.h>
+#include "route.h"
+#include "report_scheduler.h"
+
+REPORT_SUB_T * ReportScheduler::Find(uint16_t func_id) {
+  for (uint8_t i = 0; i < count_; i++) {
+    if (sub_[i].func_id == func_id)
+      return &sub_[i];
+  }
+  return NULL;
+}
+
+// insertion sort by priority, stable so registration order breaks ties
+void ReportScheduler::Sort() {
+  for (uint8_t i = 1; i < count_; i++) {
+    REPORT_SUB_T sub = sub_[i];
+    int8_t j = i - 1;
+    while (j >= 0 && sub_[j].priority > sub.priority) {
+      sub_[j + 1] = sub_[j];
+      j--;
+    }
+    sub_[j + 1] = sub;
+  }
+}
+
+bool ReportScheduler::Register(uint16_t func_id, uint16_t period, uint8_t priority) {
+  REPORT_SUB_T *sub = Find(func_id);
+  if (sub == NULL) {
+    if (count_ >= REPORT_SCHED_MAX)
+      return false;
+    sub = &sub_[count_++];
+  }
+  sub->func_id = func_id;
+  sub->period = period < REPORT_SCHED_MIN_PERIOD ? REPORT_SCHED_MIN_PERIOD : period;
+  sub->flags = REPORT_FLAG_ENABLE;
+  sub->priority = priority;
+  sub->next_time = millis() + sub->period;
+  Sort();
+  return true;
+}
+
+void ReportScheduler::Set(uint8_t *data, uint8_t len) {
+  uint8_t result = 0;
+  uint16_t func_id = len >= 2 ? (data[0] << 8) | data[1] : 0;
+
+  if (func_id == REPORT_SCHED_QUERY) {
+    result = 1;
+  } else if (len >= 6) {
+    // only what the module registered can be scheduled, it knows no other report
+    REPORT_SUB_T *sub = Find(func_id);
+    if (sub) {
+      uint16_t period = (data[3] << 8) | data[4];
+      sub->flags = data[2] & (REPORT_FLAG_ENABLE | REPORT_FLAG_RAW);
+      sub->period = period < REPORT_SCHED_MIN_PERIOD ? REPORT_SCHED_MIN_PERIOD : period;
+      sub->priority = data[5] > REPORT_PRIORITY_LOW ? REPORT_PRIORITY_LOW : data[5];
+      sub->next_time = millis();
+      Sort();
+      result = 1;
+    }
+  }
+  ReportTable(result);
+}
+
+void ReportScheduler::ReportTable(uint8_t result) {
+  uint8_t buf[2 + REPORT_SCHED_MAX * 6];
+  uint8_t index = 0;
+
+  buf[index++] = CMD_S_SET_REPORT_REACK;
+  buf[index++] = result;
+  for (uint8_t i = 0; i < count_; i++) {
+    buf[index++] = sub_[i].func_id >> 8;
+    buf[index++] = sub_[i].func_id;
+    buf[index++] = sub_[i].flags;
+    buf[index++] = sub_[i].period >> 8;
+    buf[index++] = sub_[i].period;
+    buf[index++] = sub_[i].priority;
+  }
+  longpackInstance.sendLongpack(buf, index);
+}
+
+void ReportScheduler::Loop() {
+  uint32_t now = millis();
+  bool bus_busy = canbus_g.standard_send_buffer_.freeSpace() < REPORT_SCHED_RESERVE;
+
+  for (uint8_t i = 0; i < count_; i++) {
+    REPORT_SUB_T *sub = &sub_[i];
+    if (!(sub->flags & REPORT_FLAG_ENABLE) || (int32_t)(now - sub->next_time) < 0) {
+      continue;
+    }
+    // lower priorities wait for the next pass while the send buffer is short
+    if (bus_busy && sub->priority != REPORT_PRIORITY_HIGH) {
+      continue;
+    }
+    sub->next_time += sub->period;
+    // fell behind by more than a period, do not burst to catch up
+    if ((int32_t)(now - sub->next_time) >= 0)
+      sub->next_time = now + sub->period;
+    routeInstance.module_->PeriodicReport(sub->func_id, sub->flags & REPORT_FLAG_RAW);
+    bus_busy = canbus_g.standard_send_buffer_.freeSpace() < REPORT_SCHED_RESERVE;
+  }
+}
+
+ReportScheduler reportScheduler;
@@ -0,0 +1,70 @@
+/*
+ * Snapmaker2-Modules Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Modules
+ * (see https://github.com/Snapmaker/Snapmaker2-Modules)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MODULES_WHIMSYCWD_MARLIN_SRC_REGISTRY_REPORT_SCHEDULER_H_
+#define MODULES_WHIMSYCWD_MARLIN_SRC_REGISTRY_REPORT_SCHEDULER_H_
+
+#include <stdint.h>
+
+#define REPORT_SCHED_MAX          8
+#define REPORT_SCHED_RESERVE      4     // free standard frames kept for priority 0 reports
+#define REPORT_SCHED_MIN_PERIOD   10    // ms
+#define REPORT_SCHED_QUERY        0xffff
+
+#define REPORT_FLAG_ENABLE        (1 << 0)
+#define REPORT_FLAG_RAW           (1 << 1)  // every period, the module deadband is skipped
+
+typedef enum {
+  REPORT_PRIORITY_HIGH = 0,
+  REPORT_PRIORITY_NORMAL,
+  REPORT_PRIORITY_LOW,
+} REPORT_PRIORITY_E;
+
+typedef struct {
+  uint16_t func_id;
+  uint16_t period;      // ms
+  uint8_t  flags;
+  uint8_t  priority;    // REPORT_PRIORITY_E, lower goes first
+  uint32_t next_time;
+} REPORT_SUB_T;
+
+class ReportScheduler {
+ public:
+  // module default, called from the module Init(), the host may change it later
+  bool Register(uint16_t func_id, uint16_t period, uint8_t priority = REPORT_PRIORITY_NORMAL);
+  // host command: func_id(2) flags(1) period(2) priority(1), answers with the whole table
+  void Set(uint8_t *data, uint8_t len);
+  // calls ModuleBase::PeriodicReport() for every due subscription
+  void Loop();
+
+ private:
+  REPORT_SUB_T * Find(uint16_t func_id);
+  void Sort();
+  void ReportTable(uint8_t result);
+
+ private:
+  REPORT_SUB_T sub_[REPORT_SCHED_MAX];
+  uint8_t count_ = 0;
+};
+
+extern ReportScheduler reportScheduler;
+
+#endif  // MODULES_WHIMSYCWD_MARLIN_SRC_REGISTRY_REPORT_SCHEDULER_H_
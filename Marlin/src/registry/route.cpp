@@ -94,6 +94,7 @@ const uint16_t enclosure_func_list_[] = {
   FUNC_REPORT_ENCLOSURE,
   FUNC_SET_ENCLOSURE_LIGHT,
   FUNC_SET_FAN_MODULE,
+  FUNC_SET_LIGHT_ANIMATION,
 };
 
 const uint16_t tool_setting_func_list_[] = {
@@ -102,6 +103,7 @@ const uint16_t tool_setting_func_list_[] = {
 
 const uint16_t light_func_list_[] = {
   FUNC_SET_LIGHT_COLOR,
+  FUNC_SET_LIGHT_ANIMATION,
 };
 
 const uint16_t linear_func_list_[] = {
@@ -115,6 +117,7 @@ const uint16_t stop_func_list_[] = {
 const uint16_t purifier_func_list_[] = {
   FUNC_SET_PURIFIER,
   FUNC_REPORT_PURIFIER,
+  FUNC_SET_LIGHT_ANIMATION,
 };
 
 const uint16_t fan_func_list_[] = {
@@ -132,6 +135,9 @@ const uint16_t cnc_200w_func_list_[] = {
   FUNC_REPORT_MOTOR_STATUS_INFO,
   FUNC_REPORT_MOTOR_SENSOR_INFO,
   FUNC_REPORT_MOTOR_SELF_TEST_INFO,
+  FUNC_REPORT_MOTOR_WARNING_INFO,
+  FUNC_SET_MOTOR_TELEMETRY,
+  FUNC_REPORT_MOTOR_SPECTRUM_INFO,
 };
 
 const uint16_t enclosure_a400_func_list_[] = {
@@ -139,6 +145,7 @@ const uint16_t enclosure_a400_func_list_[] = {
   FUNC_SET_ENCLOSURE_LIGHT,
   FUNC_SET_FAN_MODULE,
   FUNC_MODULE_GET_HW_VERSION,
+  FUNC_SET_LIGHT_ANIMATION,
 };
 
 const uint16_t drybox_func_list_[] = {
@@ -154,6 +161,7 @@ const uint16_t drybox_func_list_[] = {
   FUNC_REPORT_HEATER_POWER_STATE,
   FUNC_REPORT_COVER_STATE,
   FUNC_REPORT_DRYBOX_STATE,
+  FUNC_SET_LIGHT_ANIMATION,
 };
 
 const uint16_t calibrator_func_list_[] = {
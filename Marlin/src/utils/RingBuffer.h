@@ -37,6 +37,7 @@ class RingBuffer {
 
   bool isFull();
   bool isEmpty();
+  int32_t freeSpace();
 
   bool insert(const T& element);
   T& remove();
@@ -95,6 +96,10 @@ bool RingBuffer<T>::isEmpty() {
   return head == tail;
 }
 template<typename T>
+int32_t RingBuffer<T>::freeSpace() {
+  return (head > tail) ? (head - tail - 1) : (size - (tail - head) - 1);
+}
+template<typename T>
 bool RingBuffer<T>::insert(const T& element) {
   if (isFull()) {
     return false;
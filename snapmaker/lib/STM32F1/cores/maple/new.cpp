@@ -18,11 +18,18 @@
 
 #include <stdlib.h>
 
+// weak so the application can watch allocations without replacing operator new
+extern "C" void __attribute__((weak)) new_alloc_hook(size_t size) {
+  (void)size;
+}
+
 void *operator new(size_t size) {
+  new_alloc_hook(size);
   return malloc(size);
 }
 
 void *operator new[](size_t size) {
+  new_alloc_hook(size);
   return malloc(size);
 }
 
@@ -0,0 +1,121 @@
+#
+# Snapmaker2-Modules Firmware
+# Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+#
+# This file is part of Snapmaker2-Modules
+# (see https://github.com/Snapmaker/Snapmaker2-Modules)
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+#
+# Decodes LOG() records sent by the module as CMD_S_LOG longpacks.
+#
+#   python log_decode.py firmware.elf dump.txt
+#
+# dump.txt holds one longpack payload per line in hex, starting with the
+# command byte (1d), e.g. "1d 00 00 00 ab 2c 9f 4f".
+#
+from __future__ import print_function
+import re
+import struct
+import sys
+
+CMD_S_LOG = 0x1d
+
+
+def log_hash(s):
+  h = 2166136261
+  for c in bytearray(s):
+    h = ((h ^ c) * 16777619) & 0xffffffff
+  return h
+
+
+def read_tokens(elf_path):
+  with open(elf_path, "rb") as f:
+    elf = f.read()
+  if elf[:4] != b"\x7fELF" or bytearray(elf[4:5])[0] != 1:
+    raise ValueError("not an elf32 file")
+  shoff, = struct.unpack_from("<I", elf, 0x20)
+  shentsize, shnum, shstrndx = struct.unpack_from("<HHH", elf, 0x2e)
+
+  def section(i):
+    return struct.unpack_from("<IIIIIIIIII", elf, shoff + i * shentsize)
+
+  strtab = section(shstrndx)
+  tokens = {}
+  for i in range(shnum):
+    sh = section(i)
+    name = elf[strtab[4] + sh[0]:].split(b"\0", 1)[0]
+    if name != b".log_tokens":
+      continue
+    for fmt in elf[sh[4]:sh[4] + sh[5]].split(b"\0"):
+      if fmt:
+        tokens[log_hash(fmt)] = fmt.decode("utf-8", "replace")
+  return tokens
+
+
+def format_args(fmt, words):
+  args = []
+  specs = re.findall(r"%[-+ #0-9.]*(?:l|h|hh)?([diuxXcsfgeEp%])", fmt)
+  for spec in specs:
+    if spec == "%":
+      continue
+    if not words:
+      break
+    w = words.pop(0)
+    if spec in "di":
+      args.append(struct.unpack("<i", struct.pack("<I", w))[0])
+    elif spec in "feEg":
+      args.append(struct.unpack("<f", struct.pack("<I", w))[0])
+    elif spec == "s":
+      args.append("0x%08x" % w)
+    else:
+      args.append(w)
+  fmt = re.sub(r"%([-+ #0-9.]*)(?:l|h|hh)?([sp])", r"%\1s", fmt)
+  fmt = re.sub(r"(%[-+ #0-9.]*)(?:l|h|hh)([diuxXc])", r"\1\2", fmt)
+  try:
+    return fmt % tuple(args)
+  except (TypeError, ValueError):
+    return "%s %s" % (fmt, args)
+
+
+def decode(tokens, payload):
+  if len(payload) < 3 or payload[0] != CMD_S_LOG:
+    return
+  seq, dropped = payload[1], payload[2]
+  if dropped:
+    print("[%3d] %d records dropped" % (seq, dropped))
+  i = 3
+  while i < len(payload):
+    count = payload[i] + 1
+    words = list(struct.unpack_from("<%dI" % count, bytes(payload), i + 1))
+    i += 1 + count * 4
+    token = words.pop(0)
+    fmt = tokens.get(token)
+    if fmt is None:
+      print("[%3d] unknown token 0x%08x %s" % (seq, token, words))
+    else:
+      print("[%3d] %s" % (seq, format_args(fmt, words)))
+
+
+if __name__ == "__main__":
+  if len(sys.argv) != 3:
+    print("usage: log_decode.py firmware.elf dump.txt")
+    sys.exit(1)
+  tokens = read_tokens(sys.argv[1])
+  with open(sys.argv[2]) as f:
+    for line in f:
+      line = line.strip()
+      if line:
+        decode(tokens, bytearray.fromhex(line))
@@ -0,0 +1,58 @@
+#
+# Snapmaker2-Modules Firmware
+# Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+#
+# This file is part of Snapmaker2-Modules
+# (see https://github.com/Snapmaker/Snapmaker2-Modules)
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+#
+# Prints the static RAM (.data + .bss) of every firmware object after the
+# link, largest first. Sizes are taken before --gc-sections, so an object
+# may count a little it does not keep.
+#
+import subprocess
+from os import walk
+from os.path import join, relpath
+
+Import("env")
+
+
+def ram_report(source, target, env):
+  build_dir = env.subst("$BUILD_DIR")
+  objs = []
+  for root, _, files in walk(join(build_dir, "src")):
+    objs += [join(root, f) for f in files if f.endswith(".o")]
+  if not objs:
+    return
+
+  out = subprocess.check_output([env.subst("$SIZETOOL")] + sorted(objs)).decode()
+  rows = []
+  for line in out.splitlines()[1:]:
+    cols = line.split()
+    data, bss = int(cols[1]), int(cols[2])
+    if data + bss:
+      rows.append((data + bss, data, bss, relpath(" ".join(cols[5:]), build_dir)))
+  rows.sort(reverse=True)
+
+  print ("++++++++++++++++++++++++++++++static RAM start++++++++++++++++++++++++++++++")
+  print ("%6s %6s %6s  %s" % ("total", "data", "bss", "object"))
+  for total, data, bss, name in rows:
+    print ("%6d %6d %6d  %s" % (total, data, bss, name))
+  print ("%6d %6d %6d  %s" % (sum(r[0] for r in rows), sum(r[1] for r in rows), sum(r[2] for r in rows), "all"))
+  print ("++++++++++++++++++++++++++++++static RAM end++++++++++++++++++++++++++++++\n")
+
+
+env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", ram_report)
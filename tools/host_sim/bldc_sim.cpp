@@ -0,0 +1,1018 @@
+/*
+ * Snapmaker2-Modules Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Modules
+ * (see https://github.com/Snapmaker/Snapmaker2-Modules)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// BLDC spindle of the 200W CNC head against the real BldcMotor code
+//
+// The motor is a three phase star with sinusoidal back EMF, PWM averaged over a
+// period. Phase voltages follow from the TIM1 CCER/CCR the firmware writes and the
+// gate driver enable pin, hall sensors drive the EXTI callbacks, TIM2 runs the speed
+// loop every 1ms and TIM3 is the free running hall time stamp counter. Electrical
+// constants are the nominal ones the control law is written for (bldc_motor.h).
+//
+// The six step switch BldcPhaseChange ran before the lookup table is replayed on a
+// second timer through the StdPeriph calls it made, and the speed law before the
+// fixed point port runs in float on the rpm the firmware measures. The 20ms loop of
+// CncHead200W, its over current stop and the derated target, runs around SpindleGuard.
+//
+// Figures: rpm rise time and overshoot, speed dip and recovery under load steps and
+// after slowing down, stall detection latency, speed and torque ripple of both drive
+// modes, when SpindleGuard warns of a stall against the hard stops, its I2t level on
+// current traces, the largest duty difference to the float law and host time per ISR
+// for each drive mode.
+// Checks: the commutation table drives forward in every hall sector and leaves the
+// outputs and compares of the former switch, the self test passes, a stall is detected,
+// the sine drive has less torque ripple than six step under load at the lowest and a
+// middle speed, SpindleGuard warns ahead of every hard stop slower than its own
+// confirmation and never on speed changes or the rated load, its I2t overload follows
+// the winding model, and the fixed point law stays within 4 LSB of the float one. Any
+// failed check exits non zero.
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <board/board.h>
+#include <include/libmaple/libmaple_types.h>
+#include "sim_periph.h"
+#include "src/device/bldc_motor.h"
+#include "src/device/spindle_guard.h"
+
+#define SIM_DT_US                 1
+#define SIM_VBUS                  BLDC_MOTOR_WORKING_VOLTAGE
+#define SIM_R_PHASE               (BLDC_MOTOR_RESISTANCE / 2)
+#define SIM_L_PHASE               60e-6
+// line to line peak back EMF per rpm, to phase V*s/rad
+#define SIM_KE_PHASE              (USE_PID_CTRL_KE_LIMIT * 60 / (2 * M_PI) / sqrt(3.0))
+#define SIM_POLE_PAIRS            MOTOR_POLE_PAIR_NUM
+#define SIM_INERTIA               3e-5    // kg*m^2, rotor, collet and tool
+#define SIM_FRICTION_VISCOUS      3e-6    // Nm*s/rad
+#define SIM_FRICTION_COULOMB      0.002   // Nm
+#define SIM_HARD_PROTECT_CURRENT  20.0    // A, gate driver over current comparator
+#define SIM_I_ADC_MA_FULL         16500   // 0.01R * 20, see CncHead200W
+
+#define SIM_HALL_LINE_U           3
+#define SIM_HALL_LINE_V           4
+#define SIM_HALL_LINE_W           5
+#define SIM_HARD_PROTECT_LINE     6
+
+#define SIM_PUBLIC_TIMER          2
+#define SIM_HALL_TIMER            3
+#define SIM_PWM_TIMER             1
+
+#define SIM_RATED_TORQUE          (200.0 / (MOTOR_RATED_SPEED * 2 * M_PI / 60))  // 200W at rated speed
+#define SIM_LOAD_STEP_NM          0.03
+#define SIM_OVERLOAD_NM           0.2
+
+// the head side of the predictive protection, MOTOR_CTR_INTERVAL_TIME and the over
+// current stop of CncHead200W
+#define SIM_GUARD_INTERVAL_MS     20
+#define SIM_HEAD_OVERCURRENT_MA   8500
+#define SIM_HEAD_OVERCURRENT_CNT  50
+#define SIM_HEAT_TOLERANCE_MS     (2 * SIM_GUARD_INTERVAL_MS)
+
+// bldc_self_test_err_sta, one bit per MOS then one per hall step, bit 30/31 abort
+#define SIM_SELF_TEST_MOS_ERR     ((1 << SELF_TEST_MOS_INVALID_INDEX) - 1)
+#define SIM_SELF_TEST_HALL_ERR    (((1 << CHECK_HALL_CNT) - 1) << SELF_TEST_MOS_INVALID_INDEX)
+#define SIM_SELF_TEST_ABORT_ERR   (3UL << 30)
+
+// the speed law as BldcPublicTimerCallBack runs it, BLDC_PUBLIC_CAPTURE_SPEED_CNT and
+// BLDC_PID_TIME_SCALE of bldc_motor.cpp
+#define SIM_PID_PERIOD_MS         5
+#define SIM_PID_TIME_SCALE        (5.0 / 20)
+#define SIM_LAW_TOLERANCE_Q16     4       // duty LSB
+#if !defined(USE_PID_CTRL_MOTOR_RPM) || defined(USE_PID_BREAK_MODE_MOTOR_RPM)
+  #error "the float speed law reference covers the PID law without the brake mode only"
+#endif
+
+extern volatile uint32_t bldc_self_test_err_sta;
+extern volatile uint32_t self_test_send_flag;
+extern volatile BLDC_SELF_TEST_STEP bldc_self_test_step;
+
+typedef struct {
+  double theta;     // mechanical rad
+  double omega;     // mechanical rad/s
+  double i[3];      // phase current A, into the motor
+  double load;      // Nm against the rotation
+  double torque;    // Nm, electromagnetic
+  bool locked;
+  uint8_t hall;
+} MOTOR_MODEL;
+
+typedef struct {
+  int8_t high;
+  int8_t low;
+} SIM_PHASE_PAIR;
+
+// float speed law of the firmware before the fixed point port, fed the rpm the firmware
+// measured and the duty it started each control period from
+typedef struct {
+  uint32_t time_count;
+  int32_t set_point;
+  bool target_down;
+  float prev_error;
+  float last_error;
+  uint32_t periods;
+  uint32_t floor_periods;   // held at the back EMF floor while slowing down
+  double max_diff;    // duty
+} LAW_REF;
+
+static BldcMotor motor;
+static MOTOR_MODEL model;
+static uint64_t sim_us;
+static uint64_t next_pwm_us;
+static uint64_t next_public_us;
+static uint16_t ccr_active[3];  // compare preload, the update event latches CCR1..3
+static double current_sq_sum;   // phase current squared, summed over the ticks of one ms
+static double torque_sum;       // electromagnetic torque, summed over the ticks of one ms
+static double torque_sq_sum;
+static double hall_offset;   // electrical rad, where the hall magnets sit on the rotor
+static bool hard_protect;
+static LAW_REF law;
+static int failed;
+
+static double RpmOf(double omega) {
+  return omega * 60 / (2 * M_PI);
+}
+
+static double BackEmfShape(int phase, double theta_e) {
+  return sin(theta_e - phase * 2 * M_PI / 3);
+}
+
+static uint8_t HallState(double theta_e) {
+  uint8_t hall = 0;
+  for (int k = 0; k < 3; k++) {
+    if (BackEmfShape(k, theta_e + hall_offset) >= 0)
+      hall |= 1 << k;
+  }
+  return hall;
+}
+
+static void ModelReset(double theta) {
+  memset(&model, 0, sizeof(model));
+  model.theta = theta;
+  model.hall = HallState(theta * SIM_POLE_PAIRS);
+  GPIOB->IDR = model.hall << 3;
+}
+
+// phase voltage for the switch state, a single switch conducts one current direction
+// per PWM phase and the body diode the other, NAN when the leg floats
+static double PhaseVoltage(int k, bool gate_on) {
+  static const uint16_t high_en[3] = {TIM_CCER_CC1E, TIM_CCER_CC2E, TIM_CCER_CC3E};
+  static const uint16_t low_en[3] = {TIM_CCER_CC1NE, TIM_CCER_CC2NE, TIM_CCER_CC3NE};
+  uint16_t ccer = TIM1->CCER;
+  double duty = (double)ccr_active[k] / (TIM1->ARR + 1);
+  bool high = gate_on && (ccer & high_en[k]);
+  bool low = gate_on && (ccer & low_en[k]);
+
+  if (duty > 1)
+    duty = 1;
+  if (high && low)
+    return duty * SIM_VBUS;
+  if (high)
+    return model.i[k] >= 0 ? duty * SIM_VBUS : SIM_VBUS;
+  if (low)
+    return model.i[k] <= 0 ? (1 - duty) * SIM_VBUS : 0;
+  return NAN;
+}
+
+static void ModelStep(double dt) {
+  bool gate_on = GPIOA->ODR & GPIO_Pin_5;
+  double theta_e = model.theta * SIM_POLE_PAIRS;
+  double v[3], e[3], torque = 0;
+  int conducting = 0;
+  double vn = 0;
+
+  for (int k = 0; k < 3; k++) {
+    v[k] = PhaseVoltage(k, gate_on);
+    e[k] = SIM_KE_PHASE * model.omega * BackEmfShape(k, theta_e);
+    if (isnan(v[k])) {
+      model.i[k] = 0;
+    } else {
+      conducting++;
+      vn += v[k] - e[k] - SIM_R_PHASE * model.i[k];
+    }
+  }
+
+  if (conducting >= 2) {
+    vn /= conducting;
+    double sum = 0;
+    for (int k = 0; k < 3; k++) {
+      if (isnan(v[k]))
+        continue;
+      double i = model.i[k] + (v[k] - e[k] - SIM_R_PHASE * model.i[k] - vn) / SIM_L_PHASE * dt;
+      // a current that changes direction on a single switch leg stops on the diode
+      uint16_t ccer = TIM1->CCER;
+      bool both = (ccer >> (k * 4) & 0x5) == 0x5;
+      if (!both && ((model.i[k] > 0 && i < 0) || (model.i[k] < 0 && i > 0)))
+        i = 0;
+      model.i[k] = i;
+      sum += i;
+    }
+    for (int k = 0; k < 3; k++) {
+      if (!isnan(v[k]))
+        model.i[k] -= sum / conducting;
+    }
+  } else {
+    model.i[0] = model.i[1] = model.i[2] = 0;
+  }
+
+  for (int k = 0; k < 3; k++)
+    torque += SIM_KE_PHASE * model.i[k] * BackEmfShape(k, theta_e);
+  model.torque = torque;
+
+  if (model.locked) {
+    model.omega = 0;
+  } else {
+    double friction = SIM_FRICTION_VISCOUS * model.omega;
+    double drag = model.load + SIM_FRICTION_COULOMB;
+    double accel_torque = torque - friction;
+    if (model.omega > 0)
+      accel_torque -= drag;
+    else if (model.omega < 0)
+      accel_torque += drag;
+    else if (fabs(accel_torque) <= drag)
+      accel_torque = 0;
+    else
+      accel_torque -= accel_torque > 0 ? drag : -drag;
+    double omega = model.omega + accel_torque / SIM_INERTIA * dt;
+    // friction holds the rotor, it does not reverse it
+    if ((model.omega > 0 && omega < 0) || (model.omega < 0 && omega > 0))
+      omega = 0;
+    model.omega = omega;
+    model.theta += model.omega * dt;
+  }
+}
+
+static void HallUpdate(void) {
+  uint8_t hall = HallState(model.theta * SIM_POLE_PAIRS);
+  uint8_t changed = hall ^ model.hall;
+  if (!changed)
+    return;
+  model.hall = hall;
+  GPIOB->IDR = hall << 3;
+  static const uint8_t line[3] = {SIM_HALL_LINE_U, SIM_HALL_LINE_V, SIM_HALL_LINE_W};
+  for (int k = 0; k < 3; k++) {
+    if (changed & (1 << k))
+      SimExtiEdge(line[k]);
+  }
+}
+
+static void AdcUpdate(void) {
+  double amp = 0;
+  for (int k = 0; k < 3; k++) {
+    if (fabs(model.i[k]) > amp)
+      amp = fabs(model.i[k]);
+  }
+  double adc = amp * 1000 * 4095 / SIM_I_ADC_MA_FULL;
+  SimAdcSet(PA4, adc > 4095 ? 4095 : (uint16_t)adc);
+  if (amp > SIM_HARD_PROTECT_CURRENT && !hard_protect) {
+    hard_protect = true;
+    SimExtiEdge(SIM_HARD_PROTECT_LINE);
+  }
+}
+
+// ---------------------------------------------------------------- float speed law
+
+// BldcSetMotorTargetRpm
+static void LawRefTarget(double rpm) {
+  int32_t set_point = rpm < MOTOR_MIN_SPEED ? MOTOR_MIN_SPEED :
+                      rpm > MOTOR_RATED_SPEED ? MOTOR_RATED_SPEED : (int32_t)rpm;
+  law.target_down = law.set_point > set_point;
+  law.set_point = set_point;
+}
+
+// BldcControlMotorRunProcess(RUN) from standstill
+static void LawRefRun(void) {
+  law.prev_error = 0;
+  law.last_error = 0;
+  law.target_down = false;
+}
+
+// one public timer period, state and duty as they were before it
+static void LawRefTick(MOTOR_STATE state, float duty) {
+  if (bldc_self_test_step != SELF_TEST_IDLE)
+    return;
+  if (state == STOP) {
+    law.time_count = 0;
+    return;
+  }
+  if (++law.time_count < SIM_PID_PERIOD_MS)
+    return;
+  law.time_count = 0;
+  if (state != RUN || !motor.BldcGetMotorPidControl())
+    return;
+
+  // BldcIncPIDCalc in float, the gains scaled to the control period as the port does
+  float error = law.set_point - motor.BldcGetMotorRpm();
+  if (fabs(error) <= 200)
+    error = 0;
+  float kp = motor.BldcIncPIDGetPID(0);
+  float ki = motor.BldcIncPIDGetPID(1) * SIM_PID_TIME_SCALE;
+  float kd = motor.BldcIncPIDGetPID(2) / SIM_PID_TIME_SCALE;
+  float inc = kp * (error - law.prev_error) + ki * error +
+              kd * (error - 2 * law.prev_error + law.last_error);
+  law.last_error = law.prev_error;
+  law.prev_error = error;
+
+  inc = inc / (TIM1->ARR + 1);
+  if (inc > PID_CTRL_MAX_CHANGE_POWER * SIM_PID_TIME_SCALE)
+    inc = PID_CTRL_MAX_CHANGE_POWER * SIM_PID_TIME_SCALE;
+  float power = duty + inc;
+  if (power < 0)
+    power = 0;
+  else if (power > MAX_DUTY_CYCLE)
+    power = MAX_DUTY_CYCLE;
+  if (law.target_down) {
+    float v_out = power * BLDC_MOTOR_WORKING_VOLTAGE;
+    float v_ke = law.set_point * USE_PID_CTRL_KE_LIMIT * 0.4;
+    if (v_out < v_ke) {
+      power = v_ke / BLDC_MOTOR_WORKING_VOLTAGE;
+      law.floor_periods++;
+    }
+  }
+
+  double diff = fabs(motor.BldcGetMotorSpeedPower() - power);
+  if (diff > law.max_diff)
+    law.max_diff = diff;
+  law.periods++;
+}
+
+// one sim tick, the ms hook runs at every public timer period like the main loop
+static void SimTick(void) {
+  sim_us += SIM_DT_US;
+  ModelStep(SIM_DT_US * 1e-6);
+  SimTimerSetTime(SIM_HALL_TIMER, sim_us);
+  HallUpdate();
+  AdcUpdate();
+  for (int k = 0; k < 3; k++)
+    current_sq_sum += model.i[k] * model.i[k];
+  torque_sum += model.torque;
+  torque_sq_sum += model.torque * model.torque;
+
+  uint32_t pwm_period = SimTimerPeriodUs(SIM_PWM_TIMER);
+  if (pwm_period && sim_us >= next_pwm_us) {
+    next_pwm_us = sim_us + pwm_period;
+    volatile uint16_t *ccr = &TIM1->CCR1;
+    for (int k = 0; k < 3; k++)
+      ccr_active[k] = ccr[k << 1];
+    SimTimerUpdate(SIM_PWM_TIMER);
+  }
+  uint32_t public_period = SimTimerPeriodUs(SIM_PUBLIC_TIMER);
+  if (public_period && sim_us >= next_public_us) {
+    next_public_us = sim_us + public_period;
+    MOTOR_STATE state = motor.BldcGetMotorState();
+    float duty = motor.BldcGetMotorSpeedPower();
+    SimTimerUpdate(SIM_PUBLIC_TIMER);
+    LawRefTick(state, duty);
+  }
+}
+
+typedef void (*SIM_MS_HOOK)(uint32_t ms);
+
+static void SimRun(uint32_t ms, SIM_MS_HOOK hook) {
+  for (uint32_t t = 0; t < ms; t++) {
+    for (uint32_t us = 0; us < 1000; us += SIM_DT_US)
+      SimTick();
+    if (hook)
+      hook(t);
+  }
+}
+
+// stop the spindle and let the firmware settle back to STOP
+static void SimStop(void) {
+  motor.BldcControlMotorRunProcess(STOP);
+  model.omega = 0;
+  model.load = 0;
+  model.locked = false;
+  SimRun(400, NULL);
+  hard_protect = false;
+  if (motor.BldcGetMotorState() != STOP) {
+    printf("  FAIL: motor state %d after stop\n", motor.BldcGetMotorState());
+    failed++;
+  }
+}
+
+static void Check(bool ok, const char *what) {
+  if (!ok) {
+    printf("  FAIL: %s\n", what);
+    failed++;
+  }
+}
+
+// ---------------------------------------------------------------- commutation
+
+static SIM_PHASE_PAIR CommutationOf(uint8_t hall) {
+  SIM_PHASE_PAIR pair = {-1, -1};
+  uint16_t ccer = TIM1->CCER;
+  GPIOB->IDR = hall << 3;
+  SimExtiEdge(SIM_HALL_LINE_U);
+  ccer = TIM1->CCER;
+  for (int k = 0; k < 3; k++) {
+    if (ccer & (TIM_CCER_CC1E << (k * 4)))
+      pair.high = k;
+    if (ccer & (TIM_CCER_CC1NE << (k * 4)))
+      pair.low = k;
+  }
+  return pair;
+}
+
+// torque shape of the pair the table picks at theta_e, positive drives forward
+static double PairTorque(const SIM_PHASE_PAIR *table, double theta_e) {
+  const SIM_PHASE_PAIR *pair = &table[HallState(theta_e)];
+  if (pair->high < 0 || pair->low < 0)
+    return -2;
+  return BackEmfShape(pair->high, theta_e) - BackEmfShape(pair->low, theta_e);
+}
+
+static double PairTorqueMin(const SIM_PHASE_PAIR *table, double sign) {
+  double worst = 2;
+  for (int deg = 0; deg < 360; deg++) {
+    double t = sign * PairTorque(table, deg * M_PI / 180);
+    if (t < worst)
+      worst = t;
+  }
+  return worst;
+}
+
+// reads the six step table out of the hall ISR, places the halls where the CW table
+// drives forward and checks the CCW table then drives backward in every sector
+static void CommutationCheck(void) {
+  SIM_PHASE_PAIR table[2][8];
+
+  printf("commutation table\n");
+  for (int dir = CW; dir <= CCW; dir++) {
+    motor.BldcSetMotorDirection((MOTOR_DIR)dir);
+    motor.BldcControlMotorRunProcess(RUN);
+    for (uint8_t hall = 0; hall < 8; hall++)
+      table[dir][hall] = CommutationOf(hall);
+    SimStop();
+  }
+  motor.BldcSetMotorDirection(CW);
+
+  double best = -3;
+  double best_offset = 0;
+  for (int deg = 0; deg < 360; deg++) {
+    hall_offset = deg * M_PI / 180;
+    double worst = PairTorqueMin(table[CW], 1);
+    if (worst > best) {
+      best = worst;
+      best_offset = hall_offset;
+    }
+  }
+  hall_offset = best_offset;
+  double ccw_worst = PairTorqueMin(table[CCW], -1);
+  printf("  hall offset             %6.0f deg electrical\n", best_offset * 180 / M_PI);
+  printf("  CW  worst sector torque %6.2f of peak\n", best / sqrt(3.0));
+  printf("  CCW worst sector torque %6.2f of peak\n", ccw_worst / sqrt(3.0));
+  // six step worst case is cos(30) of the peak
+  Check(best / sqrt(3.0) > 0.8, "CW table does not drive forward in every hall sector");
+  Check(ccw_worst / sqrt(3.0) > 0.8, "CCW table does not drive backward in every hall sector");
+  ModelReset(0);
+}
+
+// floating, PWM and low side channel of each step of the BldcPhaseChange switch the
+// lookup table replaced, 0..2 for U..W
+static const uint8_t baseline_step[7][3] = {
+  {0, 0, 0},
+  {1, 2, 0},  // C+ A-
+  {2, 0, 1},  // A+ B-
+  {0, 2, 1},  // C+ B-
+  {0, 1, 2},  // B+ C-
+  {2, 1, 0},  // B+ A-
+  {1, 0, 2},  // A+ C-
+};
+
+static void (*const baseline_set_compare[3])(TIM_TypeDef *, uint16_t) = {
+  TIM_SetCompare1, TIM_SetCompare2, TIM_SetCompare3,
+};
+
+// the switch only turns off the leg that floats next, so like the firmware it ran
+// it is only defined for steps taken in rotation order
+static void BaselinePhaseChange(TIM_TypeDef *tim, unsigned int step, uint16_t period, float power) {
+  const uint8_t *ch = baseline_step[step];
+  TIM_CCxCmd(tim, ch[0] << 2, TIM_CCx_Disable);
+  TIM_CCxNCmd(tim, ch[0] << 2, TIM_CCxN_Disable);
+  TIM_CCxNCmd(tim, ch[1] << 2, TIM_CCxN_Disable);
+  baseline_set_compare[ch[1]](tim, period * power);
+  TIM_CCxCmd(tim, ch[1] << 2, TIM_CCx_Enable);
+  TIM_CCxCmd(tim, ch[2] << 2, TIM_CCx_Disable);
+  baseline_set_compare[ch[2]](tim, period);
+  TIM_CCxNCmd(tim, ch[2] << 2, TIM_CCxN_Enable);
+}
+
+// walks the halls in rotation order for both directions at two duties and checks the
+// outputs and compares the lookup table leaves in TIM1 against the former switch
+static void CommutationBaselineCheck(void) {
+  static const float duty[] = {MIN_DUTY_CYCLE, 0.5};
+  uint16_t period = TIM1->ARR + 1;
+  uint32_t steps = 0, mismatch = 0;
+
+  for (int dir = CW; dir <= CCW; dir++) {
+    motor.BldcSetMotorDirection((MOTOR_DIR)dir);
+    motor.BldcControlMotorRunProcess(RUN);
+    for (size_t d = 0; d < sizeof(duty) / sizeof(duty[0]); d++) {
+      TIM_TypeDef ref;
+      memset(&ref, 0, sizeof(ref));
+      motor.BldcSetMotorSpeedPower(duty[d]);
+      float power = motor.BldcGetMotorSpeedPower();
+      // two electrical turns, the first one brings the reference into step
+      for (int sector = 0; sector < 12; sector++) {
+        double theta_e = (dir == CW ? 1 : -1) * (sector * 60 + 30) * M_PI / 180;
+        uint8_t hall = HallState(theta_e);
+        CommutationOf(hall);
+        BaselinePhaseChange(&ref, dir == CW ? 7 - hall : hall, period, power);
+        if (sector < 6)
+          continue;
+        const uint8_t *ch = baseline_step[dir == CW ? 7 - hall : hall];
+        volatile uint16_t *ccr = &TIM1->CCR1, *ref_ccr = &ref.CCR1;
+        steps++;
+        if ((TIM1->CCER & 0x555) != (ref.CCER & 0x555) || ccr[ch[2] << 1] != ref_ccr[ch[2] << 1] ||
+            abs(ccr[ch[1] << 1] - ref_ccr[ch[1] << 1]) > 1)
+          mismatch++;
+      }
+    }
+    SimStop();
+  }
+  motor.BldcSetMotorDirection(CW);
+
+  printf("  steps unlike the former switch %2u of %u\n", mismatch, steps);
+  Check(steps && !mismatch, "commutation outputs differ from the former six step switch");
+}
+
+// ---------------------------------------------------------------- speed loop
+
+typedef struct {
+  double target;
+  double rpm[4000];   // true speed, one per ms
+  double fw_rpm[4000];
+  double current[4000];   // rms phase current A
+  double torque[4000];    // mean electromagnetic torque Nm
+  double torque_sq[4000];   // mean of its square
+  uint32_t count;
+} SPEED_TRACE;
+
+static SPEED_TRACE trace;
+static double hook_load_nm;
+static uint32_t hook_load_at;
+static uint32_t hook_load_until;
+static bool hook_lock;
+static int32_t block_latency;
+static uint32_t hook_load_ramp;   // ms from no load to load_nm
+
+// CncHead200W::MotorSpeedControlLoop around SpindleGuard
+typedef struct {
+  bool on;
+  double target;            // requested before the derating
+  uint32_t overcurrent_cnt;
+  int32_t warn_ms;          // first stall risk after the load, -1 none
+  int32_t head_stop_ms;     // over current stop of the head, -1 none
+  uint8_t flags_seen;
+  float lowest_derate;
+} GUARD_RUN;
+
+static SpindleGuard guard;
+static GUARD_RUN guard_run;
+
+static void GuardStep(uint32_t ms) {
+  if (!guard_run.on || ms % SIM_GUARD_INTERVAL_MS)
+    return;
+  bool running = motor.BldcGetMotorState() == RUN;
+  float current = (float)motor.BldcGetMultiChannelAdc(I_ADC_CHANNEL, 0) * SIM_I_ADC_MA_FULL / 4095;
+  if (current > SIM_HEAD_OVERCURRENT_MA) {
+    if (++guard_run.overcurrent_cnt >= SIM_HEAD_OVERCURRENT_CNT && running) {
+      motor.BldcControlMotorRunProcess(STOP);
+      running = false;
+      if (guard_run.head_stop_ms < 0)
+        guard_run.head_stop_ms = ms - hook_load_at;
+    }
+  } else {
+    guard_run.overcurrent_cnt = 0;
+  }
+
+  float derate = guard.Derate();
+  guard.Update(current, running ? motor.BldcGetMotorRpm() : 0, motor.BldcGetMotorSpeedPower(),
+               guard_run.target, running, motor.BldcGetMotorPidControl());
+  if (guard.Derate() != derate && running) {
+    motor.BldcSetMotorTargetRpm(guard_run.target * guard.Derate());
+    LawRefTarget(guard_run.target * guard.Derate());
+  }
+  guard_run.flags_seen |= guard.Flags();
+  guard_run.lowest_derate = fmin(guard_run.lowest_derate, guard.Derate());
+  if (guard_run.warn_ms < 0 && ms >= hook_load_at && (guard.Flags() & (1 << SPINDLE_GUARD_FLAG_STALL_RISK)))
+    guard_run.warn_ms = ms - hook_load_at;
+}
+
+static void TraceHook(uint32_t ms) {
+  if (ms == 0)
+    current_sq_sum = torque_sum = torque_sq_sum = 0;
+  if (ms == hook_load_at) {
+    model.load = hook_load_nm;
+    model.locked = hook_lock;
+  }
+  if (hook_load_ramp && ms > hook_load_at && ms < hook_load_until)
+    model.load = hook_load_nm * fmin(1.0, (double)(ms - hook_load_at) / hook_load_ramp);
+  if (ms == hook_load_until) {
+    model.load = 0;
+    model.locked = false;
+  }
+  if (block_latency < 0 && ms >= hook_load_at && motor.BldcGetMotorBlockState() != MOTOR_BLOCK_NORMAL)
+    block_latency = ms - hook_load_at;
+  GuardStep(ms);
+  if (trace.count < sizeof(trace.rpm) / sizeof(trace.rpm[0])) {
+    trace.rpm[trace.count] = RpmOf(model.omega);
+    trace.fw_rpm[trace.count] = motor.BldcGetMotorRpm();
+    trace.current[trace.count] = sqrt(current_sq_sum / 3 / (1000 / SIM_DT_US));
+    trace.torque[trace.count] = torque_sum / (1000 / SIM_DT_US);
+    trace.torque_sq[trace.count] = torque_sq_sum / (1000 / SIM_DT_US);
+    trace.count++;
+  }
+  current_sq_sum = torque_sum = torque_sq_sum = 0;
+}
+
+static void TraceRun(double target, uint32_t ms, double load_nm, uint32_t load_at, uint32_t load_until, bool lock) {
+  memset(&trace, 0, sizeof(trace));
+  trace.target = target;
+  hook_load_nm = load_nm;
+  hook_load_at = load_at;
+  hook_load_until = load_until;
+  hook_lock = lock;
+  block_latency = -1;
+  guard_run.target = target;
+  if (guard_run.on)
+    target *= guard.Derate();
+  motor.BldcSetMotorTargetRpm(target);
+  LawRefTarget(target);
+  if (motor.BldcGetMotorState() != RUN) {
+    motor.BldcControlMotorRunProcess(RUN);
+    LawRefRun();
+  }
+  SimRun(ms, TraceHook);
+}
+
+// first ms at or after from where the trace crosses level
+static int32_t TraceCross(uint32_t from, double level) {
+  for (uint32_t t = from; t < trace.count; t++) {
+    if (trace.rpm[t] >= level)
+      return t;
+  }
+  return -1;
+}
+
+// last ms in [from, to) outside the band around the target, settled after it
+static int32_t TraceSettle(uint32_t from, uint32_t to, double band) {
+  int32_t last = from;
+  for (uint32_t t = from; t < to && t < trace.count; t++) {
+    if (fabs(trace.rpm[t] - trace.target) > band * trace.target)
+      last = t;
+  }
+  return last - from;
+}
+
+static double TraceMax(uint32_t from, uint32_t to) {
+  double m = -1e9;
+  for (uint32_t t = from; t < to && t < trace.count; t++)
+    m = fmax(m, trace.rpm[t]);
+  return m;
+}
+
+static double TraceMin(uint32_t from, uint32_t to) {
+  double m = 1e9;
+  for (uint32_t t = from; t < to && t < trace.count; t++)
+    m = fmin(m, trace.rpm[t]);
+  return m;
+}
+
+static double TraceRipple(uint32_t from, uint32_t to) {
+  double sum = 0, sq = 0;
+  uint32_t n = 0;
+  for (uint32_t t = from; t < to && t < trace.count; t++, n++) {
+    sum += trace.rpm[t];
+    sq += trace.rpm[t] * trace.rpm[t];
+  }
+  double mean = sum / n;
+  return sqrt(fmax(sq / n - mean * mean, 0));
+}
+
+static double TraceCurrent(uint32_t from, uint32_t to) {
+  double sum = 0;
+  uint32_t n = 0;
+  for (uint32_t t = from; t < to && t < trace.count; t++, n++)
+    sum += trace.current[t];
+  return sum / n;
+}
+
+// rms of the electromagnetic torque around its mean, commutation ripple and the speed
+// loop together, relative to the mean
+static double TraceTorqueRipple(uint32_t from, uint32_t to) {
+  double sum = 0, sq = 0;
+  uint32_t n = 0;
+  for (uint32_t t = from; t < to && t < trace.count; t++, n++) {
+    sum += trace.torque[t];
+    sq += trace.torque_sq[t];
+  }
+  double mean = sum / n;
+  return sqrt(fmax(sq / n - mean * mean, 0)) / mean;
+}
+
+static double TraceReadError(uint32_t from, uint32_t to) {
+  double err = 0;
+  uint32_t n = 0;
+  for (uint32_t t = from; t < to && t < trace.count; t++, n++)
+    err += fabs(trace.fw_rpm[t] - trace.rpm[t]);
+  return err / n;
+}
+
+static void StartupBench(const char *mode, double target) {
+  TraceRun(target, 3000, 0, UINT32_MAX, UINT32_MAX, false);
+  int32_t t10 = TraceCross(0, 0.1 * target);
+  int32_t t90 = TraceCross(0, 0.9 * target);
+  double peak = TraceMax(0, 3000);
+  printf("  %-9s 0 -> %5.0f rpm  rise 10-90%% %4d ms  overshoot %5.1f%%  settle 2%% %4d ms  ripple %4.1f rpm  read error %4.1f rpm  no load current %5.2f A\n",
+         mode, target, (t10 >= 0 && t90 >= 0) ? t90 - t10 : -1, (peak - target) * 100 / target,
+         TraceSettle(0, 3000, 0.02), TraceRipple(2500, 3000), TraceReadError(2500, 3000),
+         TraceCurrent(2500, 3000));
+  Check(t90 >= 0, "spindle does not reach 90% of the target");
+}
+
+// returns the torque ripple under the load
+static double LoadStepBench(const char *mode, double target) {
+  TraceRun(target, 3500, SIM_LOAD_STEP_NM, 1500, 2500, false);
+  double dip = TraceMin(1500, 2500);
+  double peak = TraceMax(2500, 3500);
+  double ripple = TraceTorqueRipple(2000, 2500);
+  printf("  %-9s %.3f Nm at %5.0f rpm  dip %4.1f%%  recover 2%% %4d ms  release overshoot %4.1f%%  loaded current %5.2f A  torque ripple %4.1f%%\n",
+         mode, SIM_LOAD_STEP_NM, target, (target - dip) * 100 / target,
+         TraceSettle(1500, 2500, 0.02), (peak - target) * 100 / target, TraceCurrent(2000, 2500), ripple * 100);
+  Check(motor.BldcGetMotorState() == RUN, "spindle stopped under the rated load step");
+  return ripple;
+}
+
+// the spindle slows down, the law holds the duty at the back EMF floor, no check: six
+// step coasts down without braking
+static void StepDownBench(const char *mode, double from, double to) {
+  TraceRun(from, 2500, 0, UINT32_MAX, UINT32_MAX, false);
+  TraceRun(to, 4000, 0, UINT32_MAX, UINT32_MAX, false);
+  printf("  %-9s %5.0f -> %5.0f rpm  lowest %5.0f rpm  after 1s %5.0f rpm  after 4s %5.0f rpm\n", mode, from, to,
+         TraceMin(0, 4000), trace.rpm[999], trace.rpm[3999]);
+}
+
+static void StallBench(const char *what, double target, double load_nm, bool lock) {
+  static const char *block_name[] = {"none", "stall", "hardware protect"};
+  TraceRun(target, 3500, load_nm, 1500, UINT32_MAX, lock);
+  printf("  %-14s at %5.0f rpm  detected after %4d ms by %s\n", what, target, block_latency,
+         block_name[motor.BldcGetMotorBlockState()]);
+  Check(block_latency >= 0 && motor.BldcGetMotorState() == STOP, "stall not detected");
+}
+
+static void SpeedLoopBench(BLDC_DRIVE_MODE drive_mode, const char *mode, double *ripple) {
+  Check(motor.BldcSetMotorDriveMode(drive_mode), "drive mode not accepted");
+  StartupBench(mode, 12000);
+  SimStop();
+  StartupBench(mode, 18000);
+  SimStop();
+  ripple[0] = LoadStepBench(mode, MOTOR_MIN_SPEED);
+  SimStop();
+  ripple[1] = LoadStepBench(mode, 12000);
+  SimStop();
+  StepDownBench(mode, 18000, 10000);
+  SimStop();
+}
+
+// ---------------------------------------------------------------- predictive protection
+
+static void GuardStart(void) {
+  memset(&guard_run, 0, sizeof(guard_run));
+  guard_run.on = true;
+  guard_run.warn_ms = -1;
+  guard_run.head_stop_ms = -1;
+  guard_run.lowest_derate = 1;
+  guard.Init(SIM_GUARD_INTERVAL_MS, MOTOR_BLOCK_SPEED);
+}
+
+// a heavy load ramping in over ramp_ms, a hard stop has to be warned of first
+static void GuardStallBench(const char *what, double target, double load_nm, uint32_t ramp_ms, bool lock) {
+  static const char *block_name[] = {"none", "stall", "hardware protect"};
+  char stop[48];
+  GuardStart();
+  hook_load_ramp = ramp_ms;
+  TraceRun(target, 4500, load_nm, 1500, UINT32_MAX, lock);
+  hook_load_ramp = 0;
+  int32_t stop_ms = block_latency;
+  if (guard_run.head_stop_ms >= 0 && (stop_ms < 0 || guard_run.head_stop_ms < stop_ms)) {
+    stop_ms = guard_run.head_stop_ms;
+    snprintf(stop, sizeof(stop), "%4d ms by over current", stop_ms);
+  } else if (stop_ms >= 0) {
+    snprintf(stop, sizeof(stop), "%4d ms by %s", stop_ms, block_name[motor.BldcGetMotorBlockState()]);
+  } else {
+    snprintf(stop, sizeof(stop), "none, %5.0f rpm after 3 s", trace.rpm[trace.count - 1]);
+  }
+  printf("  %-14s %.2f Nm in %4u ms at %5.0f rpm  stall risk after %5d ms  derate to %.2f  stop %s\n",
+         what, load_nm, ramp_ms, target, guard_run.warn_ms, guard_run.lowest_derate, stop);
+  // a stop faster than the guard can confirm is left to the hard protection
+  if (stop_ms >= SIM_GUARD_INTERVAL_MS * STALL_PREDICT_SAMP_CNT)
+    Check(guard_run.warn_ms >= 0 && guard_run.warn_ms < stop_ms, "no stall risk warning ahead of the stop");
+}
+
+// runs the guard must stay quiet on
+static void GuardQuietBench(void) {
+  static const double steps[][2] = {{0, 18000}, {18000, 10000}, {10000, MOTOR_MIN_SPEED}, {MOTOR_MIN_SPEED, 18000}};
+  char what[96];
+  GuardStart();
+  for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+    if (steps[i][0])
+      TraceRun(steps[i][0], 2500, 0, UINT32_MAX, UINT32_MAX, false);
+    TraceRun(steps[i][1], 3000, 0, UINT32_MAX, UINT32_MAX, false);
+    printf("  %5.0f -> %5.0f rpm          flags 0x%02x\n", steps[i][0], steps[i][1], guard_run.flags_seen);
+    snprintf(what, sizeof(what), "guard warned 0x%02x going from %.0f to %.0f rpm", guard_run.flags_seen,
+             steps[i][0], steps[i][1]);
+    Check(!guard_run.flags_seen, what);
+    SimStop();
+    GuardStart();
+  }
+  for (double rpm = MOTOR_MIN_SPEED; rpm <= 12000; rpm += 4000) {
+    TraceRun(rpm, 3500, SIM_LOAD_STEP_NM, 1500, 2500, false);
+    printf("  %.3f Nm at %5.0f rpm     flags 0x%02x\n", SIM_LOAD_STEP_NM, rpm, guard_run.flags_seen);
+    snprintf(what, sizeof(what), "guard warned 0x%02x under the rated load step at %.0f rpm", guard_run.flags_seen, rpm);
+    Check(!guard_run.flags_seen, what);
+    SimStop();
+    GuardStart();
+  }
+}
+
+// I2t alone on a current trace, on_ma for on_ms of every period_ms and off_ma between
+static void GuardHeatBench(const char *what, float on_ma, float off_ma, uint32_t on_ms, uint32_t period_ms,
+                           uint32_t run_ms, int32_t expect_ms) {
+  int32_t overload_ms = -1;
+  float heat_max = 0;
+  guard.Init(SIM_GUARD_INTERVAL_MS, MOTOR_BLOCK_SPEED);
+  for (uint32_t ms = 0; ms < run_ms; ms += SIM_GUARD_INTERVAL_MS) {
+    float current = ms % period_ms < on_ms ? on_ma : off_ma;
+    guard.Update(current, 12000, 0.5, 12000, true, true);
+    heat_max = fmax(heat_max, guard.Heat());
+    if (overload_ms < 0 && (guard.Flags() & (1 << SPINDLE_GUARD_FLAG_OVERLOAD)))
+      overload_ms = ms + SIM_GUARD_INTERVAL_MS;
+  }
+  printf("  %-24s highest I2t %4.2f  overload after %7d ms, expected %7d ms\n", what, heat_max,
+         overload_ms, expect_ms);
+  if (expect_ms < 0)
+    Check(overload_ms < 0, "I2t overload under the continuous rating");
+  else
+    Check(overload_ms >= 0 && abs(overload_ms - expect_ms) <= SIM_HEAT_TOLERANCE_MS, "I2t overload off the winding model");
+}
+
+// time for the first order winding model to reach the warning level at a constant current
+static int32_t GuardHeatExpect(float ma) {
+  double ratio_sq = (double)ma * ma / ((double)I2T_RATED_CURRENT * I2T_RATED_CURRENT);
+  return lround(-I2T_TIME_CONSTANT * log(1 - I2T_WARNING_LEVEL / ratio_sq));
+}
+
+static void GuardBench(void) {
+  printf("predictive protection, stalling loads\n");
+  GuardStallBench("overload", 12000, SIM_OVERLOAD_NM, 0, false);
+  SimStop();
+  GuardStallBench("overload ramp", 12000, SIM_OVERLOAD_NM, 2000, false);
+  SimStop();
+  GuardStallBench("heavy cut", 12000, 0.12, 500, false);
+  SimStop();
+  GuardStallBench("heavy cut", MOTOR_MIN_SPEED, 0.12, 500, false);
+  SimStop();
+  GuardStallBench("locked rotor", 12000, 0, 0, true);
+  SimStop();
+  printf("predictive protection, false positives\n");
+  GuardQuietBench();
+  printf("predictive protection, winding I2t on current traces\n");
+  GuardHeatBench("5.5 A continuous", 5500, 5500, 1, 1, 600000, -1);
+  GuardHeatBench("7 A continuous", 7000, 7000, 1, 1, 600000, GuardHeatExpect(7000));
+  GuardHeatBench("9 A continuous", 9000, 9000, 1, 1, 600000, GuardHeatExpect(9000));
+  GuardHeatBench("8 A 20 s of every 60 s", 8000, 2000, 20000, 60000, 600000, -1);
+  guard_run.on = false;
+}
+
+// ---------------------------------------------------------------- self test
+
+static void SelfTestBench(void) {
+  uint32_t mos = 0, hall = 0;
+  printf("self test\n");
+  Check(BldcMotor::BldcStartSelfTest(), "self test not started");
+  for (uint32_t ms = 0; ms < 5000; ms++) {
+    SimRun(1, NULL);
+    BldcMotor::BldcSelfTestLoop(ms);
+    // the head reports and acknowledges each stage
+    if (self_test_send_flag & (1 << SELF_TEST_MOS_INFO)) {
+      mos++;
+      self_test_send_flag &= ~(1 << SELF_TEST_MOS_INFO);
+    }
+    if (self_test_send_flag & (1 << SELF_TEST_HALL_INFO)) {
+      hall++;
+      self_test_send_flag &= ~(1 << SELF_TEST_HALL_INFO);
+    }
+    if (self_test_send_flag & (1 << SELF_TEST_END_INFO)) {
+      self_test_send_flag &= ~(1 << SELF_TEST_END_INFO);
+      uint32_t err = bldc_self_test_err_sta;
+      printf("  %u MOS and %u hall checks in %u ms, error status 0x%08x\n", mos, hall, ms, err);
+      printf("  hall steps off the expected sector %d of %d\n",
+             __builtin_popcount(err & SIM_SELF_TEST_HALL_ERR), CHECK_HALL_CNT);
+      Check(!(err & (SIM_SELF_TEST_MOS_ERR | SIM_SELF_TEST_ABORT_ERR)), "self test reports MOS errors");
+      Check(!(err & SIM_SELF_TEST_HALL_ERR), "self test hall steps off the expected sector");
+      Check(mos == SELF_TEST_MOS_INVALID_INDEX && hall == CHECK_HALL_CNT, "self test skipped checks");
+      ModelReset(model.theta);
+      return;
+    }
+  }
+  Check(false, "self test did not finish");
+}
+
+// ---------------------------------------------------------------- ISR cost
+
+static void PrintIsrStat(const char *name, SIM_ISR_STAT *stat, uint32_t budget_us) {
+  if (!stat->calls)
+    return;
+  printf("  %-22s %9llu calls  mean %6.0f ns  max %7llu ns  budget %5u us\n", name,
+         (unsigned long long)stat->calls, (double)stat->total_ns / stat->calls,
+         (unsigned long long)stat->max_ns, budget_us);
+}
+
+static void SumIsrStat(SIM_ISR_STAT *sum, const SIM_ISR_STAT *stat) {
+  sum->calls += stat->calls;
+  sum->total_ns += stat->total_ns;
+  if (stat->max_ns > sum->max_ns)
+    sum->max_ns = stat->max_ns;
+}
+
+// the ISRs of one drive mode since the stats were reset run_ms ago
+static void IsrBench(const char *mode, uint32_t run_ms) {
+  SIM_ISR_STAT hall = {0, 0, 0}, all = {0, 0, 0};
+  for (uint8_t line = SIM_HALL_LINE_U; line <= SIM_HALL_LINE_W; line++)
+    SumIsrStat(&hall, SimExtiIsrStat(line));
+  SumIsrStat(&all, &hall);
+  SumIsrStat(&all, SimTimerIsrStat(SIM_PUBLIC_TIMER));
+  SumIsrStat(&all, SimTimerIsrStat(SIM_PWM_TIMER));
+  // host time, compare runs of the same machine; the budget is the shortest period at
+  // rated speed the ISR has to fit into on the MCU
+  uint32_t hall_budget = 60000000UL / (MOTOR_RATED_SPEED * SIM_POLE_PAIRS * 6);
+  printf("ISR host time, %s\n", mode);
+  PrintIsrStat("hall EXTI", &hall, hall_budget);
+  PrintIsrStat("speed loop TIM2", SimTimerIsrStat(SIM_PUBLIC_TIMER), 1000);
+  PrintIsrStat("sine update TIM1", SimTimerIsrStat(SIM_PWM_TIMER), 1000000 * 2 / BLDC_TIM_PWM_FREQ);
+  printf("  all ISRs               %9.0f ns per ms of run\n", (double)all.total_ns / run_ms);
+}
+
+int main(void) {
+  SimPeriphReset();
+  ModelReset(0);
+  Check(motor.Init(), "BldcMotor init");
+
+  CommutationCheck();
+  CommutationBaselineCheck();
+  SelfTestBench();
+
+  double six_step_ripple[2], sine_ripple[2];
+  uint64_t bench_us;
+  printf("speed loop, load step %.0f%% of rated torque\n", SIM_LOAD_STEP_NM * 100 / SIM_RATED_TORQUE);
+  SimIsrStatReset();
+  bench_us = sim_us;
+  SpeedLoopBench(BLDC_DRIVE_SIX_STEP, "six step", six_step_ripple);
+  IsrBench("six step", (sim_us - bench_us) / 1000);
+  SimIsrStatReset();
+  bench_us = sim_us;
+  SpeedLoopBench(BLDC_DRIVE_SINE, "sine", sine_ripple);
+  IsrBench("sine", (sim_us - bench_us) / 1000);
+  Check(sine_ripple[0] < six_step_ripple[0] && sine_ripple[1] < six_step_ripple[1],
+        "sine drive has no less torque ripple than six step");
+  Check(motor.BldcSetMotorDriveMode(BLDC_DRIVE_SIX_STEP), "drive mode not accepted");
+
+  printf("stall detection\n");
+  StallBench("overload", 12000, SIM_OVERLOAD_NM, false);
+  SimStop();
+  StallBench("locked rotor", 8000, 0, true);
+  SimStop();
+  StallBench("locked rotor", 12000, 0, true);
+  SimStop();
+
+  GuardBench();
+
+  printf("fixed point speed law against float\n");
+  printf("  %u control periods, %u on the back EMF floor, duty off by at most %.1f LSB of Q16\n",
+         law.periods, law.floor_periods, law.max_diff * 65536);
+  Check(law.periods && law.max_diff * 65536 <= SIM_LAW_TOLERANCE_Q16, "fixed point speed law differs from float");
+
+  printf("%s\n", failed ? "FAILED" : "OK");
+  return failed ? 1 : 0;
+}
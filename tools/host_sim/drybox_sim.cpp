@@ -0,0 +1,498 @@
+/*
+ * Snapmaker2-Modules Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Modules
+ * (see https://github.com/Snapmaker/Snapmaker2-Modules)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Drybox chamber temperature against the real Pid and ChamberCtrl
+//
+// Two thermal nodes: the heater block, driven by the 100Hz heater pwm, and the
+// chamber with the spool, coupled to the block through the fan and losing heat to
+// the room through the walls and the vent. The block thermistor is sampled every
+// 38.4ms as the ADC DMA delivers it, the GXHT3x every 110ms as DryBox fetches it,
+// each behind its own lag. The model values are estimates, not measurements.
+//
+// DryBox::TempCtrl and ResetTempCtrl are mirrored here, they only glue the two
+// controllers together. The scheme before the cascade, a heater pre heat stage at
+// 80% duty and a chamber Pid on the same pin, both with the extruder gains, runs on
+// the same plant for comparison. It holds the block at the host heater target, so its
+// figures depend on that target.
+//
+// Humidity: the spool holds water in equilibrium with the chamber RH and gives the
+// excess off with a time constant that halves about every 10C, the chamber air is
+// vented by the fan and leaks to the room. The real DryingCtrl runs the auto mode
+// once a second as DryBox::DryingProcess does, against the timed mode the host sets
+// up today, the fan at full for a fixed time.
+//
+// Figures: chamber rise time, overshoot, settle time, heater block peak and energy of
+// both temperature schemes, cycle time, energy, water left in the spool and the
+// remaining time estimate of both drying modes.
+// Checks: the cascade settles within 1C of the chamber target, overshoots it by at
+// most 1.5C and keeps the heater block below the over temperature fault. The auto
+// mode ends by itself, leaves the spool no wetter than the timed mode and ends a
+// spool stored dry in a third of the time, also when the room gets more humid on the
+// way and the ambient reference is off. Any failed check exits non zero.
+
+#include <math.h>
+#include <stdio.h>
+#include "src/core/pid.h"
+#include "src/registry/registry.h"
+#include "src/device/chamber_ctrl.h"
+#include "src/device/drying_ctrl.h"
+
+#define SIM_STEP_MS               4
+#define SIM_AMBIENT               25.0
+#define SIM_HEATER_W              60.0
+#define SIM_BLOCK_J_K             80.0    // aluminium block and heater
+#define SIM_CHAMBER_J_K           2500.0  // air, walls and a 1kg spool
+#define SIM_BLOCK_CHAMBER_W_K     0.6     // fins in still air
+#define SIM_BLOCK_FAN_W_K         1.4     // added at full fan
+#define SIM_CHAMBER_LOSS_W_K      0.45    // walls
+#define SIM_VENT_M3_S             1e-4    // at full fan
+#define SIM_AIR_J_M3_K            1200.0
+#define SIM_THERMISTOR_TAU_S      3.0
+#define SIM_THERMISTOR_NOISE      0.1
+#define SIM_SENSOR_TAU_S          8.0
+#define SIM_SENSOR_NOISE          0.02
+#define SIM_HEATER_SAMPLE_US      38400   // 16 conversions 2.4ms apart
+#define SIM_CHAMBER_SAMPLE_MS     110     // GXHT3X_FETCH_MS
+#define SIM_SEED                  0x2545F4914F6CDD1DULL
+
+#define SIM_CHAMBER_M3            0.03
+#define SIM_LEAK_M3_S             1e-5
+#define SIM_AMBIENT_RH            60.0
+#define SIM_DRY_REF_C             60.0    // the spool time constants are given at
+#define SIM_DRY_E_FOLD_C          15.0    // degree per e fold of the time constant
+#define SIM_SPOOL_G               1000.0
+#define SIM_WATER_MARGIN_G        0.1     // auto against timed, 0.01% of the spool
+
+#define SIM_SETTLE_BAND           1.0     // degree around the chamber target
+#define SIM_MAX_OVERSHOOT         1.5     // degree
+
+// DryBox: drybox.h HEATER_PROTECT_TEMP, HEATER_MAX_SETPOINT, HEATER_PWM_MAX,
+// HEATER_PID_BAND and the HEATER_DEFAULT_* gains the heater block loop starts with
+#define SIM_HEATER_PROTECT_TEMP   130
+#define SIM_HEATER_MAX_SETPOINT   (SIM_HEATER_PROTECT_TEMP - 10)
+#define SIM_HEATER_PWM_MAX        255
+#define SIM_HEATER_PID_BAND       10
+#define SIM_HEATER_KP             6
+#define SIM_HEATER_KI             0.01
+#define SIM_HEATER_KD             40
+
+// before the cascade, TEMP_CTRL_PRE_HEAT and TEMP_CTRL_CHAMBER_HEAT
+#define SIM_LEGACY_PRE_HEAT_DUTY  204
+#define SIM_LEGACY_MIN_HEATER     70
+
+typedef enum {
+  SCHEME_LEGACY,
+  SCHEME_CASCADE,
+} SIM_SCHEME;
+
+typedef struct {
+  double block;         // degree
+  double chamber;
+  double thermistor;    // lagged, as sampled
+  double sensor;
+  double fan;           // 0..1
+  double duty;          // 0..1
+  double energy_j;
+  double water_g;       // held by the spool
+  double ah;            // chamber absolute humidity, g/m3
+  double rh;            // at the GXHT3x, percent
+} SIM_PLANT;
+
+typedef struct {
+  uint16_t heater_target;
+  uint16_t chamber_target;
+  uint32_t minutes;
+} SIM_SCENARIO;
+
+typedef struct {
+  double rise_s;        // first within the settle band
+  double settle_s;      // last entry into the settle band
+  double overshoot;
+  double block_max;
+  double energy_wh;
+  bool settled;
+} RUN_STAT;
+
+typedef struct {
+  const char *name;
+  uint16_t heater_target;
+  uint16_t chamber_target;
+  double water_sat_g;   // held at 100% RH
+  double tau_ref_min;   // drying time constant at SIM_DRY_REF_C
+  double storage_rh;    // percent, where the spool was kept
+  uint32_t host_minutes;
+  double room_rh_late;  // percent from the first hour on, 0 keeps SIM_AMBIENT_RH
+} SIM_DRYING;
+
+typedef struct {
+  double minutes;
+  double energy_wh;
+  double water_g;
+  double remain_err_min;  // estimate against the real remaining time, half way
+  bool estimated;         // the estimate was a fit by then
+  bool done;
+} DRY_STAT;
+
+static const SIM_SCENARIO scenarios[] = {
+  {90,  50, 180},
+  {110, 65, 180},
+  {120, 80, 240},
+};
+
+// 1kg spools, host times as a user would set them
+static const SIM_DRYING dryings[] = {
+  {"PLA wet",  90,  50, 6,  90,  80, 360, 0},
+  {"PLA dry",  90,  50, 6,  90,  15, 360, 0},
+  {"PLA dry, room gets humid", 90, 50, 6, 90, 15, 360, 75},
+  {"PETG wet", 110, 65, 4,  90,  80, 360, 0},
+  {"PA wet",   120, 80, 40, 180, 80, 480, 0},
+};
+
+Registry registryInstance;
+static int failed;
+static uint64_t rng = SIM_SEED;
+
+MODULE_TYPE Registry::module() {
+  return MODULE_DRYBOX;
+}
+
+static double Noise(double sigma) {
+  // xorshift, sum of uniforms is close enough to gaussian here
+  double sum = 0;
+  for (int i = 0; i < 4; i++) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    sum += (double)(rng >> 11) / (double)(1ULL << 53) - 0.5;
+  }
+  return sum * sigma * sqrt(3.0);
+}
+
+static void Check(bool ok, const char *what) {
+  if (!ok) {
+    printf("  FAIL: %s\n", what);
+    failed++;
+  }
+}
+
+// ---------------------------------------------------------------- plant
+
+static void PlantReset(SIM_PLANT *plant, double fan) {
+  plant->block = plant->chamber = plant->thermistor = plant->sensor = SIM_AMBIENT;
+  plant->fan = fan;
+  plant->duty = 0;
+  plant->energy_j = 0;
+  plant->water_g = 0;
+  plant->ah = DryingCtrl::AbsoluteHumidity(SIM_AMBIENT, SIM_AMBIENT_RH);
+  plant->rh = SIM_AMBIENT_RH;
+}
+
+// absolute humidity of saturated air, g/m3
+static double SaturatedHumidity(double temp) {
+  return DryingCtrl::AbsoluteHumidity(temp, 100);
+}
+
+static void HumidityStep(SIM_PLANT *plant, const SIM_DRYING *d, double room_rh, double dt) {
+  double ah_room = DryingCtrl::AbsoluteHumidity(SIM_AMBIENT, room_rh);
+  double rh = plant->ah / SaturatedHumidity(plant->chamber);
+  double tau = d->tau_ref_min * 60 * exp((SIM_DRY_REF_C - plant->chamber) / SIM_DRY_E_FOLD_C);
+  double release = (plant->water_g - d->water_sat_g * (rh > 1 ? 1 : rh)) / tau;
+  double flow = SIM_LEAK_M3_S + SIM_VENT_M3_S * plant->fan;
+
+  plant->water_g -= dt * release;
+  plant->ah += dt * (release - flow * (plant->ah - ah_room)) / SIM_CHAMBER_M3;
+  plant->rh = 100 * plant->ah / SaturatedHumidity(plant->sensor);
+  if (plant->rh > 100)
+    plant->rh = 100;
+}
+
+static void PlantStep(SIM_PLANT *plant, double dt) {
+  double g_bc = SIM_BLOCK_CHAMBER_W_K + SIM_BLOCK_FAN_W_K * plant->fan;
+  double g_ca = SIM_CHAMBER_LOSS_W_K + SIM_VENT_M3_S * SIM_AIR_J_M3_K * plant->fan;
+  double heat = SIM_HEATER_W * plant->duty;
+  double to_chamber = g_bc * (plant->block - plant->chamber);
+
+  plant->block += dt * (heat - to_chamber) / SIM_BLOCK_J_K;
+  plant->chamber += dt * (to_chamber - g_ca * (plant->chamber - SIM_AMBIENT)) / SIM_CHAMBER_J_K;
+  plant->thermistor += dt * (plant->block - plant->thermistor) / SIM_THERMISTOR_TAU_S;
+  plant->sensor += dt * (plant->chamber - plant->sensor) / SIM_SENSOR_TAU_S;
+  plant->energy_j += heat * dt;
+}
+
+// ---------------------------------------------------------------- controllers
+
+typedef struct {
+  SIM_SCHEME scheme;
+  Pid heater;
+  Pid chamber;          // legacy only
+  ChamberCtrl cascade;
+  uint32_t cascade_ms;
+  bool chamber_stage;   // legacy only
+  uint16_t heater_target;
+  uint16_t chamber_target;
+} SIM_CTRL;
+
+// Temperature::InitPID, the gains FUNC_SET_PID leaves in the app parameters
+static void CtrlInit(SIM_CTRL *ctrl, SIM_SCHEME scheme, uint16_t heater_target, uint16_t chamber_target) {
+  ctrl->scheme = scheme;
+  if (scheme == SCHEME_CASCADE) {
+    ctrl->heater.Init(SIM_HEATER_KP, SIM_HEATER_KI, SIM_HEATER_KD);
+  } else {
+    ctrl->heater.Init(TEMP_DEFAULT_KP, TEMP_DEFAULT_KI, TEMP_DEFAULT_KD);
+    ctrl->chamber.Init(TEMP_DEFAULT_KP, TEMP_DEFAULT_KI, TEMP_DEFAULT_KD);
+  }
+  ctrl->heater_target = heater_target;
+  ctrl->chamber_target = chamber_target;
+  ctrl->chamber_stage = false;
+
+  // DryBox::SetTargetTemp then ResetTempCtrl
+  if (scheme == SCHEME_CASCADE) {
+    ctrl->cascade.Reset();
+    ctrl->cascade_ms = 0;
+    ctrl->heater.target(ctrl->chamber_target);
+  } else {
+    ctrl->heater.target(ctrl->heater_target);
+    ctrl->chamber.target(ctrl->chamber_target);
+  }
+}
+
+// DryBox::TempCtrl after a GXHT3x sample, the cascade outer loop
+static void CtrlChamberSample(SIM_CTRL *ctrl, double chamber, double heater, uint32_t now) {
+  if (ctrl->scheme == SCHEME_CASCADE) {
+    float dt = ctrl->cascade_ms ? (now - ctrl->cascade_ms) / 1000.0f : 0;
+    uint32_t pwm = ctrl->heater.getOutput();
+    int8_t heater_sat = pwm >= SIM_HEATER_PWM_MAX ? 1 : (pwm == 0 ? -1 : 0);
+    float max_sp = ctrl->heater_target < SIM_HEATER_MAX_SETPOINT ? ctrl->heater_target : SIM_HEATER_MAX_SETPOINT;
+
+    ctrl->cascade_ms = now;
+    ctrl->cascade.SetLimit(ctrl->chamber_target, max_sp);
+    ctrl->heater.target(ctrl->cascade.Update(ctrl->chamber_target, chamber, heater, heater_sat, dt));
+  }
+}
+
+// returns the duty the pin is left at, or -1 when this sample does not touch it
+static int32_t CtrlHeaterSample(SIM_CTRL *ctrl, double heater) {
+  if (ctrl->scheme == SCHEME_CASCADE) {
+    ctrl->heater.SetPwmDutyLimitAndThreshold(SIM_HEATER_PWM_MAX, SIM_HEATER_PID_BAND);
+    return ctrl->heater.output(heater);
+  }
+  if (!ctrl->chamber_stage) {
+    ctrl->heater.SetPwmDutyLimitAndThreshold(SIM_LEGACY_PRE_HEAT_DUTY, 0);
+    int32_t duty = ctrl->heater.output(heater);
+    if (heater >= ctrl->heater_target && ctrl->heater_target > SIM_LEGACY_MIN_HEATER)
+      ctrl->chamber_stage = true;
+    return duty;
+  }
+  if (heater < ctrl->heater_target)
+    ctrl->chamber_stage = false;
+  return -1;
+}
+
+// the legacy chamber stage drives the pin from the GXHT3x sample
+static int32_t CtrlLegacyChamber(SIM_CTRL *ctrl, double chamber) {
+  if (ctrl->scheme != SCHEME_LEGACY || !ctrl->chamber_stage)
+    return -1;
+  return ctrl->chamber.output(chamber);
+}
+
+// ---------------------------------------------------------------- runs
+
+typedef struct {
+  SIM_PLANT plant;
+  SIM_CTRL ctrl;
+  uint32_t heater_us;
+  uint32_t chamber_ms;
+  double heater;        // last thermistor sample
+  double chamber;       // last GXHT3x sample
+} SIM_RUN;
+
+static void RunInit(SIM_RUN *run, SIM_SCHEME scheme, uint16_t heater_target, uint16_t chamber_target, double fan) {
+  PlantReset(&run->plant, fan);
+  CtrlInit(&run->ctrl, scheme, heater_target, chamber_target);
+  run->heater_us = 0;
+  run->chamber_ms = 0;
+  run->heater = run->chamber = SIM_AMBIENT;
+}
+
+static void RunStep(SIM_RUN *run, uint32_t ms) {
+  SIM_PLANT *plant = &run->plant;
+
+  PlantStep(plant, SIM_STEP_MS / 1000.0);
+
+  run->heater_us += SIM_STEP_MS * 1000;
+  if (run->heater_us >= SIM_HEATER_SAMPLE_US) {
+    run->heater_us -= SIM_HEATER_SAMPLE_US;
+    run->heater = plant->thermistor + Noise(SIM_THERMISTOR_NOISE);
+    int32_t duty = CtrlHeaterSample(&run->ctrl, run->heater);
+    if (duty >= 0)
+      plant->duty = duty / 255.0;
+  }
+
+  if (ms - run->chamber_ms >= SIM_CHAMBER_SAMPLE_MS) {
+    run->chamber_ms = ms;
+    run->chamber = plant->sensor + Noise(SIM_SENSOR_NOISE);
+    CtrlChamberSample(&run->ctrl, run->chamber, run->heater, ms);
+    int32_t duty = CtrlLegacyChamber(&run->ctrl, run->chamber);
+    if (duty >= 0)
+      plant->duty = duty / 255.0;
+  }
+}
+
+static void Run(SIM_SCHEME scheme, const SIM_SCENARIO *sc, RUN_STAT *stat) {
+  SIM_RUN run;
+  uint32_t end_ms = sc->minutes * 60000;
+  bool inside = false;
+
+  // free and timed heating run the fan at 255
+  RunInit(&run, scheme, sc->heater_target, sc->chamber_target, 1.0);
+  stat->rise_s = -1;
+  stat->settle_s = -1;
+  stat->overshoot = 0;
+  stat->block_max = SIM_AMBIENT;
+
+  for (uint32_t ms = 0; ms < end_ms; ms += SIM_STEP_MS) {
+    RunStep(&run, ms);
+    if (run.plant.block > stat->block_max)
+      stat->block_max = run.plant.block;
+
+    double err = run.plant.chamber - sc->chamber_target;
+    if (fabs(err) <= SIM_SETTLE_BAND) {
+      if (stat->rise_s < 0)
+        stat->rise_s = ms / 1000.0;
+      if (!inside)
+        stat->settle_s = ms / 1000.0;
+      inside = true;
+    } else {
+      inside = false;
+    }
+    if (stat->rise_s >= 0 && err > stat->overshoot)
+      stat->overshoot = err;
+  }
+  stat->settled = inside;
+  stat->energy_wh = run.plant.energy_j / 3600;
+}
+
+static void PrintStat(const char *name, const RUN_STAT *stat) {
+  printf("  %-8s rise %5.0f s  overshoot %5.2f C  settle +-%.0fC %6.0f s%s  block max %6.1f C  energy %5.1f Wh\n",
+         name, stat->rise_s, stat->overshoot, SIM_SETTLE_BAND, stat->settle_s,
+         stat->settled ? "" : " (not settled)", stat->block_max, stat->energy_wh);
+}
+
+static void CascadeBench(void) {
+  printf("chamber temperature, fan at full, heater gains %.3g/%.3g/%.3g\n",
+         (double)SIM_HEATER_KP, (double)SIM_HEATER_KI, (double)SIM_HEATER_KD);
+  for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+    const SIM_SCENARIO *sc = &scenarios[i];
+    RUN_STAT legacy, cascade;
+
+    printf(" chamber %u C, heater limit %u C, %u min\n", sc->chamber_target, sc->heater_target, sc->minutes);
+    Run(SCHEME_LEGACY, sc, &legacy);
+    PrintStat("legacy", &legacy);
+    Run(SCHEME_CASCADE, sc, &cascade);
+    PrintStat("cascade", &cascade);
+
+    Check(cascade.settled && cascade.rise_s >= 0, "cascade does not settle on the chamber target");
+    Check(cascade.overshoot <= SIM_MAX_OVERSHOOT, "cascade chamber overshoot");
+    Check(cascade.block_max < SIM_HEATER_PROTECT_TEMP, "cascade heater block reaches the over temperature fault");
+  }
+}
+
+// ---------------------------------------------------------------- drying
+
+// auto: DryBox::StartHeating(2) and DryingProcess, timed: StartHeating(1) with a host time
+static void DryingRun(const SIM_DRYING *d, bool auto_mode, DRY_STAT *stat) {
+  SIM_RUN run;
+  DryingCtrl drying;
+  uint32_t end_ms = auto_mode ? DRYING_MAX_TIME_S * 1000 : d->host_minutes * 60000;
+  static int32_t remain_s[DRYING_MAX_TIME_S / 60];
+
+  if (auto_mode)
+    drying.Start(DRYING_MAX_TIME_S);
+  RunInit(&run, SCHEME_CASCADE, d->heater_target, d->chamber_target,
+          auto_mode ? drying.FanDuty() / 255.0 : 1.0);
+  run.plant.water_g = d->water_sat_g * d->storage_rh / 100;
+  stat->done = false;
+
+  uint32_t ms = 0;
+  for (; ms < end_ms; ms += SIM_STEP_MS) {
+    RunStep(&run, ms);
+    HumidityStep(&run.plant, d, (ms >= 3600000 && d->room_rh_late) ? d->room_rh_late : SIM_AMBIENT_RH,
+                 SIM_STEP_MS / 1000.0);
+
+    if (auto_mode && (ms + SIM_STEP_MS) % 1000 == 0) {
+      bool at_temp = run.chamber >= d->chamber_target - DRYING_AT_TEMP_BAND;
+      drying.Update(run.chamber, run.plant.rh, at_temp, true);
+      run.plant.fan = drying.FanDuty() / 255.0;
+      if (ms / 60000 < sizeof(remain_s) / sizeof(remain_s[0]))
+        remain_s[ms / 60000] = drying.RemainTime();
+      if (drying.Done()) {
+        stat->done = true;
+        break;
+      }
+    }
+  }
+  stat->minutes = ms / 60000.0;
+  stat->energy_wh = run.plant.energy_j / 3600;
+  stat->water_g = run.plant.water_g;
+  stat->remain_err_min = 0;
+  stat->estimated = false;
+  if (auto_mode) {
+    // before the first fit the estimate is the time limit left
+    uint32_t half = ms / 120000;
+    stat->estimated = remain_s[half] < (int32_t)(DRYING_MAX_TIME_S - half * 60 - 60);
+    stat->remain_err_min = (remain_s[half] - (ms / 1000.0 - half * 60)) / 60;
+  }
+}
+
+static void DryingBench(void) {
+  printf("drying, 1kg spool, room %.0f C %.0f%% RH\n", SIM_AMBIENT, SIM_AMBIENT_RH);
+  for (size_t i = 0; i < sizeof(dryings) / sizeof(dryings[0]); i++) {
+    const SIM_DRYING *d = &dryings[i];
+    double start = d->water_sat_g * d->storage_rh / 100;
+    DRY_STAT timed, autom;
+
+    printf(" %s, chamber %u C, water %.2f%% of the spool\n", d->name, d->chamber_target, 100 * start / SIM_SPOOL_G);
+    DryingRun(d, false, &timed);
+    printf("  timed  %4.0f min  energy %6.1f Wh  water left %.3f%%\n", timed.minutes, timed.energy_wh,
+           100 * timed.water_g / SIM_SPOOL_G);
+    DryingRun(d, true, &autom);
+    printf("  auto   %4.0f min  energy %6.1f Wh  water left %.3f%%  ", autom.minutes, autom.energy_wh,
+           100 * autom.water_g / SIM_SPOOL_G);
+    if (autom.estimated)
+      printf("remaining time half way off by %+.0f min\n", autom.remain_err_min);
+    else
+      printf("no remaining time estimate half way\n");
+
+    Check(autom.done, "auto drying does not end by itself");
+    Check(autom.water_g <= timed.water_g + SIM_WATER_MARGIN_G, "auto drying leaves the spool wetter than the timed cycle");
+    // a spool stored dry needs little, most of the timed cycle is saved
+    if (d->storage_rh <= 20)
+      Check(autom.minutes <= timed.minutes / 3, "auto drying runs long on a dry spool");
+  }
+}
+
+int main(void) {
+  CascadeBench();
+  DryingBench();
+
+  printf("%s\n", failed ? "FAILED" : "OK");
+  return failed ? 1 : 0;
+}
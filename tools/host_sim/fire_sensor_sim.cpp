@@ -0,0 +1,374 @@
+/*
+ * Snapmaker2-Modules Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Modules
+ * (see https://github.com/Snapmaker/Snapmaker2-Modules)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// 20W/40W laser head fire sensor detector against the real FireSensor
+//
+// The sensor reading is converted every 1ms on the TIM4 trigger and the detector gets
+// the mean of each ADC_DEEP block, 16ms apart, as LaserHead20W40W::LaserFireSensorLoop
+// hands it over from the DMA interrupt. A flame pulls the reading down. The levels and
+// the noise are estimates, not recordings.
+//
+// The detector before the two stage one, a 256 sample moving average of the block
+// value read every 10ms from the main loop and tripping at the threshold, runs on the
+// same readings for comparison.
+//
+// Figures: trips, latency from the start of the first block under the threshold, for
+// the two stage detector of the run that tripped as the firmware counts it, the
+// latency the firmware reports and when the trip is released, for both detectors.
+// Checks: no trip under ambient drift, laser glints or with detection off, a flame
+// well under the ambient trips within 100ms, any level under the threshold trips
+// within the 2.56s of the former average, also with the ambient close to the
+// threshold, the firmware reports the latency seen here and the trip is released 5s
+// after the flame. Any failed check exits non zero.
+//
+//   fire_sensor_sim                       synthetic readings
+//   fire_sensor_sim trace.txt [trigger]   replay block values, one per line, 16ms apart,
+//                                         against the trigger value, default 500
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "src/device/fire_sensor.h"
+
+#define SIM_BLOCK_MS              16      // ADC_DEEP conversions 1ms apart
+#define SIM_NOISE                 30.0    // adc counts per conversion
+#define SIM_SEED                  0x2545F4914F6CDD1DULL
+
+// the moving average detector before FireSensor
+#define SIM_LEGACY_SIZE           256
+#define SIM_LEGACY_PERIOD_MS      10
+#define SIM_LEGACY_SETTLE         384
+#define SIM_LEGACY_HOLD           500
+
+// LaserHead20W40W FIRE_DETECT_*_ADC_VALUE
+#define SIM_TRIGGER_HIGH          3000
+#define SIM_TRIGGER_MID           1500
+#define SIM_TRIGGER_LOW           500
+#define SIM_TRIGGER_DISABLE       0xFFFF
+
+#define SIM_AMBIENT               3600.0
+#define SIM_FLAME_MS              5000    // flames start here, after the settling
+
+#define FAST_LATENCY_MAX_MS       100
+#define LEVEL_LATENCY_MAX_MS      (FIRE_SENSOR_LEVEL_MS + FIRE_SENSOR_FAST_WINDOW * SIM_BLOCK_MS)
+#define RELEASE_MIN_MS            FIRE_SENSOR_HOLD_MS
+#define RELEASE_MAX_MS            (FIRE_SENSOR_HOLD_MS + 200)
+
+typedef double (*SIM_READING)(uint32_t ms);
+
+#define CHECK_NO_TRIP   (1 << 0)
+#define CHECK_FAST      (1 << 1)   // trips within FAST_LATENCY_MAX_MS
+#define CHECK_LEVEL     (1 << 2)   // trips within LEVEL_LATENCY_MAX_MS
+#define CHECK_RELEASE   (1 << 3)   // released the hold time after the flame is gone
+
+typedef struct {
+  const char *name;
+  uint32_t ms;
+  uint16_t trigger;
+  SIM_READING reading;
+  uint32_t flame_end_ms;    // 0 while it keeps burning
+  uint8_t check;
+} SIM_SCENARIO;
+
+typedef struct {
+  int64_t under_ms;     // start of the first block of the run under the threshold that tripped
+  int64_t trip_ms;
+  int64_t release_ms;   // last release
+  uint32_t trips;
+  uint16_t reported_ms; // FireSensor::Latency()
+} RUN_STAT;
+
+static int failed;
+static uint64_t rng = SIM_SEED;
+
+static double Noise(double sigma) {
+  // xorshift, sum of uniforms is close enough to gaussian here
+  double sum = 0;
+  for (int i = 0; i < 4; i++) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    sum += (double)(rng >> 11) / (double)(1ULL << 53) - 0.5;
+  }
+  return sum * sigma * sqrt(3.0);
+}
+
+static void Check(bool ok, const char *what) {
+  if (!ok) {
+    printf("  FAIL: %s\n", what);
+    failed++;
+  }
+}
+
+// ---------------------------------------------------------------- readings
+
+static double Ramp(uint32_t ms, uint32_t start, uint32_t len, double from, double to) {
+  if (ms < start)
+    return from;
+  if (ms >= start + len)
+    return to;
+  return from + (to - from) * (ms - start) / len;
+}
+
+static double ReadingAmbient(uint32_t ms) {
+  return SIM_AMBIENT;
+}
+
+// room light dimming by 300 counts over 20s
+static double ReadingDrift(uint32_t ms) {
+  return Ramp(ms, SIM_FLAME_MS, 20000, SIM_AMBIENT, SIM_AMBIENT - 300);
+}
+
+// the beam glinting off the work, one 16ms block down to 2000 every 2s
+static double ReadingGlint(uint32_t ms) {
+  return (ms >= SIM_FLAME_MS && ms % 2000 < SIM_BLOCK_MS) ? 2000 : SIM_AMBIENT;
+}
+
+static double ReadingFlame(uint32_t ms) {
+  return ms >= SIM_FLAME_MS ? 200 : SIM_AMBIENT;
+}
+
+// dark enclosure, the ambient sits just over the low trigger and a small flame pulls it
+// less than the flare delta under it, the baseline is held and never follows
+static double ReadingLowMargin(uint32_t ms) {
+  return ms >= SIM_FLAME_MS ? 450 : 600;
+}
+
+// a flame growing over 8s
+static double ReadingGrowing(uint32_t ms) {
+  return Ramp(ms, SIM_FLAME_MS, 8000, SIM_AMBIENT, 800);
+}
+
+// a flame that goes out after 2s
+static double ReadingFlameOut(uint32_t ms) {
+  return (ms >= SIM_FLAME_MS && ms < SIM_FLAME_MS + 2000) ? 200 : SIM_AMBIENT;
+}
+
+static const SIM_SCENARIO scenarios[] = {
+  {"ambient high",      60000, SIM_TRIGGER_HIGH,    ReadingAmbient,   0,                    CHECK_NO_TRIP},
+  {"light drift high",  30000, SIM_TRIGGER_HIGH,    ReadingDrift,     0,                    CHECK_NO_TRIP},
+  {"glints mid",        30000, SIM_TRIGGER_MID,     ReadingGlint,     0,                    CHECK_NO_TRIP},
+  {"flame low",         10000, SIM_TRIGGER_LOW,     ReadingFlame,     0,                    CHECK_FAST},
+  {"flame 450/600 low", 10000, SIM_TRIGGER_LOW,     ReadingLowMargin, 0,                    CHECK_LEVEL},
+  {"growing flame mid", 20000, SIM_TRIGGER_MID,     ReadingGrowing,   0,                    CHECK_FAST},
+  {"flame out low",     15000, SIM_TRIGGER_LOW,     ReadingFlameOut,  SIM_FLAME_MS + 2000,  CHECK_FAST | CHECK_RELEASE},
+  {"flame disabled",    10000, SIM_TRIGGER_DISABLE, ReadingFlame,     0,                    CHECK_NO_TRIP},
+};
+
+// ---------------------------------------------------------------- detectors
+
+typedef struct {
+  uint16_t buf[SIM_LEGACY_SIZE];
+  uint32_t sum;
+  uint16_t index;
+  uint32_t count;
+  uint32_t hold;
+  bool triggered;
+} SIM_LEGACY;
+
+static void LegacyInit(SIM_LEGACY *lg) {
+  *lg = SIM_LEGACY();
+}
+
+// LaserHead20W40W::LaserFireSensorLoop before the two stage detector, MovingAverage
+static bool LegacyUpdate(SIM_LEGACY *lg, uint16_t sample, uint16_t trigger) {
+  lg->sum += sample;
+  lg->sum -= lg->buf[lg->index];
+  lg->buf[lg->index] = sample;
+  lg->index = (lg->index + 1) % SIM_LEGACY_SIZE;
+  if (lg->count < SIM_LEGACY_SETTLE && ++lg->count < SIM_LEGACY_SETTLE)
+    return lg->triggered;
+
+  if (trigger <= FIRE_SENSOR_TRIGGER_LIMIT && lg->sum / SIM_LEGACY_SIZE <= trigger) {
+    lg->triggered = true;
+    lg->hold = SIM_LEGACY_HOLD;
+  } else if (lg->hold) {
+    lg->hold--;
+  } else {
+    lg->triggered = false;
+  }
+  return lg->triggered;
+}
+
+static void RunStatInit(RUN_STAT *stat) {
+  stat->under_ms = -1;
+  stat->trip_ms = -1;
+  stat->release_ms = -1;
+  stat->trips = 0;
+  stat->reported_ms = 0;
+}
+
+static void RunStatUpdate(RUN_STAT *stat, bool triggered, bool last, uint32_t ms) {
+  if (triggered && !last) {
+    if (stat->trip_ms < 0)
+      stat->trip_ms = ms;
+    stat->trips++;
+  } else if (!triggered && last) {
+    stat->release_ms = ms;
+  }
+}
+
+// one block value every 16ms, the legacy loop reads the latest one every 10ms
+static void Run(const std::vector<uint16_t> *blocks, uint16_t trigger, RUN_STAT *fs_stat, RUN_STAT *lg_stat) {
+  static FireSensor fs;
+  SIM_LEGACY lg;
+  bool fs_last = false, lg_last = false;
+  uint16_t latest = 0;
+  size_t next = 0;
+
+  fs.Init(SIM_BLOCK_MS, trigger);
+  LegacyInit(&lg);
+  RunStatInit(fs_stat);
+  RunStatInit(lg_stat);
+
+  for (uint32_t ms = 1; ms <= blocks->size() * SIM_BLOCK_MS; ms++) {
+    if (ms % SIM_BLOCK_MS == 0) {
+      latest = (*blocks)[next++];
+      // noise crossing back over the threshold starts the run again
+      if (fs_stat->trip_ms < 0 && latest > trigger)
+        fs_stat->under_ms = -1;
+      if (latest <= trigger && fs_stat->under_ms < 0)
+        fs_stat->under_ms = ms - SIM_BLOCK_MS;
+      if (latest <= trigger && lg_stat->under_ms < 0)
+        lg_stat->under_ms = ms - SIM_BLOCK_MS;
+      bool t = fs.Update(latest, ms);
+      RunStatUpdate(fs_stat, t, fs_last, ms);
+      fs_last = t;
+    }
+    if (ms % SIM_LEGACY_PERIOD_MS == 0) {
+      bool t = LegacyUpdate(&lg, latest, trigger);
+      RunStatUpdate(lg_stat, t, lg_last, ms);
+      lg_last = t;
+    }
+  }
+  fs_stat->reported_ms = fs.Latency();
+}
+
+// ---------------------------------------------------------------- scenarios
+
+static void Blocks(const SIM_SCENARIO *sc, std::vector<uint16_t> *blocks) {
+  blocks->clear();
+  for (uint32_t block = 0; block < sc->ms / SIM_BLOCK_MS; block++) {
+    double sum = 0;
+    for (uint32_t i = 0; i < SIM_BLOCK_MS; i++) {
+      double v = sc->reading(block * SIM_BLOCK_MS + i) + Noise(SIM_NOISE);
+      sum += v < 0 ? 0 : (v > 4095 ? 4095 : v);
+    }
+    blocks->push_back((uint16_t)(sum / SIM_BLOCK_MS));
+  }
+}
+
+static void StatText(const RUN_STAT *stat, char *buf, size_t size) {
+  char lat[32] = "     -", rel[32] = "     -";
+  if (stat->trip_ms >= 0 && stat->under_ms >= 0)
+    snprintf(lat, sizeof(lat), "%6lld", (long long)(stat->trip_ms - stat->under_ms));
+  if (stat->release_ms >= 0)
+    snprintf(rel, sizeof(rel), "%6lld", (long long)stat->release_ms);
+  snprintf(buf, size, "%3u %s %s", stat->trips, lat, rel);
+}
+
+static void ScenarioBench(void) {
+  std::vector<uint16_t> blocks;
+  RUN_STAT fs_stat, lg_stat;
+  char fs_text[48], lg_text[48], what[96];
+
+  printf("fire sensor, %dms blocks, latency from the start of the first block under the threshold\n", SIM_BLOCK_MS);
+  printf("  %-18s %-7s  %-24s  %-20s\n", "reading", "trigger", "two stage n/ms/rep/rel", "average n/ms/rel");
+  for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+    const SIM_SCENARIO *sc = &scenarios[i];
+    Blocks(sc, &blocks);
+    Run(&blocks, sc->trigger, &fs_stat, &lg_stat);
+    StatText(&fs_stat, fs_text, sizeof(fs_text));
+    StatText(&lg_stat, lg_text, sizeof(lg_text));
+    char trigger[8] = "off";
+    if (sc->trigger <= FIRE_SENSOR_TRIGGER_LIMIT)
+      snprintf(trigger, sizeof(trigger), "%u", sc->trigger);
+    printf("  %-18s %-7s  %s %4u  %s\n", sc->name, trigger, fs_text, fs_stat.reported_ms, lg_text);
+
+    int64_t latency = fs_stat.trip_ms - fs_stat.under_ms;
+    if (sc->check & CHECK_NO_TRIP) {
+      snprintf(what, sizeof(what), "%s: false trigger", sc->name);
+      Check(fs_stat.trips == 0, what);
+    }
+    if (sc->check & CHECK_FAST) {
+      snprintf(what, sizeof(what), "%s: late or no trip", sc->name);
+      Check(fs_stat.trip_ms >= 0 && latency <= FAST_LATENCY_MAX_MS, what);
+    }
+    if (sc->check & CHECK_LEVEL) {
+      snprintf(what, sizeof(what), "%s: level under the threshold not tripped in time", sc->name);
+      Check(fs_stat.trip_ms >= 0 && latency <= LEVEL_LATENCY_MAX_MS, what);
+    }
+    if (fs_stat.trip_ms >= 0) {
+      snprintf(what, sizeof(what), "%s: reported latency %ums", sc->name, fs_stat.reported_ms);
+      Check(fs_stat.reported_ms == latency, what);
+    }
+    if (sc->check & CHECK_RELEASE) {
+      int64_t release = fs_stat.release_ms - sc->flame_end_ms;
+      snprintf(what, sizeof(what), "%s: release %lldms after the flame", sc->name, (long long)release);
+      Check(fs_stat.release_ms >= 0 && release >= RELEASE_MIN_MS && release <= RELEASE_MAX_MS, what);
+    }
+  }
+}
+
+// ---------------------------------------------------------------- replay
+
+static bool LoadTrace(const char *path, std::vector<uint16_t> *blocks) {
+  FILE *f = fopen(path, "r");
+  unsigned v;
+  if (!f)
+    return false;
+  while (fscanf(f, "%u", &v) == 1)
+    blocks->push_back((uint16_t)(v > 4095 ? 4095 : v));
+  fclose(f);
+  return !blocks->empty();
+}
+
+static void ReplayBench(const std::vector<uint16_t> *blocks, uint16_t trigger) {
+  RUN_STAT fs_stat, lg_stat;
+  char fs_text[48], lg_text[48];
+
+  Run(blocks, trigger, &fs_stat, &lg_stat);
+  StatText(&fs_stat, fs_text, sizeof(fs_text));
+  StatText(&lg_stat, lg_text, sizeof(lg_text));
+  printf("replay, %u blocks, trigger %u, first under the threshold at %lldms\n", (unsigned)blocks->size(),
+         trigger, (long long)fs_stat.under_ms);
+  printf("  two stage n/ms/rep/rel  %s %4u\n", fs_text, fs_stat.reported_ms);
+  printf("  average n/ms/rel        %s\n", lg_text);
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1) {
+    std::vector<uint16_t> blocks;
+    uint16_t trigger = argc > 2 ? (uint16_t)atoi(argv[2]) : SIM_TRIGGER_LOW;
+    if (!LoadTrace(argv[1], &blocks)) {
+      printf("cannot read %s\n", argv[1]);
+      return 1;
+    }
+    ReplayBench(&blocks, trigger);
+    return 0;
+  }
+
+  ScenarioBench();
+
+  printf("%s\n", failed ? "FAILED" : "OK");
+  return failed ? 1 : 0;
+}
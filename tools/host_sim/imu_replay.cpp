@@ -0,0 +1,1183 @@
+/*
+ * Snapmaker2-Modules Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Modules
+ * (see https://github.com/Snapmaker/Snapmaker2-Modules)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// ICM42670 attitude path of the 20W/40W laser head against the real ICM4xxxxDriver
+//
+// A register level model of the ICM42670 answers on SPI1: bank 0 and MREG registers,
+// soft reset, record mode FIFO count, the 16 byte FIFO packets in the configured
+// endianness, wake on motion, and simplified tilt and free fall DMP events. The FIFO
+// is filled at the configured ODR from a motion (tilt ramps, vibration, a drop) or
+// from a recorded trace, the vendor driver configures the chip through it and the
+// FIFO batches land by the real DMA descriptors. The laser head security check runs
+// every 1ms on top, with its +-20 degree limits and free fall hold.
+//
+// A float Mahony filter with the same window, mounting, gains and sample spacing is
+// fed the same packets in the order the firmware decoded them.
+//
+// ImuUpdate is also driven alone: held still at attitudes across the range of its
+// integer atan2 and asin, and through a roll swing with samples lost, where the FIFO
+// timestamps give the spacing the former fixed step got wrong.
+//
+// Figures: angle error against the motion and against the float reference, protection
+// trigger latency, false triggers, how long after the DMP flagged a free fall the head
+// saw it and released the hold, the settled and swing errors of ImuUpdate alone, and
+// host cycles per sample of ImuUpdate.
+// Checks: init and APEX setup pass, the fixed point filter follows the float one, the
+// settled attitudes are within 0.01 degree of the true and float ones, lost samples
+// keep it within 0.01 degree of the float filter on the same spacing, no false trigger
+// while still or under the vibration level, tilt beyond the limits and a drop trip the
+// protection in time, the free fall event arrives within one FIFO poll and the hold
+// lasts its full time after the DMP event. Any failed check exits non zero.
+//
+//   imu_replay                  synthetic motions
+//   imu_replay -w trace.bin     also write the FIFO packets of the roll ramp as read
+//   imu_replay trace.bin        replay raw 16 byte FIFO packets, big endian as the
+//                               chip sends them after reset, one per ODR period
+
+#include <math.h>
+#include <new>
+#include <stdio.h>
+#include <string.h>
+#include <utility>
+#include <vector>
+#include <chrono>
+#include <board/board.h>
+#include "sim_periph.h"
+#include "src/device/icm4xxxx/icm4xxxx_driver.h"
+#include "src/device/icm4xxxx/icm4xxxx_delay.h"
+#include "src/device/icm4xxxx/icm42670/inv_imu_regmap.h"
+#include "src/device/icm4xxxx/icm42670/inv_imu_defs.h"
+
+#define SIM_STEP_US               1000
+#define SIM_FIFO_PACKETS          144     // 2.25KB FIFO, 16 byte packets
+#define SIM_SENSOR_STARTUP_US     50000   // samples read 0x8000 meanwhile
+#define SIM_TEMPERATURE           30.0
+#define SIM_ACCEL_NOISE_G         0.0015
+#define SIM_GYRO_NOISE_DPS        0.05
+#define SIM_SEED                  0x2545F4914F6CDD1DULL
+
+// DMP approximations: tilt once low passed gravity is 35 degree off the last rest,
+// free fall is low g for the 10cm minimum drop followed by the high g of the impact
+#define SIM_TILT_DEG              35.0
+#define SIM_TILT_LP               0.1     // per sample, about 0.2s at 50Hz
+#define SIM_LOWG_G                0.563
+#define SIM_HIGHG_G               2.5
+#define SIM_FF_MIN_US             143000
+#define SIM_FF_MAX_US             645000
+
+// LaserHead20W40W: roll_min_/roll_max_, pitch_min_/pitch_max_ defaults and
+// LASER_FREE_FALL_HOLD_MS
+#define SIM_GESTURE_LIMIT_DEG     20.0
+#define SIM_FREE_FALL_HOLD_MS     2000
+// a trip with the motion this far inside the limits is a false trigger
+#define SIM_FALSE_MARGIN_DEG      2.0
+
+#define SIM_REF_KP                10.0
+#define SIM_REF_KI                0.4
+
+#define RAD(deg)                  ((deg) * M_PI / 180)
+#define DEG(rad)                  ((rad) * 180 / M_PI)
+
+typedef struct {
+  double roll;      // degree
+  double pitch;     // degree
+  double lin[3];    // g, world frame, z up, free fall is -1 on z
+} SIM_POSE;
+
+typedef void (*SIM_MOTION)(double t, SIM_POSE *pose);
+
+typedef struct {
+  const char *name;
+  uint32_t ms;
+  SIM_MOTION motion;
+  uint8_t check;
+} SIM_SCENARIO;
+
+#define CHECK_STILL     (1 << 0)   // no trip, small angle error
+#define CHECK_TRIP      (1 << 1)   // beyond the limits, trips in time
+#define CHECK_DROP      (1 << 2)   // free fall event and trip, APEX only
+#define CHECK_NO_TRIP   (1 << 3)   // inside the limits, no false trigger
+
+typedef struct {
+  uint64_t t_us;
+  uint8_t bytes[FIFO_PACKET_SIZE];
+  double roll;      // motion at the sample, NAN when replayed
+  double pitch;
+} SIM_PACKET;
+
+// ---------------------------------------------------------------- ICM42670 model
+
+typedef struct {
+  uint8_t reg[128];
+  uint8_t mreg[0x10000];        // (BLK_SEL << 8) | MADDR, MREG1 is block 0
+  bool addressed;
+  bool read;
+  uint8_t addr;
+  uint16_t fifo[SIM_FIFO_PACKETS];  // indices into the packet log
+  uint16_t fifo_head;
+  uint16_t fifo_count;
+  uint8_t fifo_byte;            // read position in the packet at the head
+  bool sensors_on;
+  uint64_t on_us;
+  uint64_t next_sample_us;
+  double accel_last[3];
+  bool accel_last_valid;
+  bool dmp_init;
+  double tilt_ref[3];
+  bool tilt_ref_valid;
+  double tilt_lp[3];
+  uint64_t lowg_since_us;
+  bool lowg;
+  uint64_t ff_det_us;           // last free fall flagged in INT_STATUS3
+} CHIP_MODEL;
+
+static CHIP_MODEL chip;
+static std::vector<SIM_PACKET> packets;   // every packet the chip produced
+static std::vector<uint32_t> popped;      // packet indices in the order they were read out
+static uint64_t sim_us;
+static uint64_t rng_state;
+static const SIM_SCENARIO *scenario;
+static uint64_t scenario_us;
+static const std::vector<uint8_t> *replay;
+static size_t replay_pos;
+static FILE *trace_out;
+static int failed;
+
+static uint8_t &Reg(uint32_t reg) {
+  return chip.reg[reg & 0x7f];
+}
+
+static uint8_t &Mreg(uint32_t reg) {
+  return chip.mreg[reg & 0xffff];
+}
+
+static void ChipReset(void) {
+  memset(chip.reg, 0, sizeof(chip.reg));
+  memset(chip.mreg, 0, sizeof(chip.mreg));
+  Reg(MCLK_RDY) = MCLK_RDY_MCLK_RDY_MASK;
+  Reg(GYRO_CONFIG0) = 0x06;
+  Reg(ACCEL_CONFIG0) = 0x06;
+  Reg(FIFO_CONFIG1) = FIFO_CONFIG1_FIFO_BYPASS_ON;
+  Reg(INTF_CONFIG0) = INTF_CONFIG0_FIFO_COUNT_BIG_ENDIAN | INTF_CONFIG0_DATA_BIG_ENDIAN;
+  Reg(WHO_AM_I) = WHO_AM_I_ICM42670P;
+  Mreg(TMST_CONFIG1_MREG1) = TMST_CONFIG1_RESOL_1us;
+  chip.fifo_head = 0;
+  chip.fifo_count = 0;
+  chip.fifo_byte = 0;
+  chip.sensors_on = false;
+  chip.accel_last_valid = false;
+  chip.dmp_init = false;
+  chip.tilt_ref_valid = false;
+  chip.lowg = false;
+}
+
+static void ChipPowerOn(void) {
+  memset(&chip, 0, sizeof(chip));
+  ChipReset();
+  packets.clear();
+  popped.clear();
+  replay_pos = 0;
+}
+
+static void FifoFlush(void) {
+  chip.fifo_head = 0;
+  chip.fifo_count = 0;
+  chip.fifo_byte = 0;
+}
+
+static bool DataBigEndian(void) {
+  return Reg(INTF_CONFIG0) & INTF_CONFIG0_SENSOR_DATA_ENDIAN_MASK;
+}
+
+static double AccelLsbPerG(void) {
+  return 2048 << ((Reg(ACCEL_CONFIG0) & ACCEL_CONFIG0_ACCEL_UI_FS_SEL_MASK) >> ACCEL_CONFIG0_ACCEL_UI_FS_SEL_POS);
+}
+
+static double GyroLsbPerDps(void) {
+  return 16.4 * (1 << ((Reg(GYRO_CONFIG0) & GYRO_CONFIG0_GYRO_UI_FS_SEL_MASK) >> GYRO_CONFIG0_GYRO_UI_FS_SEL_POS));
+}
+
+// ODR codes from 5 (1.6kHz) halve the rate per step
+static uint32_t SamplePeriodUs(void) {
+  uint8_t odr = Reg(ACCEL_CONFIG0) & ACCEL_CONFIG0_ACCEL_ODR_MASK;
+  return odr < 5 ? 625 : 625 << (odr - 5);
+}
+
+static double Gauss(void) {
+  double u[2];
+  for (int k = 0; k < 2; k++) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    u[k] = ((rng_state >> 11) + 0.5) / 9007199254740992.0;
+  }
+  return sqrt(-2 * log(u[0])) * cos(2 * M_PI * u[1]);
+}
+
+static void Put16(uint8_t *p, int16_t v, bool big_endian) {
+  p[big_endian ? 0 : 1] = (uint16_t)v >> 8;
+  p[big_endian ? 1 : 0] = v & 0xff;
+}
+
+static int16_t Get16(const uint8_t *p, bool big_endian) {
+  return big_endian ? (int16_t)((p[0] << 8) | p[1]) : (int16_t)((p[1] << 8) | p[0]);
+}
+
+static int16_t Saturate(double v) {
+  if (v > 32767)
+    return 32767;
+  if (v < -32767)
+    return -32767;
+  return (int16_t)lrint(v);
+}
+
+static void MotionAt(double t, SIM_POSE *pose) {
+  memset(pose, 0, sizeof(*pose));
+  if (scenario && scenario->motion)
+    scenario->motion(t < 0 ? 0 : t, pose);
+}
+
+// specific force and rates in the sensor frame, the driver mounts the sensor as
+// body = M * sensor with M rows (0 0 -1) (-1 0 0) (0 1 0)
+static void SensorSample(double t, SIM_PACKET *packet, double accel[3], double gyro[3]) {
+  static const double gyro_bias[3] = {0.3, -0.2, 0.25};  // dps, sensor frame
+  SIM_POSE pose, before, after;
+  const double h = 1e-4;
+
+  MotionAt(t, &pose);
+  MotionAt(t - h, &before);
+  MotionAt(t + h, &after);
+  double phi = RAD(pose.roll), theta = RAD(pose.pitch);
+  double roll_rate = (after.roll - before.roll) / (2 * h);
+  double pitch_rate = (after.pitch - before.pitch) / (2 * h);
+
+  // body = R^T * (lin + g), R = Ry(pitch) * Rx(roll)
+  double v[3] = {pose.lin[0], pose.lin[1], pose.lin[2] + 1};
+  double u[3] = {cos(theta) * v[0] - sin(theta) * v[2], v[1], sin(theta) * v[0] + cos(theta) * v[2]};
+  double body_a[3] = {u[0], cos(phi) * u[1] + sin(phi) * u[2], -sin(phi) * u[1] + cos(phi) * u[2]};
+  double body_w[3] = {roll_rate, pitch_rate * cos(phi), -pitch_rate * sin(phi)};
+
+  accel[0] = -body_a[1];
+  accel[1] = body_a[2];
+  accel[2] = -body_a[0];
+  gyro[0] = -body_w[1] + gyro_bias[0];
+  gyro[1] = body_w[2] + gyro_bias[1];
+  gyro[2] = -body_w[0] + gyro_bias[2];
+  for (int k = 0; k < 3; k++) {
+    accel[k] += SIM_ACCEL_NOISE_G * Gauss();
+    gyro[k] += SIM_GYRO_NOISE_DPS * Gauss();
+  }
+  packet->roll = pose.roll;
+  packet->pitch = pose.pitch;
+}
+
+// wake on motion against the previous sample, tilt and free fall as the DMP would
+// roughly see them
+static void ChipEvents(const double accel[3]) {
+  if (Reg(WOM_CONFIG) & WOM_CONFIG_WOM_EN_MASK) {
+    static const uint8_t wom_bit[3] = {INT_STATUS2_WOM_X_INT_MASK, INT_STATUS2_WOM_Y_INT_MASK, INT_STATUS2_WOM_Z_INT_MASK};
+    for (int k = 0; k < 3; k++) {
+      double threshold = Mreg(ACCEL_WOM_X_THR_MREG1 + k) / 256.0;
+      if (chip.accel_last_valid && fabs(accel[k] - chip.accel_last[k]) > threshold)
+        Reg(INT_STATUS2) |= wom_bit[k];
+    }
+  }
+  memcpy(chip.accel_last, accel, sizeof(chip.accel_last));
+  chip.accel_last_valid = true;
+
+  double norm = sqrt(accel[0] * accel[0] + accel[1] * accel[1] + accel[2] * accel[2]);
+  uint8_t apex = chip.dmp_init ? Reg(APEX_CONFIG1) : 0;
+
+  if ((apex & APEX_CONFIG1_TILT_ENABLE_MASK) && norm > 0.8 && norm < 1.2) {
+    if (!chip.tilt_ref_valid) {
+      for (int k = 0; k < 3; k++)
+        chip.tilt_ref[k] = chip.tilt_lp[k] = accel[k] / norm;
+      chip.tilt_ref_valid = true;
+    }
+    for (int k = 0; k < 3; k++)
+      chip.tilt_lp[k] += (accel[k] / norm - chip.tilt_lp[k]) * SIM_TILT_LP;
+    double lp = sqrt(chip.tilt_lp[0] * chip.tilt_lp[0] + chip.tilt_lp[1] * chip.tilt_lp[1] + chip.tilt_lp[2] * chip.tilt_lp[2]);
+    double dot = (chip.tilt_lp[0] * chip.tilt_ref[0] + chip.tilt_lp[1] * chip.tilt_ref[1] + chip.tilt_lp[2] * chip.tilt_ref[2]) / lp;
+    if (dot < cos(RAD(SIM_TILT_DEG))) {
+      Reg(INT_STATUS3) |= INT_STATUS3_TILT_DET_INT_MASK;
+      chip.tilt_ref_valid = false;
+    }
+  }
+
+  if (apex & APEX_CONFIG1_FF_ENABLE_MASK) {
+    if (norm < SIM_LOWG_G) {
+      if (!chip.lowg)
+        chip.lowg_since_us = sim_us;
+      chip.lowg = true;
+    } else if (chip.lowg && norm > SIM_HIGHG_G) {
+      uint64_t fall = sim_us - chip.lowg_since_us;
+      if (fall >= SIM_FF_MIN_US && fall <= SIM_FF_MAX_US) {
+        Reg(INT_STATUS3) |= INT_STATUS3_FF_DET_INT_MASK;
+        chip.ff_det_us = sim_us;
+      }
+      chip.lowg = false;
+    } else if (chip.lowg && (sim_us - chip.lowg_since_us) > SIM_FF_MAX_US) {
+      chip.lowg = false;
+    }
+  }
+}
+
+static void ChipSample(uint64_t t_us) {
+  SIM_PACKET packet;
+  bool big = DataBigEndian();
+
+  if (replay) {
+    if (replay_pos + FIFO_PACKET_SIZE > replay->size())
+      return;
+    memcpy(packet.bytes, &(*replay)[replay_pos], FIFO_PACKET_SIZE);
+    replay_pos += FIFO_PACKET_SIZE;
+    packet.roll = NAN;
+    packet.pitch = NAN;
+  } else {
+    double accel[3], gyro[3];
+    double t = (double)(t_us - scenario_us) * 1e-6;
+    bool valid = (t_us - chip.on_us) >= SIM_SENSOR_STARTUP_US;
+    uint32_t tick = (Mreg(TMST_CONFIG1_MREG1) & TMST_CONFIG1_TMST_RES_MASK) ? 16 : 1;
+
+    SensorSample(t, &packet, accel, gyro);
+    packet.bytes[0] = 0x68;   // accel, gyro, timestamp
+    for (int k = 0; k < 3; k++) {
+      Put16(&packet.bytes[1 + k * 2], valid ? Saturate(accel[k] * AccelLsbPerG()) : INVALID_VALUE_FIFO, big);
+      Put16(&packet.bytes[7 + k * 2], valid ? Saturate(gyro[k] * GyroLsbPerDps()) : INVALID_VALUE_FIFO, big);
+    }
+    packet.bytes[13] = (int8_t)lrint((SIM_TEMPERATURE - 25) * 2);
+    Put16(&packet.bytes[14], (int16_t)(uint16_t)(t_us / tick), big);
+    if (valid)
+      ChipEvents(accel);
+  }
+  packet.t_us = t_us;
+
+  packets.push_back(packet);
+  bool fifo_on = !(Reg(FIFO_CONFIG1) & FIFO_CONFIG1_FIFO_BYPASS_MASK)
+                 && (Mreg(FIFO_CONFIG5_MREG1) & (FIFO_CONFIG5_FIFO_ACCEL_EN_MASK | FIFO_CONFIG5_FIFO_GYRO_EN_MASK));
+  // snapshot mode, a full FIFO drops the new packet
+  if (fifo_on && chip.fifo_count < SIM_FIFO_PACKETS) {
+    chip.fifo[(chip.fifo_head + chip.fifo_count) % SIM_FIFO_PACKETS] = packets.size() - 1;
+    chip.fifo_count++;
+  }
+}
+
+static void ChipAdvance(void) {
+  uint8_t pwr = Reg(PWR_MGMT0);
+  bool on = ((pwr & PWR_MGMT0_ACCEL_MODE_MASK) >= PWR_MGMT0_ACCEL_MODE_LP)
+            && ((pwr & PWR_MGMT0_GYRO_MODE_MASK) == PWR_MGMT0_GYRO_MODE_LN);
+
+  if (on != chip.sensors_on) {
+    chip.sensors_on = on;
+    chip.on_us = sim_us;
+    chip.next_sample_us = sim_us + SamplePeriodUs();
+    chip.accel_last_valid = false;
+  }
+  while (chip.sensors_on && chip.next_sample_us <= sim_us) {
+    ChipSample(chip.next_sample_us);
+    chip.next_sample_us += SamplePeriodUs();
+  }
+}
+
+static uint8_t ChipRead(uint8_t addr) {
+  uint8_t value = chip.reg[addr];
+  uint16_t count = chip.fifo_count;
+
+  switch (addr) {
+  case INT_STATUS & 0x7f:
+  case INT_STATUS2 & 0x7f:
+  case INT_STATUS3 & 0x7f:
+    chip.reg[addr] = 0;
+    return value;
+  case FIFO_COUNTH & 0x7f:
+  case (FIFO_COUNTH & 0x7f) + 1: {
+    if (!(Reg(INTF_CONFIG0) & INTF_CONFIG0_FIFO_COUNT_FORMAT_MASK))
+      count *= FIFO_PACKET_SIZE;
+    bool high = (addr == (FIFO_COUNTH & 0x7f)) == !!(Reg(INTF_CONFIG0) & INTF_CONFIG0_FIFO_COUNT_ENDIAN_MASK);
+    return high ? count >> 8 : count & 0xff;
+  }
+  case FIFO_DATA & 0x7f: {
+    if (!chip.fifo_count)
+      return 0xff;
+    uint32_t index = chip.fifo[chip.fifo_head];
+    value = packets[index].bytes[chip.fifo_byte];
+    if (++chip.fifo_byte == FIFO_PACKET_SIZE) {
+      chip.fifo_byte = 0;
+      chip.fifo_head = (chip.fifo_head + 1) % SIM_FIFO_PACKETS;
+      chip.fifo_count--;
+      popped.push_back(index);
+      if (trace_out)
+        fwrite(packets[index].bytes, FIFO_PACKET_SIZE, 1, trace_out);
+    }
+    return value;
+  }
+  case M_R & 0x7f:
+    return chip.mreg[(Reg(BLK_SEL_R) << 8) | Reg(MADDR_R)];
+  default:
+    return value;
+  }
+}
+
+static void ChipWrite(uint8_t addr, uint8_t value) {
+  switch (addr) {
+  case SIGNAL_PATH_RESET & 0x7f:
+    // both bits clear themselves once done
+    if (value & SIGNAL_PATH_RESET_SOFT_RESET_DEVICE_CONFIG_MASK) {
+      ChipReset();
+      Reg(INT_STATUS) = INT_STATUS_RESET_DONE_INT_MASK;
+    }
+    if (value & SIGNAL_PATH_RESET_FIFO_FLUSH_MASK)
+      FifoFlush();
+    return;
+  case APEX_CONFIG0 & 0x7f:
+    if (value & APEX_CONFIG0_DMP_INIT_EN_MASK)
+      chip.dmp_init = true;
+    chip.reg[addr] = value & ~(APEX_CONFIG0_DMP_INIT_EN_MASK | APEX_CONFIG0_DMP_MEM_RESET_EN_MASK);
+    return;
+  case M_W & 0x7f:
+    chip.mreg[(Reg(BLK_SEL_W) << 8) | Reg(MADDR_W)] = value;
+    return;
+  case MCLK_RDY & 0x7f:
+  case WHO_AM_I & 0x7f:
+  case FIFO_DATA & 0x7f:
+    return;
+  default:
+    chip.reg[addr] = value;
+    ChipAdvance();
+    return;
+  }
+}
+
+static void ChipSelect(bool selected) {
+  chip.addressed = false;
+  if (selected)
+    ChipAdvance();
+}
+
+// first byte is the address with the read bit, the address then increments except
+// on the FIFO data port
+static uint8_t ChipTransfer(uint8_t tx) {
+  uint8_t rx = 0;
+  if (!chip.addressed) {
+    chip.addressed = true;
+    chip.read = tx & 0x80;
+    chip.addr = tx & 0x7f;
+    return 0;
+  }
+  if (chip.read)
+    rx = ChipRead(chip.addr);
+  else
+    ChipWrite(chip.addr, tx);
+  if (chip.addr != (FIFO_DATA & 0x7f))
+    chip.addr = (chip.addr + 1) & 0x7f;
+  return rx;
+}
+
+static const SIM_SPI_DEVICE chip_spi = {GPIOA, GPIO_Pin_4, ChipSelect, ChipTransfer};
+
+// the delays and the clock of the driver and the vendor code run on the sim clock
+void icm4xxxx_delay_ms(uint32_t ms) {
+  sim_us += ms * 1000;
+}
+
+void icm4xxxx_delay_us(uint32_t us) {
+  sim_us += us;
+}
+
+void inv_imu_sleep_us(uint32_t us) {
+  sim_us += us;
+}
+
+uint64_t inv_imu_get_time_us(void) {
+  return sim_us;
+}
+
+// ---------------------------------------------------------------- float reference
+
+typedef struct {
+  int16_t window[SLIDING_WINDOW_SIZE][6];
+  double sum[6];
+  uint8_t count;
+  uint8_t index;
+  double q[4];
+  double e_int[3];
+  uint16_t timestamp_last;
+  bool timestamp_valid;
+  double roll;
+  double pitch;
+  size_t decoded;     // popped packets consumed
+} FLOAT_REF;
+
+typedef struct {
+  int32_t accel[3];
+  int32_t gyro[3];
+  uint32_t dt_us;
+} IMU_INPUT;
+
+static FLOAT_REF ref;
+static std::vector<IMU_INPUT> bench_input;
+
+static void RefReset(void) {
+  memset(&ref, 0, sizeof(ref));
+  ref.q[0] = 1;
+}
+
+static void Mount(const double in[3], double out[3]) {
+  out[0] = -in[2];
+  out[1] = -in[0];
+  out[2] = in[1];
+}
+
+static void RefUpdate(const double accel[3], const double gyro[3], double dt) {
+  double *q = ref.q;
+  double norm = sqrt(accel[0] * accel[0] + accel[1] * accel[1] + accel[2] * accel[2]);
+  if (norm == 0)
+    return;
+  double a[3] = {accel[0] / norm, accel[1] / norm, accel[2] / norm};
+  double v[3] = {2 * (q[1] * q[3] - q[0] * q[2]), 2 * (q[0] * q[1] + q[2] * q[3]),
+                 q[0] * q[0] - q[1] * q[1] - q[2] * q[2] + q[3] * q[3]};
+  double e[3] = {a[1] * v[2] - a[2] * v[1], a[2] * v[0] - a[0] * v[2], a[0] * v[1] - a[1] * v[0]};
+  double h[3];
+
+  for (int k = 0; k < 3; k++) {
+    ref.e_int[k] += e[k] * SIM_REF_KI * dt;
+    h[k] = (gyro[k] + SIM_REF_KP * e[k] + ref.e_int[k]) * dt / 2;
+  }
+  double n[4] = {q[0] - q[1] * h[0] - q[2] * h[1] - q[3] * h[2],
+                 q[1] + q[0] * h[0] + q[2] * h[2] - q[3] * h[1],
+                 q[2] + q[0] * h[1] - q[1] * h[2] + q[3] * h[0],
+                 q[3] + q[0] * h[2] + q[1] * h[1] - q[2] * h[0]};
+  norm = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2] + n[3] * n[3]);
+  for (int k = 0; k < 4; k++)
+    q[k] = n[k] / norm;
+
+  ref.roll = DEG(atan2(2 * (q[2] * q[3] + q[0] * q[1]), 1 - 2 * (q[1] * q[1] + q[2] * q[2])));
+  double s = 2 * (q[0] * q[2] - q[1] * q[3]);
+  double pitch = DEG(asin(s > 1 ? 1 : (s < -1 ? -1 : s)));
+  ref.pitch = fabs(ref.roll) < 90 ? pitch : (pitch < 0 ? -180 : 180) - pitch;
+}
+
+// the same skip rules, window and sample spacing as BatchDecode and AttitudeUpdate
+static void RefPacket(const SIM_PACKET *packet, bool record) {
+  const uint8_t *p = packet->bytes;
+  fifo_header_t header;
+  bool big = DataBigEndian();
+  int16_t value[6];
+
+  header.Byte = p[0];
+  if (header.bits.msg_bit || !header.bits.accel_bit || !header.bits.gyro_bit)
+    return;
+  for (int k = 0; k < 6; k++) {
+    value[k] = Get16(&p[FIFO_HEADER_SIZE + k * 2], big);
+    if (value[k] == INVALID_VALUE_FIFO)
+      return;
+  }
+
+  uint16_t timestamp = (uint16_t)Get16(&p[14], big);
+  uint32_t res = (Mreg(TMST_CONFIG1_MREG1) & TMST_CONFIG1_TMST_RES_MASK) ? 16 : 1;
+  uint32_t dt_us = (uint16_t)(timestamp - ref.timestamp_last) * res;
+  if (!ref.timestamp_valid || dt_us == 0 || dt_us > ATTITUDE_DT_MAX_US)
+    dt_us = ICM4xxxx_ODR_PERIOD_MS * 1000;
+  ref.timestamp_last = timestamp;
+  ref.timestamp_valid = true;
+
+  uint8_t slot = ref.index;
+  for (int k = 0; k < 6; k++) {
+    ref.sum[k] += value[k] - (ref.count == SLIDING_WINDOW_SIZE ? ref.window[slot][k] : 0);
+    ref.window[slot][k] = value[k];
+  }
+  ref.index = (ref.index + 1) % SLIDING_WINDOW_SIZE;
+  // the first full window only primes the filter
+  if (ref.count < SLIDING_WINDOW_SIZE) {
+    ref.count++;
+    return;
+  }
+
+  // the window average is integer in the firmware too, only the filter runs in float
+  double avg_a[3], avg_g[3], a[3], g[3];
+  for (int k = 0; k < 3; k++) {
+    avg_a[k] = (int32_t)ref.sum[k] / SLIDING_WINDOW_SIZE;
+    avg_g[k] = (int32_t)ref.sum[3 + k] / SLIDING_WINDOW_SIZE;
+  }
+  Mount(avg_a, a);
+  Mount(avg_g, g);
+  for (int k = 0; k < 3; k++)
+    g[k] = RAD(g[k] / GyroLsbPerDps());
+  RefUpdate(a, g, dt_us * 1e-6);
+
+  // ImuUpdate input as AttitudeUpdate builds it, for the cost bench
+  if (record) {
+    IMU_INPUT in;
+    for (int k = 0; k < 3; k++) {
+      in.accel[k] = (int32_t)a[k];
+      in.gyro[k] = (int32_t)lrint(g[k] * (1 << 24));
+    }
+    in.dt_us = dt_us;
+    bench_input.push_back(in);
+  }
+}
+
+// catch up with what the firmware has read out of the FIFO
+static void RefFollow(bool record) {
+  while (ref.decoded < popped.size())
+    RefPacket(&packets[popped[ref.decoded++]], record);
+}
+
+// ---------------------------------------------------------------- laser head loop
+
+typedef struct {
+  double err_sq[2];       // against the motion, roll and pitch
+  double err_max[2];
+  uint32_t err_count;
+  double ref_max;         // against the float reference
+  uint32_t ref_count;
+  double roll_min, roll_max, pitch_min, pitch_max;
+  int64_t hazard_ms;      // motion first beyond the limits or falling
+  int64_t trip_ms;        // first trip at or after the hazard
+  uint32_t false_trips;
+  uint32_t false_ms;
+  uint32_t trips;
+  uint32_t free_falls;    // APEX free fall events seen by the laser head
+  int64_t ff_seen_ms;     // first event seen by the laser head, after the DMP flagged it
+  int64_t ff_hold_ms;     // gesture fault released, after the DMP flagged the event
+  uint32_t samples;
+  uint64_t solve_ns;
+} RUN_STAT;
+
+static float head_yaw, head_pitch, head_roll;
+static bool head_free_fall_hold;
+static uint32_t head_free_fall_ms;
+static bool head_fault;
+
+static uint32_t NowMs(void) {
+  return (uint32_t)(sim_us / 1000);
+}
+
+static uint64_t HostNs(void) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// LaserHead20W40W::SecurityStatusCheck, gesture part
+static bool HeadSecurityCheck(RUN_STAT *stat) {
+  uint64_t start = HostNs();
+  bool solved = icm42670.AttitudeSolving();
+  stat->solve_ns += HostNs() - start;
+  if (solved)
+    icm42670.GetGesture(head_yaw, head_pitch, head_roll);
+  if (icm42670.GetEvents() & ICM_EVENT_FREE_FALL) {
+    if (stat->free_falls++ == 0)
+      stat->ff_seen_ms = (int64_t)(sim_us - chip.ff_det_us) / 1000;
+    head_free_fall_hold = true;
+    head_free_fall_ms = NowMs();
+  } else if (head_free_fall_hold && (NowMs() - head_free_fall_ms) >= SIM_FREE_FALL_HOLD_MS) {
+    head_free_fall_hold = false;
+    stat->ff_hold_ms = (int64_t)(sim_us - chip.ff_det_us) / 1000;
+  }
+  head_fault = (head_roll <= -SIM_GESTURE_LIMIT_DEG) || (head_roll >= SIM_GESTURE_LIMIT_DEG)
+               || (head_pitch <= -SIM_GESTURE_LIMIT_DEG) || (head_pitch >= SIM_GESTURE_LIMIT_DEG)
+               || head_free_fall_hold;
+  return solved;
+}
+
+static void Check(bool ok, const char *what) {
+  if (!ok) {
+    printf("  FAIL: %s\n", what);
+    failed++;
+  }
+}
+
+// power on: zeroed .bss, then the constructor
+static bool DriverPowerOn(ICM_PROTECT_MODE mode) {
+  SimPeriphReset();
+  ChipPowerOn();
+  SimSpiAttach(&chip_spi);
+  RefReset();
+  memset((void *)&icm42670, 0, sizeof(icm42670));
+  new (&icm42670) ICM4xxxxDriver();
+  head_yaw = head_pitch = head_roll = 0;
+  head_free_fall_hold = false;
+  head_fault = false;
+  sim_us = 0;
+
+  if (!icm42670.ChipInit())
+    return false;
+  return mode == ICM_PROTECT_POLLING || icm42670.SetProtectMode(mode);
+}
+
+static void RunStatInit(RUN_STAT *stat) {
+  memset(stat, 0, sizeof(*stat));
+  stat->hazard_ms = -1;
+  stat->trip_ms = -1;
+  stat->ff_seen_ms = -1;
+  stat->ff_hold_ms = -1;
+  stat->roll_min = stat->pitch_min = 1e9;
+  stat->roll_max = stat->pitch_max = -1e9;
+}
+
+static void Run(uint32_t ms, ICM_PROTECT_MODE mode, RUN_STAT *stat, bool record) {
+  bool fault_last = false;
+  uint64_t start_ms = NowMs();
+
+  scenario_us = sim_us;
+  for (uint32_t t = 0; t < ms; t++) {
+    sim_us += SIM_STEP_US;
+    ChipAdvance();
+    // the transfer started in the last loop has long finished, 8 packets take 0.23ms
+    SimSpiDmaRun();
+    bool solved = HeadSecurityCheck(stat);
+
+    SIM_POSE pose;
+    MotionAt((double)(sim_us - scenario_us) * 1e-6, &pose);
+    bool hazard = !replay && ((fabs(pose.roll) >= SIM_GESTURE_LIMIT_DEG) || (fabs(pose.pitch) >= SIM_GESTURE_LIMIT_DEG)
+                              || (pose.lin[2] < -0.5));
+    bool inside = !replay && (fabs(pose.roll) < SIM_GESTURE_LIMIT_DEG - SIM_FALSE_MARGIN_DEG)
+                  && (fabs(pose.pitch) < SIM_GESTURE_LIMIT_DEG - SIM_FALSE_MARGIN_DEG) && (stat->hazard_ms < 0);
+    int64_t now = NowMs() - start_ms;
+    if (hazard && stat->hazard_ms < 0)
+      stat->hazard_ms = now;
+    if (head_fault && !fault_last) {
+      stat->trips++;
+      if (inside)
+        stat->false_trips++;
+      else if (stat->hazard_ms >= 0 && stat->trip_ms < 0)
+        stat->trip_ms = now;
+    }
+    if (head_fault && inside)
+      stat->false_ms++;
+    fault_last = head_fault;
+
+    if (!solved)
+      continue;
+    RefFollow(record);
+    const SIM_PACKET *last = &packets[popped.back()];
+    stat->samples = ref.decoded;
+    stat->roll_min = fmin(stat->roll_min, head_roll);
+    stat->roll_max = fmax(stat->roll_max, head_roll);
+    stat->pitch_min = fmin(stat->pitch_min, head_pitch);
+    stat->pitch_max = fmax(stat->pitch_max, head_pitch);
+    if (!isnan(last->roll)) {
+      double err[2] = {head_roll - last->roll, head_pitch - last->pitch};
+      for (int k = 0; k < 2; k++) {
+        stat->err_sq[k] += err[k] * err[k];
+        stat->err_max[k] = fmax(stat->err_max[k], fabs(err[k]));
+      }
+      stat->err_count++;
+    }
+    // APEX decimates the filter in the background, the reference does not
+    if (mode == ICM_PROTECT_POLLING) {
+      stat->ref_max = fmax(stat->ref_max, fmax(fabs(head_roll - ref.roll), fabs(head_pitch - ref.pitch)));
+      stat->ref_count++;
+    }
+  }
+  // land the transfer in flight, a power on here cannot reset the static busy flag of
+  // the driver
+  SimSpiDmaRun();
+}
+
+// ---------------------------------------------------------------- motions
+
+static double Ramp(double t, double start, double rate, double end) {
+  if (t < start)
+    return 0;
+  double v = (t - start) * rate;
+  return fabs(v) > fabs(end) ? end : v;
+}
+
+static void MotionInside(double t, SIM_POSE *pose) {
+  pose->roll = Ramp(t, 3, 5, 15);
+  pose->pitch = Ramp(t, 3, -5, -15);
+}
+
+static void MotionRollRamp(double t, SIM_POSE *pose) {
+  pose->roll = Ramp(t, 3, 10, 30);
+}
+
+static void MotionPitchRamp(double t, SIM_POSE *pose) {
+  pose->pitch = Ramp(t, 3, -10, -30);
+}
+
+static void MotionKnock(double t, SIM_POSE *pose) {
+  pose->roll = Ramp(t, 3, 180, 45);
+}
+
+// engraving vibration, 0.3g lateral and 0.15g vertical, above the ODR and aliased
+static void MotionVibration(double t, SIM_POSE *pose) {
+  pose->lin[0] = 0.3 * sin(2 * M_PI * 37 * t);
+  pose->lin[1] = 0.3 * sin(2 * M_PI * 23 * t + 1);
+  pose->lin[2] = 0.15 * sin(2 * M_PI * 61 * t + 2);
+  pose->roll = 0.5 * sin(2 * M_PI * 3 * t);
+}
+
+// 30cm free fall, then the impact
+static void MotionDrop(double t, SIM_POSE *pose) {
+  const double fall = sqrt(2 * 0.3 / 9.81);
+  if (t >= 3 && t < 3 + fall)
+    pose->lin[2] = -1;
+  else if (t >= 3 + fall && t < 3 + fall + 0.02)
+    pose->lin[2] = 6;
+}
+
+static const SIM_SCENARIO scenarios[] = {
+  {"level",              10000, NULL,             CHECK_STILL},
+  {"15 deg roll+pitch",  10000, MotionInside,     CHECK_NO_TRIP},
+  {"roll ramp 10 deg/s", 10000, MotionRollRamp,   CHECK_TRIP},
+  {"pitch ramp 10 deg/s", 10000, MotionPitchRamp, CHECK_TRIP},
+  {"knock 180 deg/s",    6000,  MotionKnock,      CHECK_TRIP},
+  {"vibration 0.3g",     20000, MotionVibration,  CHECK_NO_TRIP},
+  {"drop 30cm",          8000,  MotionDrop,       CHECK_DROP},
+};
+
+// ---------------------------------------------------------------- scenarios
+
+// filter warm up is two seconds of samples, the motions start after three
+#define TRIP_LATENCY_MAX_MS       300
+#define STILL_ERROR_MAX_DEG       1.0
+#define REF_ERROR_MAX_DEG         0.1
+#define SWEEP_ERROR_MAX_DEG       0.01    // ImuUpdate alone, noise free
+
+static const char *ModeName(ICM_PROTECT_MODE mode) {
+  return mode == ICM_PROTECT_APEX ? "APEX" : "polling";
+}
+
+static void PrintStat(const char *name, ICM_PROTECT_MODE mode, const RUN_STAT *stat) {
+  char ref_text[24] = "     -", trip_text[24] = "     -";
+  char ff_text[48] = "   -/    -";
+  if (stat->ref_count)
+    snprintf(ref_text, sizeof(ref_text), "%6.3f", stat->ref_max);
+  if (stat->trip_ms >= 0)
+    snprintf(trip_text, sizeof(trip_text), "%6lld", (long long)(stat->trip_ms - stat->hazard_ms));
+  if (stat->ff_seen_ms >= 0)
+    snprintf(ff_text, sizeof(ff_text), "%4lld/%5lld", (long long)stat->ff_seen_ms, (long long)stat->ff_hold_ms);
+  double n = stat->err_count ? stat->err_count : 1;
+  printf("  %-20s %-7s %5.2f/%5.2f %6.2f/%6.2f  %s  %s  %3u/%5u  %2u  %s\n", name, ModeName(mode),
+         sqrt(stat->err_sq[0] / n), sqrt(stat->err_sq[1] / n), stat->err_max[0], stat->err_max[1],
+         ref_text, trip_text, stat->false_trips, stat->false_ms, stat->free_falls, ff_text);
+}
+
+static void ScenarioBench(const SIM_SCENARIO *sc, ICM_PROTECT_MODE mode, FILE *trace) {
+  RUN_STAT stat;
+  char what[96];
+
+  scenario = sc;
+  rng_state = SIM_SEED;
+  snprintf(what, sizeof(what), "%s %s: driver init", sc->name, ModeName(mode));
+  Check(DriverPowerOn(mode), what);
+  RunStatInit(&stat);
+  trace_out = trace;
+  bool record = (sc->check & CHECK_TRIP) && mode == ICM_PROTECT_POLLING;
+  Run(sc->ms, mode, &stat, record);
+  trace_out = NULL;
+  PrintStat(sc->name, mode, &stat);
+
+  snprintf(what, sizeof(what), "%s %s", sc->name, ModeName(mode));
+  char *tail = what + strlen(what);
+  size_t room = sizeof(what) - (tail - what);
+  if (stat.ref_count) {
+    snprintf(tail, room, ": fixed point off the float filter");
+    Check(stat.ref_max < REF_ERROR_MAX_DEG, what);
+  }
+  if (sc->check & (CHECK_STILL | CHECK_NO_TRIP)) {
+    snprintf(tail, room, ": false trigger");
+    Check(stat.trips == 0, what);
+  }
+  if (sc->check & CHECK_STILL) {
+    snprintf(tail, room, ": angle error");
+    Check(stat.err_max[0] < STILL_ERROR_MAX_DEG && stat.err_max[1] < STILL_ERROR_MAX_DEG, what);
+  }
+  if (sc->check & CHECK_TRIP) {
+    snprintf(tail, room, ": late or no trip");
+    Check(stat.trip_ms >= 0 && stat.trip_ms - stat.hazard_ms <= TRIP_LATENCY_MAX_MS, what);
+  }
+  if ((sc->check & CHECK_DROP) && mode == ICM_PROTECT_APEX) {
+    snprintf(tail, room, ": no free fall event or trip");
+    Check(stat.free_falls > 0 && stat.trip_ms >= 0, what);
+    // without INT1 the event waits for the next FIFO read
+    snprintf(tail, room, ": free fall event late");
+    Check(stat.ff_seen_ms >= 0 && stat.ff_seen_ms <= ICM4xxxx_EVENT_LATENCY_MS, what);
+    snprintf(tail, room, ": free fall hold short");
+    Check(stat.ff_hold_ms >= SIM_FREE_FALL_HOLD_MS, what);
+  }
+}
+
+static void ReplayBench(const std::vector<uint8_t> *trace) {
+  RUN_STAT stat;
+  uint32_t ms = (uint32_t)(trace->size() / FIFO_PACKET_SIZE) * ICM4xxxx_ODR_PERIOD_MS + 500;
+
+  printf("replay, %u packets\n", (unsigned)(trace->size() / FIFO_PACKET_SIZE));
+  scenario = NULL;
+  replay = trace;
+  Check(DriverPowerOn(ICM_PROTECT_POLLING), "replay: driver init");
+  RunStatInit(&stat);
+  Run(ms, ICM_PROTECT_POLLING, &stat, false);
+  replay = NULL;
+  printf("  %u samples decoded, roll %.1f..%.1f, pitch %.1f..%.1f deg, %u trips\n", stat.samples,
+         stat.roll_min, stat.roll_max, stat.pitch_min, stat.pitch_max, stat.trips);
+  printf("  fixed point against float filter, max %.3f deg\n", stat.ref_max);
+  Check(stat.ref_max < REF_ERROR_MAX_DEG, "replay: fixed point off the float filter");
+}
+
+// ---------------------------------------------------------------- estimator
+
+#define EST_ACCEL_LSB             16384   // any scale, ImuUpdate normalises it
+#define EST_SETTLE_UPDATES        7500    // 150s, the integral term decays with Kp / Ki = 25s
+#define EST_SWING_DEG             15.0
+#define EST_SWING_HZ              0.5
+#define EST_SWING_UPDATES         1500
+#define EST_DROP_EVERY            3       // one sample in this many lost
+
+static ICM4xxxxDriver est;
+
+// gravity in the mounted frame at roll/pitch, as the filter reads it back
+static void EstGravity(double roll, double pitch, int32_t accel[3]) {
+  accel[0] = lrint(-sin(RAD(pitch)) * EST_ACCEL_LSB);
+  accel[1] = lrint(sin(RAD(roll)) * cos(RAD(pitch)) * EST_ACCEL_LSB);
+  accel[2] = lrint(cos(RAD(roll)) * cos(RAD(pitch)) * EST_ACCEL_LSB);
+}
+
+static double AngleDiff(double a, double b) {
+  double d = fmod(a - b + 540, 360) - 180;
+  return fabs(d);
+}
+
+// still at one attitude until settled, the integer inverse square root, atan2 and asin
+// across their range; pitch is only kept while |roll| < 90
+static void EstSettle(double roll, double pitch, double err[3]) {
+  int32_t accel[3], gyro[3] = {0, 0, 0};
+  double a[3], g[3] = {0, 0, 0};
+  float yaw, est_pitch, est_roll;
+
+  new (&est) ICM4xxxxDriver();
+  RefReset();
+  EstGravity(roll, pitch, accel);
+  for (int k = 0; k < 3; k++)
+    a[k] = accel[k];
+  for (int i = 0; i < EST_SETTLE_UPDATES; i++) {
+    est.ImuUpdate(accel, gyro, ICM4xxxx_ODR_PERIOD_MS * 1000);
+    RefUpdate(a, g, ICM4xxxx_ODR_PERIOD_MS * 1e-3);
+  }
+  est.GetGesture(yaw, est_pitch, est_roll);
+  bool pitch_kept = fabs(roll) < 90;
+  err[0] = AngleDiff(est_roll, roll);
+  err[1] = pitch_kept ? AngleDiff(est_pitch, pitch) : 0;
+  err[2] = fmax(AngleDiff(est_roll, ref.roll), pitch_kept ? AngleDiff(est_pitch, ref.pitch) : 0);
+}
+
+static void EstSweepBench(void) {
+  double max[3] = {0, 0, 0}, err[3];
+  uint32_t n = 0;
+  for (int roll = -170; roll <= 170; roll += 10) {
+    for (int pitch = -85; pitch <= 85; pitch += 5) {
+      if (roll && pitch && (abs(roll) > 80 || abs(pitch) > 60))
+        continue;
+      EstSettle(roll, pitch, err);
+      for (int k = 0; k < 3; k++)
+        max[k] = fmax(max[k], err[k]);
+      n++;
+    }
+  }
+  printf("  still, %3u attitudes          max error roll %.4f pitch %.4f deg, against float %.4f deg\n", n,
+         max[0], max[1], max[2]);
+  Check(max[0] < SWEEP_ERROR_MAX_DEG && max[1] < SWEEP_ERROR_MAX_DEG, "settled attitude off the true one");
+  Check(max[2] < SWEEP_ERROR_MAX_DEG, "settled attitude off the float filter");
+}
+
+// roll swing with every EST_DROP_EVERY-th sample lost, the survivors carry the FIFO
+// timestamp spacing. The float filter runs alongside on the same spacing, and once more
+// with the former fixed 20ms step
+static void EstSpacingBench(void) {
+  int32_t accel[3], gyro[3] = {0, 0, 0};
+  double a[3], g[3] = {0, 0, 0};
+  double ref_err = 0, step_err = 0;
+  float yaw, pitch, roll;
+  uint32_t dt_us = 0, updates = 0;
+  FLOAT_REF step;
+
+  new (&est) ICM4xxxxDriver();
+  RefReset();
+  step = ref;
+  for (int i = 1; i <= EST_SWING_UPDATES; i++) {
+    double t = i * ICM4xxxx_ODR_PERIOD_MS * 1e-3;
+    double w = 2 * M_PI * EST_SWING_HZ;
+    dt_us += ICM4xxxx_ODR_PERIOD_MS * 1000;
+    if (i % EST_DROP_EVERY == 0)
+      continue;
+    EstGravity(EST_SWING_DEG * sin(w * t), 0, accel);
+    gyro[0] = lrint(RAD(EST_SWING_DEG) * w * cos(w * t) * (1 << 24));
+    for (int k = 0; k < 3; k++) {
+      a[k] = accel[k];
+      g[k] = gyro[k] / 16777216.0;
+    }
+    est.ImuUpdate(accel, gyro, dt_us);
+    RefUpdate(a, g, dt_us * 1e-6);
+    std::swap(ref, step);
+    RefUpdate(a, g, ICM4xxxx_ODR_PERIOD_MS * 1e-3);
+    std::swap(ref, step);
+    dt_us = 0;
+    updates++;
+    est.GetGesture(yaw, pitch, roll);
+    ref_err = fmax(ref_err, AngleDiff(roll, ref.roll));
+    step_err = fmax(step_err, AngleDiff(step.roll, ref.roll));
+  }
+  printf("  roll +-%.0f deg at %.1f Hz, 1 in %d lost, %u updates  against float %.4f deg, fixed 20ms step off by %.3f deg\n",
+         EST_SWING_DEG, EST_SWING_HZ, EST_DROP_EVERY, updates, ref_err, step_err);
+  Check(ref_err < SWEEP_ERROR_MAX_DEG, "lost samples take the fixed point filter off the float one");
+}
+
+static void EstimatorBench(void) {
+  printf("ImuUpdate alone, noise free\n");
+  EstSweepBench();
+  EstSpacingBench();
+}
+
+// ---------------------------------------------------------------- cost
+
+static uint64_t Ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();   // x86intrin.h clashes with the CMSIS __I/__O
+#else
+  return HostNs();
+#endif
+}
+
+static const char *TickUnit(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return "TSC cycles";
+#else
+  return "ns";
+#endif
+}
+
+static void CostBench(void) {
+  static ICM4xxxxDriver bench;
+  const int rounds = 50;
+  double sink = 0;
+  float yaw, pitch, roll;
+
+  if (bench_input.empty())
+    return;
+  size_t n = bench_input.size();
+
+  uint64_t start = Ticks();
+  for (int r = 0; r < rounds; r++) {
+    for (size_t i = 0; i < n; i++)
+      bench.ImuUpdate(bench_input[i].accel, bench_input[i].gyro, bench_input[i].dt_us);
+    bench.GetGesture(yaw, pitch, roll);
+    sink += roll;
+  }
+  double fixed = (double)(Ticks() - start) / (rounds * n);
+
+  start = Ticks();
+  for (int r = 0; r < rounds; r++) {
+    RefReset();
+    for (size_t i = 0; i < n; i++) {
+      double a[3], g[3];
+      for (int k = 0; k < 3; k++) {
+        a[k] = bench_input[i].accel[k];
+        g[k] = bench_input[i].gyro[k] / 16777216.0;
+      }
+      RefUpdate(a, g, bench_input[i].dt_us * 1e-6);
+    }
+    sink += ref.roll;
+  }
+  double flt = (double)(Ticks() - start) / (rounds * n);
+
+  // host figures, compare runs of the same machine; the target has no FPU, the
+  // float line is the double precision reference on the host FPU
+  printf("ImuUpdate host cost, %u samples x %d\n", (unsigned)n, rounds);
+  printf("  fixed point Q30      %8.1f %s per sample\n", fixed, TickUnit());
+  printf("  float reference      %8.1f %s per sample\n", flt, TickUnit());
+  if (sink == 12345.678)
+    printf("\n");
+}
+
+static void SolveCost(const SIM_SCENARIO *sc) {
+  RUN_STAT stat;
+  scenario = sc;
+  rng_state = SIM_SEED;
+  DriverPowerOn(ICM_PROTECT_POLLING);
+  RunStatInit(&stat);
+  Run(sc->ms, ICM_PROTECT_POLLING, &stat, false);
+  if (stat.samples)
+    printf("  AttitudeSolving      %8.1f ns per decoded sample, with the SPI model\n",
+           (double)stat.solve_ns / stat.samples);
+  SIM_ISR_STAT *dma = SimDmaIsrStat(2);
+  if (dma->calls)
+    printf("  FIFO DMA complete    %8.1f ns per interrupt\n", (double)dma->total_ns / dma->calls);
+}
+
+static bool LoadFile(const char *path, std::vector<uint8_t> *data) {
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    return false;
+  uint8_t buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    data->insert(data->end(), buf, buf + n);
+  fclose(f);
+  return true;
+}
+
+int main(int argc, char **argv) {
+  const char *write_path = NULL;
+  const char *replay_path = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-w") && i + 1 < argc)
+      write_path = argv[++i];
+    else
+      replay_path = argv[i];
+  }
+
+  if (replay_path) {
+    std::vector<uint8_t> trace;
+    if (!LoadFile(replay_path, &trace) || trace.size() < FIFO_PACKET_SIZE) {
+      printf("cannot read %s\n", replay_path);
+      return 1;
+    }
+    ReplayBench(&trace);
+    printf("%s\n", failed ? "FAILED" : "OK");
+    return failed ? 1 : 0;
+  }
+
+  FILE *trace = NULL;
+  if (write_path && !(trace = fopen(write_path, "wb"))) {
+    printf("cannot write %s\n", write_path);
+    return 1;
+  }
+
+  printf("IMU attitude, laser head limits +-%.0f deg, DMP tilt and free fall simplified\n", SIM_GESTURE_LIMIT_DEG);
+  printf("  %-20s %-7s %-11s %-13s  %-6s  %-6s  %-9s  %-2s  %s\n", "motion", "mode", "rms r/p deg",
+         "max r/p deg", "vs flt", "trip", "false/ms", "ff", "ff seen/held ms");
+  for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+    ScenarioBench(&scenarios[i], ICM_PROTECT_POLLING, (scenarios[i].motion == MotionRollRamp) ? trace : NULL);
+    ScenarioBench(&scenarios[i], ICM_PROTECT_APEX, NULL);
+  }
+  if (trace)
+    fclose(trace);
+
+  EstimatorBench();
+  CostBench();
+  SolveCost(&scenarios[2]);
+
+  printf("%s\n", failed ? "FAILED" : "OK");
+  return failed ? 1 : 0;
+}
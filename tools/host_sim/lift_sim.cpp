@@ -0,0 +1,389 @@
+/*
+ * Snapmaker2-Modules Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Modules
+ * (see https://github.com/Snapmaker/Snapmaker2-Modules)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Dual extruder lift timing against the real lift planner
+//
+// DualExtruder::QueueMoveZ, PlanMoveQueue, Stepper and StepperLoadNextBlock are
+// mirrored here, they only glue LiftPlanExitSpeed and LiftPlanSpeedCtrl to the queue
+// and the step timer. The timer counts 1us ticks and the ISR toggles the step pin, so
+// a step takes two periods of the speed control node it runs on. The main loop plans
+// every SIM_LOOP_US, the host queues the moves of a sequence as fast as the queue
+// takes them.
+//
+// The blocking move before the queue, each move planned from standstill and the next
+// one sent once the lift has stopped, is the same glue with the host waiting for the
+// lift in between, it runs the same sequences for comparison.
+//
+// Figures: time from the first move queued to the last step, for both schemes, and
+// how often the host found the queue full.
+// Checks: every block emits all its steps and the lift ends where the moves add up
+// to, no block runs faster than its nominal speed, a block ending in a stop (a
+// reversal or the end of the sequence) ends on a node at most a tenth of its nominal
+// speed, the lift never stops with a block staged late and the queue is never slower
+// than the blocking moves, faster on a stream of moves in one direction. Any failed
+// check exits non zero.
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "src/device/lift_planner.h"
+
+#define SIM_LOOP_US               500     // main loop pass
+#define SIM_TIMEOUT_US            60000000ULL
+
+#define CHECK_FASTER              (1 << 0)  // the queue has to beat the blocking moves
+
+typedef struct {
+  float length;
+  float speed;
+} SIM_MOVE;
+
+typedef struct {
+  const char *name;
+  const SIM_MOVE *moves;
+  uint8_t count;
+  uint8_t check;
+} SIM_SEQUENCE;
+
+typedef struct {
+  // DualExtruder
+  move_block_t queue[Z_MOVE_QUEUE_SIZE];
+  uint8_t head;
+  uint8_t tail;
+  speed_node_t speed_ctrl[2][Z_SPEED_CTRL_NODES];
+  uint8_t active;
+  uint8_t index;
+  uint8_t step_pin;
+  uint8_t running;
+  uint32_t stepps_count;
+  uint32_t stepps_sum;
+  uint32_t next_stepps_sum;
+  int8_t dir;
+  int8_t next_dir;
+  bool next_ready;
+  float planned_exit_speed;
+  // the timer
+  uint64_t isr_at;
+  // what the sim keeps of each block
+  float speed;
+  float next_speed;
+  float exit_speed;
+  float next_exit_speed;
+  uint16_t min_timer;
+  uint16_t last_timer;
+  int64_t position;
+} SIM_LIFT;
+
+typedef struct {
+  uint64_t time_us;
+  uint32_t blocks;
+  uint32_t queue_full;
+  uint32_t short_blocks;
+  uint32_t over_speed;
+  uint32_t hard_stops;
+  uint32_t late_stops;
+  int64_t position;
+} RUN_STAT;
+
+static int failed;
+
+static void Check(bool ok, const char *what) {
+  if (!ok) {
+    printf("  FAIL: %s\n", what);
+    failed++;
+  }
+}
+
+// ---------------------------------------------------------------- sequences
+
+// homing and switching the extruders, one long move
+static const SIM_MOVE moves_single[] = {
+  {5, 9},
+};
+
+// hops, the direction changes on every move
+static const SIM_MOVE moves_hops[] = {
+  {1, 9}, {-1, 9}, {1, 9}, {-1, 9}, {1, 9}, {-1, 9},
+};
+
+// host stepping the lift down in small moves
+static const SIM_MOVE moves_stream[] = {
+  {0.5, 9}, {0.5, 9}, {0.5, 9}, {0.5, 9}, {0.5, 9},
+  {0.5, 9}, {0.5, 9}, {0.5, 9}, {0.5, 9}, {0.5, 9},
+};
+
+static const SIM_MOVE moves_mixed[] = {
+  {1, 9}, {1, 3}, {1, 9}, {2, 6}, {-1, 9}, {-0.5, 3},
+};
+
+// more moves than the queue holds
+static const SIM_MOVE moves_fine[] = {
+  {0.05, 5}, {0.05, 5}, {0.05, 5}, {0.05, 5}, {0.05, 5},
+  {0.05, 5}, {0.05, 5}, {0.05, 5}, {0.05, 5}, {0.05, 5},
+  {0.05, 5}, {0.05, 5}, {0.05, 5}, {0.05, 5}, {0.05, 5},
+  {0.05, 5}, {0.05, 5}, {0.05, 5}, {0.05, 5}, {0.05, 5},
+};
+
+#define SEQUENCE(name, moves, check) {name, moves, sizeof(moves) / sizeof(moves[0]), check}
+static const SIM_SEQUENCE sequences[] = {
+  SEQUENCE("single 5mm",      moves_single, 0),
+  SEQUENCE("hops 1mm",        moves_hops,   0),
+  SEQUENCE("stream 0.5mm",    moves_stream, CHECK_FASTER),
+  SEQUENCE("mixed speeds",    moves_mixed,  CHECK_FASTER),
+  SEQUENCE("fine 0.05mm",     moves_fine,   CHECK_FASTER),
+};
+
+// ---------------------------------------------------------------- lift
+
+// StepperTimerStart
+static void TimerStart(SIM_LIFT *lift, uint16_t time, uint64_t now) {
+  lift->isr_at = now + time;
+  lift->last_timer = time;
+  if (time < lift->min_timer)
+    lift->min_timer = time;
+}
+
+static void BlockStart(SIM_LIFT *lift, RUN_STAT *stat, uint64_t now) {
+  lift->min_timer = 0xFFFF;
+  TimerStart(lift, lift->speed_ctrl[lift->active][0].timer_time, now);
+  stat->blocks++;
+}
+
+// a block ending in a stop has to end on a node at most a tenth of its nominal speed
+static bool StopFromSpeed(const SIM_LIFT *lift) {
+  return lift->last_timer < (uint16_t)(10 * 1000000 / (lift->speed * Z_AXIS_STEPS_PER_UNIT));
+}
+
+static void BlockEnd(SIM_LIFT *lift, RUN_STAT *stat) {
+  if (lift->stepps_count != lift->stepps_sum)
+    stat->short_blocks++;
+  stat->position += lift->dir ? (int64_t)lift->stepps_count : -(int64_t)lift->stepps_count;
+  // the cruise node is truncated to whole microseconds
+  if (lift->min_timer < (uint16_t)(1000000 / (lift->speed * Z_AXIS_STEPS_PER_UNIT)))
+    stat->over_speed++;
+}
+
+// StepperLoadNextBlock
+static void LoadNextBlock(SIM_LIFT *lift, RUN_STAT *stat, uint64_t now) {
+  BlockEnd(lift, stat);
+  lift->step_pin = 0;
+  lift->stepps_count = 0;
+
+  if (lift->next_ready) {
+    if (lift->next_dir != lift->dir && StopFromSpeed(lift))
+      stat->hard_stops++;
+    lift->active ^= 1;
+    lift->index = 0;
+    lift->stepps_sum = lift->next_stepps_sum;
+    lift->dir = lift->next_dir;
+    lift->speed = lift->next_speed;
+    lift->exit_speed = lift->next_exit_speed;
+    lift->next_ready = false;
+    BlockStart(lift, stat, now);
+    return;
+  }
+
+  if (lift->exit_speed > 0)
+    stat->late_stops++;
+  else if (StopFromSpeed(lift))
+    stat->hard_stops++;
+  lift->stepps_sum = 0;
+  lift->running = 0;
+}
+
+// Stepper
+static void Stepper(SIM_LIFT *lift, RUN_STAT *stat, uint64_t now) {
+  speed_node_t *speed_ctrl = lift->speed_ctrl[lift->active];
+
+  // the timer runs on, a node change restarts it
+  lift->isr_at = now + lift->last_timer;
+  while (lift->stepps_count == speed_ctrl[lift->index].pulse_count) {
+    if (lift->index != Z_SPEED_CTRL_NODES - 1) {
+      lift->index++;
+      TimerStart(lift, speed_ctrl[lift->index].timer_time, now);
+    } else {
+      LoadNextBlock(lift, stat, now);
+      return;
+    }
+  }
+
+  if (lift->step_pin == 0) {
+    lift->step_pin = 1;
+    lift->stepps_count++;
+  } else {
+    lift->step_pin = 0;
+    if (lift->stepps_count == lift->stepps_sum)
+      LoadNextBlock(lift, stat, now);
+  }
+}
+
+// PlanMoveQueue
+static void PlanMoveQueue(SIM_LIFT *lift, RUN_STAT *stat, uint64_t now) {
+  if (lift->head == lift->tail || lift->next_ready)
+    return;
+
+  uint8_t head = lift->head;
+  move_block_t *block = &lift->queue[head];
+  float length = fabs(block->length);
+  bool running = lift->running;
+  float entry_speed = running ? lift->planned_exit_speed : 0;
+  float exit_speed = LiftPlanExitSpeed(lift->queue, head, lift->tail, entry_speed);
+
+  uint8_t buf_index = running ? (lift->active ^ 1) : lift->active;
+  LiftPlanSpeedCtrl(lift->speed_ctrl[buf_index], block->stepps, length, entry_speed, block->speed, exit_speed);
+
+  if (running) {
+    lift->next_stepps_sum = block->stepps;
+    lift->next_dir = (block->length < 0) ? 0 : 1;
+    lift->next_speed = block->speed;
+    lift->next_exit_speed = exit_speed;
+    lift->next_ready = true;
+  } else {
+    lift->index = 0;
+    lift->stepps_count = 0;
+    lift->step_pin = 0;
+    lift->stepps_sum = block->stepps;
+    lift->dir = (block->length < 0) ? 0 : 1;
+    lift->speed = block->speed;
+    lift->exit_speed = exit_speed;
+    lift->running = 1;
+    BlockStart(lift, stat, now);
+  }
+
+  lift->planned_exit_speed = exit_speed;
+  lift->head = (head + 1) % Z_MOVE_QUEUE_SIZE;
+}
+
+// QueueMoveZ
+static bool QueueMoveZ(SIM_LIFT *lift, RUN_STAT *stat, float length, float speed, uint64_t now) {
+  uint8_t tail = lift->tail;
+  uint8_t next = (tail + 1) % Z_MOVE_QUEUE_SIZE;
+  if (next == lift->head)
+    return false;
+
+  move_block_t *block = &lift->queue[tail];
+  block->stepps = Z_AXIS_STEPS_PER_UNIT * fabs(length) + 0.5;
+  block->length = length;
+  block->speed = speed;
+  block->report = 0;
+  lift->position += length < 0 ? -(int64_t)block->stepps : (int64_t)block->stepps;
+  lift->tail = next;
+
+  PlanMoveQueue(lift, stat, now);
+  return true;
+}
+
+// ---------------------------------------------------------------- runs
+
+static void Run(const SIM_SEQUENCE *seq, bool blocking, RUN_STAT *stat, int64_t *target) {
+  static SIM_LIFT lift;
+  memset(&lift, 0, sizeof(lift));
+  memset(stat, 0, sizeof(*stat));
+
+  uint64_t now = 0;
+  uint64_t loop_at = 0;
+  uint8_t sent = 0;
+  while (now < SIM_TIMEOUT_US) {
+    bool idle = !lift.running && lift.head == lift.tail;
+    if (sent == seq->count && idle)
+      break;
+
+    if (blocking) {
+      // the former blocking move returned as soon as the lift stopped
+      if (sent < seq->count && idle) {
+        QueueMoveZ(&lift, stat, seq->moves[sent].length, seq->moves[sent].speed, now);
+        sent++;
+      }
+    } else if (now >= loop_at) {
+      while (sent < seq->count) {
+        if (!QueueMoveZ(&lift, stat, seq->moves[sent].length, seq->moves[sent].speed, now)) {
+          stat->queue_full++;
+          break;
+        }
+        sent++;
+      }
+      PlanMoveQueue(&lift, stat, now);
+    }
+
+    while (now >= loop_at)
+      loop_at += SIM_LOOP_US;
+    uint64_t next = loop_at;
+    if (lift.running && lift.isr_at < next)
+      next = lift.isr_at;
+    now = next;
+    if (lift.running && now == lift.isr_at)
+      Stepper(&lift, stat, now);
+  }
+
+  stat->time_us = now;
+  *target = lift.position;
+}
+
+static void SequenceBench(void) {
+  RUN_STAT queued, blocking;
+  int64_t target_q, target_b;
+  char what[96];
+
+  printf("dual extruder lift, %d steps/mm, %dmm/s2, %d blocks queued, main loop every %dus\n",
+         Z_AXIS_STEPS_PER_UNIT, Z_ACCELERATION, Z_MOVE_QUEUE_SIZE - 1, SIM_LOOP_US);
+  printf("  %-14s %5s  %10s %5s  %10s  %6s\n", "sequence", "moves", "queued ms", "full", "blocking ms", "saved");
+  for (size_t i = 0; i < sizeof(sequences) / sizeof(sequences[0]); i++) {
+    const SIM_SEQUENCE *seq = &sequences[i];
+    Run(seq, false, &queued, &target_q);
+    Run(seq, true, &blocking, &target_b);
+    double saved = 100.0 * (1.0 - (double)queued.time_us / blocking.time_us);
+    printf("  %-14s %5u  %10.1f %5u  %10.1f  %5.1f%%\n", seq->name, seq->count, queued.time_us / 1000.0,
+           queued.queue_full, blocking.time_us / 1000.0, saved);
+
+    const RUN_STAT *stats[] = {&queued, &blocking};
+    const int64_t targets[] = {target_q, target_b};
+    const char *scheme[] = {"queued", "blocking"};
+    for (int s = 0; s < 2; s++) {
+      const RUN_STAT *stat = stats[s];
+      snprintf(what, sizeof(what), "%s %s: %u of %u blocks run", seq->name, scheme[s], stat->blocks, seq->count);
+      Check(stat->blocks == seq->count, what);
+      snprintf(what, sizeof(what), "%s %s: %u blocks short of steps", seq->name, scheme[s], stat->short_blocks);
+      Check(stat->short_blocks == 0, what);
+      snprintf(what, sizeof(what), "%s %s: ended at step %lld of %lld", seq->name, scheme[s],
+               (long long)stat->position, (long long)targets[s]);
+      Check(stat->position == targets[s], what);
+      snprintf(what, sizeof(what), "%s %s: %u blocks over the nominal speed", seq->name, scheme[s], stat->over_speed);
+      Check(stat->over_speed == 0, what);
+      snprintf(what, sizeof(what), "%s %s: %u stops from speed", seq->name, scheme[s], stat->hard_stops);
+      Check(stat->hard_stops == 0, what);
+      snprintf(what, sizeof(what), "%s %s: %u stops on a late block", seq->name, scheme[s], stat->late_stops);
+      Check(stat->late_stops == 0, what);
+    }
+    snprintf(what, sizeof(what), "%s: queued slower than blocking", seq->name);
+    Check(queued.time_us <= blocking.time_us, what);
+    if (seq->check & CHECK_FASTER) {
+      snprintf(what, sizeof(what), "%s: queued no faster than blocking", seq->name);
+      Check(queued.time_us < blocking.time_us, what);
+    }
+  }
+}
+
+int main(void) {
+  SequenceBench();
+
+  printf("%s\n", failed ? "FAILED" : "OK");
+  return failed ? 1 : 0;
+}
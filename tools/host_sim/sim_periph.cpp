@@ -0,0 +1,392 @@
+/*
+ * Snapmaker2-Modules Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Modules
+ * (see https://github.com/Snapmaker/Snapmaker2-Modules)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include <chrono>
+#include <libmaple/nvic.h>
+#include "src/HAL/std_library/inc/stm32f10x_rcc.h"
+#include "src/HAL/std_library/inc/stm32f10x_gpio.h"
+#include "src/HAL/std_library/inc/stm32f10x_exti.h"
+#include "src/HAL/std_library/inc/stm32f10x_spi.h"
+#include "src/HAL/std_library/inc/misc.h"
+#include "sim_periph.h"
+
+// register blocks, TIMx and friends point here through the shadowed device header
+TIM_TypeDef sim_tim[SIM_TIM_COUNT];
+GPIO_TypeDef sim_gpio[2];
+EXTI_TypeDef sim_exti;
+SPI_TypeDef sim_spi1;
+DMA_TypeDef sim_dma1;
+DMA_Channel_TypeDef sim_dma1_channel[SIM_DMA_COUNT];
+volatile uint8 sim_primask = 0;
+uint32_t SystemCoreClock = 72000000;
+
+static bool sim_nvic_enabled[64];
+static TIM_CB_F sim_tim_cb[SIM_TIM_COUNT];
+static EXTI_CB_F sim_exti_cb[SIM_EXTI_COUNT];
+static uint8_t sim_adc_pin[SIM_ADC_COUNT];
+static uint16_t sim_adc_value[SIM_ADC_COUNT];
+static uint8_t sim_adc_count;
+static ADC_CB_F sim_adc_injected_cb;
+static bool sim_adc_injected_enabled;
+static uint16_t sim_adc_injected_value;
+static SIM_ISR_STAT sim_adc_injected_stat;
+static SIM_ISR_STAT sim_tim_stat[SIM_TIM_COUNT];
+static SIM_ISR_STAT sim_exti_stat[SIM_EXTI_COUNT];
+static SIM_ISR_STAT sim_dma_stat[SIM_DMA_COUNT];
+static const SIM_SPI_DEVICE *sim_spi_device;
+static bool sim_spi_selected;
+
+// the firmware defines the handlers it uses, the rest stay NULL
+extern "C" {
+void __irq_dma1_channel1(void) __attribute__((weak));
+void __irq_dma1_channel2(void) __attribute__((weak));
+void __irq_dma1_channel3(void) __attribute__((weak));
+void __irq_dma1_channel4(void) __attribute__((weak));
+void __irq_dma1_channel5(void) __attribute__((weak));
+void __irq_dma1_channel6(void) __attribute__((weak));
+void __irq_dma1_channel7(void) __attribute__((weak));
+}
+
+static void (*const sim_dma_irq[SIM_DMA_COUNT])(void) = {
+  __irq_dma1_channel1, __irq_dma1_channel2, __irq_dma1_channel3, __irq_dma1_channel4,
+  __irq_dma1_channel5, __irq_dma1_channel6, __irq_dma1_channel7,
+};
+
+static IRQn_Type SimExtiIrq(uint8_t line) {
+  if (line <= 4)
+    return (IRQn_Type)(EXTI0_IRQn + line);
+  if (line <= 9)
+    return EXTI9_5_IRQn;
+  return EXTI15_10_IRQn;
+}
+
+static uint64_t SimNowNs(void) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void SimStatAdd(SIM_ISR_STAT *stat, uint64_t start_ns) {
+  uint64_t ns = SimNowNs() - start_ns;
+  stat->calls++;
+  stat->total_ns += ns;
+  if (ns > stat->max_ns)
+    stat->max_ns = ns;
+}
+
+void SimPeriphReset(void) {
+  memset(sim_tim, 0, sizeof(sim_tim));
+  memset(sim_gpio, 0, sizeof(sim_gpio));
+  memset(&sim_exti, 0, sizeof(sim_exti));
+  memset(&sim_spi1, 0, sizeof(sim_spi1));
+  memset(&sim_dma1, 0, sizeof(sim_dma1));
+  memset(sim_dma1_channel, 0, sizeof(sim_dma1_channel));
+  memset(sim_nvic_enabled, 0, sizeof(sim_nvic_enabled));
+  memset(sim_tim_cb, 0, sizeof(sim_tim_cb));
+  memset(sim_exti_cb, 0, sizeof(sim_exti_cb));
+  sim_adc_count = 0;
+  sim_adc_injected_cb = NULL;
+  sim_adc_injected_enabled = false;
+  sim_spi_device = NULL;
+  sim_spi_selected = false;
+  sim_primask = 0;
+  SimIsrStatReset();
+}
+
+uint32_t SimTimerPeriodUs(uint8_t tim) {
+  TIM_TypeDef *timx = &sim_tim[tim - 1];
+  if (!(timx->CR1 & TIM_CR1_CEN))
+    return 0;
+  uint64_t ticks = (uint64_t)(timx->PSC + 1) * (timx->ARR + 1) * (timx->RCR + 1);
+  return (uint32_t)(ticks * 1000000 / SystemCoreClock);
+}
+
+bool SimTimerUpdate(uint8_t tim) {
+  TIM_TypeDef *timx = &sim_tim[tim - 1];
+  timx->SR |= TIM_SR_UIF;
+  if (!(timx->DIER & TIM_DIER_UIE) || !sim_tim_cb[tim - 1])
+    return false;
+  uint64_t start = SimNowNs();
+  timx->SR &= ~TIM_SR_UIF;
+  sim_tim_cb[tim - 1]();
+  SimStatAdd(&sim_tim_stat[tim - 1], start);
+  return true;
+}
+
+void SimTimerSetTime(uint8_t tim, uint64_t now_us) {
+  TIM_TypeDef *timx = &sim_tim[tim - 1];
+  if (timx->CR1 & TIM_CR1_CEN)
+    timx->CNT = (uint16_t)(now_us * (SystemCoreClock / 1000000) / (timx->PSC + 1));
+}
+
+bool SimExtiEdge(uint8_t line) {
+  if (!(sim_exti.IMR & (1 << line)) || !sim_nvic_enabled[SimExtiIrq(line)] || !sim_exti_cb[line])
+    return false;
+  uint64_t start = SimNowNs();
+  sim_exti_cb[line](line);
+  SimStatAdd(&sim_exti_stat[line], start);
+  return true;
+}
+
+void SimAdcSet(uint8_t pin, uint16_t value) {
+  for (uint8_t i = 0; i < sim_adc_count; i++) {
+    if (sim_adc_pin[i] == pin)
+      sim_adc_value[i] = value;
+  }
+}
+
+bool SimAdcInjectedConvert(uint16_t value) {
+  sim_adc_injected_value = value;
+  if (!sim_adc_injected_enabled || !sim_adc_injected_cb)
+    return false;
+  uint64_t start = SimNowNs();
+  sim_adc_injected_cb();
+  SimStatAdd(&sim_adc_injected_stat, start);
+  return true;
+}
+
+void SimSpiAttach(const SIM_SPI_DEVICE *device) {
+  sim_spi_device = device;
+  sim_spi_selected = false;
+}
+
+static uint8_t SimSpiTransfer(uint8_t tx) {
+  if (!sim_spi_device || !sim_spi_selected)
+    return 0xff;
+  return sim_spi_device->transfer(tx);
+}
+
+static void SimSpiChipSelect(GPIO_TypeDef *GPIOx) {
+  if (!sim_spi_device || sim_spi_device->cs_port != GPIOx)
+    return;
+  bool selected = !(GPIOx->ODR & sim_spi_device->cs_pin);
+  if (selected != sim_spi_selected) {
+    sim_spi_selected = selected;
+    if (sim_spi_device->select)
+      sim_spi_device->select(selected);
+  }
+}
+
+// CPAR and CMAR hold 32 bits like the silicon. The firmware only hands static buffers
+// and register blocks to DMA, all in this image, so the upper half of a host pointer
+// is that of the image.
+static void *SimDmaAddress(uint32_t addr) {
+  uintptr_t image = (uintptr_t)&sim_dma1;
+  return (void *)((image & ~(uintptr_t)UINT32_MAX) | addr);
+}
+
+// DMA channel moving bytes between memory and SPI1->DR in the given direction
+static DMA_Channel_TypeDef *SimSpiDmaChannel(bool to_peripheral) {
+  for (uint8_t ch = 0; ch < SIM_DMA_COUNT; ch++) {
+    DMA_Channel_TypeDef *c = &sim_dma1_channel[ch];
+    if ((c->CCR & DMA_CCR1_EN) && (SimDmaAddress(c->CPAR) == &sim_spi1.DR)
+        && (!!(c->CCR & DMA_CCR1_DIR) == to_peripheral))
+      return c;
+  }
+  return NULL;
+}
+
+uint32_t SimSpiDmaRun(void) {
+  DMA_Channel_TypeDef *rx = SimSpiDmaChannel(false);
+  DMA_Channel_TypeDef *tx = SimSpiDmaChannel(true);
+
+  // the master only clocks while the TX request feeds it
+  if (!rx || !tx || !rx->CNDTR || (sim_spi1.CR2 & (SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN)) != (SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN))
+    return 0;
+
+  uint32_t count = rx->CNDTR;
+  uint8_t *dst = (uint8_t *)SimDmaAddress(rx->CMAR);
+  const uint8_t *src = (const uint8_t *)SimDmaAddress(tx->CMAR);
+  for (uint32_t i = 0; i < count; i++) {
+    uint8_t byte = SimSpiTransfer(src[(tx->CCR & DMA_CCR1_MINC) ? i : 0]);
+    dst[(rx->CCR & DMA_CCR1_MINC) ? i : 0] = byte;
+  }
+  rx->CNDTR = 0;
+  tx->CNDTR = 0;
+
+  // IFCR is write one to clear
+  sim_dma1.ISR &= ~sim_dma1.IFCR;
+  sim_dma1.IFCR = 0;
+  DMA_Channel_TypeDef *done[2] = {tx, rx};
+  for (uint8_t k = 0; k < 2; k++) {
+    uint8_t ch = done[k] - sim_dma1_channel;
+    sim_dma1.ISR |= (DMA_ISR_GIF1 | DMA_ISR_TCIF1) << (ch * 4);
+    if (!(done[k]->CCR & DMA_CCR1_TCIE) || !sim_nvic_enabled[DMA1_Channel1_IRQn + ch] || !sim_dma_irq[ch])
+      continue;
+    uint64_t start = SimNowNs();
+    sim_dma_irq[ch]();
+    SimStatAdd(&sim_dma_stat[ch], start);
+    sim_dma1.ISR &= ~sim_dma1.IFCR;
+    sim_dma1.IFCR = 0;
+  }
+  return count;
+}
+
+SIM_ISR_STAT *SimTimerIsrStat(uint8_t tim) {
+  return &sim_tim_stat[tim - 1];
+}
+
+SIM_ISR_STAT *SimExtiIsrStat(uint8_t line) {
+  return &sim_exti_stat[line];
+}
+
+SIM_ISR_STAT *SimDmaIsrStat(uint8_t channel) {
+  return &sim_dma_stat[channel - 1];
+}
+
+SIM_ISR_STAT *SimAdcInjectedIsrStat(void) {
+  return &sim_adc_injected_stat;
+}
+
+void SimIsrStatReset(void) {
+  memset(sim_tim_stat, 0, sizeof(sim_tim_stat));
+  memset(sim_exti_stat, 0, sizeof(sim_exti_stat));
+  memset(sim_dma_stat, 0, sizeof(sim_dma_stat));
+  memset(&sim_adc_injected_stat, 0, sizeof(sim_adc_injected_stat));
+}
+
+// core
+void SimNvicEnableIRQ(IRQn_Type irq) {
+  sim_nvic_enabled[irq] = true;
+}
+
+void SimNvicDisableIRQ(IRQn_Type irq) {
+  sim_nvic_enabled[irq] = false;
+}
+
+void NVIC_Init(NVIC_InitTypeDef *NVIC_InitStruct) {
+  sim_nvic_enabled[NVIC_InitStruct->NVIC_IRQChannel] = NVIC_InitStruct->NVIC_IRQChannelCmd != DISABLE;
+}
+
+// StdPeriph, the TIM and DMA drivers themselves are built from the firmware tree
+void RCC_AHBPeriphClockCmd(uint32_t RCC_AHBPeriph, FunctionalState NewState) {}
+void RCC_APB1PeriphClockCmd(uint32_t RCC_APB1Periph, FunctionalState NewState) {}
+void RCC_APB2PeriphClockCmd(uint32_t RCC_APB2Periph, FunctionalState NewState) {}
+void RCC_APB1PeriphResetCmd(uint32_t RCC_APB1Periph, FunctionalState NewState) {}
+void RCC_APB2PeriphResetCmd(uint32_t RCC_APB2Periph, FunctionalState NewState) {}
+void GPIO_Init(GPIO_TypeDef *GPIOx, GPIO_InitTypeDef *GPIO_InitStruct) {}
+void GPIO_PinRemapConfig(uint32_t GPIO_Remap, FunctionalState NewState) {}
+
+void GPIO_WriteBit(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, BitAction BitVal) {
+  if (BitVal != Bit_RESET)
+    GPIOx->ODR |= GPIO_Pin;
+  else
+    GPIOx->ODR &= ~GPIO_Pin;
+}
+
+void GPIO_SetBits(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin) {
+  GPIOx->ODR |= GPIO_Pin;
+  SimSpiChipSelect(GPIOx);
+}
+
+void GPIO_ResetBits(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin) {
+  GPIOx->ODR &= ~GPIO_Pin;
+  SimSpiChipSelect(GPIOx);
+}
+
+// SPI1 only, a byte written to DR is clocked at once so TXE and RXNE are always set
+void SPI_Init(SPI_TypeDef *SPIx, SPI_InitTypeDef *SPI_InitStruct) {}
+
+void SPI_Cmd(SPI_TypeDef *SPIx, FunctionalState NewState) {
+  if (NewState != DISABLE)
+    SPIx->CR1 |= SPI_CR1_SPE;
+  else
+    SPIx->CR1 &= ~SPI_CR1_SPE;
+}
+
+FlagStatus SPI_I2S_GetFlagStatus(SPI_TypeDef *SPIx, uint16_t SPI_I2S_FLAG) {
+  return (SPI_I2S_FLAG & (SPI_I2S_FLAG_TXE | SPI_I2S_FLAG_RXNE)) ? SET : RESET;
+}
+
+void SPI_I2S_SendData(SPI_TypeDef *SPIx, uint16_t Data) {
+  SPIx->DR = SimSpiTransfer((uint8_t)Data);
+}
+
+uint16_t SPI_I2S_ReceiveData(SPI_TypeDef *SPIx) {
+  return SPIx->DR;
+}
+
+void SPI_I2S_DMACmd(SPI_TypeDef *SPIx, uint16_t SPI_I2S_DMAReq, FunctionalState NewState) {
+  if (NewState != DISABLE)
+    SPIx->CR2 |= SPI_I2S_DMAReq;
+  else
+    SPIx->CR2 &= ~SPI_I2S_DMAReq;
+}
+
+void EXTI_ClearITPendingBit(uint32_t EXTI_Line) {
+  sim_exti.PR &= ~EXTI_Line;
+}
+
+// HAL
+void HAL_timer_init(uint8_t tim, uint16_t u16Prescaler, uint16_t u16Period) {
+  TIM_TypeDef *timx = &sim_tim[tim - 1];
+  timx->PSC = u16Prescaler - 1;
+  timx->ARR = u16Period - 1;
+  timx->CR1 &= ~TIM_CR1_CEN;
+}
+
+void HAL_timer_nvic_init(uint8_t tim, uint8_t PreemptionPriority, uint8_t SubPriority) {
+  sim_tim[tim - 1].DIER |= TIM_DIER_UIE;
+}
+
+void HAL_timer_cb_init(uint8_t tim, TIM_CB_F cb) {
+  sim_tim_cb[tim - 1] = cb;
+}
+
+void HAL_timer_enable(uint8_t tim) {
+  sim_tim[tim - 1].CR1 |= TIM_CR1_CEN;
+}
+
+uint8_t HAL_adc_init(uint8_t pin, ADC_TIM_E tim, uint16_t period_us) {
+  if (sim_adc_count >= SIM_ADC_COUNT)
+    return ADC_ERROR;
+  sim_adc_pin[sim_adc_count] = pin;
+  sim_adc_value[sim_adc_count] = 0;
+  return sim_adc_count++;
+}
+
+uint16_t ADC_Get(uint8_t index) {
+  return index < sim_adc_count ? sim_adc_value[index] : 0;
+}
+
+uint16_t ADC_GetCusum(uint8_t index) {
+  return ADC_Get(index) * ADC_DEEP;
+}
+
+uint8_t HAL_adc_injected_init(uint8_t pin, uint32_t trigger, ADC_CB_F cb) {
+  sim_adc_injected_cb = cb;
+  return 0;
+}
+
+void HAL_adc_injected_enable(bool enable) {
+  sim_adc_injected_enabled = enable;
+}
+
+uint16_t HAL_adc_injected_get() {
+  return sim_adc_injected_value;
+}
+
+uint8_t ExtiInit(uint8_t pin, EXTI_MODE_E exti_mode, EXTI_CB_F cb, EXTI_GPIO_INPUT_MODE mode) {
+  uint8_t pin_source = pin % 16;
+  sim_exti.IMR |= 1 << pin_source;
+  sim_exti_cb[pin_source] = cb;
+  SimNvicEnableIRQ(SimExtiIrq(pin_source));
+  return pin_source;
+}
@@ -0,0 +1,83 @@
+/*
+ * Snapmaker2-Modules Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Modules
+ * (see https://github.com/Snapmaker/Snapmaker2-Modules)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Simulated peripherals behind the host build of the firmware. The sim owns the
+// clock: it moves the free running counters, raises timer updates and EXTI edges,
+// and every callback the firmware registered runs timed from here
+#ifndef TOOLS_HOST_SIM_SIM_PERIPH_H_
+#define TOOLS_HOST_SIM_SIM_PERIPH_H_
+
+#include <stdint.h>
+#include "src/HAL/std_library/inc/stm32f10x.h"
+#include "src/HAL/hal_tim.h"
+#include "src/HAL/hal_adc.h"
+#include "src/HAL/hal_exti.h"
+
+#define SIM_TIM_COUNT       4
+#define SIM_EXTI_COUNT      16
+#define SIM_ADC_COUNT       ADC_MAX_DEV_COUNT
+#define SIM_DMA_COUNT       7
+
+typedef struct {
+  uint64_t calls;
+  uint64_t total_ns;
+  uint64_t max_ns;
+} SIM_ISR_STAT;
+
+// a slave on SPI1, selected while its chip select pin is low, one byte each way per transfer
+typedef struct {
+  GPIO_TypeDef *cs_port;
+  uint16_t cs_pin;
+  void (*select)(bool selected);
+  uint8_t (*transfer)(uint8_t tx);
+} SIM_SPI_DEVICE;
+
+// back to power on state, callbacks and counters included
+void SimPeriphReset(void);
+
+// update period from PSC, ARR and RCR, 0 while the timer is stopped
+uint32_t SimTimerPeriodUs(uint8_t tim);
+// update event, runs the callback if the update interrupt is enabled
+bool SimTimerUpdate(uint8_t tim);
+// free running counters follow the sim clock
+void SimTimerSetTime(uint8_t tim, uint64_t now_us);
+
+// edge on an EXTI line, runs the callback if the line and its IRQ are enabled
+bool SimExtiEdge(uint8_t line);
+
+// raw 12 bit value returned for the ADC channel on pin
+void SimAdcSet(uint8_t pin, uint16_t value);
+// one conversion of the injected channel, runs its callback while it is enabled
+bool SimAdcInjectedConvert(uint16_t value);
+
+// NULL detaches, bytes clocked without a device read back 0xff
+void SimSpiAttach(const SIM_SPI_DEVICE *device);
+// runs an armed SPI1 RX DMA transfer to its end and raises the transfer complete
+// interrupts, returns the bytes moved, 0 if nothing was armed
+uint32_t SimSpiDmaRun(void);
+
+SIM_ISR_STAT *SimTimerIsrStat(uint8_t tim);
+SIM_ISR_STAT *SimExtiIsrStat(uint8_t line);
+SIM_ISR_STAT *SimDmaIsrStat(uint8_t channel);
+SIM_ISR_STAT *SimAdcInjectedIsrStat(void);
+void SimIsrStatReset(void);
+
+#endif  // TOOLS_HOST_SIM_SIM_PERIPH_H_
@@ -0,0 +1,283 @@
+/*
+ * Snapmaker2-Modules Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Modules
+ * (see https://github.com/Snapmaker/Snapmaker2-Modules)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// CNC 200W head spindle current spectrum against the real SpindleSpectrum
+//
+// Synthetic phase current, a mean load with the commutation ripple at 6x the
+// electrical rotation, optionally a 1x rotation tone for a bent bit or imbalance and a
+// tone not locked to the rotation for chatter, plus noise. It is converted once per
+// PWM period and handed to the injected ADC callback as BldcCurrentSampleInit sets it
+// up, the analyser loop runs every 1ms with the rpm the way CncHead200W calls it.
+//
+// cr4_fft_256_stm32 is Cortex-M3 assembly. An integer radix 2 FFT on the same 16 bit
+// data, halving every stage for the same 1/N scaling, stands in for it, so the
+// quantisation is close to the library but not bit exact.
+//
+// Figures: what the analyser reports for each signal, the windows analysed and host
+// time of the capture ISR and the analysis.
+// Checks: the bent bit and chatter signals raise their flag and only theirs, the 1x
+// and chatter amplitudes are read within 10% of the tone left after the 5 conversion
+// boxcar and the chatter frequency within one bin, a clean cut, chatter under the
+// amplitude floor and a bent bit spinning up raise nothing, windows taken while the
+// speed moves are dropped and nothing is captured under SPECTRUM_MIN_RPM. Any failed check exits non zero.
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <board/board.h>
+#include <include/libmaple/libmaple_types.h>
+#include <wirish_time.h>
+#include <cr4_fft_stm32.h>
+#include "sim_periph.h"
+#include "src/device/bldc_motor.h"
+#include "src/device/spindle_spectrum.h"
+
+#define SIM_PWM_HZ                BLDC_TIM_PWM_FREQ
+#define SIM_I_ADC_MA_FULL         16500   // 0.01R * 20, see CncHead200W
+#define SIM_NOISE_MA              30.0
+#define SIM_RUN_MS                3000
+#define SIM_SPINUP_RPM_PER_MS     12      // 0 to 18000rpm in 1.5s
+#define SIM_AMP_TOLERANCE         0.1
+#define SIM_BIN_HZ                ((double)SPECTRUM_SAMPLE_HZ / SPECTRUM_FFT_POINTS)
+#define SIM_SEED                  0x2545F4914F6CDD1DULL
+
+#define CHECK_ROTATION  (1 << 0)   // 1x amplitude read within SIM_AMP_TOLERANCE
+#define CHECK_CHATTER   (1 << 1)   // chatter frequency within a bin, amplitude within SIM_AMP_TOLERANCE
+#define CHECK_DROPPED   (1 << 2)   // every window dropped for the changing speed
+#define CHECK_NO_WINDOW (1 << 3)   // nothing captured
+
+#define FLAG_NONE       0
+#define FLAG_CHATTER    (1 << SPECTRUM_FLAG_CHATTER)
+#define FLAG_IMBALANCE  (1 << SPECTRUM_FLAG_IMBALANCE)
+
+typedef struct {
+  const char *name;
+  uint32_t rpm;
+  uint32_t rpm_end;       // spins up from rpm and the run ends here, 0 holds rpm
+  double mean_ma;
+  double rotation_ma;     // 1x rotation
+  double ripple_ma;       // commutation, 6x the electrical rotation
+  double chatter_hz;
+  double chatter_ma;
+  uint8_t flags;          // expected at the end of the run
+  uint8_t check;
+} SIM_SCENARIO;
+
+typedef struct {
+  uint32_t windows;       // analysed
+  uint32_t captures;
+  SPECTRUM_RESULT last;
+  uint8_t flags_seen;     // raised at any time
+  uint64_t analyse_ns;
+} RUN_STAT;
+
+volatile uint32 systick_uptime_millis;
+
+static BldcMotor motor;
+static SpindleSpectrum spectrum;
+static int failed;
+static uint64_t rng = SIM_SEED;
+
+static const SIM_SCENARIO scenarios[] = {
+  {"clean cut",       12000,     0, 1500,   0, 300,    0,   0, FLAG_NONE,      0},
+  {"bent bit",        12000,     0, 1500, 400, 300,    0,   0, FLAG_IMBALANCE, CHECK_ROTATION},
+  {"chatter",         12000,     0, 2500,   0, 300,  730, 600, FLAG_CHATTER,   CHECK_CHATTER},
+  {"light chatter",   12000,     0, 2500,   0, 300,  730, 120, FLAG_NONE,      CHECK_CHATTER},
+  {"chatter 18000",   18000,     0, 2500,   0, 300, 1150, 500, FLAG_CHATTER,   CHECK_CHATTER},
+  {"bent bit 18000",  18000,     0, 2500, 500, 300,    0,   0, FLAG_IMBALANCE, CHECK_ROTATION},
+  {"spinning up",      6000, 18000, 1500, 400, 300,    0,   0, FLAG_NONE,      CHECK_DROPPED},
+  {"slow spindle",     5000,     0, 2500, 400, 300,  730, 600, FLAG_NONE,      CHECK_NO_WINDOW},
+};
+
+static double Noise(double sigma) {
+  // xorshift, sum of uniforms is close enough to gaussian here
+  double sum = 0;
+  for (int i = 0; i < 4; i++) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    sum += (double)(rng >> 11) / (double)(1ULL << 53) - 0.5;
+  }
+  return sum * sigma * sqrt(3.0);
+}
+
+static uint64_t NowNs(void) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// the capture sums SPECTRUM_DECIMATION conversions, a boxcar that takes some off a tone
+static double BoxcarGain(double hz) {
+  double x = M_PI * hz / SIM_PWM_HZ;
+  return sin(SPECTRUM_DECIMATION * x) / (SPECTRUM_DECIMATION * sin(x));
+}
+
+static void Check(bool ok, const char *what) {
+  if (!ok) {
+    printf("  FAIL: %s\n", what);
+    failed++;
+  }
+}
+
+// ---------------------------------------------------------------- FFT
+
+static uint32_t BitReverse(uint32_t i, uint32_t bits) {
+  uint32_t r = 0;
+  for (uint32_t b = 0; b < bits; b++, i >>= 1)
+    r = (r << 1) | (i & 1);
+  return r;
+}
+
+// real part in the low half word, imaginary in the high one, output scaled by 1/N
+extern "C" void cr4_fft_256_stm32(void *pssOUT, void *pssIN, uint16_t Nbin) {
+  static int32_t re[SPECTRUM_FFT_POINTS], im[SPECTRUM_FFT_POINTS];
+  const uint32_t *in = (const uint32_t *)pssIN;
+  uint32_t *out = (uint32_t *)pssOUT;
+  uint32_t bits = 0;
+  while ((1U << bits) < Nbin)
+    bits++;
+
+  for (uint32_t i = 0; i < Nbin; i++) {
+    uint32_t j = BitReverse(i, bits);
+    re[j] = (int16_t)(in[i] & 0xffff);
+    im[j] = (int16_t)(in[i] >> 16);
+  }
+  for (uint32_t len = 2; len <= Nbin; len <<= 1) {
+    for (uint32_t k = 0; k < len / 2; k++) {
+      double a = -2 * M_PI * k / len;
+      int32_t wr = lround(cos(a) * 32767), wi = lround(sin(a) * 32767);
+      for (uint32_t i = 0; i < Nbin; i += len) {
+        uint32_t p = i + k, q = p + len / 2;
+        int32_t tr = (re[q] * wr - im[q] * wi) >> 15;
+        int32_t ti = (re[q] * wi + im[q] * wr) >> 15;
+        re[q] = (re[p] - tr) >> 1;
+        im[q] = (im[p] - ti) >> 1;
+        re[p] = (re[p] + tr) >> 1;
+        im[p] = (im[p] + ti) >> 1;
+      }
+    }
+  }
+  for (uint32_t i = 0; i < Nbin; i++)
+    out[i] = (uint16_t)re[i] | ((uint32_t)(uint16_t)im[i] << 16);
+}
+
+// ---------------------------------------------------------------- runs
+
+static void Run(const SIM_SCENARIO *sc, RUN_STAT *stat) {
+  double rot = 0, chatter = 0;
+  memset(stat, 0, sizeof(*stat));
+  uint64_t conversions = SimAdcInjectedIsrStat()->calls;
+  // millis() runs on from the last run, the analyser keeps its capture schedule
+  uint32_t start_ms = systick_uptime_millis + 1;
+  spectrum.Loop(0, false);
+
+  uint32_t run_ms = sc->rpm_end ? (sc->rpm_end - sc->rpm) / SIM_SPINUP_RPM_PER_MS : SIM_RUN_MS;
+  for (uint32_t ms = 0; ms < run_ms; ms++) {
+    double rpm = sc->rpm;
+    if (sc->rpm_end)
+      rpm += (double)SIM_SPINUP_RPM_PER_MS * ms;
+    for (uint32_t n = 0; n < SIM_PWM_HZ / 1000; n++) {
+      rot += 2 * M_PI * rpm / 60 / SIM_PWM_HZ;
+      chatter += 2 * M_PI * sc->chatter_hz / SIM_PWM_HZ;
+      double ma = sc->mean_ma + sc->rotation_ma * sin(rot + 0.3) +
+                  sc->ripple_ma * sin(6 * MOTOR_POLE_PAIR_NUM * rot) +
+                  sc->chatter_ma * sin(chatter) + Noise(SIM_NOISE_MA);
+      long adc = lround(ma * 4095 / SIM_I_ADC_MA_FULL);
+      SimAdcInjectedConvert(adc < 0 ? 0 : adc > 4095 ? 4095 : adc);
+    }
+
+    systick_uptime_millis = start_ms + ms;
+    uint64_t start = NowNs();
+    if (spectrum.Loop((uint32_t)rpm, true)) {
+      stat->analyse_ns += NowNs() - start;
+      stat->windows++;
+      stat->last = *spectrum.Result();
+    }
+    stat->flags_seen |= spectrum.Result()->flags;
+  }
+  conversions = SimAdcInjectedIsrStat()->calls - conversions;
+  stat->captures = conversions / (SPECTRUM_FFT_POINTS * SPECTRUM_DECIMATION);
+}
+
+static void ScenarioBench(void) {
+  RUN_STAT stat;
+  uint64_t analyse_ns = 0;
+  uint32_t windows = 0;
+  char what[96];
+
+  printf("spindle spectrum, %d points at %dHz, %.1fHz per bin, %dms per steady run\n", SPECTRUM_FFT_POINTS,
+         SPECTRUM_SAMPLE_HZ, SIM_BIN_HZ, SIM_RUN_MS);
+  printf("  %-15s %5s  %4s %4s  %5s %6s %6s %5s  %s\n", "signal", "rpm", "win", "cap",
+         "1x mA", "chat Hz", "chat mA", "ratio", "flags");
+  for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+    const SIM_SCENARIO *sc = &scenarios[i];
+    Run(sc, &stat);
+    const SPECTRUM_RESULT *r = &stat.last;
+    printf("  %-15s %5u  %4u %4u  %5u %6u %6u %4u%%  %s%s\n", sc->name, sc->rpm, stat.windows, stat.captures,
+           r->rotation_ma, r->chatter_hz, r->chatter_ma, r->chatter_ratio,
+           r->flags & FLAG_CHATTER ? "chatter " : "", r->flags & FLAG_IMBALANCE ? "imbalance" : "");
+    analyse_ns += stat.analyse_ns;
+    windows += stat.windows;
+
+    snprintf(what, sizeof(what), "%s: flags 0x%x, expected 0x%x", sc->name, stat.last.flags, sc->flags);
+    Check(stat.last.flags == sc->flags && (stat.flags_seen & ~sc->flags) == 0, what);
+    if (sc->check & CHECK_ROTATION) {
+      double ma = sc->rotation_ma * BoxcarGain(sc->rpm / 60.0);
+      snprintf(what, sizeof(what), "%s: 1x read %umA of %.0fmA", sc->name, r->rotation_ma, ma);
+      Check(stat.windows && fabs(r->rotation_ma - ma) <= SIM_AMP_TOLERANCE * ma, what);
+    }
+    if (sc->check & CHECK_CHATTER) {
+      double ma = sc->chatter_ma * BoxcarGain(sc->chatter_hz);
+      snprintf(what, sizeof(what), "%s: chatter read %umA at %uHz, sent %.0fmA at %.0fHz", sc->name,
+               r->chatter_ma, r->chatter_hz, ma, sc->chatter_hz);
+      Check(stat.windows && fabs(r->chatter_hz - sc->chatter_hz) <= SIM_BIN_HZ &&
+            fabs(r->chatter_ma - ma) <= SIM_AMP_TOLERANCE * ma, what);
+    }
+    if (sc->check & CHECK_DROPPED) {
+      snprintf(what, sizeof(what), "%s: %u windows analysed of %u", sc->name, stat.windows, stat.captures);
+      Check(stat.captures && !stat.windows, what);
+    }
+    if (sc->check & CHECK_NO_WINDOW) {
+      snprintf(what, sizeof(what), "%s: %u windows captured", sc->name, stat.captures);
+      Check(!stat.captures && !stat.windows, what);
+    }
+  }
+
+  // host time, compare runs of the same machine, the analysis includes the FFT stand in
+  SIM_ISR_STAT *isr = SimAdcInjectedIsrStat();
+  printf("host time\n");
+  printf("  capture ISR   %9llu calls  mean %6.0f ns  max %7llu ns  budget %5u us\n",
+         (unsigned long long)isr->calls, isr->calls ? (double)isr->total_ns / isr->calls : 0,
+         (unsigned long long)isr->max_ns, 1000000 / SIM_PWM_HZ);
+  printf("  analysis      %9u calls  mean %6.0f ns\n", windows, windows ? (double)analyse_ns / windows : 0);
+}
+
+int main(void) {
+  SimPeriphReset();
+  Check(motor.Init(), "BldcMotor init");
+  Check(spectrum.Init(&motor), "SpindleSpectrum init");
+
+  ScenarioBench();
+
+  printf("%s\n", failed ? "FAILED" : "OK");
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,34 @@
+/*
+ * Snapmaker2-Modules Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Modules
+ * (see https://github.com/Snapmaker/Snapmaker2-Modules)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Forced ahead of every host sim source: glibc's __always_inline already says inline,
+// libmaple writes "static inline __always_inline",
+// glibc's own extern inlines keep theirs
+#ifndef TOOLS_HOST_SIM_STUB_HOST_PREFIX_H_
+#define TOOLS_HOST_SIM_STUB_HOST_PREFIX_H_
+
+#include <sys/cdefs.h>
+#undef __always_inline
+#define __always_inline __attribute__((always_inline))
+#undef __extern_always_inline
+#define __extern_always_inline extern __inline __attribute__((always_inline, gnu_inline))
+
+#endif  // TOOLS_HOST_SIM_STUB_HOST_PREFIX_H_
@@ -0,0 +1,52 @@
+/*
+ * Snapmaker2-Modules Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Modules
+ * (see https://github.com/Snapmaker/Snapmaker2-Modules)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Host shadow of libmaple/nvic.h, PRIMASK is only a flag on the host
+#ifndef TOOLS_HOST_SIM_STUB_LIBMAPLE_NVIC_H_
+#define TOOLS_HOST_SIM_STUB_LIBMAPLE_NVIC_H_
+
+// CMSIS core_cm3.h names the same 0xE000E100 block NVIC_BASE, as an address
+#undef NVIC_BASE
+#define nvic_globalirq_enable   libmaple_nvic_globalirq_enable
+#define nvic_globalirq_disable  libmaple_nvic_globalirq_disable
+#include_next <libmaple/nvic.h>
+#undef nvic_globalirq_enable
+#undef nvic_globalirq_disable
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern volatile uint8 sim_primask;
+
+static inline void nvic_globalirq_enable() {
+  sim_primask = 0;
+}
+
+static inline void nvic_globalirq_disable() {
+  sim_primask = 1;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // TOOLS_HOST_SIM_STUB_LIBMAPLE_NVIC_H_
@@ -0,0 +1,85 @@
+/*
+ * Snapmaker2-Modules Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Modules
+ * (see https://github.com/Snapmaker/Snapmaker2-Modules)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Host shadow of the StdPeriph device header, the peripherals the firmware drives
+// point at simulated register blocks instead of the memory map
+#ifndef TOOLS_HOST_SIM_STUB_STM32F10X_H_
+#define TOOLS_HOST_SIM_STUB_STM32F10X_H_
+
+// libmaple/nvic.h names the same 0xE000E100 block NVIC_BASE, as a struct pointer
+#undef NVIC_BASE
+#include_next <src/HAL/std_library/inc/stm32f10x.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern TIM_TypeDef sim_tim[4];    // TIM1..TIM4
+extern GPIO_TypeDef sim_gpio[2];  // GPIOA, GPIOB
+extern EXTI_TypeDef sim_exti;
+extern SPI_TypeDef sim_spi1;
+extern DMA_TypeDef sim_dma1;
+extern DMA_Channel_TypeDef sim_dma1_channel[7];
+
+void SimNvicEnableIRQ(IRQn_Type irq);
+void SimNvicDisableIRQ(IRQn_Type irq);
+
+#ifdef __cplusplus
+}
+#endif
+
+#undef TIM1
+#undef TIM2
+#undef TIM3
+#undef TIM4
+#undef GPIOA
+#undef GPIOB
+#undef EXTI
+#undef SPI1
+#undef DMA1
+#undef DMA1_Channel1
+#undef DMA1_Channel2
+#undef DMA1_Channel3
+#undef DMA1_Channel4
+#undef DMA1_Channel5
+#undef DMA1_Channel6
+#undef DMA1_Channel7
+#define TIM1              (&sim_tim[0])
+#define TIM2              (&sim_tim[1])
+#define TIM3              (&sim_tim[2])
+#define TIM4              (&sim_tim[3])
+#define GPIOA             (&sim_gpio[0])
+#define GPIOB             (&sim_gpio[1])
+#define EXTI              (&sim_exti)
+#define SPI1              (&sim_spi1)
+#define DMA1              (&sim_dma1)
+#define DMA1_Channel1     (&sim_dma1_channel[0])
+#define DMA1_Channel2     (&sim_dma1_channel[1])
+#define DMA1_Channel3     (&sim_dma1_channel[2])
+#define DMA1_Channel4     (&sim_dma1_channel[3])
+#define DMA1_Channel5     (&sim_dma1_channel[4])
+#define DMA1_Channel6     (&sim_dma1_channel[5])
+#define DMA1_Channel7     (&sim_dma1_channel[6])
+
+#define NVIC_EnableIRQ    SimNvicEnableIRQ
+#define NVIC_DisableIRQ   SimNvicDisableIRQ
+
+#endif  // TOOLS_HOST_SIM_STUB_STM32F10X_H_